@@ -0,0 +1,251 @@
+/* Arena allocation.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* An arena hands out memory for objects that all die at the same
+   time, such as the links found in a document along with their
+   strings.  Objects are carved out of large blocks, so that
+   allocating them costs a pointer increment most of the time, and
+   the whole arena is released by freeing its few blocks:
+
+     struct arena *a = arena_new ();
+     struct foo *f = arena_new0 (a, struct foo);
+     f->name = arena_strdup (a, name);
+     ...
+     arena_free (a);
+
+   Memory obtained from an arena can't be freed individually.  The
+   number of objects allocated from an arena and the number of blocks
+   it took are kept for debugging and for measuring the savings.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "utils.h"
+#include "arena.h"
+#ifdef TESTING
+#include "test.h"
+#endif
+
+/* The first block holds ARENA_INITIAL_SIZE bytes, and each following
+   one twice as much as the previous, up to ARENA_MAX_BLOCK_SIZE.  */
+#define ARENA_INITIAL_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE (64 * 1024)
+
+/* Allocations larger than this are given a block of their own, so as
+   not to waste the rest of the current block.  */
+#define ARENA_LARGE_OBJECT (ARENA_MAX_BLOCK_SIZE / 4)
+
+/* Returned memory is aligned as strictly as any of these types.  */
+union arena_align {
+  long l;
+  double d;
+  long double ld;
+  void *p;
+  void (*fp) (void);
+};
+#define ARENA_ALIGNMENT (sizeof (union arena_align))
+#define ARENA_ALIGN(n) (((n) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+struct arena_block {
+  struct arena_block *next;     /* previously filled block */
+  union arena_align data[1];    /* start of the block's storage */
+};
+#define BLOCK_HEADER_SIZE (offsetof (struct arena_block, data))
+
+struct arena {
+  struct arena_block *blocks;   /* the current block, first in the
+                                   list of all blocks */
+  char *ptr, *end;              /* free space of the current block */
+  size_t next_size;             /* size of the next block */
+  long objects;                 /* number of objects allocated */
+  int block_count;              /* number of blocks allocated */
+};
+
+/* Create a new empty arena.  */
+
+struct arena *
+arena_new (void)
+{
+  struct arena *a = xnew0 (struct arena);
+  a->next_size = ARENA_INITIAL_SIZE;
+  return a;
+}
+
+/* Free all the memory allocated from A, along with A itself.  */
+
+void
+arena_free (struct arena *a)
+{
+  struct arena_block *b, *next;
+
+  if (!a)
+    return;
+  for (b = a->blocks; b; b = next)
+    {
+      next = b->next;
+      xfree (b);
+    }
+  xfree (a);
+}
+
+/* Allocate a block with room for at least SIZE bytes, and make it the
+   current block of A unless it's for a large object, in which case
+   the current block is kept for the small objects to come.  Return
+   the block's storage.  */
+
+static char *
+arena_new_block (struct arena *a, size_t size)
+{
+  struct arena_block *b;
+  bool large = size > ARENA_LARGE_OBJECT;
+  size_t block_size = large ? size : a->next_size;
+
+  b = xmalloc (BLOCK_HEADER_SIZE + block_size);
+  ++a->block_count;
+
+  if (large && a->blocks)
+    {
+      /* Link it behind the current block.  */
+      b->next = a->blocks->next;
+      a->blocks->next = b;
+      return (char *) b->data;
+    }
+
+  b->next = a->blocks;
+  a->blocks = b;
+  a->ptr = (char *) b->data;
+  a->end = a->ptr + block_size;
+  if (a->next_size < ARENA_MAX_BLOCK_SIZE)
+    a->next_size <<= 1;
+  return a->ptr;
+}
+
+/* Allocate SIZE bytes from A.  */
+
+void *
+arena_alloc (struct arena *a, size_t size)
+{
+  char *p;
+
+  size = ARENA_ALIGN (size ? size : 1);
+  ++a->objects;
+  if (size > (size_t) (a->end - a->ptr))
+    {
+      p = arena_new_block (a, size);
+      if (p != a->ptr)
+        return p;
+    }
+  p = a->ptr;
+  a->ptr += size;
+  return p;
+}
+
+/* Allocate SIZE zeroed bytes from A.  */
+
+void *
+arena_alloc0 (struct arena *a, size_t size)
+{
+  void *p = arena_alloc (a, size);
+  memset (p, 0, size);
+  return p;
+}
+
+/* Copy the string S to A.  */
+
+char *
+arena_strdup (struct arena *a, const char *s)
+{
+  return arena_strdupdelim (a, s, s + strlen (s));
+}
+
+/* Copy the string delimited by BEG and END to A, and zero-terminate
+   it.  */
+
+char *
+arena_strdupdelim (struct arena *a, const char *beg, const char *end)
+{
+  char *s = arena_alloc (a, end - beg + 1);
+  memcpy (s, beg, end - beg);
+  s[end - beg] = '\0';
+  return s;
+}
+
+/* Return the number of objects allocated from A.  */
+
+long
+arena_object_count (const struct arena *a)
+{
+  return a->objects;
+}
+
+/* Return the number of blocks A has taken from malloc.  */
+
+int
+arena_block_count (const struct arena *a)
+{
+  return a->block_count;
+}
+
+#ifdef TESTING
+
+const char *
+test_arena (void)
+{
+  struct arena *a = arena_new ();
+  char *big, *s1, *s2;
+  int i;
+
+  s1 = arena_strdup (a, "foo");
+  for (i = 0; i < 1000; i++)
+    {
+      long *l = arena_new0 (a, long);
+      mu_assert ("test_arena: memory is misaligned",
+                 ((size_t) l % ARENA_ALIGNMENT) == 0);
+      mu_assert ("test_arena: memory isn't zeroed", *l == 0);
+      *l = i;
+    }
+  big = arena_alloc (a, 2 * ARENA_MAX_BLOCK_SIZE);
+  memset (big, 'x', 2 * ARENA_MAX_BLOCK_SIZE);
+  s2 = arena_strdupdelim (a, "barbaz", "barbaz" + 3);
+
+  mu_assert ("test_arena: wrong string", 0 == strcmp (s1, "foo"));
+  mu_assert ("test_arena: wrong delimited string", 0 == strcmp (s2, "bar"));
+  mu_assert ("test_arena: wrong object count",
+             arena_object_count (a) == 1003);
+  mu_assert ("test_arena: too many blocks", arena_block_count (a) <= 5);
+
+  arena_free (a);
+  return NULL;
+}
+
+#endif /* TESTING */
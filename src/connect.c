@@ -36,6 +36,7 @@ as that of the covered work.  */
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
 #include <sys/select.h>
@@ -59,7 +60,9 @@ as that of the covered work.  */
 #include "utils.h"
 #include "host.h"
 #include "connect.h"
+#include "retr.h"
 #include "hash.h"
+#include "timing.h"
 
 #include <stdint.h>
 
@@ -253,13 +256,65 @@ connect_with_timeout (int fd, const struct sockaddr *addr, socklen_t addrlen,
   return ctx.result;
 }
 
-/* Connect via TCP to the specified address and port.
+#ifdef HAVE_PTHREAD
+/* Like connect_with_timeout, but wait for the connection with
+   select_fd rather than with an alarm.  run_with_timeout relies on
+   SIGALRM and on a single jump buffer, neither of which may be used
+   outside of the main thread.  */
+
+static int
+connect_with_select (int fd, const struct sockaddr *addr, socklen_t addrlen,
+                     double timeout)
+{
+  int flags, res;
+
+  if (timeout == 0)
+    return connect (fd, addr, addrlen);
+
+  flags = fcntl (fd, F_GETFL, 0);
+  if (flags < 0 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+
+  res = connect (fd, addr, addrlen);
+  if (res < 0 && errno == EINPROGRESS)
+    {
+      res = select_fd (fd, timeout, WAIT_FOR_WRITE);
+      if (res == 0)
+        {
+          errno = ETIMEDOUT;
+          res = -1;
+        }
+      else if (res > 0)
+        {
+          int err;
+          socklen_t errlen = sizeof (err);
+          if (getsockopt (fd, SOL_SOCKET, SO_ERROR, (void *) &err, &errlen) < 0)
+            res = -1;
+          else if (err != 0)
+            {
+              errno = err;
+              res = -1;
+            }
+          else
+            res = 0;
+        }
+    }
+
+  if (res == 0 && fcntl (fd, F_SETFL, flags) < 0)
+    res = -1;
+  return res;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Connect via TCP to the specified address and port.  If THREADED is
+   true, the caller may be a thread other than the main one.
 
    If PRINT is non-NULL, it is the host name to print that we're
    connecting to.  */
 
-int
-connect_to_ip (const ip_address *ip, int port, const char *print)
+static int
+connect_socket (const ip_address *ip, int port, const char *print,
+                bool threaded _GL_UNUSED)
 {
   struct sockaddr_storage ss;
   struct sockaddr *sa = (struct sockaddr *)&ss;
@@ -319,9 +374,9 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
      hopefully, the kernel's TCP window size) to the per-second limit.
      That way we should never have to sleep for more than 1s between
      network reads.  */
-  if (opt.limit_rate && opt.limit_rate < 8192)
+  if (limit_bandwidth_rate () && limit_bandwidth_rate () < 8192)
     {
-      int bufsize = opt.limit_rate;
+      int bufsize = limit_bandwidth_rate ();
       if (bufsize < 512)
         bufsize = 512;          /* avoid pathologically small values */
 #ifdef SO_RCVBUF
@@ -348,6 +403,15 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
     }
 
   /* Connect the socket to the remote endpoint.  */
+#ifdef HAVE_PTHREAD
+  if (threaded)
+    {
+      if (connect_with_select (sock, sa, sockaddr_size (sa),
+                               opt.connect_timeout) < 0)
+        goto err;
+    }
+  else
+#endif
   if (connect_with_timeout (sock, sa, sockaddr_size (sa),
                             opt.connect_timeout) < 0)
     goto err;
@@ -380,6 +444,28 @@ connect_to_ip (const ip_address *ip, int port, const char *print)
   }
 }
 
+/* Connect via TCP to the specified address and port.
+
+   If PRINT is non-NULL, it is the host name to print that we're
+   connecting to.  */
+
+int
+connect_to_ip (const ip_address *ip, int port, const char *print)
+{
+  return connect_socket (ip, port, print, false);
+}
+
+#ifdef HAVE_PTHREAD
+/* Like connect_to_ip, but safe to call from a thread other than the
+   main one.  Nothing is printed.  */
+
+int
+connect_to_ip_threaded (const ip_address *ip, int port)
+{
+  return connect_socket (ip, port, NULL, true);
+}
+#endif
+
 /* Connect via TCP to a remote host on the specified port.
 
    HOST is resolved as an Internet host name.  If HOST resolves to
@@ -392,7 +478,11 @@ connect_to_host (const char *host, int port)
   int i, start, end;
   int sock;
 
-  struct address_list *al = lookup_host (host, 0);
+  struct address_list *al;
+
+  timing_start (TIMING_DNS);
+  al = lookup_host (host, 0);
+  timing_stop (TIMING_DNS);
 
  retry:
   if (!al)
@@ -407,7 +497,9 @@ connect_to_host (const char *host, int port)
   for (i = start; i < end; i++)
     {
       const ip_address *ip = address_list_address_at (al, i);
+      timing_start (TIMING_CONNECT);
       sock = connect_to_ip (ip, port, host);
+      timing_stop (TIMING_CONNECT);
       if (sock >= 0)
         {
           /* Success. */
@@ -429,7 +521,9 @@ connect_to_host (const char *host, int port)
       /* We connected to AL before, but cannot do so now.  That might
          indicate that our DNS cache entry for HOST has expired.  */
       address_list_release (al);
+      timing_start (TIMING_DNS);
       al = lookup_host (host, LH_REFRESH);
+      timing_stop (TIMING_DNS);
       goto retry;
     }
   address_list_release (al);
@@ -835,7 +929,13 @@ struct transport_info {
 
    This should be used for transport layers like SSL that piggyback on
    sockets.  FD should otherwise be a real socket, on which you can
-   call getpeername, etc.  */
+   call getpeername, etc.
+
+   A transport can also be stacked on top of the one already
+   registered for FD, such as HTTP/2 on top of SSL.  It replaces the
+   old one, which it should retrieve first with
+   fd_transport_implementation and fd_transport_context in order to
+   call it.  */
 
 void
 fd_register_transport (int fd, struct transport_implementation *imp, void *ctx)
@@ -847,12 +947,16 @@ fd_register_transport (int fd, struct transport_implementation *imp, void *ctx)
      hash key.  */
   assert (fd >= 0);
 
-  info = xnew (struct transport_info);
-  info->imp = imp;
-  info->ctx = ctx;
   if (!transport_map)
     transport_map = hash_table_new (0, NULL, NULL);
-  hash_table_put (transport_map, (void *)(intptr_t) fd, info);
+  info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  if (!info)
+    {
+      info = xnew (struct transport_info);
+      hash_table_put (transport_map, (void *)(intptr_t) fd, info);
+    }
+  info->imp = imp;
+  info->ctx = ctx;
   ++transport_map_modified_tick;
 }
 
@@ -867,6 +971,18 @@ fd_transport_context (int fd)
   return info ? info->ctx : NULL;
 }
 
+/* Return the implementation of the transport registered with
+   fd_register_transport, or NULL if FD is a plain socket.  */
+
+struct transport_implementation *
+fd_transport_implementation (int fd)
+{
+  struct transport_info *info = NULL;
+  if (transport_map)
+    info = hash_table_get (transport_map, (void *)(intptr_t) fd);
+  return info ? info->imp : NULL;
+}
+
 /* When fd_read/fd_write are called multiple times in a loop, they should
    remember the INFO pointer instead of fetching it every time.  It is
    not enough to compare FD to LAST_FD because FD might have been
@@ -1043,3 +1159,14 @@ fd_close (int fd)
       ++transport_map_modified_tick;
     }
 }
+
+/* Return true if a transport, such as TLS, has been registered for
+   some descriptor.  fd_read and friends then cache the lookups of the
+   transport map in static variables, and must not be called from
+   threads other than the main one.  */
+
+bool
+fd_transports_registered (void)
+{
+  return transport_map != NULL;
+}
@@ -42,6 +42,9 @@ enum {
 };
 int connect_to_host (const char *, int);
 int connect_to_ip (const ip_address *, int, const char *);
+#ifdef HAVE_PTHREAD
+int connect_to_ip_threaded (const ip_address *, int);
+#endif
 
 int bind_local (const ip_address *, int *);
 int accept_connection (int);
@@ -74,10 +77,12 @@ struct transport_implementation {
 
 void fd_register_transport (int, struct transport_implementation *, void *);
 void *fd_transport_context (int);
+struct transport_implementation *fd_transport_implementation (int);
 int fd_read (int, char *, int, double);
 int fd_write (int, char *, int, double);
 int fd_peek (int, char *, int, double);
 const char *fd_errstr (int);
 void fd_close (int);
+bool fd_transports_registered (void);
 
 #endif /* CONNECT_H */
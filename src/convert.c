@@ -36,6 +36,10 @@ as that of the covered work.  */
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 #include "convert.h"
 #include "url.h"
 #include "recur.h"
@@ -47,6 +51,7 @@ as that of the covered work.  */
 #include "css-url.h"
 #include "iri.h"
 #include "xstrndup.h"
+#include "nproc.h"
 
 static struct hash_table *dl_file_url_map;
 struct hash_table *dl_url_file_map;
@@ -56,18 +61,665 @@ struct hash_table *dl_url_file_map;
 struct hash_table *downloaded_html_set;
 struct hash_table *downloaded_css_set;
 
-static void convert_links (const char *, struct urlpos *);
+/* Links harvested from a downloaded file, in the order of their
+   position in the file.  Recording them while the file is parsed
+   during the crawl spares convert_all_links from having to load and
+   parse every HTML and CSS file a second time.  */
+
+enum {
+  LR_BASE     = 0x01,           /* the link came from <base href=...> */
+  LR_COMPLETE = 0x02,           /* the link was complete (had host name) */
+  LR_CSS      = 0x04,           /* the link came from CSS */
+  LR_NOQUOTE  = 0x08,           /* from HTML, but doesn't need quoting */
+  LR_REFRESH  = 0x10            /* from <meta http-equiv=refresh ...> */
+};
+
+struct link_record {
+  int pos, size;                /* position of the link in the file */
+  int refresh_timeout;          /* for reconstructing the refresh */
+  unsigned int flags;           /* LR_* flags above */
+  const char *url;              /* the absolute URL of the link */
+  const char *key;              /* canonical form of URL, used to look
+                                   it up in dl_url_file_map; NULL if
+                                   the URL doesn't parse */
+};
+
+struct file_links {
+  wgint size;                   /* size and modification time of the */
+  time_t mtime;                 /* file at the time it was parsed */
+  int count;
+  struct link_record *links;
+};
+
+/* Maps local file names to the struct file_links recorded for
+   them.  */
+static struct hash_table *file_links_map;
+
+/* Link URLs are interned because the same URLs tend to be referenced
+   by many documents of a site (navigation, style sheets, logos).  */
+static struct hash_table *link_strings;
+
+struct convert_job;
+static void convert_links (struct convert_job *);
 
+static const char *
+intern_link_string (const char *s)
+{
+  char *interned;
+
+  if (!link_strings)
+    link_strings = make_string_hash_table (0);
+  if (!hash_table_get_pair (link_strings, s, &interned, NULL))
+    {
+      interned = xstrdup (s);
+      hash_table_put (link_strings, interned, interned);
+    }
+  return interned;
+}
+
+/* Build the link records for the urlpos list LINKS.  The conversion
+   direction is decided later, in convert_links, because only at the
+   end of the retrieval is it known which URLs have been downloaded.  */
+
+static struct file_links *
+file_links_new (const struct urlpos *links)
+{
+  const struct urlpos *cur_url;
+  struct file_links *fl = xnew0 (struct file_links);
+  struct link_record *lr;
+
+  for (cur_url = links; cur_url; cur_url = cur_url->next)
+    ++fl->count;
+  if (fl->count)
+    fl->links = xnew0_array (struct link_record, fl->count);
+
+  for (cur_url = links, lr = fl->links; cur_url; cur_url = cur_url->next, lr++)
+    {
+      lr->pos = cur_url->pos;
+      lr->size = cur_url->size;
+      lr->refresh_timeout = cur_url->refresh_timeout;
+      lr->url = intern_link_string (cur_url->url->url);
+
+      if (cur_url->link_base_p)
+        lr->flags |= LR_BASE;
+      if (cur_url->link_complete_p)
+        lr->flags |= LR_COMPLETE;
+      if (cur_url->link_css_p)
+        lr->flags |= LR_CSS;
+      if (cur_url->link_noquote_html_p)
+        lr->flags |= LR_NOQUOTE;
+      if (cur_url->link_refresh_p)
+        lr->flags |= LR_REFRESH;
+
+      if (!cur_url->link_base_p)
+        {
+          struct iri *pi = iri_new ();
+          struct url *u;
+
+          set_uri_encoding (pi, opt.locale, true);
+          u = url_parse (cur_url->url->url, NULL, pi, true);
+          if (u)
+            {
+              lr->key = (0 == strcmp (u->url, lr->url)
+                         ? lr->url : intern_link_string (u->url));
+              url_free (u);
+            }
+          iri_free (pi);
+        }
+    }
+
+  return fl;
+}
+
+static void
+file_links_free (struct file_links *fl)
+{
+  xfree (fl->links);
+  xfree (fl);
+}
+
+/* Forget the links recorded for FILE, typically because FILE is
+   about to be overwritten or has been removed.  */
+
+static void
+forget_links (const char *file)
+{
+  char *old_file;
+  struct file_links *fl;
+
+  if (file_links_map
+      && hash_table_get_pair (file_links_map, file, &old_file, &fl))
+    {
+      hash_table_remove (file_links_map, file);
+      xfree (old_file);
+      file_links_free (fl);
+    }
+}
+
+/* Register LINKS as the list of links found in FILE, which has been
+   downloaded from URL.  This is called by the recursive retrieval
+   code right after parsing a downloaded HTML or CSS file, so that
+   convert_all_links can reuse the result.  */
+
+void
+register_links (const char *file, const char *url, const struct urlpos *links)
+{
+  struct stat st;
+  struct file_links *fl;
+  char *file_url;
+
+  if (!opt.convert_links || opt.delete_after || opt.spider)
+    return;
+
+  /* Only files that will be converted, and that were parsed against
+     the URL the conversion will use, are worth remembering.  */
+  if (!(downloaded_html_set && string_set_contains (downloaded_html_set, file))
+      && !(downloaded_css_set && string_set_contains (downloaded_css_set, file)))
+    return;
+  file_url = dl_file_url_map ? hash_table_get (dl_file_url_map, file) : NULL;
+  if (!file_url || 0 != strcmp (file_url, url))
+    return;
+
+  if (stat (file, &st) < 0)
+    return;
+
+  forget_links (file);
+
+  fl = file_links_new (links);
+  fl->size = st.st_size;
+  fl->mtime = st.st_mtime;
+
+  if (!file_links_map)
+    file_links_map = make_string_hash_table (0);
+  hash_table_put (file_links_map, xstrdup (file), fl);
+}
+
+/* Remove and return the links recorded for FILE, provided that FILE
+   hasn't changed on disk since they were recorded.  Otherwise return
+   NULL, and the caller will have to parse FILE.  */
+
+static struct file_links *
+take_links (const char *file)
+{
+  struct stat st;
+  char *old_file;
+  struct file_links *fl;
+
+  if (!file_links_map
+      || !hash_table_get_pair (file_links_map, file, &old_file, &fl))
+    return NULL;
+
+  hash_table_remove (file_links_map, file);
+  xfree (old_file);
+
+  if (stat (file, &st) < 0 || st.st_size != fl->size
+      || st.st_mtime != fl->mtime)
+    {
+      DEBUGP (("%s changed since it was parsed.\n", file));
+      file_links_free (fl);
+      return NULL;
+    }
+
+  return fl;
+}
+
+/* The link map kept in --link-map-file.  For every converted file, it
+   records the size and modification time of the file right after the
+   conversion, and the links found in it along with the local file each
+   was converted to, or NULL for links converted to complete URLs.  A
+   later run uses it to leave alone the files that haven't been
+   downloaded again and whose links would be converted the same way.  */
+
+struct link_map_link {
+  const char *key;              /* canonical URL of the link */
+  const char *local_name;       /* local file it was converted to */
+};
+
+struct link_map_entry {
+  wgint size;
+  time_t mtime;
+  int count, size_links;
+  struct link_map_link *links;
+};
+
+/* Maps local file names to their struct link_map_entry.  */
+static struct hash_table *link_map;
+
+/* Number of files left alone because of the link map.  */
+static int link_map_skipped;
+
+static void
+link_map_entry_free (struct link_map_entry *lme)
+{
+  xfree (lme->links);
+  xfree (lme);
+}
+
+static void
+link_map_remove (const char *file)
+{
+  char *old_file;
+  struct link_map_entry *lme;
+
+  if (link_map && hash_table_get_pair (link_map, file, &old_file, &lme))
+    {
+      hash_table_remove (link_map, file);
+      xfree (old_file);
+      link_map_entry_free (lme);
+    }
+}
+
+static void
+link_map_entry_add_link (struct link_map_entry *lme, const char *key,
+                         const char *local_name)
+{
+  struct link_map_link *lml;
+
+  DO_REALLOC (lme->links, lme->size_links, lme->count + 1,
+              struct link_map_link);
+  lml = &lme->links[lme->count++];
+  lml->key = intern_link_string (key);
+  lml->local_name = local_name ? intern_link_string (local_name) : NULL;
+}
+
+/* Read the link map from FILENAME.  Each file is described by a line
+   of the form "<file>\t<size>\t<mtime>", followed by a line of the
+   form "\t<url>\t<local file>" for each of its links.  */
+
+static void
+link_map_read (const char *filename)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t len = 0;
+  ssize_t read_len;
+  struct link_map_entry *lme = NULL;
+
+  link_map = make_string_hash_table (0);
+  link_map_skipped = 0;
+
+  fp = fopen (filename, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot read link map %s: %s\n"),
+                   quote (filename), strerror (errno));
+      return;
+    }
+
+  while ((read_len = getline (&line, &len, fp)) > 0)
+    {
+      char *sep, *end;
+
+      if (line[read_len - 1] == '\n')
+        line[--read_len] = '\0';
+      if (*line == '#' || *line == '\0')
+        continue;
+
+      if (*line == '\t')
+        {
+          /* A link of the last file.  */
+          if (!lme || !(sep = strchr (line + 1, '\t')))
+            continue;
+          *sep++ = '\0';
+          link_map_entry_add_link (lme, line + 1, *sep ? sep : NULL);
+          continue;
+        }
+
+      /* A file.  Its name is split from the right, since it's the only
+         field that might contain funny characters.  */
+      lme = NULL;
+      sep = strrchr (line, '\t');
+      if (!sep || sep == line)
+        continue;
+      *sep = '\0';
+      end = strrchr (line, '\t');
+      if (!end || end == line)
+        continue;
+      *end = '\0';
+
+      lme = xnew0 (struct link_map_entry);
+      lme->size = str_to_wgint (end + 1, NULL, 10);
+      lme->mtime = (time_t) strtoul (sep + 1, NULL, 10);
+      link_map_remove (line);
+      hash_table_put (link_map, xstrdup (line), lme);
+    }
+
+  xfree (line);
+  fclose (fp);
+}
+
+/* Write the link map to FILENAME.  It is written to a temporary file
+   which replaces the old map when it is complete, so that a failed
+   write doesn't leave a truncated map to be trusted by the next run.  */
+
+static void
+link_map_save (const char *filename)
+{
+  FILE *fp;
+  char *tmp;
+  bool ok;
+  hash_table_iterator iter;
+
+  tmp = aprintf ("%s.tmp", filename);
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write link map %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      xfree (tmp);
+      return;
+    }
+
+  fputs ("# Link map of converted files for GNU Wget.\n", fp);
+  fputs ("# Edit at your own risk.\n", fp);
+  fputs ("# <file>\t<size>\t<mtime>\n", fp);
+  fputs ("# \t<url>\t<local file, if downloaded>\n", fp);
+
+  for (hash_table_iterate (link_map, &iter); hash_table_iter_next (&iter);)
+    {
+      const char *file = iter.key;
+      const struct link_map_entry *lme = iter.value;
+      int i;
+
+      /* Files whose names would break the format aren't recorded, and
+         will simply be converted on every run.  */
+      if (strpbrk (file, "\t\r\n"))
+        continue;
+      for (i = 0; i < lme->count; i++)
+        if (lme->links[i].local_name
+            && strpbrk (lme->links[i].local_name, "\t\r\n"))
+          break;
+      if (i < lme->count)
+        continue;
+
+      fprintf (fp, "%s\t%s\t%lu\n", file, number_to_static_string (lme->size),
+               (unsigned long) lme->mtime);
+      for (i = 0; i < lme->count; i++)
+        fprintf (fp, "\t%s\t%s\n", lme->links[i].key,
+                 lme->links[i].local_name ? lme->links[i].local_name : "");
+      if (ferror (fp))
+        break;
+    }
+
+  ok = !ferror (fp);
+  if (fclose (fp) == EOF)
+    ok = false;
+  if (!ok || rename (tmp, filename) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write link map %s: %s\n"),
+                 quote (filename), strerror (errno));
+      unlink (tmp);
+    }
+  xfree (tmp);
+}
+
+/* Record in the link map that FILE, whose links are FL, has just been
+   converted.  */
+
+static void
+link_map_put (const char *file, const struct file_links *fl)
+{
+  struct stat st;
+  struct link_map_entry *lme;
+  int i;
+
+  link_map_remove (file);
+  if (stat (file, &st) < 0)
+    return;
+
+  lme = xnew0 (struct link_map_entry);
+  lme->size = st.st_size;
+  lme->mtime = st.st_mtime;
+  for (i = 0; i < fl->count; i++)
+    {
+      const struct link_record *lr = &fl->links[i];
+
+      /* Skip the repeated links, which are common in navigation.  */
+      if (!lr->key || (i > 0 && lr->key == fl->links[i - 1].key))
+        continue;
+      link_map_entry_add_link (lme, lr->key,
+                               hash_table_get (dl_url_file_map, lr->key));
+    }
+  hash_table_put (link_map, xstrdup (file), lme);
+}
+
+/* Return true if FILE needn't be converted, because it hasn't been
+   downloaded or otherwise changed since its last conversion, and all
+   its links would be converted as they were then.  */
+
+static bool
+link_map_unchanged (const char *file)
+{
+  struct stat st;
+  struct link_map_entry *lme;
+  int i;
+
+  if (downloaded_file (CHECK_FOR_FILE, file) != FILE_NOT_ALREADY_DOWNLOADED)
+    return false;
+  lme = hash_table_get (link_map, file);
+  if (!lme)
+    return false;
+  if (stat (file, &st) < 0 || st.st_size != lme->size
+      || st.st_mtime != lme->mtime)
+    return false;
+
+  for (i = 0; i < lme->count; i++)
+    {
+      const char *local_name = hash_table_get (dl_url_file_map,
+                                               lme->links[i].key);
+      const char *old_local_name = lme->links[i].local_name;
+
+      if (!local_name != !old_local_name
+          || (local_name && 0 != strcmp (local_name, old_local_name)))
+        {
+          DEBUGP (("%s: %s is now converted to %s.\n", file,
+                   lme->links[i].key, local_name ? local_name : "a URL"));
+          return false;
+        }
+    }
+  return true;
+}
+
+/* Return the name of the backup of FILE written by write_backup_file,
+   if there is one, or NULL.  */
+
+static char *
+find_backup_file (const char *file)
+{
+  size_t filename_len = strlen (file);
+  char *backup = concat_strings (file, ORIG_SFX, (char *) 0);
+
+  if (file_exists_p (backup, NULL))
+    return backup;
+  xfree (backup);
+
+  /* See write_backup_file for the case of -E.  */
+  if (filename_len > 5 && 0 == strcmp (file + filename_len - 5, ".html"))
+    {
+      backup = xstrdup (file);
+      strcpy (backup + filename_len - 4, "orig");
+      if (file_exists_p (backup, NULL))
+        return backup;
+      xfree (backup);
+    }
+  return NULL;
+}
+
+/* A file whose links are to be converted.  The messages produced by
+   its conversion are not logged right away, but after the conversion
+   is done and in the order of the files, so that the log reads the
+   same however the files are distributed among the workers.  */
+
+struct convert_message {
+  enum log_options o;
+  char *text;
+  struct convert_message *next;
+};
+
+struct convert_job {
+  const char *file;
+  char *source;                 /* file to convert the links from, if
+                                   not FILE itself */
+  struct file_links *links;
+  struct convert_message *msgs, *msgs_tail;
+  bool converted;               /* whether FILE is converted */
+  bool done;
+};
+
+/* Statistics of one conversion worker, for the final summary.  */
+
+struct convert_worker {
+  struct convert_pool *pool;
+  int files;                    /* number of files converted */
+  double secs;                  /* time spent converting them */
+#ifdef HAVE_PTHREAD
+  pthread_t thread;
+#endif
+};
+
+struct convert_pool {
+  struct convert_job *jobs;
+  int count;
+  int next;                     /* the next job to be picked up */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t job_done;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+/* Serializes the few things that the workers share: the set of backed
+   up files and the formatting of error messages, which uses strerror
+   and quote.  */
+static pthread_mutex_t convert_lock = PTHREAD_MUTEX_INITIALIZER;
+# define CONVERT_LOCK pthread_mutex_lock (&convert_lock)
+# define CONVERT_UNLOCK pthread_mutex_unlock (&convert_lock)
+#else
+# define CONVERT_LOCK
+# define CONVERT_UNLOCK
+#endif
+
+/* Queue TEXT, which must be malloced, to be logged at level O once the
+   conversion of JOB's file is done.  */
+
+static void
+job_log (struct convert_job *job, enum log_options o, char *text)
+{
+  struct convert_message *msg = xnew (struct convert_message);
+  msg->o = o;
+  msg->text = text;
+  msg->next = NULL;
+  if (job->msgs_tail)
+    job->msgs_tail->next = msg;
+  else
+    job->msgs = msg;
+  job->msgs_tail = msg;
+}
+
+/* Log the messages queued for JOB, record it in the link map and free
+   the job's data.  */
+
+static void
+job_finish (struct convert_job *job)
+{
+  struct convert_message *msg, *next;
+
+  if (link_map)
+    {
+      if (job->converted)
+        link_map_put (job->file, job->links);
+      else
+        link_map_remove (job->file);
+    }
+
+  for (msg = job->msgs; msg; msg = next)
+    {
+      next = msg->next;
+      logputs (msg->o, msg->text);
+      xfree (msg->text);
+      xfree (msg);
+    }
+  job->msgs = job->msgs_tail = NULL;
+  file_links_free (job->links);
+  job->links = NULL;
+  xfree (job->source);
+}
+
+/* Convert the links of the jobs in the worker's pool, picking them up
+   one by one until none are left.  */
+
+static void *
+convert_worker_run (void *arg)
+{
+  struct convert_worker *worker = arg;
+  struct convert_pool *pool = worker->pool;
+  struct ptimer *timer = ptimer_new ();
+
+  while (1)
+    {
+      struct convert_job *job;
+      double start;
+
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock (&pool->lock);
+#endif
+      job = pool->next < pool->count ? &pool->jobs[pool->next++] : NULL;
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock (&pool->lock);
+#endif
+      if (!job)
+        break;
+
+      start = ptimer_measure (timer);
+      convert_links (job);
+      worker->secs += ptimer_measure (timer) - start;
+      ++worker->files;
+
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock (&pool->lock);
+      job->done = true;
+      pthread_cond_broadcast (&pool->job_done);
+      pthread_mutex_unlock (&pool->lock);
+#else
+      job->done = true;
+#endif
+    }
+
+  ptimer_destroy (timer);
+  return NULL;
+}
+
+/* Return the number of workers to convert links with.  Conversion is
+   done in the main thread when debugging, so that the debug output
+   comes out in a sensible order.  */
+
+static int
+convert_worker_count (void)
+{
+#ifdef HAVE_PTHREAD
+  if (!opt.debug)
+    {
+      unsigned long n = num_processors (NPROC_CURRENT_OVERRIDABLE);
+      return n > 0 ? n : 1;
+    }
+#endif
+  return 1;
+}
+
+/* Convert the links in the files of DOWNLOADED_SET, using the
+   NWORKERS workers in WORKERS.  */
 
 static void
 convert_links_in_hashtable (struct hash_table *downloaded_set,
                             int is_css,
-                            int *file_count)
+                            struct convert_worker *workers, int nworkers)
 {
   int i;
 
   int cnt;
   char **file_array;
+  struct convert_pool pool;
 
   cnt = 0;
   if (downloaded_set)
@@ -77,11 +729,17 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
   file_array = alloca_array (char *, cnt);
   string_set_to_array (downloaded_set, file_array);
 
+  xzero (pool);
+  pool.jobs = xnew0_array (struct convert_job, cnt);
+
+  /* Collect the links of the files.  This is done here rather than in
+     the workers, because the parser isn't thread-safe.  */
   for (i = 0; i < cnt; i++)
     {
-      struct urlpos *urls, *cur_url;
+      struct file_links *fl;
       char *url;
       char *file = file_array[i];
+      char *source = NULL;
 
       /* Determine the URL of the file.  get_urls_{html,css} will need
          it.  */
@@ -92,80 +750,101 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
           continue;
         }
 
-      DEBUGP (("Scanning %s (from %s)\n", file, url));
-
-      /* Parse the file...  */
-      urls = is_css ? get_urls_css_file (file, url) :
-                      get_urls_html (file, url, NULL, NULL);
-
-      /* We don't respect meta_disallow_follow here because, even if
-         the file is not followed, we might still want to convert the
-         links that have been followed from other files.  */
-
-      for (cur_url = urls; cur_url; cur_url = cur_url->next)
+      if (link_map)
         {
-          char *local_name;
-          struct url *u;
-          struct iri *pi;
-
-          if (cur_url->link_base_p)
+          if (link_map_unchanged (file))
             {
-              /* Base references have been resolved by our parser, so
-                 we turn the base URL into an empty string.  (Perhaps
-                 we should remove the tag entirely?)  */
-              cur_url->convert = CO_NULLIFY_BASE;
+              DEBUGP (("%s is unchanged since its last conversion.\n",
+                       file));
+              forget_links (file);
+              ++link_map_skipped;
               continue;
             }
 
-          /* We decide the direction of conversion according to whether
-             a URL was downloaded.  Downloaded URLs will be converted
-             ABS2REL, whereas non-downloaded will be converted REL2ABS.  */
+          /* FILE has been converted by a previous run, but not
+             downloaded by this one.  Convert it again from the
+             original, if it's been kept, rather than from the
+             result of the previous conversion.  */
+          if (opt.backup_converted
+              && hash_table_contains (link_map, file)
+              && !downloaded_file (CHECK_FOR_FILE, file))
+            source = find_backup_file (file);
+        }
 
-          pi = iri_new ();
-          set_uri_encoding (pi, opt.locale, true);
+      /* Use the links recorded when FILE was parsed during the crawl,
+         and parse the file only if there are none.  */
+      if (source)
+        forget_links (file);
+      fl = source ? NULL : take_links (file);
+      if (!fl)
+        {
+          struct urlpos *urls;
+          const char *parsed = source ? source : file;
+
+          DEBUGP (("Scanning %s (from %s)\n", parsed, url));
+
+          /* We don't respect meta_disallow_follow here because, even
+             if the file is not followed, we might still want to
+             convert the links that have been followed from other
+             files.  */
+          urls = is_css ? get_urls_css_file (parsed, url) :
+                          get_urls_html (parsed, url, NULL, NULL);
+          fl = file_links_new (urls);
+          free_urlpos (urls);
+        }
 
-          u = url_parse (cur_url->url->url, NULL, pi, true);
-          if (!u)
-              continue;
+      pool.jobs[pool.count].file = file;
+      pool.jobs[pool.count].source = source;
+      pool.jobs[pool.count].links = fl;
+      ++pool.count;
+    }
 
-          local_name = hash_table_get (dl_url_file_map, u->url);
+  if (nworkers > pool.count)
+    nworkers = pool.count;
 
-          /* Decide on the conversion type.  */
-          if (local_name)
-            {
-              /* We've downloaded this URL.  Convert it to relative
-                 form.  We do this even if the URL already is in
-                 relative form, because our directory structure may
-                 not be identical to that on the server (think `-nd',
-                 `--cut-dirs', etc.). If --convert-file-only was passed,
-                 we only convert the basename portion of the URL.  */
-              cur_url->convert = (opt.convert_file_only ? CO_CONVERT_BASENAME_ONLY : CO_CONVERT_TO_RELATIVE);
-              cur_url->local_name = xstrdup (local_name);
-              DEBUGP (("will convert url %s to local %s\n", u->url, local_name));
-            }
-          else
-            {
-              /* We haven't downloaded this URL.  If it's not already
-                 complete (including a full host name), convert it to
-                 that form, so it can be reached while browsing this
-                 HTML locally.  */
-              if (!cur_url->link_complete_p)
-                cur_url->convert = CO_CONVERT_TO_COMPLETE;
-              cur_url->local_name = NULL;
-              DEBUGP (("will convert url %s to complete\n", u->url));
-            }
+#ifdef HAVE_PTHREAD
+  if (nworkers > 1)
+    {
+      int started;
 
-          url_free (u);
-          iri_free (pi);
+      pthread_mutex_init (&pool.lock, NULL);
+      pthread_cond_init (&pool.job_done, NULL);
+      for (started = 0; started < nworkers; started++)
+        {
+          workers[started].pool = &pool;
+          if (pthread_create (&workers[started].thread, NULL,
+                              convert_worker_run, &workers[started]) != 0)
+            break;
         }
+      if (started == 0)
+        /* No thread could be created; do the work ourselves.  */
+        convert_worker_run (&workers[0]);
 
-      /* Convert the links in the file.  */
-      convert_links (file, urls);
-      ++*file_count;
+      /* Log the results in order, as the workers finish the jobs.  */
+      for (i = 0; i < pool.count; i++)
+        {
+          pthread_mutex_lock (&pool.lock);
+          while (!pool.jobs[i].done)
+            pthread_cond_wait (&pool.job_done, &pool.lock);
+          pthread_mutex_unlock (&pool.lock);
+          job_finish (&pool.jobs[i]);
+        }
 
-      /* Free the data.  */
-      free_urlpos (urls);
+      while (started-- > 0)
+        pthread_join (workers[started].thread, NULL);
+      pthread_cond_destroy (&pool.job_done);
+      pthread_mutex_destroy (&pool.lock);
+    }
+  else
+#endif
+    {
+      workers[0].pool = &pool;
+      convert_worker_run (&workers[0]);
+      for (i = 0; i < pool.count; i++)
+        job_finish (&pool.jobs[i]);
     }
+
+  xfree (pool.jobs);
 }
 
 /* This function is called when the retrieval is done to convert the
@@ -181,78 +860,203 @@ convert_links_in_hashtable (struct hash_table *downloaded_set,
 
    All the downloaded HTMLs are kept in downloaded_html_files, and
    downloaded URLs in urls_downloaded.  All the information is
-   extracted from these two lists.  */
+   extracted from these two lists.
+
+   The files are converted by a pool of workers, one per available
+   CPU, since the conversion of each file is independent of the
+   others and only reads the tables built during the retrieval.
+
+   With --link-map-file, the conversions are recorded, and the files
+   that a previous run has converted the same way are skipped.  */
 
 void
 convert_all_links (void)
 {
   double secs;
-  int file_count = 0;
+  int i, file_count = 0;
+  int nworkers = convert_worker_count ();
+  struct convert_worker *workers = xnew0_array (struct convert_worker,
+                                                nworkers);
 
   struct ptimer *timer = ptimer_new ();
 
-  convert_links_in_hashtable (downloaded_html_set, 0, &file_count);
-  convert_links_in_hashtable (downloaded_css_set, 1, &file_count);
+  if (opt.link_map_file && !link_map)
+    link_map_read (opt.link_map_file);
+
+  convert_links_in_hashtable (downloaded_html_set, 0, workers, nworkers);
+  convert_links_in_hashtable (downloaded_css_set, 1, workers, nworkers);
+
+  for (i = 0; i < nworkers; i++)
+    file_count += workers[i].files;
 
   secs = ptimer_measure (timer);
   logprintf (LOG_VERBOSE, _("Converted links in %d files in %s seconds.\n"),
              file_count, print_decimal (secs));
+  if (link_map_skipped)
+    logprintf (LOG_VERBOSE,
+               _("Skipped %d files unchanged since their last conversion.\n"),
+               link_map_skipped);
+
+  if (nworkers > 1)
+    for (i = 0; i < nworkers; i++)
+      {
+        struct convert_worker *worker = &workers[i];
+
+        logprintf (LOG_VERBOSE, _("  worker %d: %d files in %s seconds"),
+                   i + 1, worker->files, print_decimal (worker->secs));
+        logprintf (LOG_VERBOSE, _(" (%s files/s).\n"),
+                   print_decimal (worker->secs > 0
+                                  ? worker->files / worker->secs : 0));
+      }
 
+  if (link_map)
+    link_map_save (opt.link_map_file);
+
+  xfree (workers);
   ptimer_destroy (timer);
 }
 
-static void write_backup_file (const char *, downloaded_file_t);
+static void write_backup_file (struct convert_job *, downloaded_file_t);
 static const char *replace_plain (const char*, int, FILE*, const char *);
 static const char *replace_attr (const char *, int, FILE *, const char *);
 static const char *replace_attr_refresh_hack (const char *, int, FILE *,
                                               const char *, int);
 static char *local_quote_string (const char *, bool);
 static char *construct_relative (const char *, const char *);
-static char *convert_basename (const char *, const struct urlpos *);
+static char *convert_basename (const char *, int, const char *);
+
+/* Size of the stdio buffer used for writing converted files.  The
+   text between two converted links is written with a single fwrite
+   straight from the (usually mmapped) input, so a large buffer mostly
+   serves to coalesce the small writes of the replaced links.  */
+#define CONVERT_BUFSIZE (64 * 1024)
+
+/* The conversion decided on for a single link of a file.  */
+struct link_conversion {
+  enum convert_options convert;
+  const char *local_name;       /* local file to which the URL was
+                                   saved, if any */
+};
+
+/* Decide on the conversion of the link LR, storing it to LC.  */
+
+static void
+decide_link_conversion (const struct link_record *lr,
+                        struct link_conversion *lc)
+{
+  lc->convert = CO_NOCONVERT;
+  lc->local_name = NULL;
+
+  if (lr->flags & LR_BASE)
+    {
+      /* Base references have been resolved by our parser, so we turn
+         the base URL into an empty string.  (Perhaps we should remove
+         the tag entirely?)  */
+      lc->convert = CO_NULLIFY_BASE;
+      return;
+    }
+  if (!lr->key)
+    return;
+
+  /* We decide the direction of conversion according to whether a URL
+     was downloaded.  Downloaded URLs will be converted ABS2REL,
+     whereas non-downloaded will be converted REL2ABS.  */
+  lc->local_name = hash_table_get (dl_url_file_map, lr->key);
+  if (lc->local_name)
+    {
+      /* We've downloaded this URL.  Convert it to relative form.  We
+         do this even if the URL already is in relative form, because
+         our directory structure may not be identical to that on the
+         server (think `-nd', `--cut-dirs', etc.). If
+         --convert-file-only was passed, we only convert the basename
+         portion of the URL.  */
+      lc->convert = (opt.convert_file_only ? CO_CONVERT_BASENAME_ONLY
+                     : CO_CONVERT_TO_RELATIVE);
+      DEBUGP (("will convert url %s to local %s\n", lr->key, lc->local_name));
+    }
+  else
+    {
+      /* We haven't downloaded this URL.  If it's not already complete
+         (including a full host name), convert it to that form, so it
+         can be reached while browsing this HTML locally.  */
+      if (!(lr->flags & LR_COMPLETE))
+        lc->convert = CO_CONVERT_TO_COMPLETE;
+      DEBUGP (("will convert url %s to complete\n", lr->key));
+    }
+}
+
+/* Write NEW_TEXT in place of the link LR, which starts at P.  */
+
+static const char *
+replace_link (const char *p, const struct link_record *lr, FILE *fp,
+              const char *new_text, const char *new_text_plain)
+{
+  if ((lr->flags & LR_CSS) || (lr->flags & LR_NOQUOTE))
+    return replace_plain (p, lr->size, fp, new_text_plain);
+  else if (!(lr->flags & LR_REFRESH))
+    return replace_attr (p, lr->size, fp, new_text);
+  else
+    return replace_attr_refresh_hack (p, lr->size, fp, new_text,
+                                      lr->refresh_timeout);
+}
 
-/* Change the links in one file.  LINKS is a list of links in the
-   document, along with their positions and the desired direction of
-   the conversion.  */
+/* Change the links in the file of JOB, whose links, along with their
+   positions in the document, are in JOB->links.  The file is read
+   once, and the text between the converted links is copied
+   verbatim.  */
 static void
-convert_links (const char *file, struct urlpos *links)
+convert_links (struct convert_job *job)
 {
+  const char *file = job->file;
+  const char *source = job->source ? job->source : file;
+  const struct file_links *fl = job->links;
   struct file_memory *fm;
   FILE *fp;
   const char *p;
   downloaded_file_t downloaded_file_return;
+  struct link_conversion *conv;
+  int i, to_url_count = 0, to_file_count = 0;
 
-  struct urlpos *link;
-  int to_url_count = 0, to_file_count = 0;
-
-  logprintf (LOG_VERBOSE, _("Converting links in %s... "), file);
+  job_log (job, LOG_VERBOSE, aprintf (_("Converting links in %s... "), file));
 
   {
-    /* First we do a "dry run": go through the list L and see whether
+    /* First we do a "dry run": go through the links and see whether
        any URL needs to be converted in the first place.  If not, just
-       leave the file alone.  */
+       leave the file alone, unless it is to be restored from its
+       backup.  */
     int dry_count = 0;
-    struct urlpos *dry;
-    for (dry = links; dry; dry = dry->next)
-      if (dry->convert != CO_NOCONVERT)
-        ++dry_count;
-    if (!dry_count)
+    conv = xnew_array (struct link_conversion, fl->count ? fl->count : 1);
+    for (i = 0; i < fl->count; i++)
       {
-        logputs (LOG_VERBOSE, _("nothing to do.\n"));
+        decide_link_conversion (&fl->links[i], &conv[i]);
+        if (conv[i].convert != CO_NOCONVERT)
+          ++dry_count;
+      }
+    if (!dry_count && !job->source)
+      {
+        job_log (job, LOG_VERBOSE, xstrdup (_("nothing to do.\n")));
+        xfree (conv);
+        job->converted = true;
         return;
       }
   }
 
-  fm = wget_read_file (file);
+  fm = wget_read_file (source);
   if (!fm)
     {
-      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
-                 file, strerror (errno));
+      int err = errno;
+      CONVERT_LOCK;
+      job_log (job, LOG_NOTQUIET,
+               aprintf (_("Cannot convert links in %s: %s\n"),
+                        source, strerror (err)));
+      CONVERT_UNLOCK;
+      xfree (conv);
       return;
     }
 
   downloaded_file_return = downloaded_file (CHECK_FOR_FILE, file);
   if (opt.backup_converted && downloaded_file_return)
-    write_backup_file (file, downloaded_file_return);
+    write_backup_file (job, downloaded_file_return);
 
   /* Before opening the file for writing, unlink the file.  This is
      important if the data in FM is mmaped.  In such case, nulling the
@@ -260,37 +1064,49 @@ convert_links (const char *file, struct urlpos *links)
      zeroes from the mmaped region.  */
   if (unlink (file) < 0 && errno != ENOENT)
     {
-      logprintf (LOG_NOTQUIET, _("Unable to delete %s: %s\n"),
-                 quote (file), strerror (errno));
+      int err = errno;
+      CONVERT_LOCK;
+      job_log (job, LOG_NOTQUIET, aprintf (_("Unable to delete %s: %s\n"),
+                                           quote (file), strerror (err)));
+      CONVERT_UNLOCK;
       wget_read_file_free (fm);
+      xfree (conv);
       return;
     }
   /* Now open the file for writing.  */
   fp = fopen (file, "wb");
   if (!fp)
     {
-      logprintf (LOG_NOTQUIET, _("Cannot convert links in %s: %s\n"),
-                 file, strerror (errno));
+      int err = errno;
+      CONVERT_LOCK;
+      job_log (job, LOG_NOTQUIET,
+               aprintf (_("Cannot convert links in %s: %s\n"),
+                        file, strerror (err)));
+      CONVERT_UNLOCK;
       wget_read_file_free (fm);
+      xfree (conv);
       return;
     }
+  setvbuf (fp, NULL, _IOFBF, CONVERT_BUFSIZE);
 
   /* Here we loop through all the URLs in file, replacing those of
      them that are downloaded with relative references.  */
   p = fm->content;
-  for (link = links; link; link = link->next)
+  for (i = 0; i < fl->count; i++)
     {
-      char *url_start = fm->content + link->pos;
+      const struct link_record *lr = &fl->links[i];
+      const struct link_conversion *lc = &conv[i];
+      char *url_start = fm->content + lr->pos;
 
-      if (link->pos >= fm->length)
+      if (lr->pos >= fm->length)
         {
           DEBUGP (("Something strange is going on.  Please investigate."));
           break;
         }
       /* If the URL is not to be converted, skip it.  */
-      if (link->convert == CO_NOCONVERT)
+      if (lc->convert == CO_NOCONVERT)
         {
-          DEBUGP (("Skipping %s at position %d.\n", link->url->url, link->pos));
+          DEBUGP (("Skipping %s at position %d.\n", lr->url, lr->pos));
           continue;
         }
 
@@ -299,25 +1115,19 @@ convert_links (const char *file, struct urlpos *links)
       fwrite (p, 1, url_start - p, fp);
       p = url_start;
 
-      switch (link->convert)
+      switch (lc->convert)
         {
         case CO_CONVERT_TO_RELATIVE:
           /* Convert absolute URL to relative. */
           {
-            char *newname = construct_relative (file, link->local_name);
+            char *newname = construct_relative (file, lc->local_name);
             char *quoted_newname = local_quote_string (newname,
-                                                       link->link_css_p);
+                                                       lr->flags & LR_CSS);
 
-            if (link->link_css_p || link->link_noquote_html_p)
-              p = replace_plain (p, link->size, fp, quoted_newname);
-            else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newname);
-            else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newname,
-                                             link->refresh_timeout);
+            p = replace_link (p, lr, fp, quoted_newname, quoted_newname);
 
             DEBUGP (("TO_RELATIVE: %s to %s at position %d in %s.\n",
-                     link->url->url, newname, link->pos, file));
+                     lr->url, newname, lr->pos, file));
 
             xfree (newname);
             xfree (quoted_newname);
@@ -326,19 +1136,14 @@ convert_links (const char *file, struct urlpos *links)
           }
         case CO_CONVERT_BASENAME_ONLY:
           {
-            char *newname = convert_basename (p, link);
-            char *quoted_newname = local_quote_string (newname, link->link_css_p);
+            char *newname = convert_basename (p, lr->size, lc->local_name);
+            char *quoted_newname = local_quote_string (newname,
+                                                       lr->flags & LR_CSS);
 
-            if (link->link_css_p || link->link_noquote_html_p)
-              p = replace_plain (p, link->size, fp, quoted_newname);
-            else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newname);
-            else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newname,
-                                             link->refresh_timeout);
+            p = replace_link (p, lr, fp, quoted_newname, quoted_newname);
 
             DEBUGP (("Converted file part only: %s to %s at position %d in %s.\n",
-                     link->url->url, newname, link->pos, file));
+                     lr->url, newname, lr->pos, file));
 
             xfree (newname);
             xfree (quoted_newname);
@@ -349,19 +1154,13 @@ convert_links (const char *file, struct urlpos *links)
         case CO_CONVERT_TO_COMPLETE:
           /* Convert the link to absolute URL. */
           {
-            char *newlink = link->url->url;
+            const char *newlink = lr->url;
             char *quoted_newlink = html_quote_string (newlink);
 
-            if (link->link_css_p || link->link_noquote_html_p)
-              p = replace_plain (p, link->size, fp, newlink);
-            else if (!link->link_refresh_p)
-              p = replace_attr (p, link->size, fp, quoted_newlink);
-            else
-              p = replace_attr_refresh_hack (p, link->size, fp, quoted_newlink,
-                                             link->refresh_timeout);
+            p = replace_link (p, lr, fp, quoted_newlink, newlink);
 
             DEBUGP (("TO_COMPLETE: <something> to %s at position %d in %s.\n",
-                     newlink, link->pos, file));
+                     newlink, lr->pos, file));
 
             xfree (quoted_newlink);
             ++to_url_count;
@@ -369,7 +1168,7 @@ convert_links (const char *file, struct urlpos *links)
           }
         case CO_NULLIFY_BASE:
           /* Change the base href to "". */
-          p = replace_attr (p, link->size, fp, "");
+          p = replace_attr (p, lr->size, fp, "");
           break;
         case CO_NOCONVERT:
           abort ();
@@ -382,8 +1181,11 @@ convert_links (const char *file, struct urlpos *links)
     fwrite (p, 1, fm->length - (p - fm->content), fp);
   fclose (fp);
   wget_read_file_free (fm);
+  xfree (conv);
 
-  logprintf (LOG_VERBOSE, "%d-%d\n", to_file_count, to_url_count);
+  job->converted = true;
+
+  job_log (job, LOG_VERBOSE, aprintf ("%d-%d\n", to_file_count, to_url_count));
 }
 
 /* Construct and return a link that points from BASEFILE to LINKFILE.
@@ -472,19 +1274,18 @@ construct_relative (const char *basefile, const char *linkfile)
    if
                      p = "//foo.com/bar.cgi?xyz"
    and
-      link->local_name = "docroot/foo.com/bar.cgi?xyz.css"
+      local_name = "docroot/foo.com/bar.cgi?xyz.css"
    then
 
-      new_construct_func(p, link);
+      convert_basename(p, size, local_name);
    will return
       "//foo.com/bar.cgi?xyz.css"
 
-   Essentially, we do s/$(basename orig_url)/$(basename link->local_name)/
+   Essentially, we do s/$(basename orig_url)/$(basename local_name)/
 */
 static char *
-convert_basename (const char *p, const struct urlpos *link)
+convert_basename (const char *p, int len, const char *local_name)
 {
-  int len = link->size;
   char *url = NULL;
   char *org_basename = NULL, *local_basename = NULL;
   char *result = NULL;
@@ -503,7 +1304,7 @@ convert_basename (const char *p, const struct urlpos *link)
   else
     org_basename = url;
 
-  local_basename = strrchr (link->local_name, '/');
+  local_basename = strrchr (local_name, '/');
   if (local_basename)
     local_basename++;
   else
@@ -529,7 +1330,8 @@ convert_basename (const char *p, const struct urlpos *link)
 static struct hash_table *converted_files;
 
 static void
-write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
+write_backup_file (struct convert_job *job,
+                   downloaded_file_t downloaded_file_return)
 {
   /* Rather than just writing over the original .html file with the
      converted version, save the former to *.orig.  Note we only do
@@ -538,6 +1340,7 @@ write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
      On VMS, use "_orig" instead of ".orig".  See "wget.h". */
 
   /* Construct the backup filename as the original name plus ".orig". */
+  const char    *file = job->file;
   size_t         filename_len = strlen (file);
   char*          filename_plus_orig_suffix;
 
@@ -563,6 +1366,7 @@ write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
       strcpy (filename_plus_orig_suffix + filename_len, ORIG_SFX);
     }
 
+  CONVERT_LOCK;
   if (!converted_files)
     converted_files = make_string_hash_table (0);
 
@@ -575,8 +1379,9 @@ write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
     {
       /* Rename <file> to <file>.orig before former gets written over. */
       if (rename (file, filename_plus_orig_suffix) != 0)
-        logprintf (LOG_NOTQUIET, _("Cannot back up %s as %s: %s\n"),
-                   file, filename_plus_orig_suffix, strerror (errno));
+        job_log (job, LOG_NOTQUIET,
+                 aprintf (_("Cannot back up %s as %s: %s\n"),
+                          file, filename_plus_orig_suffix, strerror (errno)));
 
       /* Remember that we've already written a .orig backup for this file.
          Note that we never free this memory since we need it till the
@@ -597,6 +1402,7 @@ write_backup_file (const char *file, downloaded_file_t downloaded_file_return)
       */
       string_set_add (converted_files, file);
     }
+  CONVERT_UNLOCK;
 }
 
 static bool find_fragment (const char *, int, const char **, const char **);
@@ -869,6 +1675,10 @@ register_download (const char *url, const char *file)
 
   ENSURE_TABLES_EXIST;
 
+  /* FILE has new contents, so the links recorded for it, if any, are
+     no longer valid.  */
+  forget_links (file);
+
   /* With some forms of retrieval, it is possible, although not likely
      or particularly desirable.  If both are downloaded, the second
      download will override the first one.  When that happens,
@@ -964,6 +1774,8 @@ register_delete_file (const char *file)
 
   ENSURE_TABLES_EXIST;
 
+  forget_links (file);
+
   if (!hash_table_get_pair (dl_file_url_map, file, &old_file, &old_url))
     return;
 
@@ -1017,6 +1829,37 @@ convert_cleanup (void)
   downloaded_files_free ();
   if (converted_files)
     string_set_free (converted_files);
+  if (file_links_map)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (file_links_map, &iter);
+           hash_table_iter_next (&iter);
+           )
+        {
+          xfree (iter.key);
+          file_links_free (iter.value);
+        }
+      hash_table_destroy (file_links_map);
+      file_links_map = NULL;
+    }
+  if (link_map)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (link_map, &iter);
+           hash_table_iter_next (&iter);
+           )
+        {
+          xfree (iter.key);
+          link_map_entry_free (iter.value);
+        }
+      hash_table_destroy (link_map);
+      link_map = NULL;
+    }
+  if (link_strings)
+    {
+      string_set_free (link_strings);
+      link_strings = NULL;
+    }
 }
 
 /* Book-keeping code for downloaded files that enables extension
@@ -1087,6 +1930,10 @@ downloaded_file (downloaded_file_t mode, const char *file)
       return *ptr;
     }
 
+  /* Only link conversion asks.  */
+  if (!opt.convert_links)
+    return FILE_NOT_ALREADY_DOWNLOADED;
+
   if (!downloaded_files_hash)
     downloaded_files_hash = make_string_hash_table (0);
 
@@ -84,6 +84,7 @@ struct urlpos {
   int pos, size;
 
   struct urlpos *next;              /* next list element */
+  struct arena *arena;              /* arena that owns the list */
 };
 
 /* downloaded_file() takes a parameter of this type and returns this type. */
@@ -107,6 +108,7 @@ void register_redirection (const char *, const char *);
 void register_html (const char *);
 void register_css (const char *);
 void register_delete_file (const char *);
+void register_links (const char *, const char *, const struct urlpos *);
 void convert_all_links (void);
 void convert_cleanup (void);
 
@@ -61,6 +61,12 @@ as that of the covered work.  */
 #include "http.h"               /* for http_atotm */
 #include "c-strcase.h"
 
+#ifdef TESTING
+#include <unistd.h>
+#include "init.h"               /* for home_dir */
+#include "test.h"
+#endif
+
 
 /* Declarations of `struct cookie' and the most basic functions. */
 
@@ -81,6 +87,15 @@ struct cookie_jar {
   struct hash_table *chains;
 
   int cookie_count;             /* number of cookies in the jar. */
+
+  /* Cookie headers already built for requests, see cookie_header.  */
+  struct hash_table *headers;
+
+  /* For --incremental-save: the file the jar was loaded from, the
+     number of lines read from it, and the cookies removed since.  */
+  char *file;
+  int records;
+  struct cookie *discarded;
 };
 
 /* Value set by entry point functions, so that the low-level
@@ -93,6 +108,10 @@ cookie_jar_new (void)
   struct cookie_jar *jar = xnew (struct cookie_jar);
   jar->chains = make_nocase_string_hash_table (0);
   jar->cookie_count = 0;
+  jar->headers = make_string_hash_table (0);
+  jar->file = NULL;
+  jar->records = 0;
+  jar->discarded = NULL;
   return jar;
 }
 
@@ -113,6 +132,8 @@ struct cookie {
 
   unsigned permanent :1;        /* whether the cookie should outlive
                                    the session. */
+  unsigned dirty :1;            /* whether the cookie was received
+                                   after the jar was loaded. */
   time_t expiry_time;           /* time when the cookie expires, 0
                                    means undetermined. */
 
@@ -161,6 +182,43 @@ delete_cookie (struct cookie *cookie)
   xfree (cookie);
 }
 
+/* A Cookie header built by cookie_header, kept for later requests to
+   the same directory.  */
+struct cached_header {
+  char *value;                  /* the header, NULL if no cookies
+                                   pertain to the requests. */
+  time_t valid_until;           /* the earliest expiry time among
+                                   the cookies in VALUE, 0 if none of
+                                   them expires. */
+};
+
+/* The most headers kept at once; the cache is emptied when it gets
+   that large, so that crawling a huge number of directories doesn't
+   make it grow without bounds.  */
+#define MAX_CACHED_HEADERS 1024
+
+/* Forget all the headers built so far.  Called whenever a cookie is
+   added to or removed from JAR.  */
+
+static void
+clear_header_cache (struct cookie_jar *jar)
+{
+  hash_table_iterator iter;
+
+  if (!hash_table_count (jar->headers))
+    return;
+  for (hash_table_iterate (jar->headers, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      struct cached_header *ch = iter.value;
+      xfree (iter.key);
+      xfree (ch->value);
+      xfree (ch);
+    }
+  hash_table_clear (jar->headers);
+}
+
 /* Functions for storing cookies.
 
    All cookies can be reached beginning with jar->chains.  The key in
@@ -215,6 +273,8 @@ store_cookie (struct cookie_jar *jar, struct cookie *cookie)
   struct cookie *chain_head;
   char *chain_key;
 
+  clear_header_cache (jar);
+
   if (hash_table_get_pair (jar->chains, cookie->domain,
                            &chain_key, &chain_head))
     {
@@ -240,7 +300,15 @@ store_cookie (struct cookie_jar *jar, struct cookie *cookie)
                  all we need to do is:  */
               cookie->next = victim->next;
             }
-          delete_cookie (victim);
+          if (victim->permanent && !cookie->permanent)
+            {
+              /* COOKIE might not be saved; record that VICTIM is gone
+                 in case the jar is saved incrementally.  */
+              victim->next = jar->discarded;
+              jar->discarded = victim;
+            }
+          else
+            delete_cookie (victim);
           --jar->cookie_count;
           DEBUGP (("Deleted old cookie (to be replaced.)\n"));
         }
@@ -293,6 +361,7 @@ discard_matching_cookie (struct cookie_jar *jar, struct cookie *cookie)
   victim = find_matching_cookie (jar, cookie, &prev);
   if (victim)
     {
+      clear_header_cache (jar);
       if (prev)
         /* Simply unchain the victim. */
         prev->next = victim->next;
@@ -321,7 +390,10 @@ discard_matching_cookie (struct cookie_jar *jar, struct cookie *cookie)
           else
             hash_table_put (jar->chains, chain_key, victim->next);
         }
-      delete_cookie (victim);
+      --jar->cookie_count;
+      /* Keep it for cookie_jar_save to record its removal.  */
+      victim->next = jar->discarded;
+      jar->discarded = victim;
       DEBUGP (("Discarded old cookie.\n"));
     }
 }
@@ -809,6 +881,7 @@ cookie_handle_set_cookie (struct cookie_jar *jar,
       goto out;
     }
 
+  cookie->dirty = 1;
   store_cookie (jar, cookie);
   return;
 
@@ -1036,15 +1109,19 @@ goodness_comparator (const void *p1, const void *p2)
   return dgdiff ? dgdiff : pgdiff;
 }
 
-/* Generate a `Cookie' header for a request that goes to HOST:PORT and
-   requests PATH from the server.  The resulting string is allocated
-   with `malloc', and the caller is responsible for freeing it.  If no
-   cookies pertain to this request, i.e. no cookie header should be
-   generated, NULL is returned.  */
+/* Build the `Cookie' header for a request that goes to HOST:PORT and
+   requests PATH from the server, as described at cookie_header.
 
-char *
-cookie_header (struct cookie_jar *jar, const char *host,
-               int port, const char *path, bool secflag)
+   The earliest expiry time among the cookies sent is stored to
+   VALID_UNTIL, or 0 if none of them expires.  PER_FILE is set if
+   cookies from the chains of HOST have paths that extend PATH's
+   directory, so that other requests to the directory might not get
+   the same header.  */
+
+static char *
+build_cookie_header (struct cookie_jar *jar, const char *host,
+                     int port, const char *path, bool secflag,
+                     time_t *valid_until, bool *per_file)
 {
   struct cookie **chains;
   int chain_count;
@@ -1054,7 +1131,10 @@ cookie_header (struct cookie_jar *jar, const char *host,
   size_t count, i, ocnt;
   char *result;
   int result_size, pos;
-  PREPEND_SLASH (path);         /* see cookie_handle_set_cookie */
+  size_t dirlen = strrchr (path, '/') + 1 - path;
+
+  *valid_until = 0;
+  *per_file = false;
 
   /* First, find the cookie chains whose domains match HOST. */
 
@@ -1068,8 +1148,6 @@ cookie_header (struct cookie_jar *jar, const char *host,
   if (chain_count <= 0)
     return NULL;
 
-  cookies_now = time (NULL);
-
   /* Now extract from the chains those cookies that match our host
      (for domain_exact cookies), port (for cookies with port other
      than PORT_ANY), etc.  See matching_cookie for details.  */
@@ -1078,8 +1156,13 @@ cookie_header (struct cookie_jar *jar, const char *host,
   count = 0;
   for (i = 0; i < (unsigned) chain_count; i++)
     for (cookie = chains[i]; cookie; cookie = cookie->next)
-      if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
-        ++count;
+      {
+        if (cookie_matches_url (cookie, host, port, path, secflag, NULL))
+          ++count;
+        if (strlen (cookie->path) > dirlen
+            && 0 == strncmp (cookie->path, path, dirlen))
+          *per_file = true;
+      }
   if (!count)
     return NULL;                /* no cookies matched */
 
@@ -1101,6 +1184,9 @@ cookie_header (struct cookie_jar *jar, const char *host,
         outgoing[ocnt].domain_goodness = strlen (cookie->domain);
         outgoing[ocnt].path_goodness   = pg;
         ++ocnt;
+        if (cookie->expiry_time
+            && (!*valid_until || cookie->expiry_time < *valid_until))
+          *valid_until = cookie->expiry_time;
       }
   assert (ocnt == count);
 
@@ -1151,6 +1237,67 @@ cookie_header (struct cookie_jar *jar, const char *host,
   return result;
 }
 
+/* Generate a `Cookie' header for a request that goes to HOST:PORT and
+   requests PATH from the server.  The resulting string is allocated
+   with `malloc', and the caller is responsible for freeing it.  If no
+   cookies pertain to this request, i.e. no cookie header should be
+   generated, NULL is returned.
+
+   Going through the cookies of every domain HOST belongs to, sorting
+   and serializing them, is repeated for each request of a recursive
+   download although the result hardly ever changes.  The header is
+   therefore kept per host, port and directory until the jar changes
+   or one of its cookies expires.  */
+
+char *
+cookie_header (struct cookie_jar *jar, const char *host,
+               int port, const char *path, bool secflag)
+{
+  struct cached_header *ch;
+  char *key, *old_key;
+  char *result;
+  time_t valid_until;
+  bool per_file;
+  PREPEND_SLASH (path);         /* see cookie_handle_set_cookie */
+
+  if (!hash_table_count (jar->chains))
+    return NULL;
+
+  cookies_now = time (NULL);
+
+  key = aprintf ("%s:%d%s%.*s", host, port, secflag ? "s" : "",
+                 (int) (strrchr (path, '/') + 1 - path), path);
+  if (hash_table_get_pair (jar->headers, key, &old_key, &ch))
+    {
+      if (!ch->valid_until || ch->valid_until >= cookies_now)
+        {
+          xfree (key);
+          return ch->value ? xstrdup (ch->value) : NULL;
+        }
+      /* Some of its cookies have expired since.  */
+      hash_table_remove (jar->headers, key);
+      xfree (old_key);
+      xfree (ch->value);
+      xfree (ch);
+    }
+
+  result = build_cookie_header (jar, host, port, path, secflag,
+                                &valid_until, &per_file);
+  if (per_file)
+    {
+      xfree (key);
+      return result;
+    }
+
+  if (hash_table_count (jar->headers) >= MAX_CACHED_HEADERS)
+    clear_header_cache (jar);
+  ch = xnew (struct cached_header);
+  ch->value = result ? xstrdup (result) : NULL;
+  ch->valid_until = valid_until;
+  hash_table_put (jar->headers, key, ch);
+  return result;
+}
+
 /* Support for loading and saving cookies.  The format used for
    loading and saving should be the format of the `cookies.txt' file
    used by Netscape and Mozilla, at least the Unix versions.
@@ -1212,22 +1359,18 @@ domain_port (const char *domain_b, const char *domain_e,
   ++p;                                          \
 } while (0)
 
-/* Load cookies from FILE.  */
+/* Read cookies from FP into JAR.  Lines are applied in order, so a
+   cookie replaces an earlier one with the same domain, port, path and
+   name, and an expired one removes it.  */
 
-void
-cookie_jar_load (struct cookie_jar *jar, const char *file)
+static void
+read_cookies (struct cookie_jar *jar, FILE *fp)
 {
   char *line = NULL;
   size_t bufsize = 0;
+  struct cookie *discarded = jar->discarded;
 
-  FILE *fp = fopen (file, "r");
-  if (!fp)
-    {
-      logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
-                 quote (file), strerror (errno));
-      return;
-    }
-
+  jar->discarded = NULL;
   cookies_now = time (NULL);
 
   while (getline (&line, &bufsize, fp) > 0)
@@ -1259,6 +1402,7 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
       GET_WORD (p, secure_b,  secure_e);
       GET_WORD (p, expires_b, expires_e);
       GET_WORD (p, name_b,    name_e);
+      ++jar->records;
 
       /* Don't use GET_WORD for value because it ends with newline,
          not TAB.  */
@@ -1311,7 +1455,12 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
       else
         {
           if (expiry < cookies_now)
-            goto abort_cookie;  /* ignore stale cookie. */
+            {
+              /* Ignore stale cookie, and forget an earlier one it
+                 was meant to remove.  */
+              discard_matching_cookie (jar, cookie);
+              goto abort_cookie;
+            }
           cookie->expiry_time = expiry;
           cookie->permanent = 1;
         }
@@ -1326,22 +1475,23 @@ cookie_jar_load (struct cookie_jar *jar, const char *file)
     }
 
   xfree(line);
-  fclose (fp);
+
+  /* The removals seen in FP needn't be recorded again.  */
+  while (jar->discarded)
+    {
+      struct cookie *next = jar->discarded->next;
+      delete_cookie (jar->discarded);
+      jar->discarded = next;
+    }
+  jar->discarded = discarded;
 }
 
-/* Save cookies, in format described above, to FILE. */
+/* Load cookies from FILE.  */
 
 void
-cookie_jar_save (struct cookie_jar *jar, const char *file)
+cookie_jar_load (struct cookie_jar *jar, const char *file)
 {
-  FILE *fp;
-  hash_table_iterator iter;
-
-  DEBUGP (("Saving cookies to %s.\n", file));
-
-  cookies_now = time (NULL);
-
-  fp = fopen (file, "w");
+  FILE *fp = fopen (file, "r");
   if (!fp)
     {
       logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
@@ -1349,6 +1499,39 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
       return;
     }
 
+  read_cookies (jar, fp);
+  fclose (fp);
+
+  if (!jar->file)
+    jar->file = xstrdup (file);
+}
+
+/* Write COOKIE, of the chain of DOMAIN, to FP as a line of the
+   format described above.  */
+
+static void
+write_cookie (FILE *fp, const char *domain, const struct cookie *cookie)
+{
+  if (!cookie->domain_exact)
+    fputc ('.', fp);
+  fputs (domain, fp);
+  if (cookie->port != PORT_ANY)
+    fprintf (fp, ":%d", cookie->port);
+  fprintf (fp, "\t%s\t%s\t%s\t%.0f\t%s\t%s\n",
+           cookie->domain_exact ? "FALSE" : "TRUE",
+           cookie->path, cookie->secure ? "TRUE" : "FALSE",
+           (double)cookie->expiry_time,
+           cookie->attr, cookie->value);
+}
+
+/* Write the cookies of JAR that are to be saved to FP.  */
+
+static void
+dump_cookies (FILE *fp, void *arg)
+{
+  struct cookie_jar *jar = arg;
+  hash_table_iterator iter;
+
   fputs ("# HTTP cookie file.\n", fp);
   fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (cookies_now));
   fputs ("# Edit at your own risk.\n\n", fp);
@@ -1365,21 +1548,123 @@ cookie_jar_save (struct cookie_jar *jar, const char *file)
             continue;
           if (cookie_expired_p (cookie))
             continue;
-          if (!cookie->domain_exact)
-            fputc ('.', fp);
-          fputs (domain, fp);
-          if (cookie->port != PORT_ANY)
-            fprintf (fp, ":%d", cookie->port);
-          fprintf (fp, "\t%s\t%s\t%s\t%.0f\t%s\t%s\n",
-                   cookie->domain_exact ? "FALSE" : "TRUE",
-                   cookie->path, cookie->secure ? "TRUE" : "FALSE",
-                   (double)cookie->expiry_time,
-                   cookie->attr, cookie->value);
+          write_cookie (fp, domain, cookie);
           if (ferror (fp))
-            goto out;
+            return;
         }
     }
- out:
+}
+
+/* Append the changes to JAR since it was loaded to FP, which is open
+   on the file it was loaded from: the cookies removed, written with
+   an expiry time in the past, and those received.  Returns the number
+   of lines written.  */
+
+static int
+append_cookies (struct cookie_jar *jar, FILE *fp)
+{
+  hash_table_iterator iter;
+  int count = 0;
+
+  while (jar->discarded)
+    {
+      struct cookie *c = jar->discarded;
+      jar->discarded = c->next;
+      if (c->permanent || opt.keep_session_cookies)
+        {
+          c->expiry_time = 1;
+          write_cookie (fp, c->domain, c);
+          ++count;
+        }
+      delete_cookie (c);
+    }
+
+  for (hash_table_iterate (jar->chains, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      const char *domain = iter.key;
+      struct cookie *cookie = iter.value;
+      for (; cookie; cookie = cookie->next)
+        {
+          if (!cookie->dirty)
+            continue;
+          cookie->dirty = 0;
+          if (!cookie->permanent && !opt.keep_session_cookies)
+            continue;
+          /* An expired cookie is written too, to remove the one it
+             may have replaced.  */
+          write_cookie (fp, domain, cookie);
+          ++count;
+        }
+    }
+  return count;
+}
+
+/* With --incremental-save, when the cookies are saved to the file
+   they were loaded from, only what changed is appended to it.  Once
+   the superseded lines outnumber the cookies, the file is rewritten
+   from what it holds, including the cookies appended by other Wget
+   processes meanwhile.  */
+
+static bool
+cookie_jar_save_incremental (struct cookie_jar *jar, const char *file)
+{
+  FILE *fp = journal_open (file);
+
+  if (!fp)
+    return false;
+
+  jar->records += append_cookies (jar, fp);
+  if (jar->records > 2 * jar->cookie_count + 64)
+    {
+      struct cookie_jar *current = cookie_jar_new ();
+
+      fflush (fp);
+      fseek (fp, 0, SEEK_SET);
+      read_cookies (current, fp);
+      if (journal_replace (file, dump_cookies, current))
+        jar->records = current->cookie_count;
+      cookie_jar_delete (current);
+    }
+
+  if (ferror (fp))
+    logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+               quote (file), strerror (errno));
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error closing %s: %s\n"),
+               quote (file), strerror (errno));
+  return true;
+}
+
+/* Save cookies, in format described above, to FILE. */
+
+void
+cookie_jar_save (struct cookie_jar *jar, const char *file)
+{
+  FILE *fp;
+
+  DEBUGP (("Saving cookies to %s.\n", file));
+
+  cookies_now = time (NULL);
+
+  if (opt.incremental_save && jar->file && !strcmp (jar->file, file)
+      && cookie_jar_save_incremental (jar, file))
+    {
+      DEBUGP (("Done saving cookies.\n"));
+      return;
+    }
+
+  fp = fopen (file, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open cookies file %s: %s\n"),
+                 quote (file), strerror (errno));
+      return;
+    }
+
+  dump_cookies (fp, jar);
+
   if (ferror (fp))
     logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
                quote (file), strerror (errno));
@@ -1410,6 +1695,15 @@ cookie_jar_delete (struct cookie_jar *jar)
         }
     }
   hash_table_destroy (jar->chains);
+  clear_header_cache (jar);
+  hash_table_destroy (jar->headers);
+  while (jar->discarded)
+    {
+      struct cookie *next = jar->discarded->next;
+      delete_cookie (jar->discarded);
+      jar->discarded = next;
+    }
+  xfree (jar->file);
   xfree (jar);
 }
 
@@ -1499,3 +1793,139 @@ test_cookies (void)
     }
 }
 #endif /* TEST_COOKIES */
+
+#ifdef TESTING
+
+/* Return the number of lines of FILE, or -1 if it can't be read or
+   its last line is unfinished.  */
+
+static int
+count_lines (const char *file)
+{
+  FILE *fp = fopen (file, "r");
+  int lines = 0, c, last = '\n';
+
+  if (!fp)
+    return -1;
+  while ((c = getc (fp)) != EOF)
+    {
+      if (c == '\n')
+        ++lines;
+      last = c;
+    }
+  fclose (fp);
+  return last == '\n' ? lines : -1;
+}
+
+/* Return whether the cookies JAR sends to http://HOST/ are EXPECTED.  */
+
+static bool
+header_is (struct cookie_jar *jar, const char *host, const char *expected)
+{
+  char *header = cookie_header (jar, host, 80, "", false);
+  bool ok = header ? expected && !strcmp (header, expected) : !expected;
+
+  xfree (header);
+  return ok;
+}
+
+const char *
+test_cookies_incremental_save (void)
+{
+  struct cookie_jar *jar, *copy;
+  bool saved_incremental = opt.incremental_save;
+  char *home = home_dir ();
+  char *file, *expected;
+  FILE *fp;
+  int i;
+
+  if (!home)
+    return NULL;
+  file = aprintf ("%s/.wget-cookies-testing", home);
+  xfree (home);
+  fp = fopen (file, "w");
+  if (!fp)
+    {
+      xfree (file);
+      return NULL;
+    }
+  /* The last line was left unfinished by a process that died.  */
+  fputs ("example.com\tFALSE\t/\tFALSE\t4102444800\tkeep\t1\n"
+         "example.com\tFALSE\t/\tFALSE\t4102444800\tgone\t1\n"
+         "example.org\tFALSE\t/\tFALSE\t4102444800\tother\t1\n"
+         "example.com\tFALSE\t/\tFALSE\t41024", fp);
+  fclose (fp);
+
+  opt.incremental_save = true;
+
+  jar = cookie_jar_new ();
+  cookie_jar_load (jar, file);
+  mu_assert ("the unfinished line should have been skipped",
+             jar->records == 3 && jar->cookie_count == 3);
+
+  /* Replace one cookie, remove one, and add one.  */
+  cookie_handle_set_cookie (jar, "example.com", 80, "", "keep=2; Max-Age=3600");
+  cookie_handle_set_cookie (jar, "example.com", 80, "", "gone=1; Max-Age=0");
+  cookie_handle_set_cookie (jar, "example.com", 80, "", "new=1; Max-Age=3600");
+  cookie_jar_save (jar, file);
+
+  mu_assert ("the unfinished line should have been dropped and three "
+             "records appended", count_lines (file) == 6);
+  mu_assert ("the discarded cookies should have been written",
+             jar->discarded == NULL && jar->records == 6);
+
+  /* Saving again without changes appends nothing.  */
+  cookie_jar_save (jar, file);
+  mu_assert ("only the dirty cookies should have been appended",
+             count_lines (file) == 6);
+
+  copy = cookie_jar_new ();
+  cookie_jar_load (copy, file);
+  mu_assert ("the changes should have been replayed",
+             copy->cookie_count == 3
+             && (header_is (copy, "example.com", "keep=2; new=1")
+                 || header_is (copy, "example.com", "new=1; keep=2"))
+             && header_is (copy, "example.org", "other=1"));
+  cookie_jar_delete (copy);
+
+  /* Another process appends a cookie, then changes pile up until the
+     file is rewritten from what it holds.  */
+  fp = fopen (file, "a");
+  fputs ("example.net\tFALSE\t/\tFALSE\t4102444800\tshared\t1\n", fp);
+  fclose (fp);
+  cookie_handle_set_cookie (jar, "example.com", 80, "", "new=1; Max-Age=0");
+  for (i = 0; i < 100; i++)
+    {
+      char *set_cookie = aprintf ("keep=%d; Max-Age=3600", i);
+      cookie_handle_set_cookie (jar, "example.com", 80, "", set_cookie);
+      xfree (set_cookie);
+      cookie_jar_save (jar, file);
+      if (count_lines (file) < 8 + i)
+        break;
+    }
+
+  /* The four lines of the dump_cookies header and one per cookie.  */
+  mu_assert ("the file should have been rewritten",
+             i < 100 && count_lines (file) == 7);
+  mu_assert ("the records should have been counted afresh",
+             jar->records == 3);
+
+  copy = cookie_jar_new ();
+  cookie_jar_load (copy, file);
+  expected = aprintf ("keep=%d", i);
+  mu_assert ("the rewritten file should hold the latest cookies",
+             copy->cookie_count == 3
+             && header_is (copy, "example.com", expected)
+             && header_is (copy, "example.org", "other=1")
+             && header_is (copy, "example.net", "shared=1"));
+  xfree (expected);
+  cookie_jar_delete (copy);
+
+  cookie_jar_delete (jar);
+  opt.incremental_save = saved_incremental;
+  unlink (file);
+  xfree (file);
+  return NULL;
+}
+
+#endif /* TESTING */
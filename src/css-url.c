@@ -53,6 +53,7 @@ as that of the covered work.  */
 #include "css-tokens.h"
 #include "css-url.h"
 #include "xstrndup.h"
+#include "arena.h"
 
 /* from lex.yy.c */
 extern char *yytext;
@@ -213,6 +214,7 @@ get_urls_css_file (const char *file, const char *url)
 
   ctx.text = fm->content;
   ctx.head = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
@@ -220,5 +222,7 @@ get_urls_css_file (const char *file, const char *url)
 
   get_urls_css (&ctx, 0, fm->length);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
@@ -49,15 +49,19 @@ as that of the covered work.  */
 /* Get the response of FTP server and allocate enough room to handle
    it.  <CR> and <LF> characters are stripped from the line, and the
    line is 0-terminated.  All the response lines but the last one are
-   skipped.  The last line is determined as described in RFC959.
+   skipped, unless BODY is non-NULL, in which case they are collected
+   into *BODY, each followed by a newline (*BODY is NULL if there were
+   none).  The last line is determined as described in RFC959.
 
    If the line is successfully read, FTPOK is returned, and *ret_line
    is assigned a freshly allocated line.  Otherwise, FTPRERR is
    returned, and the value of *ret_line should be ignored.  */
 
-uerr_t
-ftp_response (int fd, char **ret_line)
+static uerr_t
+ftp_response_full (int fd, char **ret_line, char **body)
 {
+  if (body)
+    *body = NULL;
   while (1)
     {
       char *p;
@@ -86,10 +90,26 @@ ftp_response (int fd, char **ret_line)
           *ret_line = line;
           return FTPOK;
         }
+      if (body)
+        {
+          char *old = *body;
+          *body = old ? concat_strings (old, line, "\n", (char *) 0)
+                      : concat_strings (line, "\n", (char *) 0);
+          xfree (old);
+        }
       xfree (line);
     }
 }
 
+/* Get the response of FTP server, skipping all the lines but the
+   last one.  See ftp_response_full for details.  */
+
+uerr_t
+ftp_response (int fd, char **ret_line)
+{
+  return ftp_response_full (fd, ret_line, NULL);
+}
+
 /* Returns the malloc-ed FTP request, ending with <CR><LF>, printing
    it if printing is required.  If VALUE is NULL, just use
    command<CR><LF>.  */
@@ -160,6 +180,11 @@ ftp_login (int csock, const char *acc, const char *pass)
   uerr_t err;
   char *request, *respline;
   int nwritten;
+#ifdef ENABLE_OPIE
+  /* Not static, as worker threads of an FTP pool log in at the same
+     time as the main thread.  */
+  char skey[SKEY_RESPONSE_SIZE];
+#endif
 
   /* Send USER username.  */
   request = ftp_request ("USER", acc);
@@ -220,7 +245,7 @@ ftp_login (int csock, const char *acc, const char *pass)
           }
         /* Replace the password with the SKEY response to the
            challenge.  */
-        pass = skey_response (skey_sequence, seed, pass);
+        pass = skey_response (skey_sequence, seed, pass, skey);
       }
   }
 #endif /* ENABLE_OPIE */
@@ -1141,6 +1166,156 @@ ftp_list (int csock, const char *file, bool avoid_list_a, bool avoid_list,
   return err;
 }
 
+/* Sends the MLSD command to the server.  FILE is the directory to
+   list; if NULL, the current working directory is listed.  */
+uerr_t
+ftp_mlsd (int csock, const char *file)
+{
+  char *request, *respline;
+  int nwritten;
+  uerr_t err;
+
+  /* Send MLSD request.  */
+  request = ftp_request ("MLSD", file);
+  nwritten = fd_write (csock, request, strlen (request), -1);
+  if (nwritten < 0)
+    {
+      xfree (request);
+      return WRITEFAILED;
+    }
+  xfree (request);
+  /* Get appropriate response.  */
+  err = ftp_response (csock, &respline);
+  if (err != FTPOK)
+    return err;
+  if (*respline == '5')
+    {
+      xfree (respline);
+      return FTPNSFOD;
+    }
+  if (*respline != '1')
+    {
+      xfree (respline);
+      return FTPRERR;
+    }
+  xfree (respline);
+  /* All OK.  */
+  return FTPOK;
+}
+
+/* Sends the MLST command to the server, and sets *TSTAMP to the
+   modification time it reports for FILE, or to -1 if it reports
+   none.  Returns FTPNSFOD if the server refuses the command.  */
+uerr_t
+ftp_mlst (int csock, const char *file, long *tstamp)
+{
+  char *request, *respline, *facts, *line, *next;
+  int nwritten;
+  uerr_t err;
+
+  *tstamp = -1;
+
+  /* Send MLST request.  */
+  request = ftp_request ("MLST", file);
+  nwritten = fd_write (csock, request, strlen (request), -1);
+  if (nwritten < 0)
+    {
+      xfree (request);
+      return WRITEFAILED;
+    }
+  xfree (request);
+
+  /* Get appropriate response.  The facts are sent on a line of their
+     own, beginning with a space, within a multi-line reply.  */
+  err = ftp_response_full (csock, &respline, &facts);
+  if (err != FTPOK)
+    return err;
+  if (*respline == '5')
+    {
+      xfree (facts);
+      xfree (respline);
+      return FTPNSFOD;
+    }
+  if (*respline != '2')
+    {
+      xfree (facts);
+      xfree (respline);
+      return FTPRERR;
+    }
+  xfree (respline);
+
+  for (line = facts; line && *line; line = next)
+    {
+      next = strchr (line, '\n');
+      *next++ = '\0';
+      if (*line == ' ')
+        {
+          struct fileinfo *f = ftp_parse_mlst (line + 1);
+          if (f)
+            {
+              *tstamp = f->tstamp;
+              freefileinfo (f);
+            }
+        }
+    }
+  xfree (facts);
+  /* All OK.  */
+  return FTPOK;
+}
+
+/* Sends the FEAT command to the server (RFC 2389) and sets *MLST to
+   whether the server announced the MLST feature, and thereby the
+   MLSD command of RFC 3659.  Servers that don't know FEAT reply with
+   an error, which is reported as FTPSRVERR.  */
+uerr_t
+ftp_feat (int csock, bool *mlst)
+{
+  char *request, *respline, *features, *line, *next;
+  int nwritten;
+  uerr_t err;
+
+  *mlst = false;
+
+  /* Send FEAT request.  */
+  request = ftp_request ("FEAT", NULL);
+  nwritten = fd_write (csock, request, strlen (request), -1);
+  if (nwritten < 0)
+    {
+      xfree (request);
+      return WRITEFAILED;
+    }
+  xfree (request);
+
+  /* Get appropriate response.  The features are listed one per line
+     between the first and the last line of a multi-line reply.  */
+  err = ftp_response_full (csock, &respline, &features);
+  if (err != FTPOK)
+    return err;
+  if (*respline != '2')
+    {
+      xfree (features);
+      xfree (respline);
+      return FTPSRVERR;
+    }
+  xfree (respline);
+
+  for (line = features; line && *line; line = next)
+    {
+      next = strchr (line, '\n');
+      *next++ = '\0';
+      /* Feature lines begin with a space; MLST is followed by the
+         list of supported facts.  */
+      while (*line == ' ')
+        ++line;
+      if (!c_strncasecmp (line, "MLST", 4)
+          && (line[4] == '\0' || line[4] == ' '))
+        *mlst = true;
+    }
+  xfree (features);
+  /* All OK.  */
+  return FTPOK;
+}
+
 /* Sends the SYST command to the server. */
 uerr_t
 ftp_syst (int csock, enum stype *server_type, enum ustype *unix_type)
@@ -0,0 +1,341 @@
+/* Persistent cache of FTP directory listings.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --ftp-listing-cache, the parsed listing of every directory is
+   kept along with the modification time the server reported for the
+   directory when it was listed.  A later run asks the server for that
+   time again with MLST, which takes a single command on the control
+   connection, and reuses the cached listing if it hasn't changed,
+   saving the data connection and the transfer of the listing.
+
+   The cache is a text file holding, for every directory, a line with
+   its time-stamp and URL, followed by its entries in the format of
+   MLSD, each indented by a space:
+
+     1429176373 ftp://anonymous@ftp.example.com:21/pub
+      type=file;size=1024;modify=20150416092613;unix.mode=0644; README
+      type=dir;size=0;modify=20150410120000; incoming
+
+   so that they are read back by the same parser as MLSD listings.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "hash.h"
+#include "ftp.h"
+
+/* The listing of a directory, and the modification time of the
+   directory when it was listed.  */
+struct cached_listing
+{
+  long tstamp;
+  struct fileinfo *files;
+};
+
+/* Maps directory URLs to their cached_listing.  */
+static struct hash_table *listing_cache;
+
+/* Whether the cache has to be written back.  */
+static bool listing_cache_changed;
+
+/* Returns a copy of the list of files F.  */
+static struct fileinfo *
+copy_fileinfo (const struct fileinfo *f)
+{
+  struct fileinfo *head = NULL, *tail = NULL;
+
+  for (; f; f = f->next)
+    {
+      struct fileinfo *c = xnew (struct fileinfo);
+      memcpy (c, f, sizeof (*c));
+      c->name = xstrdup (f->name);
+      c->linkto = f->linkto ? xstrdup (f->linkto) : NULL;
+      c->prev = tail;
+      c->next = NULL;
+      if (tail)
+        tail->next = c;
+      else
+        head = c;
+      tail = c;
+    }
+  return head;
+}
+
+/* Stores FILES, the listing of URL, replacing any previous one.  Takes
+   ownership of FILES.  */
+static void
+store_listing (const char *url, long tstamp, struct fileinfo *files)
+{
+  struct cached_listing *cl;
+  char *old_url;
+
+  if (hash_table_get_pair (listing_cache, url, &old_url, &cl))
+    freefileinfo (cl->files);
+  else
+    {
+      cl = xnew (struct cached_listing);
+      hash_table_put (listing_cache, xstrdup (url), cl);
+    }
+  cl->tstamp = tstamp;
+  cl->files = files;
+}
+
+/* Reads the cache from FILE.  A missing file is an empty cache.  */
+static void
+load_listing_cache (const char *file)
+{
+  FILE *fp;
+  char *line = NULL, *url = NULL;
+  size_t bufsize = 0;
+  ssize_t len;
+  long tstamp = -1;
+  struct fileinfo *head = NULL, *tail = NULL;
+  int count = 0;
+
+  fp = fopen (file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open FTP listing cache %s: %s\n"),
+                   quote (file), strerror (errno));
+      return;
+    }
+
+  while ((len = getline (&line, &bufsize, fp)) > 0)
+    {
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+      if (!*line || *line == '#')
+        continue;
+      if (*line == ' ')
+        {
+          struct fileinfo *f;
+          if (!url)
+            continue;
+          f = ftp_parse_mlsd (line + 1);
+          if (!f)
+            continue;
+          f->prev = tail;
+          if (tail)
+            tail->next = f;
+          else
+            head = f;
+          tail = f;
+        }
+      else
+        {
+          char *end;
+          if (url)
+            {
+              store_listing (url, tstamp, head);
+              xfree (url);
+              ++count;
+            }
+          head = tail = NULL;
+          tstamp = strtol (line, &end, 10);
+          if (end == line || *end != ' ')
+            continue;
+          url = xstrdup (end + 1);
+        }
+    }
+  if (url)
+    {
+      store_listing (url, tstamp, head);
+      xfree (url);
+      ++count;
+    }
+
+  xfree (line);
+  fclose (fp);
+  DEBUGP (("Loaded %d cached FTP listings from %s.\n", count, file));
+}
+
+/* Makes sure the cache has been read, if there is one.  */
+static bool
+listing_cache_init (void)
+{
+  if (!opt.ftp_listing_cache)
+    return false;
+  if (!listing_cache)
+    {
+      listing_cache = make_string_hash_table (0);
+      load_listing_cache (opt.ftp_listing_cache);
+    }
+  return true;
+}
+
+/* If the listing of the directory URL has been cached while the
+   directory had the modification time TSTAMP, store a copy of it in
+   *FILES and return true.  */
+bool
+ftp_cache_get (const char *url, long tstamp, struct fileinfo **files)
+{
+  struct cached_listing *cl;
+
+  if (!listing_cache_init ())
+    return false;
+  cl = hash_table_get (listing_cache, url);
+  if (!cl || cl->tstamp != tstamp)
+    return false;
+  *files = copy_fileinfo (cl->files);
+  return true;
+}
+
+/* Remember FILES as the listing of the directory URL, whose
+   modification time was TSTAMP before it was listed.  */
+void
+ftp_cache_put (const char *url, long tstamp, const struct fileinfo *files)
+{
+  if (!listing_cache_init ())
+    return;
+  store_listing (url, tstamp, copy_fileinfo (files));
+  listing_cache_changed = true;
+}
+
+/* Writes F as an indented line of MLSD facts to FP.  */
+static void
+write_entry (FILE *fp, const struct fileinfo *f)
+{
+  switch (f->type)
+    {
+    case FT_PLAINFILE:
+      fputs (" type=file", fp);
+      break;
+    case FT_DIRECTORY:
+      fputs (" type=dir", fp);
+      break;
+    case FT_SYMLINK:
+      if (!f->linkto)
+        return;
+      fprintf (fp, " type=OS.unix=slink:%s", f->linkto);
+      break;
+    default:
+      return;
+    }
+  fprintf (fp, ";size=%s", number_to_static_string (f->size));
+  if (f->tstamp != -1)
+    {
+      time_t t = f->tstamp;
+      char buf[32];
+      strftime (buf, sizeof (buf), "%Y%m%d%H%M%S", gmtime (&t));
+      fprintf (fp, ";modify=%s", buf);
+    }
+  if (f->perms)
+    fprintf (fp, ";unix.mode=0%o", (unsigned) f->perms);
+  fprintf (fp, "; %s\n", f->name);
+}
+
+/* Writes the cache back to the file it was read from, if it has
+   changed.  The cache is written to a temporary file which replaces
+   the old one when it is complete, so that a failed write doesn't
+   leave a truncated cache behind.  */
+void
+ftp_cache_save (void)
+{
+  const char *file = opt.ftp_listing_cache;
+  char *tmp;
+  hash_table_iterator iter;
+  FILE *fp;
+  bool ok;
+
+  if (!listing_cache || !listing_cache_changed)
+    return;
+
+  DEBUGP (("Saving FTP listings to %s.\n", file));
+  tmp = aprintf ("%s.tmp", file);
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot open FTP listing cache %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      xfree (tmp);
+      return;
+    }
+
+  fputs ("# FTP listing cache.\n", fp);
+  fprintf (fp, "# Generated by Wget on %s.\n", datetime_str (time (NULL)));
+  fputs ("# Edit at your own risk.\n\n", fp);
+
+  for (hash_table_iterate (listing_cache, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      const char *url = iter.key;
+      struct cached_listing *cl = iter.value;
+      const struct fileinfo *f;
+
+      fprintf (fp, "%ld %s\n", cl->tstamp, url);
+      for (f = cl->files; f; f = f->next)
+        write_entry (fp, f);
+      if (ferror (fp))
+        break;
+    }
+
+  ok = !ferror (fp);
+  if (fclose (fp) != 0)
+    ok = false;
+  if (!ok || rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing to %s: %s\n"),
+                 quote (file), strerror (errno));
+      unlink (tmp);
+    }
+  else
+    listing_cache_changed = false;
+  xfree (tmp);
+}
+
+/* Frees the cache.  */
+void
+ftp_cache_cleanup (void)
+{
+  hash_table_iterator iter;
+
+  if (!listing_cache)
+    return;
+  for (hash_table_iterate (listing_cache, &iter);
+       hash_table_iter_next (&iter);
+       )
+    {
+      struct cached_listing *cl = iter.value;
+      xfree (iter.key);
+      freefileinfo (cl->files);
+      xfree (cl);
+    }
+  hash_table_destroy (listing_cache);
+  listing_cache = NULL;
+  listing_cache_changed = false;
+}
@@ -44,6 +44,10 @@ as that of the covered work.  */
 #include "retr.h"               /* for output_stream */
 #include "c-strcase.h"
 
+#ifdef TESTING
+#include "test.h"
+#endif
+
 /* Converts symbolic permissions to number-style ones, e.g. string
    rwxr-xr-x to 755.  For now, it knows nothing of
    setuid/setgid/sticky.  ACLs are ignored.  */
@@ -1010,6 +1014,134 @@ ftp_parse_vms_ls (const char *file)
 }
 
 
+/* Parses LINE, one line of an MLSD listing (RFC 3659, section 7), such
+   as
+
+     type=file;size=1024;modify=20150416092613;unix.mode=0644; README
+
+   into a newly allocated fileinfo.  Unlike the LIST parsers above,
+   this doesn't depend on the system type, and the time-stamp is exact
+   and in UTC.  Returns NULL for the "." and ".." entries, for symbolic
+   links whose target isn't given, and for lines that can't be parsed.
+   The trailing <CR><LF> must have been stripped from LINE.
+
+   If MLST is true, LINE is instead the fact line of a reply to MLST,
+   which describes the given path itself: a directory is then accepted
+   whatever its name, even when typed as "cdir".  */
+
+static struct fileinfo *
+parse_mlsx (const char *line, bool mlst)
+{
+  struct fileinfo cur, *f;
+  char *facts, *fact, *next, *name, *value;
+  bool have_type = false, skip = false;
+
+  facts = xstrdup (line);
+  /* The facts are separated from the name by a single space; the name
+     itself may contain spaces and semicolons.  */
+  name = strchr (facts, ' ');
+  if (!name || !name[1])
+    {
+      DEBUGP (("Bad MLSD line: %s\n", line));
+      xfree (facts);
+      return NULL;
+    }
+  *name++ = '\0';
+
+  memset (&cur, 0, sizeof (cur));
+  cur.tstamp = -1;
+  cur.ptype = TT_HOUR_MIN;
+
+  for (fact = facts; *fact; fact = next)
+    {
+      next = strchr (fact, ';');
+      if (next)
+        *next++ = '\0';
+      else
+        next = fact + strlen (fact);
+      value = strchr (fact, '=');
+      if (!value)
+        continue;
+      *value++ = '\0';
+
+      if (!c_strcasecmp (fact, "type"))
+        {
+          have_type = true;
+          if (!c_strcasecmp (value, "file"))
+            cur.type = FT_PLAINFILE;
+          else if (!c_strcasecmp (value, "dir")
+                   || (mlst && !c_strcasecmp (value, "cdir")))
+            cur.type = FT_DIRECTORY;
+          else if (!c_strncasecmp (value, "OS.unix=slink", 13))
+            {
+              /* "OS.unix=slink:TARGET", as sent by ProFTPD.  */
+              cur.type = FT_SYMLINK;
+              if (value[13] == ':' && value[14])
+                cur.linkto = xstrdup (value + 14);
+            }
+          else if (!c_strcasecmp (value, "OS.unix=symlink"))
+            cur.type = FT_SYMLINK;
+          else
+            /* "cdir" and "pdir" are the listed directory and its
+               parent; anything else is of no use to us.  */
+            skip = true;
+        }
+      else if (!c_strcasecmp (fact, "size"))
+        cur.size = str_to_wgint (value, NULL, 10);
+      else if (!c_strcasecmp (fact, "modify"))
+        {
+          /* YYYYMMDDHHMMSS[.sss], always in UTC.  */
+          struct tm t;
+          memset (&t, 0, sizeof (t));
+          if (sscanf (value, "%4d%2d%2d%2d%2d%2d", &t.tm_year, &t.tm_mon,
+                      &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) == 6)
+            {
+              t.tm_year -= 1900;
+              t.tm_mon -= 1;
+              cur.tstamp = timegm (&t);
+            }
+        }
+      else if (!c_strcasecmp (fact, "unix.mode"))
+        cur.perms = strtol (value, NULL, 8) & 0777;
+    }
+
+  if (!mlst && (!strcmp (name, ".") || !strcmp (name, "..")))
+    skip = true;
+  if (!have_type || (cur.type == FT_SYMLINK && !cur.linkto))
+    skip = true;
+
+  DEBUGP (("%s\n", name));
+  if (skip)
+    {
+      DEBUGP (("Skipping.\n"));
+      xfree (cur.linkto);
+      xfree (facts);
+      return NULL;
+    }
+
+  cur.name = xstrdup (name);
+  xfree (facts);
+  f = xnew (struct fileinfo);
+  memcpy (f, &cur, sizeof (cur));
+  return f;
+}
+
+/* Parses one line of an MLSD listing; see parse_mlsx.  */
+
+struct fileinfo *
+ftp_parse_mlsd (const char *line)
+{
+  return parse_mlsx (line, false);
+}
+
+/* Parses the fact line of a reply to MLST; see parse_mlsx.  */
+
+struct fileinfo *
+ftp_parse_mlst (const char *line)
+{
+  return parse_mlsx (line, true);
+}
+
 /* This function switches between the correct parsing routine depending on
    the SYSTEM_TYPE. The system type should be based on the result of the
    "SYST" response of the FTP server. According to this repsonse we will
@@ -1179,3 +1311,61 @@ ftp_index (const char *file, struct url *u, struct fileinfo *f)
     fflush (fp);
   return FTPOK;
 }
+
+#ifdef TESTING
+
+const char *
+test_ftp_parse_mlsd (void)
+{
+  struct fileinfo *f;
+
+  f = ftp_parse_mlsd ("type=file;size=1024;modify=20150416092613;"
+                      "UNIX.mode=0644; read me;txt");
+  mu_assert ("test_ftp_parse_mlsd: file not parsed", f != NULL);
+  mu_assert ("test_ftp_parse_mlsd: wrong type", f->type == FT_PLAINFILE);
+  mu_assert ("test_ftp_parse_mlsd: wrong name",
+             strcmp (f->name, "read me;txt") == 0);
+  mu_assert ("test_ftp_parse_mlsd: wrong size", f->size == 1024);
+  mu_assert ("test_ftp_parse_mlsd: wrong time-stamp",
+             f->tstamp == 1429176373);
+  mu_assert ("test_ftp_parse_mlsd: wrong permissions", f->perms == 0644);
+  xfree (f->name);
+  xfree (f);
+
+  f = ftp_parse_mlsd ("Type=dir;Modify=20150416092613.123; pub");
+  mu_assert ("test_ftp_parse_mlsd: directory not parsed",
+             f != NULL && f->type == FT_DIRECTORY);
+  mu_assert ("test_ftp_parse_mlsd: fractional seconds",
+             f->tstamp == 1429176373);
+  xfree (f->name);
+  xfree (f);
+
+  f = ftp_parse_mlsd ("type=OS.unix=slink:/pub/README;size=10; link");
+  mu_assert ("test_ftp_parse_mlsd: symlink not parsed",
+             f != NULL && f->type == FT_SYMLINK
+             && strcmp (f->linkto, "/pub/README") == 0
+             && f->tstamp == -1);
+  xfree (f->linkto);
+  xfree (f->name);
+  xfree (f);
+
+  mu_assert ("test_ftp_parse_mlsd: cdir not skipped",
+             ftp_parse_mlsd ("type=cdir;modify=20150416092613; .") == NULL);
+  mu_assert ("test_ftp_parse_mlsd: pdir not skipped",
+             ftp_parse_mlsd ("type=pdir; ..") == NULL);
+  mu_assert ("test_ftp_parse_mlsd: untyped entry not skipped",
+             ftp_parse_mlsd ("size=10; foo") == NULL);
+  mu_assert ("test_ftp_parse_mlsd: missing name not detected",
+             ftp_parse_mlsd ("type=file;size=10;") == NULL);
+
+  f = ftp_parse_mlst ("type=cdir;modify=20150416092613; /pub");
+  mu_assert ("test_ftp_parse_mlsd: MLST directory not parsed",
+             f != NULL && f->type == FT_DIRECTORY
+             && f->tstamp == 1429176373);
+  xfree (f->name);
+  xfree (f);
+
+  return NULL;
+}
+
+#endif /* TESTING */
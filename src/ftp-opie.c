@@ -2182,20 +2182,16 @@ btoe (char *store, const unsigned char *c)
      password.)
 
    + Convert the resulting 64-bit key to 6 English words separated by
-     spaces (see btoe for details) and return the resulting ASCII
-     string.
+     spaces (see btoe for details), and store the resulting ASCII
+     string to ENGLISH, of SKEY_RESPONSE_SIZE bytes, which is returned.
 
    All this is described in section 6 of rfc2289 in more detail.  */
 
 const char *
-skey_response (int sequence, const char *seed, const char *pass)
+skey_response (int sequence, const char *seed, const char *pass,
+               char *english)
 {
   unsigned char key[8];
-
-  /* Room to hold 6 four-letter words (heh), 5 space separators, and
-     the terminating \0.  24+5+1 == 30  */
-  static char english[30];
-
   struct md5_ctx ctx;
   uint32_t checksum[4];
 
@@ -39,6 +39,10 @@ as that of the covered work.  */
 #include <assert.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "utils.h"
 #include "url.h"
@@ -52,6 +56,7 @@ as that of the covered work.  */
 #include "recur.h"              /* for INFINITE_RECURSION */
 #include "warc.h"
 #include "c-strcase.h"
+#include "ptimer.h"
 #ifdef ENABLE_XATTR
 #include "xattr.h"
 #endif
@@ -68,6 +73,14 @@ as that of the covered work.  */
 #define LIST_FILENAME ".listing"
 #endif
 
+/* A connection to the server besides the main one, over which files
+   are retrieved in parallel when --ftp-connections is given.  */
+struct ftp_session
+{
+  int csock;                    /* control connection socket, or -1 */
+  char *dir;                    /* current directory, NULL if unknown */
+};
+
 typedef struct
 {
   int st;                       /* connection status */
@@ -79,6 +92,10 @@ typedef struct
   char *id;                     /* initial directory */
   char *target;                 /* target file name */
   struct url *proxy;            /* FTWK-style proxy */
+  struct ftp_session *sessions; /* the opt.ftp_connections - 1
+                                   additional connections, or NULL */
+  bool use_mlsd;                /* server announced MLST in FEAT */
+  struct fileinfo *listing;     /* the parsed MLSD listing */
 } ccon;
 
 
@@ -273,7 +290,7 @@ init_control_ssl_connection (int csock, struct url *u, bool *using_control_secur
     logputs (LOG_VERBOSE, "==> AUTH TLS ... ");
   if (opt.ftps_implicit || ftp_auth (csock, SCHEME_FTPS) == FTPOK)
     {
-      if (!ssl_connect_wget (csock, u->host, NULL))
+      if (!ssl_connect_wget (csock, u->host, NULL, false))
         {
           fd_close (csock);
           return CONSSLERR;
@@ -313,6 +330,131 @@ init_control_ssl_connection (int csock, struct url *u, bool *using_control_secur
 }
 #endif
 
+/* Find the user name and the password to log in to the server of U
+   with, in order of priority.  */
+static void
+ftp_credentials (struct url *u, const char **user, const char **passwd)
+{
+  /* Find the username with priority */
+  if (u->user)
+    *user = u->user;
+  else if (opt.user && (opt.use_askpass || opt.ask_passwd))
+    *user = opt.user;
+  else if (opt.ftp_user)
+    *user = opt.ftp_user;
+  else if (opt.user)
+    *user = opt.user;
+  else
+    *user = NULL;
+
+  /* Find the password with priority */
+  if (u->passwd)
+    *passwd = u->passwd;
+  else if (opt.passwd && (opt.use_askpass || opt.ask_passwd))
+    *passwd = opt.passwd;
+  else if (opt.ftp_passwd)
+    *passwd = opt.ftp_passwd;
+  else if (opt.passwd)
+    *passwd = opt.passwd;
+  else
+    *passwd = NULL;
+
+  /* Check for ~/.netrc if none of the above match */
+  if (opt.netrc && (!*user || !*passwd))
+    search_netrc (u->host, user, passwd, 1);
+
+  if (!*user) *user = "anonymous";
+  if (!*passwd) *passwd = "-wget@";
+}
+
+/* Handles one line of an MLSD listing: prints it if the server
+   response is being shown, and appends its entry to CON->listing,
+   whose last element is *TAIL.  */
+static void
+ftp_mlsd_line (ccon *con, struct fileinfo **tail, char *line, char *end)
+{
+  struct fileinfo *f;
+
+  if (end > line && end[-1] == '\r')
+    --end;
+  *end = '\0';
+  if (!*line)
+    return;
+  if (opt.server_response)
+    logprintf (LOG_ALWAYS, "%s\n",
+               quotearg_style (escape_quoting_style, line));
+  f = ftp_parse_mlsd (line);
+  if (!f)
+    return;
+  f->prev = *tail;
+  f->next = NULL;
+  if (*tail)
+    (*tail)->next = f;
+  else
+    con->listing = f;
+  *tail = f;
+}
+
+/* Reads an MLSD listing from the data connection FD, parsing it into
+   CON->listing line by line as it arrives, so that it never needs to
+   be written out and read back.  If FP is non-NULL, the listing is
+   also written there.  The return value and *QTYREAD, *QTYWRITTEN and
+   *ELAPSED are as with fd_read_body.  */
+static int
+ftp_read_mlsd (int fd, FILE *fp, ccon *con, wgint *qtyread,
+               wgint *qtywritten, double *elapsed)
+{
+  size_t size = 16384, have = 0;
+  char *buf = xmalloc (size);
+  char *line, *eol;
+  struct fileinfo *tail = NULL;
+  struct ptimer *timer = ptimer_new ();
+  int res;
+
+  freefileinfo (con->listing);
+  con->listing = NULL;
+  while (1)
+    {
+      /* A line longer than the buffer: make room for the rest.  */
+      if (have == size)
+        {
+          size <<= 1;
+          buf = xrealloc (buf, size);
+        }
+      res = fd_read (fd, buf + have, size - have, -1);
+      if (res <= 0)
+        break;
+      if (fp && fwrite (buf + have, 1, res, fp) < (size_t) res)
+        {
+          res = -2;
+          break;
+        }
+      *qtyread += res;
+      *qtywritten += res;
+      have += res;
+
+      line = buf;
+      while ((eol = memchr (line, '\n', have - (line - buf))) != NULL)
+        {
+          ftp_mlsd_line (con, &tail, line, eol);
+          line = eol + 1;
+        }
+      have -= line - buf;
+      memmove (buf, line, have);
+    }
+  /* The last line may lack its terminator.  */
+  if (res == 0 && have)
+    {
+      if (have == size)
+        buf = xrealloc (buf, ++size);
+      ftp_mlsd_line (con, &tail, buf, buf + have);
+    }
+  *elapsed = ptimer_measure (timer);
+  ptimer_destroy (timer);
+  xfree (buf);
+  return res;
+}
+
 /* Retrieves a file with denoted parameters through opening an FTP
    connection to the server.  It always closes the data connection,
    and closes the control connection in case of error.  If warc_tmp
@@ -337,6 +479,7 @@ getftp (struct url *u, struct url *original_url,
   char type_char;
   bool try_again;
   bool list_a_used = false;
+  bool mlsd_used = false;
 #ifdef HAVE_SSL
   enum prot_level prot = (opt.ftps_clear_data_connection ? PROT_CLEAR : PROT_PRIVATE);
   /* these variables tell whether the target server
@@ -359,36 +502,7 @@ getftp (struct url *u, struct url *original_url,
 
   *qtyread = restval;
 
-  /* Find the username with priority */
-  if (u->user)
-    user = u->user;
-  else if (opt.user && (opt.use_askpass || opt.ask_passwd))
-    user = opt.user;
-  else if (opt.ftp_user)
-    user = opt.ftp_user;
-  else if (opt.user)
-    user = opt.user;
-  else
-    user = NULL;
-
-  /* Find the password with priority */
-  if (u->passwd)
-    passwd = u->passwd;
-  else if (opt.passwd && (opt.use_askpass || opt.ask_passwd))
-    passwd = opt.passwd;
-  else if (opt.ftp_passwd)
-    passwd = opt.ftp_passwd;
-  else if (opt.passwd)
-    passwd = opt.passwd;
-  else
-    passwd = NULL;
-
-  /* Check for ~/.netrc if none of the above match */
-  if (opt.netrc && (!user || !passwd))
-    search_netrc (u->host, (const char **) &user, (const char **) &passwd, 1);
-
-  if (!user) user = "anonymous";
-  if (!passwd) passwd = "-wget@";
+  ftp_credentials (u, &user, &passwd);
 
   dtsock = -1;
   local_sock = -1;
@@ -607,6 +721,41 @@ Error in server response, closing control connection.\n"));
       if (!opt.server_response && err != FTPSRVERR)
         logputs (LOG_VERBOSE, _("done.    "));
 
+      /* Ask for the extensions supported by the server.  If MLSD is
+         among them, directory listings will be requested with it, as
+         its format is the same on every system.  */
+      if (!opt.server_response)
+        logprintf (LOG_VERBOSE, "==> FEAT ... ");
+      err = ftp_feat (csock, &con->use_mlsd);
+      switch (err)
+        {
+        case FTPRERR:
+          logputs (LOG_VERBOSE, "\n");
+          logputs (LOG_NOTQUIET, _("\
+Error in server response, closing control connection.\n"));
+          fd_close (csock);
+          con->csock = -1;
+          return err;
+        case WRITEFAILED:
+          logputs (LOG_VERBOSE, "\n");
+          logputs (LOG_NOTQUIET,
+                   _("Write failed, closing control connection.\n"));
+          fd_close (csock);
+          con->csock = -1;
+          return err;
+        case FTPSRVERR:
+          /* FEAT is not supported, which is not an error.  */
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, _("not supported.    "));
+          break;
+        case FTPOK:
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, _("done.    "));
+          break;
+        default:
+          abort ();
+        }
+
       /* 2013-10-17 Andrea Urbani (matfanjol)
          According to the system type I choose which
          list command will be used.
@@ -1314,12 +1463,35 @@ Error in server response, closing control connection.\n"));
 
   if (cmd & DO_LIST)
     {
-      if (!opt.server_response)
-        logputs (LOG_VERBOSE, "==> LIST ... ");
-      /* As Maciej W. Rozycki (macro@ds2.pg.gda.pl) says, `LIST'
-         without arguments is better than `LIST .'; confirmed by
-         RFC959.  */
-      err = ftp_list (csock, NULL, con->st&AVOID_LIST_A, con->st&AVOID_LIST, &list_a_used);
+      mlsd_used = false;
+      if (con->use_mlsd)
+        {
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, "==> MLSD ... ");
+          err = ftp_mlsd (csock, NULL);
+          if (err == FTPOK)
+            mlsd_used = true;
+          else if (err == FTPNSFOD)
+            {
+              /* The server announced MLST, but refuses MLSD.  Don't
+                 try it again in this session, and ask for the listing
+                 with LIST over the same data connection, as ftp_list
+                 does when "LIST -a" fails.  */
+              if (!opt.server_response)
+                logputs (LOG_VERBOSE, _("failed.\n"));
+              con->use_mlsd = false;
+            }
+        }
+      if (!mlsd_used && !con->use_mlsd)
+        {
+          if (!opt.server_response)
+            logputs (LOG_VERBOSE, "==> LIST ... ");
+          /* As Maciej W. Rozycki (macro@ds2.pg.gda.pl) says, `LIST'
+             without arguments is better than `LIST .'; confirmed by
+             RFC959.  */
+          err = ftp_list (csock, NULL, con->st&AVOID_LIST_A,
+                          con->st&AVOID_LIST, &list_a_used);
+        }
 
       /* FTPRERR, WRITEFAILED */
       switch (err)
@@ -1396,8 +1568,13 @@ Error in server response, closing control connection.\n"));
      there allows a open failure to be detected immediately, without first
      connecting to the server.)
   */
-  if (!output_stream || con->cmd & DO_LIST)
+  if (mlsd_used && opt.remove_listing)
+    /* The MLSD listing is parsed as it arrives, so there is no need
+       to write it out unless it is to be kept.  */
+    fp = NULL;
+  else if (!output_stream || con->cmd & DO_LIST)
     {
+      bool dirs_made_again = false;
 /* On VMS, alter the name as required. */
 #ifdef __VMS
       char *targ;
@@ -1441,6 +1618,7 @@ Error in server response, closing control connection.\n"));
 # define BIN_TYPE_FILE true
 #endif /* def __VMS [else] */
 
+    reopen:
       if (restval && !(con->cmd & DO_LIST))
         {
 #ifdef __VMS
@@ -1512,6 +1690,14 @@ Error in server response, closing control connection.\n"));
               return FOPEN_EXCL_ERR;
             }
         }
+      if (!fp && errno == ENOENT && !dirs_made_again)
+        {
+          /* The directory was removed since mkalldirs saw it.  */
+          dirs_made_again = true;
+          if (mkalldirs_again (con->target) == 0)
+            goto reopen;
+          errno = ENOENT;
+        }
       if (!fp)
         {
           logprintf (LOG_NOTQUIET, "%s: %s\n", con->target, strerror (errno));
@@ -1540,11 +1726,12 @@ Error in server response, closing control connection.\n"));
       /* We should try to restore the existing SSL session in the data connection
        * and fall back to establishing a new session if the server doesn't want to restore it.
        */
-      if (!opt.ftps_resume_ssl || !ssl_connect_wget (dtsock, u->host, &csock))
+      if (!opt.ftps_resume_ssl
+          || !ssl_connect_wget (dtsock, u->host, &csock, false))
         {
           if (opt.ftps_resume_ssl)
             logputs (LOG_NOTQUIET, "Server does not want to resume the SSL session. Trying with a new one.\n");
-          if (!ssl_connect_wget (dtsock, u->host, NULL))
+          if (!ssl_connect_wget (dtsock, u->host, NULL, false))
             {
               fd_close (csock);
               fd_close (dtsock);
@@ -1571,22 +1758,26 @@ Error in server response, closing control connection.\n"));
   if (restval && rest_failed)
     flags |= rb_skip_startpos;
   rd_size = 0;
-  res = fd_read_body (con->target, dtsock, fp,
-                      expected_bytes ? expected_bytes - restval : 0,
-                      restval, &rd_size, qtyread, &con->dltime, flags, warc_tmp);
+  if (mlsd_used)
+    res = ftp_read_mlsd (dtsock, fp, con, &rd_size, qtyread, &con->dltime);
+  else
+    res = fd_read_body (con->target, dtsock, fp,
+                        expected_bytes ? expected_bytes - restval : 0,
+                        restval, &rd_size, qtyread, &con->dltime, flags,
+                        warc_tmp);
 
   tms = datetime_str (time (NULL));
   tmrate = retr_rate (rd_size, con->dltime);
   total_download_time += con->dltime;
 
 #ifdef ENABLE_XATTR
-  if (opt.enable_xattr)
+  if (opt.enable_xattr && fp)
     set_file_metadata (u->url, NULL, fp);
 #endif
 
   fd_close (local_sock);
   /* Close the local file.  */
-  if (!output_stream || con->cmd & DO_LIST)
+  if (fp && (!output_stream || con->cmd & DO_LIST))
     fclose (fp);
 
   /* If fd_read_body couldn't write to fp or warc_tmp, bail out.  */
@@ -1669,7 +1860,8 @@ Error in server response, closing control connection.\n"));
      print it out.  */
   if (con->cmd & DO_LIST)
     {
-      if (opt.server_response)
+      /* The lines of an MLSD listing were printed as they were read.  */
+      if (opt.server_response && !mlsd_used)
         {
 /* 2005-02-25 SMS.
    Much of this work may already have been done, but repeating it should
@@ -1725,7 +1917,7 @@ Error in server response, closing control connection.\n"));
           ("LIST -a" is used to get also the hidden files)
 
           */
-      if (!(con->st & LIST_AFTER_LIST_A_CHECK_DONE))
+      if (!mlsd_used && !(con->st & LIST_AFTER_LIST_A_CHECK_DONE))
         {
           /* We still have to check "LIST" after the first "LIST -a" to see
              if with "LIST" we get more data than "LIST -a", that means
@@ -1983,7 +2175,7 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
 #endif
           /* Fatal errors, give up.  */
           if (warc_tmp != NULL)
-              fclose (warc_tmp);
+              warc_tempfile_close (warc_tmp);
           return err;
         case CONSOCKERR: case CONERROR: case FTPSRVERR: case FTPRERR:
         case WRITEFAILED: case FTPUNKNOWNTYPE: case FTPSYSERR:
@@ -2032,13 +2224,18 @@ ftp_loop_internal (struct url *u, struct url *original_url, struct fileinfo *f,
         {
           bool write_to_stdout = (opt.output_document && HYPHENP (opt.output_document));
 
-          logprintf (LOG_VERBOSE,
-                     write_to_stdout
-                     ? _("%s (%s) - written to stdout %s[%s]\n\n")
-                     : _("%s (%s) - %s saved [%s]\n\n"),
-                     tms, tmrate,
-                     write_to_stdout ? "" : quote (locf),
-                     number_to_static_string (qtyread));
+          if ((con->cmd & DO_LIST) && con->use_mlsd && opt.remove_listing)
+            /* The listing was parsed in memory, not saved.  */
+            logprintf (LOG_VERBOSE, _("%s (%s) - listing received [%s]\n\n"),
+                       tms, tmrate, number_to_static_string (qtyread));
+          else
+            logprintf (LOG_VERBOSE,
+                       write_to_stdout
+                       ? _("%s (%s) - written to stdout %s[%s]\n\n")
+                       : _("%s (%s) - %s saved [%s]\n\n"),
+                       tms, tmrate,
+                       write_to_stdout ? "" : quote (locf),
+                       number_to_static_string (qtyread));
         }
       if (!opt.verbose && !opt.quiet)
         {
@@ -2111,7 +2308,7 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
         *local_file = xstrdup (locf);
 
       if (warc_tmp != NULL)
-        fclose (warc_tmp);
+        warc_tempfile_close (warc_tmp);
 
       return RETROK;
     } while (!opt.ntry || (count < opt.ntry));
@@ -2123,11 +2320,65 @@ Removing file due to --delete-after in ftp_loop_internal():\n"));
     }
 
   if (warc_tmp != NULL)
-    fclose (warc_tmp);
+    warc_tempfile_close (warc_tmp);
 
   return TRYLIMEXC;
 }
 
+/* Return the absolute directory that getftp changes to for DIR.  Only
+   Unix-like servers are handled.  */
+static char *
+ftp_absolute_dir (ccon *con, const char *dir)
+{
+  int idlen;
+
+  if (!*dir)
+    return xstrdup (con->id);
+  if (dir[0] == '/'
+      || (con->rs != ST_UNIX && c_isalpha (dir[0]) && dir[1] == ':'))
+    return xstrdup (dir);
+
+  /* Strip trailing slash(es) from con->id. */
+  idlen = strlen (con->id);
+  while (idlen > 0 && con->id[idlen - 1] == '/')
+    --idlen;
+  return aprintf ("%.*s/%s", idlen, con->id, dir);
+}
+
+/* Returns the modification time of the directory DIR, as reported by
+   MLST, or -1 if it can't be determined.  */
+static long
+ftp_dir_mtime (ccon *con, const char *dir)
+{
+  long tstamp;
+  uerr_t err;
+
+  if (!opt.server_response)
+    logprintf (LOG_VERBOSE, "==> MLST %s ... ",
+               quotearg_style (escape_quoting_style, dir));
+  err = ftp_mlst (con->csock, dir, &tstamp);
+  switch (err)
+    {
+    case FTPRERR:
+    case WRITEFAILED:
+      /* Let the listing find out again, and reconnect.  */
+      logputs (LOG_VERBOSE, "\n");
+      fd_close (con->csock);
+      con->csock = -1;
+      return -1;
+    case FTPNSFOD:
+      if (!opt.server_response)
+        logputs (LOG_VERBOSE, _("failed.\n"));
+      return -1;
+    case FTPOK:
+      if (!opt.server_response)
+        logputs (LOG_VERBOSE, _("done.\n"));
+      return tstamp;
+    default:
+      abort ();
+    }
+}
+
 /* Return the directory listing in a reusable format.  The directory
    is specified in u->dir.  */
 static uerr_t
@@ -2138,6 +2389,39 @@ ftp_get_listing (struct url *u, struct url *original_url, ccon *con,
   char *uf;                     /* url file name */
   char *lf;                     /* list file name */
   char *old_target = con->target;
+  char *cache_key = NULL;       /* the directory's --ftp-listing-cache key */
+  long dir_tstamp = -1;
+
+  /* With --ftp-listing-cache, a directory whose modification time is
+     still the one it had when it was last listed needn't be listed
+     again.  The time must be asked for before the listing, so that a
+     change made meanwhile is noticed next time; that needs MLST, and
+     a connection on which FEAT has told us it is supported.  */
+  if (opt.ftp_listing_cache && con->csock != -1 && con->use_mlsd && con->id)
+    {
+      char *dir = ftp_absolute_dir (con, u->dir);
+
+      dir_tstamp = ftp_dir_mtime (con, dir);
+      if (dir_tstamp != -1)
+        {
+          const char *user, *passwd;
+
+          ftp_credentials (u, &user, &passwd);
+          cache_key = aprintf ("%s%s@%s:%d%s",
+                               scheme_leading_string (u->scheme), user,
+                               u->host, u->port, dir);
+          if (ftp_cache_get (cache_key, dir_tstamp, f))
+            {
+              logprintf (LOG_VERBOSE, _("Directory %s not modified, using "
+                                        "its cached listing.\n"),
+                         quote (dir));
+              xfree (cache_key);
+              xfree (dir);
+              return RETROK;
+            }
+        }
+      xfree (dir);
+    }
 
   con->st &= ~ON_YOUR_OWN;
   con->cmd |= (DO_LIST | LEAVE_PENDING);
@@ -2160,8 +2444,18 @@ ftp_get_listing (struct url *u, struct url *original_url, ccon *con,
 
   if (err == RETROK)
     {
-      *f = ftp_parse_ls (lf, con->rs);
-      if (opt.remove_listing)
+      if (con->use_mlsd)
+        {
+          /* Already parsed by getftp.  */
+          *f = con->listing;
+          con->listing = NULL;
+        }
+      else
+        *f = ftp_parse_ls (lf, con->rs);
+      /* Only an MLSD listing, whose entries are exact, is cached.  */
+      if (cache_key && con->use_mlsd)
+        ftp_cache_put (cache_key, dir_tstamp, *f);
+      if (opt.remove_listing && !con->use_mlsd)
         {
           if (unlink (lf))
             logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
@@ -2171,6 +2465,9 @@ ftp_get_listing (struct url *u, struct url *original_url, ccon *con,
     }
   else
     *f = NULL;
+  freefileinfo (con->listing);
+  con->listing = NULL;
+  xfree (cache_key);
   xfree (lf);
   con->cmd &= ~DO_LIST;
   return err;
@@ -2180,13 +2477,673 @@ static uerr_t ftp_retrieve_dirs (struct url *, struct url *,
                                  struct fileinfo *, ccon *);
 static uerr_t ftp_retrieve_glob (struct url *, struct url *, ccon *, int);
 static struct fileinfo *delelement (struct fileinfo *, struct fileinfo **);
-static void freefileinfo (struct fileinfo *f);
+
+/* Set the permissions and the time-stamp of TARGET, the local copy of
+   the listing entry F, which has been retrieved if DLTHIS is true.  */
+static void
+ftp_set_local_attributes (const char *target, struct fileinfo *f,
+                          bool dlthis)
+{
+  const char *actual_target = NULL;
+
+  /* 2004-12-15 SMS.
+   * Set permissions _before_ setting the times, as setting the
+   * permissions changes the modified-time, at least on VMS.
+   * Also, use the opt.output_document name here, too, as
+   * appropriate.  (Do the test once, and save the result.)
+   */
+
+  set_local_file (&actual_target, target);
+
+  /* If downloading a plain file, and the user requested it, then
+     set valid (non-zero) permissions. */
+  if (dlthis && (actual_target != NULL) &&
+   (f->type == FT_PLAINFILE) && opt.preserve_perm)
+    {
+      if (f->perms)
+        {
+          if (chmod (actual_target, f->perms))
+            logprintf (LOG_NOTQUIET,
+                       _("Failed to set permissions for %s.\n"),
+                       actual_target);
+        }
+      else
+        DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
+    }
+
+  /* Set the time-stamp information to the local file.  Symlinks
+     are not to be stamped because it sets the stamp on the
+     original.  :( */
+  if (actual_target != NULL)
+    {
+      if (opt.useservertimestamps
+          && !(f->type == FT_SYMLINK && !opt.retr_symlinks)
+          && f->tstamp != -1
+          && dlthis
+          && file_exists_p (target, NULL))
+        {
+          touch (actual_target, f->tstamp);
+        }
+      else if (f->tstamp == -1)
+        logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
+                   actual_target);
+    }
+}
+
+/* Close the additional connections of CON.  */
+static void
+ftp_close_sessions (ccon *con)
+{
+  int i;
+
+  if (!con->sessions)
+    return;
+  for (i = 0; i < opt.ftp_connections - 1; i++)
+    {
+      if (con->sessions[i].csock != -1)
+        fd_close (con->sessions[i].csock);
+      xfree (con->sessions[i].dir);
+    }
+  xfree (con->sessions);
+}
+
+#ifdef HAVE_PTHREAD
+/* Parallel retrieval of the files of a listing.
+
+   With --ftp-connections=N, the plain files of a directory listing are
+   handed to a pool of N-1 worker threads as ftp_retrieve_list goes
+   through the listing, each worker owning a logged-in connection of
+   its own.  The connections stay open for the next directories of the
+   same retrieval.  While waiting for the files to be done, the main
+   thread retrieves files over the main connection as well.
+
+   The workers log nothing, show no progress and ask for nothing but
+   the file (the size is known from the listing): a file they fail to
+   retrieve is simply retrieved again by ftp_loop_internal, with the
+   usual messages and retries.  The results are logged in the order
+   of the listing.  */
+
+/* A file of the listing, retrieved by the pool.  */
+struct ftp_job
+{
+  struct fileinfo *f;           /* the listing entry */
+  char *target;                 /* the local file */
+  char *url;                    /* the URL of the file */
+  char *hurl;                   /* the same, without the password */
+  bool force_full_retrieve;
+
+  /* Set by the thread that retrieves the file.  */
+  bool ok;                      /* whether the file was retrieved */
+  wgint qtyread;                /* the number of bytes retrieved */
+  double dltime;                /* the time the retrieval took */
+  bool done;
+};
+
+struct ftp_worker
+{
+  struct ftp_pool *pool;
+  struct ftp_session *session;
+  pthread_t thread;
+};
+
+struct ftp_pool
+{
+  struct ftp_job **jobs;
+  int count, size;
+  int next;                     /* the next job to be picked up */
+  bool closed;                  /* whether all the jobs have been added */
+
+  /* What the workers need to log in and to find the files.  */
+  ip_address ip;
+  int port;
+  const char *user, *passwd;
+  char type_char;
+  char *dir;                    /* the absolute directory of the files */
+
+  struct ftp_session main_session;  /* the main connection */
+  struct ftp_worker *workers;
+  int nworkers;                 /* the number of workers started */
+  int max_workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t job_added;
+  pthread_cond_t job_done;
+};
+
+#define FTP_POOL_BUFSIZE 65536
+
+/* Return whether the files of U can be retrieved by a pool.  This
+   rules out everything that needs files to be retrieved one at a time,
+   or that the workers couldn't do without logging or without sharing
+   state with the main thread.  */
+static bool
+ftp_pool_usable (struct url *u, ccon *con)
+{
+  return (opt.ftp_connections > 1
+          && u->scheme == SCHEME_FTP
+          && !con->proxy
+          && con->csock != -1
+          && opt.ftp_pasv
+          && (con->rs == ST_UNIX || con->rs == ST_WINNT)
+          && !opt.debug && !opt.server_response
+          && !opt.output_document && !opt.spider && !opt.warc_filename
+          && !opt.quota && !opt.wait
+          && !opt.always_rest && opt.start_pos < 0 && !opt.backups
+          && !fd_transports_registered ());
+}
+
+/* Pick up the next job of POOL.  If none is left and WAIT is true,
+   wait for one to be added; return NULL once POOL is closed.  */
+static struct ftp_job *
+ftp_pool_next (struct ftp_pool *pool, bool wait)
+{
+  struct ftp_job *job = NULL;
+
+  pthread_mutex_lock (&pool->lock);
+  while (wait && pool->next == pool->count && !pool->closed)
+    pthread_cond_wait (&pool->job_added, &pool->lock);
+  if (pool->next < pool->count)
+    job = pool->jobs[pool->next++];
+  pthread_mutex_unlock (&pool->lock);
+  return job;
+}
+
+/* Close the control connection of S, after an error on it.  */
+static void
+ftp_session_close (struct ftp_session *s)
+{
+  fd_close (s->csock);
+  s->csock = -1;
+  xfree (s->dir);
+}
+
+/* Log in to the server of POOL over S, and change to the directory of
+   the files.  */
+static bool
+ftp_session_prepare (struct ftp_pool *pool, struct ftp_session *s)
+{
+  if (s->csock == -1)
+    {
+      uerr_t err;
+
+      s->csock = connect_to_ip_threaded (&pool->ip, pool->port);
+      if (s->csock < 0)
+        {
+          s->csock = -1;
+          return false;
+        }
+      err = ftp_greeting (s->csock);
+      if (err == FTPOK)
+        err = ftp_login (s->csock, pool->user, pool->passwd);
+      if (err == FTPOK)
+        err = ftp_type (s->csock, pool->type_char);
+      if (err != FTPOK)
+        {
+          ftp_session_close (s);
+          return false;
+        }
+    }
+
+  if (!s->dir || strcmp (s->dir, pool->dir) != 0)
+    {
+      xfree (s->dir);
+      if (ftp_cwd (s->csock, pool->dir) != FTPOK)
+        {
+          ftp_session_close (s);
+          return false;
+        }
+      s->dir = xstrdup (pool->dir);
+    }
+  return true;
+}
+
+/* Retrieve the file of JOB over S, using BUF to copy the data.  */
+static void
+ftp_job_run (struct ftp_pool *pool, struct ftp_session *s,
+             struct ftp_job *job, char *buf)
+{
+  ip_address addr;
+  int port, dtsock, res;
+  uerr_t err;
+  char *respline;
+  FILE *fp;
+  struct ptimer *timer;
+  struct limit_state limit_state;
+  bool limited;
+
+  if (!ftp_session_prepare (pool, s))
+    return;
+
+  if (!socket_ip_address (s->csock, &addr, ENDPOINT_PEER))
+    {
+      ftp_session_close (s);
+      return;
+    }
+#ifdef ENABLE_IPV6
+  if (addr.family == AF_INET6)
+    {
+      err = ftp_epsv (s->csock, &addr, &port);
+      if (err == FTPNOPASV)
+        err = ftp_lpsv (s->csock, &addr, &port);
+    }
+  else
+#endif
+    err = ftp_pasv (s->csock, &addr, &port);
+  if (err != FTPOK)
+    {
+      if (err == FTPRERR || err == WRITEFAILED)
+        ftp_session_close (s);
+      return;
+    }
+
+  dtsock = connect_to_ip_threaded (&addr, port);
+  if (dtsock < 0)
+    {
+      ftp_session_close (s);
+      return;
+    }
+
+  err = ftp_retr (s->csock, job->f->name);
+  if (err != FTPOK)
+    {
+      fd_close (dtsock);
+      if (err != FTPNSFOD)
+        ftp_session_close (s);
+      return;
+    }
+
+  fp = fopen (job->target, "wb");
+  if (!fp)
+    {
+      /* The server is sending the file nevertheless; the connection
+         can't be used for anything else.  */
+      fd_close (dtsock);
+      ftp_session_close (s);
+      return;
+    }
+
+  limited = limit_bandwidth_rate () != 0;
+  if (limited)
+    limit_bandwidth_start (&limit_state, dtsock);
+  timer = ptimer_new ();
+  job->qtyread = 0;
+  while ((res = fd_read (dtsock, buf, FTP_POOL_BUFSIZE, -1)) > 0)
+    {
+      if (fwrite (buf, 1, res, fp) < (size_t) res)
+        {
+          res = -2;
+          break;
+        }
+      job->qtyread += res;
+      if (limited)
+        limit_bandwidth (res, &limit_state);
+    }
+  job->dltime = ptimer_measure (timer);
+  ptimer_destroy (timer);
+  fd_close (dtsock);
+  if (fclose (fp) != 0 && res == 0)
+    res = -2;
+
+  /* Get the server to tell us if everything is retrieved.  */
+  if (res == -2 || ftp_response (s->csock, &respline) != FTPOK)
+    ftp_session_close (s);
+  else
+    {
+      job->ok = (res == 0 && *respline == '2');
+      xfree (respline);
+    }
+
+  /* Don't leave a partial file behind, as ftp_loop_internal will
+     retrieve it anew, possibly under another name.  */
+  if (!job->ok)
+    unlink (job->target);
+}
+
+/* Mark JOB of POOL as done.  */
+static void
+ftp_job_done (struct ftp_pool *pool, struct ftp_job *job)
+{
+  pthread_mutex_lock (&pool->lock);
+  job->done = true;
+  pthread_cond_broadcast (&pool->job_done);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Retrieve the jobs of the worker's pool as they are added, until the
+   pool is closed.  */
+static void *
+ftp_worker_run (void *arg)
+{
+  struct ftp_worker *worker = arg;
+  struct ftp_pool *pool = worker->pool;
+  char *buf = xmalloc (FTP_POOL_BUFSIZE);
+  struct ftp_job *job;
+  sigset_t set;
+
+  /* Leave the signals to the main thread, whose timeouts are
+     implemented with SIGALRM.  */
+  sigfillset (&set);
+  pthread_sigmask (SIG_BLOCK, &set, NULL);
+
+  while ((job = ftp_pool_next (pool, true)) != NULL)
+    {
+      ftp_job_run (pool, worker->session, job, buf);
+      ftp_job_done (pool, job);
+    }
+
+  xfree (buf);
+  return NULL;
+}
+
+/* Start a pool to retrieve the plain files of the listing F of U over
+   the additional connections of CON.  Return NULL if the files are to
+   be retrieved one after the other.  */
+static struct ftp_pool *
+ftp_pool_start (struct url *u, struct fileinfo *f, ccon *con)
+{
+  struct ftp_pool *pool;
+  int nfiles = 0;
+  int i;
+
+  if (!ftp_pool_usable (u, con))
+    return NULL;
+  for (; f; f = f->next)
+    if (f->type == FT_PLAINFILE)
+      ++nfiles;
+  if (nfiles < 2)
+    return NULL;
+
+  pool = xnew0 (struct ftp_pool);
+  if (!socket_ip_address (con->csock, &pool->ip, ENDPOINT_PEER))
+    {
+      xfree (pool);
+      return NULL;
+    }
+  pool->port = u->port;
+  ftp_credentials (u, &pool->user, &pool->passwd);
+  pool->type_char = ftp_process_type (u->params);
+  pool->dir = ftp_absolute_dir (con, u->dir);
+
+  pool->main_session.csock = con->csock;
+  if (con->st & DONE_CWD)
+    pool->main_session.dir = xstrdup (pool->dir);
+
+  if (!con->sessions)
+    {
+      con->sessions = xnew_array (struct ftp_session,
+                                  opt.ftp_connections - 1);
+      for (i = 0; i < opt.ftp_connections - 1; i++)
+        {
+          con->sessions[i].csock = -1;
+          con->sessions[i].dir = NULL;
+        }
+    }
+
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->job_added, NULL);
+  pthread_cond_init (&pool->job_done, NULL);
+
+  /* The workers are started as the jobs are added.  */
+  pool->max_workers = MIN (nfiles, opt.ftp_connections) - 1;
+  pool->workers = xnew0_array (struct ftp_worker, pool->max_workers);
+  for (i = 0; i < pool->max_workers; i++)
+    {
+      pool->workers[i].pool = pool;
+      pool->workers[i].session = &con->sessions[i];
+    }
+  return pool;
+}
+
+/* Hand the retrieval of the listing entry F of U, to be saved to
+   TARGET, to POOL.  Return false if the caller must retrieve it.  */
+static bool
+ftp_pool_add (struct ftp_pool *pool, struct url *u, struct fileinfo *f,
+              const char *target, bool force_full_retrieve)
+{
+  struct ftp_job *job;
+
+  /* Leave the cases where ftp_loop_internal or getftp would say
+     something to them.  */
+  if (opt.noclobber && file_exists_p (target, NULL))
+    return false;
+  if (opt.unlink_requested && file_exists_p (target, NULL)
+      && unlink (target) < 0)
+    return false;
+
+  remove_link (target);
+  mkalldirs (target);
+
+  job = xnew0 (struct ftp_job);
+  job->f = f;
+  job->target = xstrdup (target);
+  job->url = xstrdup (u->url);
+  job->hurl = url_string (u, URL_AUTH_HIDE_PASSWD);
+  job->force_full_retrieve = force_full_retrieve;
+
+  pthread_mutex_lock (&pool->lock);
+  if (pool->count == pool->size)
+    {
+      pool->size = pool->size ? 2 * pool->size : 16;
+      pool->jobs = xrealloc (pool->jobs, pool->size * sizeof *pool->jobs);
+    }
+  pool->jobs[pool->count++] = job;
+  pthread_cond_signal (&pool->job_added);
+  pthread_mutex_unlock (&pool->lock);
+
+  /* Start a worker for every job but the one the main thread will be
+     retrieving.  If no thread can be created, the main thread does all
+     the work over the main connection.  */
+  if (pool->nworkers < pool->max_workers
+      && pool->nworkers < pool->count - 1)
+    {
+      struct ftp_worker *worker = &pool->workers[pool->nworkers];
+      if (pthread_create (&worker->thread, NULL, ftp_worker_run, worker) == 0)
+        ++pool->nworkers;
+      else
+        pool->max_workers = pool->nworkers;
+    }
+  return true;
+}
+
+/* Log the retrieval of JOB's file, and account for it the way
+   ftp_loop_internal does.  */
+static void
+ftp_job_report (struct ftp_job *job)
+{
+  char *tms = datetime_str (time (NULL));
+
+  if (opt.verbose)
+    {
+      logprintf (LOG_VERBOSE, "--%s--  %s\n  %s => %s\n",
+                 tms, job->hurl, "        ", quote (job->target));
+      print_length (job->qtyread, 0, true);
+    }
+  total_download_time += job->dltime;
+  downloaded_file (FILE_DOWNLOADED_NORMALLY, job->target);
+
+  logprintf (LOG_VERBOSE, _("%s (%s) - %s saved [%s]\n\n"),
+             tms, retr_rate (job->qtyread, job->dltime),
+             quote (job->target), number_to_static_string (job->qtyread));
+  if (!opt.verbose && !opt.quiet)
+    logprintf (LOG_NONVERBOSE, "%s URL: %s [%s] -> \"%s\" [%d]\n",
+               tms, job->hurl, number_to_static_string (job->qtyread),
+               job->target, 1);
+
+#ifdef ENABLE_XATTR
+  if (opt.enable_xattr)
+    {
+      FILE *fp = fopen (job->target, "rb");
+      if (fp)
+        {
+          set_file_metadata (job->url, NULL, fp);
+          fclose (fp);
+        }
+    }
+#endif
+
+  total_downloaded_bytes += job->qtyread;
+  numurls++;
+
+  if (opt.delete_after && !input_file_url (opt.input_filename))
+    {
+      DEBUGP (("\
+Removing file due to --delete-after in ftp_job_report():\n"));
+      logprintf (LOG_VERBOSE, _("Removing %s.\n"), job->target);
+      if (unlink (job->target))
+        logprintf (LOG_NOTQUIET, "unlink: %s\n", strerror (errno));
+    }
+}
+
+/* Wait for the jobs of POOL to be done, in order, retrieving files over
+   the main connection of CON in the meantime.  Report the jobs, and
+   retrieve the files that POOL failed to with ftp_loop_internal.
+   Return the error of the last of those that failed, or RETROK.  */
+static uerr_t
+ftp_pool_finish (struct ftp_pool *pool, struct url *u,
+                 struct url *original_url, ccon *con)
+{
+  struct ftp_session *ms = &pool->main_session;
+  char *buf = xmalloc (FTP_POOL_BUFSIZE);
+  uerr_t err = RETROK;
+  bool fatal = false;
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->closed = true;
+  pthread_cond_broadcast (&pool->job_added);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (i = 0; i < pool->count; i++)
+    {
+      struct ftp_job *job = pool->jobs[i];
+
+      while (1)
+        {
+          struct ftp_job *other;
+          bool done;
+
+          pthread_mutex_lock (&pool->lock);
+          done = job->done;
+          pthread_mutex_unlock (&pool->lock);
+          if (done)
+            break;
+
+          other = ftp_pool_next (pool, false);
+          if (other)
+            {
+              ftp_job_run (pool, ms, other, buf);
+              ftp_job_done (pool, other);
+              continue;
+            }
+
+          pthread_mutex_lock (&pool->lock);
+          while (!job->done)
+            pthread_cond_wait (&pool->job_done, &pool->lock);
+          pthread_mutex_unlock (&pool->lock);
+        }
+
+      if (job->ok)
+        {
+          ftp_job_report (job);
+          ftp_set_local_attributes (job->target, job->f, true);
+        }
+      else if (!fatal)
+        {
+          char *old_target = con->target;
+          char *ofile = xstrdup (u->file);
+          uerr_t job_err;
+
+          /* Hand the main connection back to ftp_loop_internal.  */
+          con->csock = ms->csock;
+          if (ms->csock != -1 && ms->dir)
+            con->st |= DONE_CWD;
+          else
+            con->st &= ~DONE_CWD;
+
+          url_set_file (u, job->f->name);
+          con->target = xstrdup (job->target);
+          job_err = ftp_loop_internal (u, original_url, job->f, con, NULL,
+                                       job->force_full_retrieve);
+          ftp_set_local_attributes (con->target, job->f, true);
+          xfree (con->target);
+          con->target = old_target;
+          url_set_file (u, ofile);
+          xfree (ofile);
+
+          ms->csock = con->csock;
+          xfree (ms->dir);
+          if (con->csock != -1 && (con->st & DONE_CWD))
+            ms->dir = xstrdup (pool->dir);
+
+          if (job_err != RETROK)
+            err = job_err;
+          if (job_err == HOSTERR || job_err == FWRITEERR)
+            fatal = true;
+        }
+
+      xfree (job->target);
+      xfree (job->url);
+      xfree (job->hurl);
+      xfree (job);
+    }
+
+  for (i = 0; i < pool->nworkers; i++)
+    pthread_join (pool->workers[i].thread, NULL);
+
+  con->csock = ms->csock;
+  if (ms->csock != -1 && ms->dir)
+    con->st |= DONE_CWD;
+  else
+    con->st &= ~DONE_CWD;
+
+  pthread_cond_destroy (&pool->job_done);
+  pthread_cond_destroy (&pool->job_added);
+  pthread_mutex_destroy (&pool->lock);
+  xfree (ms->dir);
+  xfree (pool->dir);
+  xfree (pool->workers);
+  xfree (pool->jobs);
+  xfree (pool);
+  xfree (buf);
+  return err;
+}
+#else /* not HAVE_PTHREAD */
+
+struct ftp_pool;
+
+static struct ftp_pool *
+ftp_pool_start (struct url *u _GL_UNUSED, struct fileinfo *f _GL_UNUSED,
+                ccon *con _GL_UNUSED)
+{
+  return NULL;
+}
+
+static bool
+ftp_pool_add (struct ftp_pool *pool _GL_UNUSED, struct url *u _GL_UNUSED,
+              struct fileinfo *f _GL_UNUSED, const char *target _GL_UNUSED,
+              bool force_full_retrieve _GL_UNUSED)
+{
+  return false;
+}
+
+static uerr_t
+ftp_pool_finish (struct ftp_pool *pool _GL_UNUSED,
+                 struct url *u _GL_UNUSED,
+                 struct url *original_url _GL_UNUSED,
+                 ccon *con _GL_UNUSED)
+{
+  return RETROK;
+}
+#endif /* not HAVE_PTHREAD */
 
 /* Retrieve a list of files given in struct fileinfo linked list.  If
    a file is a symbolic link, do not retrieve it, but rather try to
    set up a similar link on the local disk, if the symlinks are
    supported.
 
+   The plain files are retrieved in parallel if --ftp-connections
+   allows it; see ftp_pool_start.
+
    If opt.recursive is set, after all files have been retrieved,
    ftp_retrieve_dirs will be called to retrieve the directories.  */
 static uerr_t
@@ -2199,8 +3156,9 @@ ftp_retrieve_list (struct url *u, struct url *original_url,
   wgint local_size;
   time_t tml;
   bool dlthis; /* Download this (file). */
-  const char *actual_target = NULL;
+  bool queued; /* Handed to the pool. */
   bool force_full_retrieve = false;
+  struct ftp_pool *pool;
 
   /* Increase the depth.  */
   ++depth;
@@ -2229,6 +3187,8 @@ ftp_retrieve_list (struct url *u, struct url *original_url,
 
   err = RETROK;                 /* in case it's not used */
 
+  pool = ftp_pool_start (u, f, con);
+
   while (f)
     {
       char *old_target, *ofile;
@@ -2247,6 +3207,7 @@ ftp_retrieve_list (struct url *u, struct url *original_url,
       err = RETROK;
 
       dlthis = true;
+      queued = false;
       if (opt.timestamping && f->type == FT_PLAINFILE)
         {
           struct stat st;
@@ -2364,11 +3325,15 @@ Already have correct symlink %s -> %s\n\n"),
                        quote (f->name));
           break;
         case FT_PLAINFILE:
-          /* Call the retrieve loop.  */
+          /* Call the retrieve loop, unless the pool takes the file.  */
           if (dlthis)
             {
-              err = ftp_loop_internal (u, original_url, f, con, NULL,
-                                       force_full_retrieve);
+              if (pool && ftp_pool_add (pool, u, f, con->target,
+                                        force_full_retrieve))
+                queued = true;
+              else
+                err = ftp_loop_internal (u, original_url, f, con, NULL,
+                                         force_full_retrieve);
             }
           break;
         case FT_UNKNOWN:
@@ -2379,48 +3344,9 @@ Already have correct symlink %s -> %s\n\n"),
         }       /* switch */
 
 
-      /* 2004-12-15 SMS.
-       * Set permissions _before_ setting the times, as setting the
-       * permissions changes the modified-time, at least on VMS.
-       * Also, use the opt.output_document name here, too, as
-       * appropriate.  (Do the test once, and save the result.)
-       */
-
-      set_local_file (&actual_target, con->target);
-
-      /* If downloading a plain file, and the user requested it, then
-         set valid (non-zero) permissions. */
-      if (dlthis && (actual_target != NULL) &&
-       (f->type == FT_PLAINFILE) && opt.preserve_perm)
-        {
-          if (f->perms)
-            {
-              if (chmod (actual_target, f->perms))
-                logprintf (LOG_NOTQUIET,
-                           _("Failed to set permissions for %s.\n"),
-                           actual_target);
-            }
-          else
-            DEBUGP (("Unrecognized permissions for %s.\n", actual_target));
-        }
-
-      /* Set the time-stamp information to the local file.  Symlinks
-         are not to be stamped because it sets the stamp on the
-         original.  :( */
-      if (actual_target != NULL)
-        {
-          if (opt.useservertimestamps
-              && !(f->type == FT_SYMLINK && !opt.retr_symlinks)
-              && f->tstamp != -1
-              && dlthis
-              && file_exists_p (con->target, NULL))
-            {
-              touch (actual_target, f->tstamp);
-            }
-          else if (f->tstamp == -1)
-            logprintf (LOG_NOTQUIET, _("%s: corrupt time-stamp.\n"),
-                       actual_target);
-        }
+      /* The pool sets the attributes once the file is retrieved.  */
+      if (!queued)
+        ftp_set_local_attributes (con->target, f, dlthis);
 
       xfree (con->target);
       con->target = old_target;
@@ -2437,6 +3363,13 @@ Already have correct symlink %s -> %s\n\n"),
       f = f->next;
     }
 
+  if (pool)
+    {
+      uerr_t pool_err = ftp_pool_finish (pool, u, original_url, con);
+      if (pool_err != RETROK)
+        err = pool_err;
+    }
+
   /* We do not want to call ftp_retrieve_dirs here */
   if (opt.recursive &&
       !(opt.reclevel != INFINITE_RECURSION && depth >= opt.reclevel))
@@ -2795,6 +3728,7 @@ ftp_loop (struct url *u, struct url *original_url, char **local_file, int *dt,
   /* If a connection was left, quench it.  */
   if (con.csock != -1)
     fd_close (con.csock);
+  ftp_close_sessions (&con);
   xfree (con.id);
   xfree (con.target);
   return res;
@@ -2823,7 +3757,7 @@ delelement (struct fileinfo *f, struct fileinfo **start)
 }
 
 /* Free the fileinfo linked list of files.  */
-static void
+void
 freefileinfo (struct fileinfo *f)
 {
   while (f)
@@ -86,12 +86,18 @@ uerr_t ftp_cwd (int, const char *);
 uerr_t ftp_retr (int, const char *);
 uerr_t ftp_rest (int, wgint);
 uerr_t ftp_list (int, const char *, bool, bool, bool *);
+uerr_t ftp_mlsd (int, const char *);
+uerr_t ftp_feat (int, bool *);
+uerr_t ftp_mlst (int, const char *, long *);
 uerr_t ftp_syst (int, enum stype *, enum ustype *);
 uerr_t ftp_pwd (int, char **);
 uerr_t ftp_size (int, const char *, wgint *);
 
 #ifdef ENABLE_OPIE
-const char *skey_response (int, const char *, const char *);
+/* Room to hold 6 four-letter words (heh), 5 space separators, and
+   the terminating \0.  24+5+1 == 30  */
+#define SKEY_RESPONSE_SIZE 30
+const char *skey_response (int, const char *, const char *, char *);
 #endif
 
 struct url;
@@ -169,11 +175,19 @@ enum wget_ftp_fstatus
 };
 
 struct fileinfo *ftp_parse_ls (const char *, const enum stype);
+struct fileinfo *ftp_parse_mlsd (const char *);
+struct fileinfo *ftp_parse_mlst (const char *);
+void freefileinfo (struct fileinfo *);
 uerr_t ftp_loop (struct url *, struct url *, char **, int *, struct url *,
                  bool, bool);
 
 uerr_t ftp_index (const char *, struct url *, struct fileinfo *);
 
+bool ftp_cache_get (const char *, long, struct fileinfo **);
+void ftp_cache_put (const char *, long, const struct fileinfo *);
+void ftp_cache_save (void);
+void ftp_cache_cleanup (void);
+
 char ftp_process_type (const char *);
 
 
@@ -537,7 +537,8 @@ _sni_hostname(const char *hostname)
 }
 
 bool
-ssl_connect_wget (int fd, const char *hostname, int *continue_session)
+ssl_connect_wget (int fd, const char *hostname, int *continue_session,
+                  bool http2)
 {
   struct wgnutls_transport_context *ctx;
   gnutls_session_t session;
@@ -650,6 +651,23 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
       return false;
     }
 
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+  if (http2)
+    {
+      gnutls_datum_t alpn[2] = {
+        { (unsigned char *) "h2", 2 },
+        { (unsigned char *) "http/1.1", 8 }
+      };
+      err = gnutls_alpn_set_protocols (session, alpn, countof (alpn), 0);
+      if (err < 0)
+        {
+          logprintf (LOG_NOTQUIET, "GnuTLS: %s\n", gnutls_strerror (err));
+          gnutls_deinit (session);
+          return false;
+        }
+    }
+#endif
+
   if (continue_session)
     {
       ctx = (struct wgnutls_transport_context *) fd_transport_context (*continue_session);
@@ -695,6 +713,20 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
   return true;
 }
 
+bool
+ssl_http2_selected (int fd)
+{
+#if GNUTLS_VERSION_NUMBER >= 0x030200
+  struct wgnutls_transport_context *ctx = fd_transport_context (fd);
+  gnutls_datum_t proto;
+
+  return gnutls_alpn_get_selected_protocol (ctx->session, &proto) == 0
+    && proto.size == 2 && 0 == memcmp (proto.data, "h2", 2);
+#else
+  return false;
+#endif
+}
+
 static bool
 pkp_pin_peer_pubkey (gnutls_x509_crt_t cert, const char *pinnedpubkey)
 {
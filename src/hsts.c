@@ -49,11 +49,14 @@ as that of the covered work.  */
 #include <string.h>
 #include <stdio.h>
 #include <sys/file.h>
+#include <errno.h>
 
 struct hsts_store {
   struct hash_table *table;
   time_t last_mtime;
   bool changed;
+  int records;                       /* lines read from the database */
+  struct hsts_removal *removals;     /* hosts removed since it was read */
 };
 
 struct hsts_kh {
@@ -65,6 +68,16 @@ struct hsts_kh_info {
   time_t created;
   time_t max_age;
   bool include_subdomains;
+  bool dirty;                        /* changed since the database was read */
+};
+
+/* A Known HSTS Host that was removed from the store, which has to be
+   recorded when the database is saved incrementally.  */
+struct hsts_removal {
+  char *host;
+  int explicit_port;
+  time_t when;
+  struct hsts_removal *next;
 };
 
 enum hsts_kh_match {
@@ -168,7 +181,8 @@ hsts_new_entry_internal (hsts_store_t store,
                          bool include_subdomains,
                          bool check_validity,
                          bool check_expired,
-                         bool check_duplicates)
+                         bool check_duplicates,
+                         bool dirty)
 {
   struct hsts_kh *kh = xnew (struct hsts_kh);
   struct hsts_kh_info *khi = xnew0 (struct hsts_kh_info);
@@ -180,6 +194,7 @@ hsts_new_entry_internal (hsts_store_t store,
   khi->created = created;
   khi->max_age = max_age;
   khi->include_subdomains = include_subdomains;
+  khi->dirty = dirty;
 
   /* Check validity */
   if (check_validity && !hsts_is_host_name_valid (host))
@@ -221,7 +236,7 @@ hsts_add_entry (hsts_store_t store,
   /* It might happen time() returned -1 */
   return (t < 0 ?
       false :
-      hsts_new_entry_internal (store, host, port, t, max_age, include_subdomains, false, true, false));
+      hsts_new_entry_internal (store, host, port, t, max_age, include_subdomains, false, true, false, true));
 }
 
 /* Creates a new entry, unless an identical one already exists. */
@@ -231,7 +246,7 @@ hsts_new_entry (hsts_store_t store,
                 time_t created, time_t max_age,
                 bool include_subdomains)
 {
-  return hsts_new_entry_internal (store, host, port, created, max_age, include_subdomains, true, true, true);
+  return hsts_new_entry_internal (store, host, port, created, max_age, include_subdomains, true, true, true, false);
 }
 
 static void
@@ -240,6 +255,58 @@ hsts_remove_entry (hsts_store_t store, struct hsts_kh *kh)
   hash_table_remove (store->table, kh);
 }
 
+/* Remember that KH has been removed, so that an incremental save can
+   record it.  */
+static void
+hsts_record_removal (hsts_store_t store, struct hsts_kh *kh)
+{
+  struct hsts_removal *r = xnew (struct hsts_removal);
+
+  r->host = xstrdup (kh->host);
+  r->explicit_port = kh->explicit_port;
+  r->when = time (NULL);
+  r->next = store->removals;
+  store->removals = r;
+}
+
+/* Applies a line of the database to the store: the entry replaces any
+   earlier one for the same host, and a max-age of zero removes it.
+   With incremental saves the database is a log of such changes.  */
+static bool
+hsts_store_replay (hsts_store_t store,
+                   const char *host, int port,
+                   time_t created, time_t max_age,
+                   bool include_subdomains)
+{
+  struct hsts_kh kh, *old_kh;
+  struct hsts_kh_info *khi;
+  bool found;
+
+  kh.host = xstrdup_lower (host);
+  kh.explicit_port = MAKE_EXPLICIT_PORT (SCHEME_HTTPS, port);
+  found = hash_table_get_pair (store->table, &kh, &old_kh, &khi);
+  xfree (kh.host);
+
+  if (!found)
+    return max_age && hsts_new_entry (store, host, port, created,
+                                      max_age, include_subdomains);
+
+  if (!max_age)
+    {
+      hash_table_remove (store->table, old_kh);
+      xfree (old_kh->host);
+      xfree (old_kh);
+      xfree (khi);
+    }
+  else
+    {
+      khi->created = created;
+      khi->max_age = max_age;
+      khi->include_subdomains = include_subdomains;
+    }
+  return true;
+}
+
 static bool
 hsts_store_merge (hsts_store_t store,
                   const char *host, int port,
@@ -281,7 +348,7 @@ hsts_read_database (hsts_store_t store, FILE *fp, bool merge_with_existing_entri
   time_t created, max_age;
   int include_subdomains;
 
-  func = (merge_with_existing_entries ? hsts_store_merge : hsts_new_entry);
+  func = (merge_with_existing_entries ? hsts_store_merge : hsts_store_replay);
 
   while (getline (&line, &len, fp) > 0)
     {
@@ -299,7 +366,10 @@ hsts_read_database (hsts_store_t store, FILE *fp, bool merge_with_existing_entri
                            (unsigned long *) &max_age);
 
       if (items_read == 5)
-        func (store, host, port, created, max_age, !!include_subdomains);
+        {
+          func (store, host, port, created, max_age, !!include_subdomains);
+          store->records++;
+        }
     }
 
   xfree (line);
@@ -312,6 +382,7 @@ static void
 hsts_store_dump (hsts_store_t store, FILE *fp)
 {
   hash_table_iterator it;
+  time_t now = time (NULL);
 
   /* Print preliminary comments. We don't care if any of these fail. */
   fputs ("# HSTS 1.0 Known Hosts database for GNU Wget.\n", fp);
@@ -324,6 +395,9 @@ hsts_store_dump (hsts_store_t store, FILE *fp)
       struct hsts_kh *kh = (struct hsts_kh *) it.key;
       struct hsts_kh_info *khi = (struct hsts_kh_info *) it.value;
 
+      if (khi->created + khi->max_age < now)
+        continue;
+
       if (fprintf (fp, "%s\t%d\t%d\t%lu\t%lu\n",
                    kh->host, kh->explicit_port, khi->include_subdomains,
                    (unsigned long) khi->created,
@@ -335,6 +409,12 @@ hsts_store_dump (hsts_store_t store, FILE *fp)
     }
 }
 
+static void
+hsts_store_dump_cb (FILE *fp, void *store)
+{
+  hsts_store_dump (store, fp);
+}
+
 /*
  * Test:
  *  - The file is a regular file (ie. not a symlink), and
@@ -453,6 +533,7 @@ hsts_store_entry (hsts_store_t store,
           if (max_age == 0)
             {
               hsts_remove_entry (store, kh);
+              hsts_record_removal (store, kh);
               store->changed = true;
             }
           else if (max_age > 0)
@@ -469,6 +550,7 @@ hsts_store_entry (hsts_store_t store,
                   entry->created = t;
                   entry->max_age = max_age;
                   entry->include_subdomains = include_subdomains;
+                  entry->dirty = true;
                   store->changed = true;
                 }
             }
@@ -547,6 +629,72 @@ out:
   return store;
 }
 
+/* Appends the entries changed since the database was read, and the
+   removals, to FP.  Returns the number of lines written.  */
+static int
+hsts_store_append (hsts_store_t store, FILE *fp)
+{
+  hash_table_iterator it;
+  struct hsts_removal *r;
+  int count = 0;
+
+  for (r = store->removals; r; r = r->next, count++)
+    fprintf (fp, "%s\t%d\t0\t%lu\t0\n",
+             r->host, r->explicit_port, (unsigned long) r->when);
+
+  for (hash_table_iterate (store->table, &it); hash_table_iter_next (&it);)
+    {
+      struct hsts_kh *kh = (struct hsts_kh *) it.key;
+      struct hsts_kh_info *khi = (struct hsts_kh_info *) it.value;
+
+      if (!khi->dirty)
+        continue;
+      fprintf (fp, "%s\t%d\t%d\t%lu\t%lu\n",
+               kh->host, kh->explicit_port, khi->include_subdomains,
+               (unsigned long) khi->created,
+               (unsigned long) khi->max_age);
+      khi->dirty = false;
+      count++;
+    }
+
+  return count;
+}
+
+/* With --incremental-save, only the changes are appended to the
+   database, so that saving costs in proportion to them and concurrent
+   Wget processes don't need to merge each other's entries.  When the
+   superseded lines come to outnumber the live ones, the database is
+   rewritten with just the latter.  */
+static bool
+hsts_store_save_incremental (hsts_store_t store, const char *filename)
+{
+  FILE *fp = journal_open (filename);
+
+  if (!fp)
+    return false;
+
+  store->records += hsts_store_append (store, fp);
+  if (store->records > 2 * hash_table_count (store->table) + 64)
+    {
+      struct hsts_store current;
+
+      current.table = hash_table_new (0, hsts_hash_func, hsts_cmp_func);
+      current.records = 0;
+      current.removals = NULL;
+      fflush (fp);
+      fseek (fp, 0, SEEK_SET);
+      hsts_read_database (&current, fp, false);
+      if (journal_replace (filename, hsts_store_dump_cb, &current))
+        store->records = hash_table_count (current.table);
+      hsts_store_close (&current);
+    }
+
+  if (fclose (fp) < 0)
+    logprintf (LOG_NOTQUIET, _("Error closing %s: %s\n"),
+               quote (filename), strerror (errno));
+  return true;
+}
+
 void
 hsts_store_save (hsts_store_t store, const char *filename)
 {
@@ -554,6 +702,11 @@ hsts_store_save (hsts_store_t store, const char *filename)
   FILE *fp = NULL;
   int fd = 0;
 
+  /* Incremental saves need the database to have been read.  */
+  if (filename && opt.incremental_save && store->last_mtime
+      && hsts_store_save_incremental (store, filename))
+    return;
+
   if (filename && hash_table_count (store->table) > 0)
     {
       fp = fopen (filename, "a+");
@@ -604,6 +757,14 @@ hsts_store_close (hsts_store_t store)
     }
 
   hash_table_destroy (store->table);
+
+  while (store->removals)
+    {
+      struct hsts_removal *next = store->removals->next;
+      xfree (store->removals->host);
+      xfree (store->removals);
+      store->removals = next;
+    }
 }
 
 #ifdef TESTING
@@ -825,5 +986,44 @@ test_hsts_read_database (void)
 
   return NULL;
 }
+
+const char*
+test_hsts_read_log (void)
+{
+  hsts_store_t table;
+  char *home = home_dir();
+  char *file = NULL;
+  FILE *fp = NULL;
+  time_t created = time(NULL) - 10;
+
+  if (home)
+    {
+      file = aprintf ("%s/.wget-hsts-testing", home);
+      fp = fopen (file, "w");
+      if (fp)
+        {
+          /* Later lines replace earlier ones, max-age 0 removes.  */
+          fprintf (fp, "foo.example.com\t0\t0\t%lu\t123\n", (unsigned long) created);
+          fprintf (fp, "bar.example.com\t0\t0\t%lu\t456\n", (unsigned long) created);
+          fprintf (fp, "foo.example.com\t0\t1\t%lu\t123\n", (unsigned long) created + 1);
+          fprintf (fp, "bar.example.com\t0\t0\t%lu\t0\n", (unsigned long) created + 1);
+          fclose (fp);
+
+          table = hsts_store_open (file);
+
+          mu_assert("every line should have been read", table->records == 4);
+          TEST_URL_RW (table, "www.foo.example.com", 80);
+          TEST_URL_NORW (table, "bar.example.com", 80);
+
+          hsts_store_close (table);
+          close_hsts_test_store (table);
+          unlink (file);
+        }
+      xfree (file);
+      xfree (home);
+    }
+
+  return NULL;
+}
 #endif /* TESTING */
 #endif /* HAVE_HSTS */
@@ -280,10 +280,19 @@ struct tagstack_item {
   struct tagstack_item *next;
 };
 
+/* The items popped off the tag stack are kept in a list of spares and
+   reused by the following pushes, so that a document costs as many
+   allocations as its deepest nesting of tags rather than one per tag.  */
+
 static struct tagstack_item *
-tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
+tagstack_push (struct tagstack_item **head, struct tagstack_item **tail,
+               struct tagstack_item **spare)
 {
-  struct tagstack_item *ts = xmalloc(sizeof(struct tagstack_item));
+  struct tagstack_item *ts = *spare;
+  if (ts)
+    *spare = ts->next;
+  else
+    ts = xmalloc(sizeof(struct tagstack_item));
   if (*head == NULL)
     {
       *head = *tail = ts;
@@ -300,10 +309,11 @@ tagstack_push (struct tagstack_item **head, struct tagstack_item **tail)
   return ts;
 }
 
-/* remove ts and everything after it from the stack */
+/* remove ts and everything after it from the stack, and put them on
+   the list of spares */
 static void
 tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
-              struct tagstack_item *ts)
+              struct tagstack_item **spare, struct tagstack_item *ts)
 {
   if (*head == NULL)
     return;
@@ -312,14 +322,16 @@ tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
     {
       if (ts == *head)
         {
-          xfree (ts);
+          ts->next = *spare;
+          *spare = ts;
           *head = *tail = NULL;
         }
       else
         {
           ts->prev->next = NULL;
           *tail = ts->prev;
-          xfree (ts);
+          ts->next = *spare;
+          *spare = ts;
         }
     }
   else
@@ -337,12 +349,25 @@ tagstack_pop (struct tagstack_item **head, struct tagstack_item **tail,
       while (ts)
         {
           struct tagstack_item *p = ts->next;
-          xfree (ts);
+          ts->next = *spare;
+          *spare = ts;
           ts = p;
         }
     }
 }
 
+/* free the list of spares */
+static void
+tagstack_free_spares (struct tagstack_item **spare)
+{
+  while (*spare)
+    {
+      struct tagstack_item *p = (*spare)->next;
+      xfree (*spare);
+      *spare = p;
+    }
+}
+
 static struct tagstack_item *
 tagstack_find (struct tagstack_item *tail, const char *tagname_begin,
                const char *tagname_end)
@@ -841,6 +866,7 @@ map_html_tags (const char *text, int size,
 
   struct tagstack_item *head = NULL;
   struct tagstack_item *tail = NULL;
+  struct tagstack_item *spare = NULL;
 
   if (!size)
     return;
@@ -911,7 +937,7 @@ map_html_tags (const char *text, int size,
 
     if (!end_tag)
       {
-        struct tagstack_item *ts = tagstack_push (&head, &tail);
+        struct tagstack_item *ts = tagstack_push (&head, &tail, &spare);
         if (ts)
           {
             ts->tagname_begin  = tag_name_begin;
@@ -1128,7 +1154,7 @@ map_html_tags (const char *text, int size,
                   taginfo.contents_begin = ts->contents_begin;
                   taginfo.contents_end   = tag_start_position;
                 }
-              tagstack_pop (&head, &tail, ts);
+              tagstack_pop (&head, &tail, &spare, ts);
             }
         }
 
@@ -1153,7 +1179,8 @@ map_html_tags (const char *text, int size,
   if (attr_pair_resized)
     xfree (pairs);
   /* pop any tag stack that's left */
-  tagstack_pop (&head, &tail, head);
+  tagstack_pop (&head, &tail, &spare, head);
+  tagstack_free_spares (&spare);
 }
 
 #undef ADVANCE
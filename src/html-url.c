@@ -47,6 +47,7 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "css-url.h"
 #include "c-strcase.h"
+#include "arena.h"
 
 typedef void (*tag_handler_t) (int, struct taginfo *, struct map_context *);
 
@@ -349,7 +350,8 @@ append_url (const char *link_uri, int position, int size,
 
   DEBUGP (("appending %s to urlpos.\n", quote (url->url)));
 
-  newel = xnew0 (struct urlpos);
+  newel = arena_new0 (ctx->arena, struct urlpos);
+  newel->arena = ctx->arena;
   newel->url = url;
   newel->pos = position;
   newel->size = size;
@@ -816,6 +818,7 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
 
   ctx.text = fm->content;
   ctx.head = NULL;
+  ctx.arena = arena_new ();
   ctx.base = NULL;
   ctx.parent_base = url ? url : opt.base_href;
   ctx.document_file = file;
@@ -850,49 +853,84 @@ get_urls_html (const char *file, const char *url, bool *meta_disallow_follow,
   DEBUGP (("no-follow in %s: %d\n", file, ctx.nofollow));
   if (meta_disallow_follow)
     *meta_disallow_follow = ctx.nofollow;
+  DEBUGP (("%s: %ld links allocated in %d blocks.\n", file,
+           arena_object_count (ctx.arena), arena_block_count (ctx.arena)));
 
   xfree (ctx.base);
   wget_read_file_free (fm);
+  if (!ctx.head)
+    arena_free (ctx.arena);
   return ctx.head;
 }
 
 /* This doesn't really have anything to do with HTML, but it's similar
-   to get_urls_html, so we put it here.  */
+   to get_urls_html, so we put it here.
+
+   A file of URLs, one per line, is read a line at a time, and every
+   URL is parsed just before it is retrieved.  That way memory use
+   doesn't grow with the size of the file, the first URL is retrieved
+   without waiting for the rest to be read, and URLs piped to
+   standard input are retrieved as they are written.  */
+
+struct urls_file {
+  char *name;                   /* name of the file, for messages */
+  FILE *fp;
+  char *line;                   /* buffer for the current line */
+  size_t size;                  /* size of the buffer */
+  struct urlpos *last;          /* URL returned last */
+  int count;                    /* number of URLs returned */
+};
 
-struct urlpos *
-get_urls_file (const char *file)
+/* Open FILE for reading URLs from it with urls_file_next.  If FILE is
+   "-", the URLs are read from standard input.  */
+
+struct urls_file *
+urls_file_open (const char *file)
 {
-  struct file_memory *fm;
-  struct urlpos *head, *tail;
-  const char *text, *text_end;
+  struct urls_file *uf;
+  FILE *fp;
 
-  /* Load the file.  */
-  fm = wget_read_file (file);
-  if (!fm)
+  if (HYPHENP (file))
+    fp = stdin;
+  else
+    fp = fopen (file, "r");
+  if (!fp)
     {
       logprintf (LOG_NOTQUIET, "%s: %s\n", file, strerror (errno));
       return NULL;
     }
-  DEBUGP (("Loaded %s (size %s).\n", file, number_to_static_string (fm->length)));
+  DEBUGP (("Reading URLs from %s.\n", file));
+
+  uf = xnew0 (struct urls_file);
+  uf->name = xstrdup (file);
+  uf->fp = fp;
+  return uf;
+}
+
+/* Return the next URL of UF, or NULL at the end of the file.  The
+   URL is valid until the next call.  Empty lines and lines starting
+   with '#' are skipped, and invalid URLs are reported and skipped.  */
+
+struct urlpos *
+urls_file_next (struct urls_file *uf)
+{
+  ssize_t length;
+
+  if (uf->last)
+    {
+      free_urlpos (uf->last);
+      uf->last = NULL;
+    }
 
-  head = tail = NULL;
-  text = fm->content;
-  text_end = fm->content + fm->length;
-  while (text < text_end)
+  while ((length = getline (&uf->line, &uf->size, uf->fp)) > 0)
     {
       int up_error_code;
       char *url_text;
       char *new_url;
-      struct urlpos *entry;
       struct url *url;
 
-      const char *line_beg = text;
-      const char *line_end = memchr (text, '\n', text_end - text);
-      if (!line_end)
-        line_end = text_end;
-      else
-        ++line_end;
-      text = line_end;
+      const char *line_beg = uf->line;
+      const char *line_end = uf->line + length;
 
       /* Strip whitespace from the beginning and end of line. */
       while (line_beg < line_end && c_isspace (*line_beg))
@@ -900,13 +938,11 @@ get_urls_file (const char *file)
       while (line_end > line_beg && c_isspace (*(line_end - 1)))
         --line_end;
 
-      if (line_beg == line_end)
+      /* A URL starting with '#' would only name the base document.  */
+      if (line_beg == line_end || *line_beg == '#')
         continue;
 
       /* The URL is in the [line_beg, line_end) region. */
-
-      /* We must copy the URL to a zero-terminated string, and we
-         can't use alloca because we're in a loop.  *sigh*.  */
       url_text = strdupdelim (line_beg, line_end);
 
       if (opt.base_href)
@@ -929,7 +965,7 @@ get_urls_file (const char *file)
         {
           char *error = url_error (url_text, up_error_code);
           logprintf (LOG_NOTQUIET, _("%s: Invalid URL %s: %s\n"),
-                     file, url_text, error);
+                     uf->name, url_text, error);
           xfree (url_text);
           xfree (error);
           inform_exit_status (URLERROR);
@@ -937,17 +973,30 @@ get_urls_file (const char *file)
         }
       xfree (url_text);
 
-      entry = xnew0 (struct urlpos);
-      entry->url = url;
-
-      if (!head)
-        head = entry;
-      else
-        tail->next = entry;
-      tail = entry;
+      uf->last = xnew0 (struct urlpos);
+      uf->last->url = url;
+      ++uf->count;
+      return uf->last;
     }
-  wget_read_file_free (fm);
-  return head;
+
+  if (ferror (uf->fp))
+    logprintf (LOG_NOTQUIET, "%s: %s\n", uf->name, strerror (errno));
+  return NULL;
+}
+
+/* Close UF and free the memory it holds.  */
+
+void
+urls_file_close (struct urls_file *uf)
+{
+  DEBUGP (("Read %d URLs from %s.\n", uf->count, uf->name));
+  if (uf->last)
+    free_urlpos (uf->last);
+  if (uf->fp != stdin)
+    fclose (uf->fp);
+  xfree (uf->line);
+  xfree (uf->name);
+  xfree (uf);
 }
 
 void
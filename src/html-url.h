@@ -41,9 +41,12 @@ struct map_context {
                                    <meta name=robots> tag. */
 
   struct urlpos *head;          /* List of URLs that is being built. */
+  struct arena *arena;          /* Arena the list is allocated from. */
 };
 
-struct urlpos *get_urls_file (const char *);
+struct urls_file *urls_file_open (const char *);
+struct urlpos *urls_file_next (struct urls_file *);
+void urls_file_close (struct urls_file *);
 struct urlpos *get_urls_html (const char *, const char *, bool *, struct iri *);
 struct urlpos *append_url (const char *, int, int, struct map_context *);
 void free_urlpos (struct urlpos *);
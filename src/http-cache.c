@@ -0,0 +1,365 @@
+/* Persistent cache of HTTP responses.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --http-cache, the responses to GET requests that may be stored
+   are kept in a directory, where later runs look them up by URL.  A
+   response that is still fresh by the rules of RFC 9111 is read from
+   the cache instead of the network.  A stale one is revalidated with
+   a conditional request, and read from the cache if the server
+   answers 304 Not Modified.
+
+   Every entry consists of two files named after the SHA-256 digest of
+   the URL.  NAME.data holds the response exactly as it was received,
+   headers included, so that it is read back by the same code as
+   responses coming from the network.  NAME.meta describes it with
+   lines of keywords and values:
+
+     url https://example.com/artifact.tar.gz
+     time 1429176373
+     lifetime 3600
+     age 0
+     etag "5e1f-52a3b9"
+     last-modified Thu, 16 Apr 2015 09:26:13 GMT
+     vary accept-encoding: identity
+
+   The freshness lifetime and the age of a response are computed by
+   http.c from its headers when it is received, so that only the time
+   it has spent in the cache has to be added to the age later.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "utils.h"
+#include "connect.h"
+#include "url.h"
+#include "sha256.h"
+#include "http-cache.h"
+
+/* Returns the name of the file holding the part SUFFIX of the entry
+   for URL.  */
+static char *
+entry_file (const char *url, const char *suffix)
+{
+  unsigned char digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+
+  sha256_buffer (url, strlen (url), digest);
+  wg_hex_to_string (hex, (const char *) digest, SHA256_DIGEST_SIZE);
+  return aprintf ("%s/%s%s", opt.http_cache, hex, suffix);
+}
+
+/* Stored responses are read through the transport layer like
+   sockets, so they have to support peeking.  */
+
+static int
+cache_read (int fd, char *buf, int bufsize, void *ctx _GL_UNUSED)
+{
+  int res;
+  do
+    res = read (fd, buf, bufsize);
+  while (res == -1 && errno == EINTR);
+  return res;
+}
+
+static int
+cache_poll (int fd _GL_UNUSED, double timeout _GL_UNUSED,
+            int wait_for _GL_UNUSED, void *ctx _GL_UNUSED)
+{
+  return 1;
+}
+
+static int
+cache_peek (int fd, char *buf, int bufsize, void *ctx)
+{
+  int res = cache_read (fd, buf, bufsize, ctx);
+  if (res > 0 && lseek (fd, -res, SEEK_CUR) < 0)
+    return -1;
+  return res;
+}
+
+static void
+cache_close (int fd, void *ctx _GL_UNUSED)
+{
+  close (fd);
+}
+
+static struct transport_implementation cache_transport =
+{
+  cache_read, NULL, cache_poll, cache_peek, NULL, cache_close
+};
+
+/* Returns a new entry for URL, describing nothing yet.  */
+struct http_cache_entry *
+http_cache_entry_new (const char *url)
+{
+  struct http_cache_entry *e = xnew0 (struct http_cache_entry);
+  e->url = xstrdup (url);
+  return e;
+}
+
+void
+http_cache_entry_free (struct http_cache_entry *e)
+{
+  if (!e)
+    return;
+  if (e->fp)
+    http_cache_store_end (e, false);
+  xfree (e->url);
+  xfree (e->etag);
+  xfree (e->last_modified);
+  free_vec (e->vary);
+  xfree (e);
+}
+
+/* Returns the entry stored for URL, or NULL if there is none.  */
+struct http_cache_entry *
+http_cache_lookup (const char *url)
+{
+  struct http_cache_entry *e;
+  char *file, *line = NULL;
+  size_t bufsize = 0;
+  ssize_t len;
+  bool url_matches = false;
+  FILE *fp;
+
+  file = entry_file (url, ".meta");
+  fp = fopen (file, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        logprintf (LOG_NOTQUIET, _("Cannot open HTTP cache entry %s: %s\n"),
+                   quote (file), strerror (errno));
+      xfree (file);
+      return NULL;
+    }
+
+  e = http_cache_entry_new (url);
+  while ((len = getline (&line, &bufsize, fp)) > 0)
+    {
+      char *value;
+
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+      value = strchr (line, ' ');
+      if (!value)
+        continue;
+      *value++ = '\0';
+
+      if (!strcmp (line, "url"))
+        url_matches = !strcmp (value, url);
+      else if (!strcmp (line, "time"))
+        e->response_time = strtol (value, NULL, 10);
+      else if (!strcmp (line, "lifetime"))
+        e->lifetime = strtol (value, NULL, 10);
+      else if (!strcmp (line, "age"))
+        e->initial_age = strtol (value, NULL, 10);
+      else if (!strcmp (line, "etag"))
+        {
+          xfree (e->etag);
+          e->etag = xstrdup (value);
+        }
+      else if (!strcmp (line, "last-modified"))
+        {
+          xfree (e->last_modified);
+          e->last_modified = xstrdup (value);
+        }
+      else if (!strcmp (line, "vary"))
+        e->vary = vec_append (e->vary, value);
+    }
+  xfree (line);
+  fclose (fp);
+
+  if (!url_matches)
+    {
+      DEBUGP (("HTTP cache entry %s is not for %s.\n", file, url));
+      http_cache_entry_free (e);
+      e = NULL;
+    }
+  xfree (file);
+  return e;
+}
+
+/* Whether the response stored in E may still be used without asking
+   the server.  */
+bool
+http_cache_fresh_p (const struct http_cache_entry *e)
+{
+  long resident_time = time (NULL) - e->response_time;
+
+  if (resident_time < 0)
+    resident_time = 0;
+  return e->lifetime > e->initial_age + resident_time;
+}
+
+/* Opens the response stored in E for reading with fd_read and
+   friends.  Returns the file descriptor, or -1 on error.  */
+int
+http_cache_open (const struct http_cache_entry *e)
+{
+  char *file = entry_file (e->url, ".data");
+  int fd = open (file, O_RDONLY | O_BINARY);
+
+  if (fd < 0)
+    logprintf (LOG_NOTQUIET, _("Cannot open HTTP cache entry %s: %s\n"),
+               quote (file), strerror (errno));
+  else
+    fd_register_transport (fd, &cache_transport, NULL);
+  xfree (file);
+  return fd;
+}
+
+/* Writes the description of E, replacing the stored one.  */
+void
+http_cache_update (const struct http_cache_entry *e)
+{
+  char *file = entry_file (e->url, ".meta");
+  char *tmp = aprintf ("%s.tmp", file);
+  char **v;
+  bool ok;
+  FILE *fp;
+
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write to HTTP cache entry %s: %s\n"),
+                 quote (tmp), strerror (errno));
+      goto out;
+    }
+
+  fprintf (fp, "url %s\n", e->url);
+  fprintf (fp, "time %ld\n", (long) e->response_time);
+  fprintf (fp, "lifetime %ld\n", e->lifetime);
+  fprintf (fp, "age %ld\n", e->initial_age);
+  if (e->etag)
+    fprintf (fp, "etag %s\n", e->etag);
+  if (e->last_modified)
+    fprintf (fp, "last-modified %s\n", e->last_modified);
+  for (v = e->vary; v && *v; v++)
+    fprintf (fp, "vary %s\n", *v);
+
+  ok = !ferror (fp);
+  if (fclose (fp) != 0)
+    ok = false;
+  if (!ok || rename (tmp, file) != 0)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write to HTTP cache entry %s: %s\n"),
+                 quote (file), strerror (errno));
+      unlink (tmp);
+    }
+
+ out:
+  xfree (tmp);
+  xfree (file);
+}
+
+/* Removes the entry E from the cache.  */
+void
+http_cache_remove (const struct http_cache_entry *e)
+{
+  char *file = entry_file (e->url, ".meta");
+  unlink (file);
+  xfree (file);
+
+  file = entry_file (e->url, ".data");
+  unlink (file);
+  xfree (file);
+}
+
+/* Starts storing a response to the URL of E, whose headers are HEAD.
+   Its body is then written to E->fp as it is received.  */
+bool
+http_cache_store_begin (struct http_cache_entry *e, const char *head)
+{
+  char *file = entry_file (e->url, ".data.tmp");
+
+  if (mkalldirs (file) == 0)
+    {
+      e->fp = fopen (file, "wb");
+      if (!e->fp && errno == ENOENT && mkalldirs_again (file) == 0)
+        e->fp = fopen (file, "wb");
+    }
+  if (!e->fp)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write to HTTP cache entry %s: %s\n"),
+                 quote (file), strerror (errno));
+      xfree (file);
+      return false;
+    }
+  fputs (head, e->fp);
+  xfree (file);
+  return true;
+}
+
+/* Finishes storing the response to the URL of E.  Unless COMPLETE,
+   the response has not been received in full and is discarded.  */
+void
+http_cache_store_end (struct http_cache_entry *e, bool complete)
+{
+  char *tmp = entry_file (e->url, ".data.tmp");
+  bool ok = complete && !ferror (e->fp);
+
+  if (fclose (e->fp) != 0)
+    ok = false;
+  e->fp = NULL;
+
+  if (ok)
+    {
+      char *meta = entry_file (e->url, ".meta");
+      char *data = entry_file (e->url, ".data");
+
+      /* Without its description, the old response is not used while
+         being replaced.  */
+      unlink (meta);
+      if (rename (tmp, data) == 0)
+        {
+          http_cache_update (e);
+          DEBUGP (("Stored the response for %s in the HTTP cache.\n",
+                   e->url));
+        }
+      else
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("Cannot write to HTTP cache entry %s: %s\n"),
+                     quote (data), strerror (errno));
+          ok = false;
+        }
+      xfree (meta);
+      xfree (data);
+    }
+  if (!ok)
+    unlink (tmp);
+  xfree (tmp);
+}
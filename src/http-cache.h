@@ -0,0 +1,63 @@
+/* Declarations for http-cache.c.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* What the cache knows about a stored response, apart from the
+   response itself.  */
+struct http_cache_entry
+{
+  char *url;                    /* the URL the response is for */
+  time_t response_time;         /* when the response was received */
+  long lifetime;                /* its freshness lifetime, in seconds */
+  long initial_age;             /* its age when it was received */
+  char *etag;                   /* validators for conditional requests */
+  char *last_modified;
+  char **vary;                  /* "name: value" of the request headers
+                                   it was selected by, NULL-terminated */
+  FILE *fp;                     /* response being stored, if any */
+};
+
+struct http_cache_entry *http_cache_entry_new (const char *);
+void http_cache_entry_free (struct http_cache_entry *);
+
+struct http_cache_entry *http_cache_lookup (const char *);
+bool http_cache_fresh_p (const struct http_cache_entry *);
+int http_cache_open (const struct http_cache_entry *);
+void http_cache_update (const struct http_cache_entry *);
+void http_cache_remove (const struct http_cache_entry *);
+
+bool http_cache_store_begin (struct http_cache_entry *, const char *);
+void http_cache_store_end (struct http_cache_entry *, bool);
+
+#endif /* HTTP_CACHE_H */
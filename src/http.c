@@ -49,6 +49,7 @@ as that of the covered work.  */
 #include "host.h"
 #include "retr.h"
 #include "connect.h"
+#include "http2.h"
 #include "netrc.h"
 #ifdef HAVE_SSL
 # include "ssl.h"
@@ -60,9 +61,12 @@ as that of the covered work.  */
 #include "md5.h"
 #include "convert.h"
 #include "spider.h"
+#include "res.h"
 #include "warc.h"
 #include "c-strcase.h"
 #include "version.h"
+#include "http-cache.h"
+#include "timing.h"
 #ifdef HAVE_METALINK
 # include "metalink.h"
 # include "xstrndup.h"
@@ -313,21 +317,33 @@ request_remove_header (struct request *req, const char *name)
   return false;
 }
 
+/* Return the value of the header with specified name in REQ, or NULL
+   if there is no such header.  */
+
+static const char *
+request_get_header (const struct request *req, const char *name)
+{
+  int i;
+  for (i = 0; i < req->hcount; i++)
+    if (0 == c_strcasecmp (name, req->headers[i].name))
+      return req->headers[i].value;
+  return NULL;
+}
+
 #define APPEND(p, str) do {                     \
   int A_len = strlen (str);                     \
   memcpy (p, str, A_len);                       \
   p += A_len;                                   \
 } while (0)
 
-/* Construct the request and write it to FD using fd_write.
-   If warc_tmp is set to a file pointer, the request string will
-   also be written to that file. */
+/* Construct the request.  Return it as a freshly allocated string,
+   and store its length to SIZE_REF.  */
 
-static int
-request_send (const struct request *req, int fd, FILE *warc_tmp)
+static char *
+request_format (const struct request *req, int *size_ref)
 {
   char *request_string, *p;
-  int i, size, write_error;
+  int i, size;
 
   /* Count the request size. */
   size = 0;
@@ -367,19 +383,32 @@ request_send (const struct request *req, int fd, FILE *warc_tmp)
 
 #undef APPEND
 
+  *size_ref = size - 1;
+  return request_string;
+}
+
+/* Construct the request and write it to FD using fd_write.
+   If warc_tmp is set to a file pointer, the request string will
+   also be written to that file. */
+
+static int
+request_send (const struct request *req, int fd, FILE *warc_tmp)
+{
+  int size, write_error;
+  char *request_string = request_format (req, &size);
+
   DEBUGP (("\n---request begin---\n%s---request end---\n", request_string));
 
   /* Send the request to the server. */
 
-  write_error = fd_write (fd, request_string, size - 1, -1);
+  write_error = fd_write (fd, request_string, size, -1);
   if (write_error < 0)
     logprintf (LOG_VERBOSE, _("Failed writing HTTP request: %s.\n"),
                fd_errstr (fd));
   else if (warc_tmp != NULL)
     {
       /* Write a copy of the data to the WARC record. */
-      int warc_tmp_written = fwrite (request_string, 1, size - 1, warc_tmp);
-      if (warc_tmp_written != size - 1)
+      if (!warc_tempfile_write (warc_tmp, request_string, size))
         write_error = -2;
     }
   xfree (request_string);
@@ -494,8 +523,7 @@ body_file_send (int sock, const char *file_name, wgint promised_size, FILE *warc
       if (warc_tmp != NULL)
         {
           /* Write a copy of the data to the WARC record. */
-          int warc_tmp_written = fwrite (chunk, 1, towrite, warc_tmp);
-          if (warc_tmp_written != towrite)
+          if (!warc_tempfile_write (warc_tmp, chunk, towrite))
             {
               fclose (fp);
               return -2;
@@ -1493,7 +1521,13 @@ persistent_available_p (const char *host, int port, bool ssl,
      body in response to HEAD, or if it sends more than conent-length
      data, we won't reuse the corrupted connection.)  */
 
+#ifdef HAVE_NGHTTP2
+  if (http2_connection_p (pconn.socket)
+      ? !http2_connection_open (pconn.socket)
+      : !test_socket_open (pconn.socket))
+#else
   if (!test_socket_open (pconn.socket))
+#endif
     {
       /* Oops, the socket is no longer open.  Now that we know that,
          let's invalidate the persistent connection before returning
@@ -1548,6 +1582,7 @@ struct http_stat
   char *rderrmsg;               /* error message from read error */
   char *newloc;                 /* new location (redirection) */
   char *remote_time;            /* remote time-stamp string */
+  char *etag;                   /* entity tag of the remote file */
   char *error;                  /* textual HTTP error */
   int statcode;                 /* status code */
   char *message;                /* status message */
@@ -1566,6 +1601,7 @@ struct http_stat
   wgint orig_file_size;         /* size of file to compare for time-stamping */
   time_t orig_file_tstamp;      /* time-stamp of file to compare for
                                  * time-stamping */
+  char *orig_file_etag;         /* entity tag stored with that file */
 #ifdef HAVE_METALINK
   metalink_t *metalink;
 #endif
@@ -1577,10 +1613,12 @@ free_hstat (struct http_stat *hs)
 {
   xfree (hs->newloc);
   xfree (hs->remote_time);
+  xfree (hs->etag);
   xfree (hs->error);
   xfree (hs->rderrmsg);
   xfree (hs->local_file);
   xfree (hs->orig_file_name);
+  xfree (hs->orig_file_etag);
   xfree (hs->message);
 #ifdef HAVE_METALINK
   metalink_delete (hs->metalink);
@@ -1626,9 +1664,10 @@ static int
 read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
                     wgint contrange, bool chunked_transfer_encoding,
                     char *url, char *warc_timestamp_str, char *warc_request_uuid,
-                    ip_address *warc_ip, char *type, int statcode, char *head)
+                    ip_address *warc_ip, char *type, int statcode, char *head,
+                    FILE *cache_fp)
 {
-  int warc_payload_offset = 0;
+  off_t warc_payload_offset = 0;
   FILE *warc_tmp = NULL;
   int warcerr = 0;
   int flags = 0;
@@ -1644,17 +1683,15 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
       if (warcerr == 0)
         {
           /* We should keep the response headers for the WARC record.  */
-          int head_len = strlen (head);
-          int warc_tmp_written = fwrite (head, 1, head_len, warc_tmp);
-          if (warc_tmp_written != head_len)
+          if (!warc_tempfile_write (warc_tmp, head, strlen (head)))
             warcerr = WARC_TMP_FWRITEERR;
-          warc_payload_offset = head_len;
+          warc_payload_offset = warc_tempfile_start_payload (warc_tmp);
         }
 
       if (warcerr != 0)
         {
           if (warc_tmp != NULL)
-            fclose (warc_tmp);
+            warc_tempfile_close (warc_tmp);
           return warcerr;
         }
     }
@@ -1684,10 +1721,12 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
   hs->rd_size = 0;
   /* Download the response body and write it to fp.
      If we are working on a WARC file, we simultaneously write the
-     response body to warc_tmp.  */
+     response body to warc_tmp.  Responses are never stored in both a
+     WARC file and the HTTP cache, which takes the body as it was
+     received, too.  */
   hs->res = fd_read_body (hs->local_file, sock, fp, contlen != -1 ? contlen : 0,
                           hs->restval, &hs->rd_size, &hs->len, &hs->dltime,
-                          flags, warc_tmp);
+                          flags, warc_tmp ? warc_tmp : cache_fp);
   if (hs->res >= 0)
     {
       if (warc_tmp != NULL)
@@ -1711,7 +1750,7 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     }
 
   if (warc_tmp != NULL)
-    fclose (warc_tmp);
+    warc_tempfile_close (warc_tmp);
 
   if (hs->res == -2)
     {
@@ -1720,8 +1759,8 @@ read_response_body (struct http_stat *hs, int sock, FILE *fp, wgint contlen,
     }
   else if (hs->res == -3)
     {
-      /* Error while writing to warc_tmp. */
-      return WARC_TMP_FWRITEERR;
+      /* Error while writing to warc_tmp, or to the HTTP cache. */
+      return warc_tmp ? WARC_TMP_FWRITEERR : FWRITEERR;
     }
   else
     {
@@ -1865,6 +1904,11 @@ initialize_request (const struct url *u, struct http_stat *hs, int *dt, struct u
           strcpy (strtime, "Thu, 01 Jan 1970 00:00:00 GMT");
         }
       request_set_header (req, "If-Modified-Since", xstrdup (strtime), rel_value);
+
+      /* Servers that compare entity tags can tell a changed file from
+         an unchanged one even when its time-stamp is unreliable.  */
+      if (hs->orig_file_etag)
+        request_set_header (req, "If-None-Match", hs->orig_file_etag, rel_none);
     }
   if (hs->restval)
     request_set_header (req, "Range",
@@ -1977,6 +2021,33 @@ initialize_request (const struct url *u, struct http_stat *hs, int *dt, struct u
   return req;
 }
 
+/* Add the cookies to send to U and the headers given by the user to
+   REQ.  */
+
+static void
+set_cookie_and_user_headers (struct request *req, const struct url *u)
+{
+  if (opt.cookies)
+    request_set_header (req, "Cookie",
+                        cookie_header (wget_cookie_jar,
+                                       u->host, u->port, u->path,
+#ifdef HAVE_SSL
+                                       u->scheme == SCHEME_HTTPS
+#else
+                                       0
+#endif
+                                       ),
+                        rel_value);
+
+  /* Add the user headers. */
+  if (opt.user_headers)
+    {
+      int i;
+      for (i = 0; opt.user_headers[i]; i++)
+        request_set_user_header (req, opt.user_headers[i]);
+    }
+}
+
 static void
 initialize_proxy_configuration (const struct url *u, struct request *req,
                                 struct url *proxy, char **proxyauth)
@@ -2168,7 +2239,19 @@ establish_connection (const struct url *u, const struct url **conn_ref,
 
       if (conn->scheme == SCHEME_HTTPS)
         {
-          if (!ssl_connect_wget (sock, u->host, NULL))
+#ifdef HAVE_NGHTTP2
+          /* WARC records hold the messages as sent and received; those
+             of HTTP/2 would be made up from the frames.  */
+          bool http2 = opt.http2 && !opt.warc_filename;
+#else
+          bool http2 = false;
+#endif
+          bool ok;
+
+          timing_start (TIMING_TLS);
+          ok = ssl_connect_wget (sock, u->host, NULL, http2);
+          timing_stop (TIMING_TLS);
+          if (!ok)
             {
               CLOSE_INVALIDATE (sock);
               return CONSSLERR;
@@ -2179,6 +2262,16 @@ establish_connection (const struct url *u, const struct url **conn_ref,
               return VERIFCERTERR;
             }
           *using_ssl = true;
+#ifdef HAVE_NGHTTP2
+          /* The server has agreed to HTTP/2, which from now on is
+             spoken on SOCK in place of the HTTP/1.1 we write and
+             read.  */
+          if (http2 && ssl_http2_selected (sock) && !http2_start (sock))
+            {
+              CLOSE_INVALIDATE (sock);
+              return CONERROR;
+            }
+#endif
         }
 #endif /* HAVE_SSL */
     }
@@ -2470,9 +2563,12 @@ open_output_stream (struct http_stat *hs, int count, FILE **fp)
   /* Open the local file.  */
   if (!output_stream)
     {
+      bool dirs_made_again = false;
+
       mkalldirs (hs->local_file);
       if (opt.backups)
         rotate_backups (hs->local_file);
+    reopen:
       if (hs->restval)
         {
 #ifdef __VMS
@@ -2504,7 +2600,8 @@ open_output_stream (struct http_stat *hs, int count, FILE **fp)
 #else /* def __VMS */
           if (hs->temporary)
             {
-              *fp = fdopen (open (hs->local_file, O_BINARY | O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR), "wb");
+              int fd = open (hs->local_file, O_BINARY | O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+              *fp = fd < 0 ? NULL : fdopen (fd, "wb");
             }
           else
             {
@@ -2528,6 +2625,14 @@ open_output_stream (struct http_stat *hs, int count, FILE **fp)
               return FOPEN_EXCL_ERR;
             }
         }
+      if (!*fp && errno == ENOENT && !dirs_made_again)
+        {
+          /* The directory was removed since mkalldirs saw it.  */
+          dirs_made_again = true;
+          if (mkalldirs_again (hs->local_file) == 0)
+            goto reopen;
+          errno = ENOENT;
+        }
       if (!*fp)
         {
           logprintf (LOG_NOTQUIET, "%s: %s\n", hs->local_file, strerror (errno));
@@ -3070,6 +3175,142 @@ fail:
 }
 #endif /* HAVE_METALINK */
 
+/* The longest freshness lifetime guessed for a response without an
+   explicit expiration time.  RFC 9111 asks caches to warn about older
+   responses that are only fresh by such a guess.  */
+#define CACHE_HEURISTIC_LIFETIME_MAX (24 * 60 * 60)
+
+/* Compute the freshness lifetime of RESP, received at RESPONSE_TIME
+   in answer to a request sent at REQUEST_TIME, and its age at that
+   time, as described in RFC 9111, section 4.2.  Return false if RESP
+   may not be stored in the HTTP cache at all.  */
+static bool
+cache_freshness (const struct response *resp, time_t request_time,
+                 time_t response_time, long *lifetime, long *age)
+{
+  param_token name, value;
+  const char *b, *e;
+  char hdrval[256];
+  time_t date = (time_t) -1, expires, last_modified;
+  long max_age = -1, age_value = 0, apparent_age, corrected_age;
+  bool no_cache = false;
+  int i;
+
+  for (i = 0;
+       (i = resp_header_locate (resp, "Cache-Control", i, &b, &e)) != -1;
+       ++i)
+    {
+      char *cache_control;
+      const char *p;
+      BOUNDED_TO_ALLOCA (b, e, cache_control);
+      for (p = cache_control;
+           extract_param (&p, &name, &value, ',', NULL);
+           )
+        {
+          if (BOUNDED_EQUAL_NO_CASE (name.b, name.e, "no-store"))
+            return false;
+          else if (BOUNDED_EQUAL_NO_CASE (name.b, name.e, "no-cache"))
+            no_cache = true;
+          else if (BOUNDED_EQUAL_NO_CASE (name.b, name.e, "max-age")
+                   && value.b)
+            max_age = strtol (value.b, NULL, 10);
+        }
+    }
+
+  if (resp_header_copy (resp, "Date", hdrval, sizeof (hdrval)))
+    date = http_atotm (hdrval);
+  if (date == (time_t) -1)
+    date = response_time;
+
+  if (no_cache)
+    *lifetime = 0;
+  else if (max_age >= 0)
+    *lifetime = max_age;
+  else if (resp_header_copy (resp, "Expires", hdrval, sizeof (hdrval)))
+    {
+      /* Invalid dates, such as "0", mean that it has already expired.  */
+      expires = http_atotm (hdrval);
+      *lifetime = (expires != (time_t) -1 && expires > date
+                   ? expires - date : 0);
+    }
+  else if (resp_header_copy (resp, "Last-Modified", hdrval, sizeof (hdrval))
+           && (last_modified = http_atotm (hdrval)) != (time_t) -1
+           && last_modified < date)
+    *lifetime = MIN ((date - last_modified) / 10,
+                     CACHE_HEURISTIC_LIFETIME_MAX);
+  else
+    *lifetime = 0;
+
+  if (resp_header_copy (resp, "Age", hdrval, sizeof (hdrval)))
+    age_value = MAX (strtol (hdrval, NULL, 10), 0);
+  apparent_age = MAX (response_time - date, 0);
+  corrected_age = age_value + (response_time - request_time);
+  *age = MAX (apparent_age, corrected_age);
+  return true;
+}
+
+/* Record in ENTRY the values of the headers of REQ that the server
+   selected RESP by, as listed in its Vary headers.  Return false if
+   RESP varies on something other than request headers, and may not be
+   stored in the HTTP cache.  */
+static bool
+cache_set_vary (struct http_cache_entry *entry, const struct response *resp,
+                const struct request *req)
+{
+  param_token name, value;
+  const char *b, *e;
+  int i;
+
+  for (i = 0; (i = resp_header_locate (resp, "Vary", i, &b, &e)) != -1; ++i)
+    {
+      char *vary;
+      const char *p;
+      BOUNDED_TO_ALLOCA (b, e, vary);
+      for (p = vary; extract_param (&p, &name, &value, ',', NULL); )
+        {
+          char *header, *selected, *q;
+          const char *hvalue;
+
+          if (BOUNDED_EQUAL (name.b, name.e, "*"))
+            return false;
+          header = strdupdelim (name.b, name.e);
+          for (q = header; *q; q++)
+            *q = c_tolower (*q);
+          hvalue = request_get_header (req, header);
+          selected = aprintf ("%s: %s", header, hvalue ? hvalue : "");
+          entry->vary = vec_append (entry->vary, selected);
+          xfree (selected);
+          xfree (header);
+        }
+    }
+  return true;
+}
+
+/* Whether REQ would select the response stored in ENTRY, because the
+   request headers the response varies on have the same values as in
+   the request it was stored for.  */
+static bool
+cache_vary_matches (const struct http_cache_entry *entry,
+                    const struct request *req)
+{
+  char **v;
+
+  for (v = entry->vary; v && *v; v++)
+    {
+      const char *sep = strchr (*v, ':');
+      const char *hvalue;
+      char *header;
+
+      if (!sep || sep[1] != ' ')
+        return false;
+      BOUNDED_TO_ALLOCA (*v, sep, header);
+      hvalue = request_get_header (req, header);
+      if (strcmp (sep + 2, hvalue ? hvalue : ""))
+        return false;
+    }
+  return true;
+}
+
 /* Retrieve a document through HTTP protocol.  It recognizes status
    code, and correctly handles redirections.  It closes the network
    socket.  If it receives an error from the functions below it, it
@@ -3089,7 +3330,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   char *type = NULL;
   char *user, *passwd;
   char *proxyauth;
-  int statcode;
+  int statcode = 0;
   int write_error;
   wgint contlen, contrange;
   const struct url *conn;
@@ -3132,6 +3373,18 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   /* Whether conditional get request will be issued.  */
   bool cond_get = !!(*dt & IF_MODIFIED_SINCE);
 
+  /* Whether the response may be read from, or stored in, the HTTP
+     cache; the entry found there, if any, and whether it is being
+     revalidated; whether the response is read from the cache, and the
+     entry it is stored in, if any.  */
+  bool cacheable = false;
+  bool cache_checked = false;
+  struct http_cache_entry *cache_entry = NULL;
+  bool cache_revalidate = false;
+  bool from_cache = false;
+  struct http_cache_entry *cache_store = NULL;
+  time_t request_time = 0, response_time;
+
 #ifdef HAVE_METALINK
   /* Are we looking for metalink info in HTTP headers?  */
   bool metalink = !!(*dt & METALINK_METADATA);
@@ -3180,13 +3433,17 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
 #endif /* HAVE_SSL */
 
+  timing_begin ();
+
   /* Initialize certain elements of struct http_stat.  */
   hs->len = 0;
+  hs->rd_size = 0;
   hs->contlen = -1;
   hs->res = -1;
   hs->rderrmsg = NULL;
   hs->newloc = NULL;
   xfree (hs->remote_time);
+  xfree (hs->etag);
   hs->error = NULL;
   hs->message = NULL;
 
@@ -3203,29 +3460,53 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         goto cleanup;
       }
   }
+  cacheable = opt.http_cache && !warc_enabled && hs->restval == 0
+    && !strcmp (request_method (req), "GET");
+
  retry_with_auth:
   /* We need to come back here when the initial attempt to retrieve
      without authorization header fails.  (Expected to happen at least
      for the Digest authorization scheme.)  */
 
-  if (opt.cookies)
-    request_set_header (req, "Cookie",
-                        cookie_header (wget_cookie_jar,
-                                       u->host, u->port, u->path,
-#ifdef HAVE_SSL
-                                       u->scheme == SCHEME_HTTPS
-#else
-                                       0
-#endif
-                                       ),
-                        rel_value);
+  set_cookie_and_user_headers (req, u);
 
-  /* Add the user headers. */
-  if (opt.user_headers)
+  /* Look the response up in the HTTP cache.  A fresh one is read from
+     there, a stale one is revalidated.  */
+  if (cacheable && !cache_checked)
     {
-      int i;
-      for (i = 0; opt.user_headers[i]; i++)
-        request_set_user_header (req, opt.user_headers[i]);
+      cache_checked = true;
+      cache_entry = http_cache_lookup (u->url);
+      if (cache_entry && !cache_vary_matches (cache_entry, req))
+        {
+          DEBUGP (("The cached response was selected by other headers.\n"));
+          http_cache_entry_free (cache_entry);
+          cache_entry = NULL;
+        }
+
+      if (cache_entry && !(*dt & SEND_NOCACHE)
+          && http_cache_fresh_p (cache_entry))
+        {
+          sock = http_cache_open (cache_entry);
+          if (sock >= 0)
+            {
+              logputs (LOG_VERBOSE,
+                       _("Reading fresh response from the HTTP cache... "));
+              keep_alive = false;
+              from_cache = true;
+              goto read_response;
+            }
+        }
+      else if (cache_entry && !cond_get
+               && (cache_entry->etag || cache_entry->last_modified))
+        {
+          if (cache_entry->etag)
+            request_set_header (req, "If-None-Match", cache_entry->etag,
+                                rel_none);
+          if (cache_entry->last_modified)
+            request_set_header (req, "If-Modified-Since",
+                                cache_entry->last_modified, rel_none);
+          cache_revalidate = true;
+        }
     }
 
   proxyauth = NULL;
@@ -3269,6 +3550,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
 
   /* Send the request to server.  */
+  request_time = time (NULL);
   write_error = request_send (req, sock, warc_tmp);
 
   if (write_error >= 0)
@@ -3279,14 +3561,12 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
           write_error = fd_write (sock, opt.body_data, body_data_size, -1);
           if (write_error >= 0 && warc_tmp != NULL)
             {
-              int warc_tmp_written;
-
               /* Remember end of headers / start of payload. */
-              warc_payload_offset = ftello (warc_tmp);
+              warc_payload_offset = warc_tempfile_start_payload (warc_tmp);
 
               /* Write a copy of the data to the WARC record. */
-              warc_tmp_written = fwrite (opt.body_data, 1, body_data_size, warc_tmp);
-              if (warc_tmp_written != body_data_size)
+              if (!warc_tempfile_write (warc_tmp, opt.body_data,
+                                        body_data_size))
                 write_error = -2;
             }
          }
@@ -3294,7 +3574,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         {
           if (warc_tmp != NULL)
             /* Remember end of headers / start of payload */
-            warc_payload_offset = ftello (warc_tmp);
+            warc_payload_offset = warc_tempfile_start_payload (warc_tmp);
 
           write_error = body_file_send (sock, opt.body_file, body_data_size, warc_tmp);
         }
@@ -3305,7 +3585,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
       CLOSE_INVALIDATE (sock);
 
       if (warc_tmp != NULL)
-        fclose (warc_tmp);
+        warc_tempfile_close (warc_tmp);
 
       if (write_error == -2)
         retval = WARC_TMP_FWRITEERR;
@@ -3315,6 +3595,8 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
   logprintf (LOG_VERBOSE, _("%s request sent, awaiting response... "),
              proxy ? "Proxy" : "HTTP");
+  timing_start (TIMING_TTFB);
+ read_response:
   contlen = -1;
   contrange = 0;
   *dt &= ~RETROKF;
@@ -3399,6 +3681,8 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
       }
     while (_repeat);
   }
+  timing_stop (TIMING_TTFB);
+  response_time = time (NULL);
 
   xfree (hs->message);
   hs->message = xstrdup (message);
@@ -3490,6 +3774,39 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
     }
 #endif
 
+  if (cache_revalidate && statcode == HTTP_STATUS_NOT_MODIFIED)
+    {
+      /* The cached response is still valid.  Update its freshness from
+         this response, and read it from the cache.  */
+      long lifetime, age;
+
+      if (cache_freshness (resp, request_time, response_time,
+                           &lifetime, &age))
+        {
+          cache_entry->response_time = response_time;
+          cache_entry->lifetime = lifetime;
+          cache_entry->initial_age = age;
+          http_cache_update (cache_entry);
+        }
+      CLOSE_FINISH (sock);
+
+      sock = http_cache_open (cache_entry);
+      if (sock < 0)
+        {
+          http_cache_remove (cache_entry);
+          retval = HERR;
+          goto cleanup;
+        }
+      logputs (LOG_VERBOSE,
+               _("Reading revalidated response from the HTTP cache... "));
+      xfree (head);
+      resp_free (&resp);
+      cache_revalidate = false;
+      keep_alive = false;
+      from_cache = true;
+      goto read_response;
+    }
+
   if (statcode == HTTP_STATUS_UNAUTHORIZED)
     {
       /* Authorization is required.  */
@@ -3505,7 +3822,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
                                     chunked_transfer_encoding,
                                     u->url, warc_timestamp_str,
                                     warc_request_uuid, warc_ip, type,
-                                    statcode, head);
+                                    statcode, head, NULL);
           xfree (type);
 
           if (_err != RETRFINISHED || hs->res < 0)
@@ -3627,6 +3944,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   hs->remote_time = resp_header_strdup (resp, "Last-Modified");
   if (!hs->remote_time) // now look for the Wayback Machine's timestamp
     hs->remote_time = resp_header_strdup (resp, "X-Archive-Orig-last-modified");
+  hs->etag = resp_header_strdup (resp, "ETag");
 
   if (resp_header_copy (resp, "Content-Range", hdrval, sizeof (hdrval)))
     {
@@ -3688,7 +4006,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
                                             chunked_transfer_encoding,
                                             u->url, warc_timestamp_str,
                                             warc_request_uuid, warc_ip, type,
-                                            statcode, head);
+                                            statcode, head, NULL);
 
               if (_err != RETRFINISHED || hs->res < 0)
                 {
@@ -3759,6 +4077,10 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
                      _ ("File %s not modified on server. Omitting download.\n\n"),
                      quote (hs->local_file));
           *dt |= RETROKF;
+          /* A 304 response seldom carries Content-Type, but the local
+             file still has to be parsed for links when recursing.  */
+          if (!type && has_html_suffix_p (hs->local_file))
+            *dt |= TEXTHTML;
           CLOSE_FINISH (sock);
           retval = RETRUNNEEDED;
           goto cleanup;
@@ -3784,13 +4106,16 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   if (cond_get)
     {
       /* Handle the case when server ignores If-Modified-Since header.  */
-      if (statcode == HTTP_STATUS_OK && hs->remote_time)
+      if (statcode == HTTP_STATUS_OK
+          && (hs->remote_time || (hs->etag && hs->orig_file_etag)))
         {
-          time_t tmr = http_atotm (hs->remote_time);
+          time_t tmr = hs->remote_time ? http_atotm (hs->remote_time) : -1;
 
-          /* Check if the local file is up-to-date based on Last-Modified header
-             and content length.  */
-          if (tmr != (time_t) - 1 && tmr <= hs->orig_file_tstamp
+          /* Check if the local file is up-to-date based on the entity
+             tag or the Last-Modified header, and content length.  */
+          if (((hs->etag && hs->orig_file_etag
+                && !strcmp (hs->etag, hs->orig_file_etag))
+               || (tmr != (time_t) - 1 && tmr <= hs->orig_file_tstamp))
               && (contlen == -1 || contlen == hs->orig_file_size))
             {
               logprintf (LOG_VERBOSE,
@@ -3894,7 +4219,7 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
                                         chunked_transfer_encoding,
                                         u->url, warc_timestamp_str,
                                         warc_request_uuid, warc_ip, type,
-                                        statcode, head);
+                                        statcode, head, NULL);
 
           if (_err != RETRFINISHED || hs->res < 0)
             {
@@ -3949,14 +4274,53 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
         set_file_metadata (u->url, original_url->url, fp);
       else
         set_file_metadata (u->url, NULL, fp);
+      if (fp != output_stream)
+        set_file_etag (hs->etag, fp);
     }
 #endif
 
+  if (cacheable && !from_cache && statcode == HTTP_STATUS_OK)
+    {
+      long lifetime, age;
+
+      cache_store = http_cache_entry_new (u->url);
+      if (cache_freshness (resp, request_time, response_time,
+                           &lifetime, &age)
+          && cache_set_vary (cache_store, resp, req))
+        {
+          cache_store->response_time = response_time;
+          cache_store->lifetime = lifetime;
+          cache_store->initial_age = age;
+          cache_store->etag = hs->etag ? xstrdup (hs->etag) : NULL;
+          cache_store->last_modified = resp_header_strdup (resp,
+                                                           "Last-Modified");
+        }
+      else
+        lifetime = 0;
+
+      /* Responses that can neither be used as they are nor revalidated
+         are not worth storing.  */
+      if ((!lifetime && !cache_store->etag && !cache_store->last_modified)
+          || !http_cache_store_begin (cache_store, head))
+        {
+          http_cache_entry_free (cache_store);
+          cache_store = NULL;
+        }
+    }
+
+  timing_start (TIMING_TRANSFER);
   err = read_response_body (hs, sock, fp, contlen, contrange,
                             chunked_transfer_encoding,
                             u->url, warc_timestamp_str,
                             warc_request_uuid, warc_ip, type,
-                            statcode, head);
+                            statcode, head,
+                            cache_store ? cache_store->fp : NULL);
+  timing_stop (TIMING_TRANSFER);
+
+  if (cache_store)
+    http_cache_store_end (cache_store,
+                          hs->res >= 0
+                          && (contlen == -1 || hs->len == contlen));
 
   if (hs->res >= 0)
     CLOSE_FINISH (sock);
@@ -3974,6 +4338,9 @@ gethttp (const struct url *u, struct url *original_url, struct http_stat *hs,
   xfree (message);
   resp_free (&resp);
   request_free (&req);
+  http_cache_entry_free (cache_entry);
+  http_cache_entry_free (cache_store);
+  timing_end (u, statcode, hs->rd_size);
 
   return retval;
 }
@@ -4101,6 +4468,10 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
             if (timestamp_err != RETROK)
               return timestamp_err;
           }
+#ifdef ENABLE_XATTR
+          if (opt.enable_xattr && hstat.orig_file_name)
+            hstat.orig_file_etag = get_file_etag (hstat.orig_file_name);
+#endif
         }
         /* Send preliminary HEAD request if -N is given and we have existing
          * destination file or content disposition is enabled.  */
@@ -4114,6 +4485,7 @@ http_loop (const struct url *u, struct url *original_url, char **newloc,
       /* Increment the pass counter.  */
       ++count;
       sleep_between_retrievals (count);
+      res_crawl_delay (u->host, u->port);
 
       /* Get the current time string.  */
       tms = datetime_str (time (NULL));
@@ -4631,6 +5003,76 @@ exit:
   return ret;
 }
 
+/* Send the request for URL, to be retrieved with REFERER, ahead on the
+   persistent connection if it speaks HTTP/2 to the server of URL, so
+   that the response is already under way when URL is retrieved.
+   Return false if it can't be sent now, nor the requests for the URLs
+   to be retrieved after it.  */
+
+#ifdef HAVE_NGHTTP2
+bool
+http_send_ahead (const char *url, const char *referer, struct iri *iri)
+{
+  struct http_stat hs;
+  struct url *u;
+  struct request *req;
+  char *user, *passwd, *head;
+  bool basic_auth_finished = false;
+  wgint body_data_size = 0;
+  int dt = 0, size;
+  uerr_t err;
+  bool ok = false;
+
+  if (!pconn_active || !http2_connection_p (pconn.socket))
+    return false;
+
+  /* Leave out the cases where http_loop would send another request,
+     or none, or where the requests are to be spaced out.  */
+  if (opt.method || opt.spider || opt.timestamping || opt.always_rest
+      || opt.noclobber || opt.http_cache
+      || opt.wait || opt.quota || limit_bandwidth_rate ())
+    return false;
+#ifdef HAVE_METALINK
+  if (opt.metalink_over_http)
+    return false;
+#endif
+
+  u = url_parse (url, NULL, iri, true);
+  if (!u || u->scheme != SCHEME_HTTPS || u->port != pconn.port
+      || 0 != strcasecmp (u->host, pconn.host)
+      || url_uses_proxy (u)
+      || res_get_crawl_delay (u->host, u->port) > 0)
+    goto cleanup;
+
+  xzero (hs);
+  hs.referer = referer;
+  if (!opt.allow_cache)
+    dt |= SEND_NOCACHE;
+  req = initialize_request (u, &hs, &dt, NULL, false, &basic_auth_finished,
+                            &body_data_size, &user, &passwd, &err);
+  if (!req)
+    goto cleanup;
+  set_cookie_and_user_headers (req, u);
+
+  head = request_format (req, &size);
+  ok = http2_send_ahead (pconn.socket, head, size);
+  xfree (head);
+  request_free (&req);
+
+ cleanup:
+  if (u)
+    url_free (u);
+  return ok;
+}
+#else /* not HAVE_NGHTTP2 */
+bool
+http_send_ahead (const char *url _GL_UNUSED, const char *referer _GL_UNUSED,
+                 struct iri *iri _GL_UNUSED)
+{
+  return false;
+}
+#endif /* not HAVE_NGHTTP2 */
+
 /* Check whether the result of strptime() indicates success.
    strptime() returns the pointer to how far it got to in the string.
    The processing has been successful if the string is at `GMT' or
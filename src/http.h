@@ -37,6 +37,7 @@ struct url;
 
 uerr_t http_loop (const struct url *, struct url *, char **, char **, const char *,
                   int *, struct url *, struct iri *);
+bool http_send_ahead (const char *, const char *, struct iri *);
 void save_cookies (void);
 void http_cleanup (void);
 time_t http_atotm (const char *);
@@ -0,0 +1,954 @@
+/* HTTP/2 transport for HTTP connections.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* When the server agrees to HTTP/2 during the TLS handshake,
+   http2_start stacks a transport on top of the TLS one.  It speaks
+   HTTP/2 to the server, but reads and writes HTTP/1.1 messages on the
+   side of gethttp, so that the rest of Wget needs no changes:
+
+   - the request written by request_send, along with its body, is sent
+     as a HEADERS frame and the DATA frames following it;
+
+   - the response is read back as an HTTP/1.1 response head, followed
+     by the body in chunked encoding unless the server sent a
+     Content-Length, so that the end of the body is always known and
+     the connection can be reused.
+
+   Every request is sent on a new stream of the same connection, which
+   is registered as persistent like any other, and thus shared by all
+   the downloads from the same server over one TLS handshake.
+
+   The requests for the URLs to be retrieved next from the server can
+   be sent ahead with http2_send_ahead, each on a stream of its own, so
+   that their responses are received concurrently with the one being
+   read.  When gethttp then writes one of these requests, its response
+   is read from the stream already under way instead of being asked
+   for again.  */
+
+#include "wget.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <nghttp2/nghttp2.h>
+
+#include "utils.h"
+#include "connect.h"
+#include "http2.h"
+#include "c-ctype.h"
+#include "c-strcase.h"
+
+/* Size of the flow-control windows we give the server, for the stream
+   and for the connection.  The default of 64K would limit the speed
+   of downloads to 64K per round-trip time.  */
+#define HTTP2_WINDOW_SIZE (1 << 24)
+
+/* Size of the flow-control window of a stream until its response is
+   read, which bounds how much of the responses to the requests sent
+   ahead is kept in memory.  */
+#define HTTP2_AHEAD_WINDOW (1 << 18)
+
+/* How many requests are sent ahead at most.  */
+#define HTTP2_AHEAD_MAX 16
+
+struct http2_buffer
+{
+  char *data;
+  int len;                      /* bytes stored */
+  int pos;                      /* bytes consumed */
+  int size;                     /* bytes allocated */
+};
+
+/* A request sent on a stream, and its response.  */
+
+struct http2_stream
+{
+  int32_t id;
+  char *request;                /* the head of a request sent ahead */
+  int request_len;
+  bool head_only;               /* whether it was a HEAD request */
+  int status;                   /* status code of the response */
+  bool has_length;              /* whether it has a Content-Length */
+  struct http2_buffer head;     /* header lines of the response */
+  bool head_done;               /* whether the head has been passed on */
+  bool chunked;                 /* whether we add chunked encoding */
+  bool closed;                  /* whether the stream has been closed */
+  uint32_t reset;               /* the error closing it, if any */
+  bool window_open;             /* whether it has the whole window */
+  size_t unconsumed;            /* DATA not given back to its window */
+
+  /* The response as read by gethttp.  */
+  struct http2_buffer out;
+
+  struct http2_stream *next;    /* the next request sent ahead */
+};
+
+struct http2_context
+{
+  int fd;
+  struct transport_implementation *lower; /* the TLS transport */
+  void *lower_ctx;
+  nghttp2_session *session;
+
+  /* The request as written by gethttp, until it is complete.  */
+  struct http2_buffer req;      /* its head */
+  nghttp2_nv *nva;              /* its fields, once the head is complete */
+  int nvlen;
+  bool head_only;               /* whether it is a HEAD request */
+  struct http2_buffer body;     /* its body */
+  wgint req_body;               /* the length of the body */
+
+  struct http2_stream *cur;     /* the stream of the current request */
+  struct http2_stream *ahead;   /* the requests sent ahead, oldest first */
+  int nahead;
+
+  bool goaway;                  /* no new streams will be accepted */
+  bool broken;                  /* the connection has failed */
+  char *error;                  /* last error reported by http2_errstr */
+};
+
+static void
+buffer_add (struct http2_buffer *buf, const void *data, int len)
+{
+  if (buf->len + len > buf->size)
+    {
+      buf->size = MAX (2 * buf->size, buf->len + len);
+      buf->data = xrealloc (buf->data, buf->size);
+    }
+  memcpy (buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void
+set_error (struct http2_context *ctx, char *error)
+{
+  xfree (ctx->error);
+  ctx->error = error;
+}
+
+/* HTTP/2 responses carry no reason phrase; supply the usual one, for
+   the benefit of the messages printed by gethttp.  */
+
+static const char *
+reason_phrase (int status)
+{
+  static const struct {
+    int status;
+    const char *reason;
+  } reasons[] = {
+    { 200, "OK" },
+    { 201, "Created" },
+    { 202, "Accepted" },
+    { 203, "Non-Authoritative Information" },
+    { 204, "No Content" },
+    { 206, "Partial Content" },
+    { 300, "Multiple Choices" },
+    { 301, "Moved Permanently" },
+    { 302, "Found" },
+    { 303, "See Other" },
+    { 304, "Not Modified" },
+    { 307, "Temporary Redirect" },
+    { 308, "Permanent Redirect" },
+    { 400, "Bad Request" },
+    { 401, "Unauthorized" },
+    { 403, "Forbidden" },
+    { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 407, "Proxy Authentication Required" },
+    { 408, "Request Timeout" },
+    { 410, "Gone" },
+    { 416, "Range Not Satisfiable" },
+    { 429, "Too Many Requests" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
+    { 502, "Bad Gateway" },
+    { 503, "Service Unavailable" },
+    { 504, "Gateway Timeout" },
+  };
+  size_t i;
+
+  for (i = 0; i < countof (reasons); i++)
+    if (reasons[i].status == status)
+      return reasons[i].reason;
+  return "";
+}
+
+static void
+stream_free (struct http2_stream *st)
+{
+  xfree (st->request);
+  xfree (st->head.data);
+  xfree (st->out.data);
+  xfree (st);
+}
+
+/* Forget ST, cancelling its stream unless it is over.  */
+
+static void
+stream_drop (struct http2_context *ctx, struct http2_stream *st)
+{
+  if (!st->closed)
+    {
+      nghttp2_submit_rst_stream (ctx->session, NGHTTP2_FLAG_NONE, st->id,
+                                 NGHTTP2_CANCEL);
+      nghttp2_session_set_stream_user_data (ctx->session, st->id, NULL);
+    }
+  stream_free (st);
+}
+
+/* Let the server send the response of ST, which gethttp is reading,
+   at full speed: give back to its window what has been received so
+   far, and widen the window once the server has seen the stream.  */
+
+static void
+stream_open_window (struct http2_context *ctx, struct http2_stream *st)
+{
+  if (st->closed)
+    return;
+  if (st->unconsumed)
+    {
+      nghttp2_session_consume_stream (ctx->session, st->id, st->unconsumed);
+      st->unconsumed = 0;
+    }
+  if (st->head_done && !st->window_open)
+    {
+      nghttp2_submit_window_update (ctx->session, NGHTTP2_FLAG_NONE, st->id,
+                                    HTTP2_WINDOW_SIZE - HTTP2_AHEAD_WINDOW);
+      st->window_open = true;
+    }
+}
+
+/* Callbacks of the nghttp2 session.  */
+
+static ssize_t
+send_callback (nghttp2_session *session _GL_UNUSED, const uint8_t *data,
+               size_t length, int flags _GL_UNUSED, void *user_data)
+{
+  struct http2_context *ctx = user_data;
+  int res;
+
+  if (opt.read_timeout && ctx->lower->poller)
+    {
+      res = ctx->lower->poller (ctx->fd, opt.read_timeout, WAIT_FOR_WRITE,
+                                ctx->lower_ctx);
+      if (res == 0)
+        errno = ETIMEDOUT;
+      if (res <= 0)
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+  res = ctx->lower->writer (ctx->fd, (char *) data, MIN (length, INT_MAX),
+                            ctx->lower_ctx);
+  if (res <= 0)
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  return res;
+}
+
+static int
+on_header_callback (nghttp2_session *session,
+                    const nghttp2_frame *frame,
+                    const uint8_t *name, size_t namelen,
+                    const uint8_t *value, size_t valuelen,
+                    uint8_t flags _GL_UNUSED, void *user_data _GL_UNUSED)
+{
+  struct http2_stream *st =
+    nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+
+  /* Trailers are dropped, as they would be by gethttp.  */
+  if (!st || st->head_done)
+    return 0;
+
+  if (namelen == 7 && 0 == memcmp (name, ":status", 7))
+    st->status = atoi ((const char *) value);
+  else if (*name != ':')
+    {
+      if (namelen == 14 && 0 == memcmp (name, "content-length", 14))
+        st->has_length = true;
+      buffer_add (&st->head, name, namelen);
+      buffer_add (&st->head, ": ", 2);
+      buffer_add (&st->head, value, valuelen);
+      buffer_add (&st->head, "\r\n", 2);
+    }
+  return 0;
+}
+
+static int
+on_frame_recv_callback (nghttp2_session *session,
+                        const nghttp2_frame *frame, void *user_data)
+{
+  struct http2_context *ctx = user_data;
+  struct http2_stream *st;
+  bool end_stream = frame->hd.flags & NGHTTP2_FLAG_END_STREAM;
+  char line[64];
+
+  if (frame->hd.type == NGHTTP2_GOAWAY)
+    {
+      DEBUGP (("Received GOAWAY on socket %d.\n", ctx->fd));
+      ctx->goaway = true;
+      return 0;
+    }
+  if (frame->hd.type != NGHTTP2_HEADERS)
+    return 0;
+  st = nghttp2_session_get_stream_user_data (session, frame->hd.stream_id);
+  if (!st || st->head_done)
+    return 0;
+
+  /* Skip interim responses such as 100 Continue.  */
+  if (st->status / 100 == 1)
+    {
+      st->status = 0;
+      st->has_length = false;
+      st->head.len = 0;
+      return 0;
+    }
+
+  st->chunked = !st->has_length && !st->head_only && !end_stream;
+  snprintf (line, sizeof (line), "HTTP/2 %d %s\r\n", st->status,
+            reason_phrase (st->status));
+  buffer_add (&st->out, line, strlen (line));
+  buffer_add (&st->out, st->head.data, st->head.len);
+  if (st->chunked)
+    buffer_add (&st->out, "Transfer-Encoding: chunked\r\n", 28);
+  buffer_add (&st->out, "\r\n", 2);
+  st->head_done = true;
+  if (st == ctx->cur)
+    stream_open_window (ctx, st);
+  return 0;
+}
+
+static int
+on_data_chunk_recv_callback (nghttp2_session *session,
+                             uint8_t flags _GL_UNUSED, int32_t stream_id,
+                             const uint8_t *data, size_t len,
+                             void *user_data)
+{
+  struct http2_context *ctx = user_data;
+  struct http2_stream *st =
+    nghttp2_session_get_stream_user_data (session, stream_id);
+  char line[32];
+
+  /* The window of the connection is given back at once, that of a
+     stream sent ahead only once its response is read.  */
+  nghttp2_session_consume_connection (session, len);
+  if (!st)
+    return 0;
+  if (st == ctx->cur)
+    nghttp2_session_consume_stream (session, stream_id, len);
+  else
+    st->unconsumed += len;
+
+  if (!st->head_done || st->head_only)
+    return 0;
+  if (st->chunked)
+    {
+      snprintf (line, sizeof (line), "%lx\r\n", (unsigned long) len);
+      buffer_add (&st->out, line, strlen (line));
+    }
+  buffer_add (&st->out, data, len);
+  if (st->chunked)
+    buffer_add (&st->out, "\r\n", 2);
+  return 0;
+}
+
+static int
+on_stream_close_callback (nghttp2_session *session,
+                          int32_t stream_id, uint32_t error_code,
+                          void *user_data _GL_UNUSED)
+{
+  struct http2_stream *st =
+    nghttp2_session_get_stream_user_data (session, stream_id);
+
+  if (!st)
+    return 0;
+  st->closed = true;
+  if (error_code != NGHTTP2_NO_ERROR)
+    st->reset = error_code;
+  else if (st->chunked)
+    buffer_add (&st->out, "0\r\n\r\n", 5);
+  return 0;
+}
+
+static ssize_t
+read_request_body (nghttp2_session *session _GL_UNUSED,
+                   int32_t stream_id _GL_UNUSED, uint8_t *buf, size_t length,
+                   uint32_t *data_flags, nghttp2_data_source *source _GL_UNUSED,
+                   void *user_data)
+{
+  struct http2_context *ctx = user_data;
+  size_t left = ctx->body.len - ctx->body.pos;
+
+  if (length > left)
+    length = left;
+  memcpy (buf, ctx->body.data + ctx->body.pos, length);
+  ctx->body.pos += length;
+  if (ctx->body.pos == ctx->body.len)
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  return length;
+}
+
+/* Send what the session has queued.  */
+
+static int
+http2_send (struct http2_context *ctx)
+{
+  int res = nghttp2_session_send (ctx->session);
+  if (res != 0)
+    {
+      if (res != NGHTTP2_ERR_CALLBACK_FAILURE)
+        set_error (ctx, xstrdup (nghttp2_strerror (res)));
+      ctx->broken = true;
+      return -1;
+    }
+  return 0;
+}
+
+/* Read from the connection once, and process the frames read.  */
+
+static int
+http2_pump (struct http2_context *ctx)
+{
+  char buf[16 * 1024];
+  ssize_t res;
+
+  if (http2_send (ctx) < 0)
+    return -1;
+  res = ctx->lower->reader (ctx->fd, buf, sizeof (buf), ctx->lower_ctx);
+  if (res <= 0)
+    {
+      if (res == 0)
+        {
+          set_error (ctx, xstrdup (_("Connection closed by server")));
+          errno = ECONNRESET;
+        }
+      ctx->broken = true;
+      return -1;
+    }
+  res = nghttp2_session_mem_recv (ctx->session, (uint8_t *) buf, res);
+  if (res < 0)
+    {
+      set_error (ctx, xstrdup (nghttp2_strerror (res)));
+      ctx->broken = true;
+      return -1;
+    }
+  return http2_send (ctx);
+}
+
+/* Forget the previous request, cancelling its stream if the response
+   hasn't been read to the end.  */
+
+static void
+http2_new_request (struct http2_context *ctx)
+{
+  if (ctx->cur)
+    stream_drop (ctx, ctx->cur);
+  ctx->cur = NULL;
+  ctx->req.len = 0;
+  xfree (ctx->nva);
+  ctx->head_only = false;
+  ctx->body.len = ctx->body.pos = 0;
+  ctx->req_body = 0;
+}
+
+/* Header fields of HTTP/1.1 that are specific to the connection and
+   may not be sent over HTTP/2.  */
+
+static bool
+connection_header_p (const char *name)
+{
+  return 0 == c_strcasecmp (name, "Connection")
+    || 0 == c_strcasecmp (name, "Keep-Alive")
+    || 0 == c_strcasecmp (name, "Proxy-Connection")
+    || 0 == c_strcasecmp (name, "Transfer-Encoding")
+    || 0 == c_strcasecmp (name, "Upgrade");
+}
+
+static void
+set_nv (nghttp2_nv *nv, const char *name, const char *value)
+{
+  nv->name = (uint8_t *) name;
+  nv->namelen = strlen (name);
+  nv->value = (uint8_t *) value;
+  nv->valuelen = strlen (value);
+  nv->flags = NGHTTP2_NV_FLAG_NONE;
+}
+
+/* Turn HEAD, the LEN bytes of the head of a request, into the header
+   fields of a HEADERS frame, modifying it in place.  The number of
+   fields is stored to NVLEN, whether it is a HEAD request to
+   HEAD_ONLY, and the length of its body to BODY_LEN.  */
+
+static nghttp2_nv *
+parse_request (char *head, int len, int *nvlen, bool *head_only,
+               wgint *body_len)
+{
+  char *p, *end = head + len;
+  char *method, *path;
+  nghttp2_nv *nva;
+  int lines = 0;
+  bool host = false;
+
+  for (p = head; p < end; p++)
+    if (*p == '\n')
+      {
+        p[-1] = '\0';           /* the request ends in "\r\n\r\n" */
+        ++lines;
+      }
+  nva = xnew_array (nghttp2_nv, lines + 3);
+  *nvlen = 0;
+  *body_len = 0;
+
+  /* "METHOD PATH HTTP/1.1" */
+  p = method = head;
+  p += strcspn (p, " ");
+  *p++ = '\0';
+  path = p;
+  p += strcspn (p, " ");
+  *p = '\0';
+  p = strchr (p + 1, '\0') + 2;
+  set_nv (nva + (*nvlen)++, ":method", method);
+  set_nv (nva + (*nvlen)++, ":scheme", "https");
+  set_nv (nva + (*nvlen)++, ":path", path);
+  /* The pseudo-header fields come first; leave room for :authority,
+     made from the Host header.  */
+  (*nvlen)++;
+  *head_only = 0 == strcmp (method, "HEAD");
+
+  while (p < end && *p)
+    {
+      char *name = p, *value = p + strcspn (p, ":"), *q;
+      p = strchr (p, '\0') + 2;
+      if (!*value)
+        continue;
+      *value++ = '\0';
+      value += strspn (value, " \t");
+      for (q = value + strlen (value); q > value && c_isspace (q[-1]); )
+        *--q = '\0';
+
+      if (connection_header_p (name))
+        continue;
+      if (0 == c_strcasecmp (name, "Host"))
+        {
+          set_nv (nva + 3, ":authority", value);
+          host = true;
+          continue;
+        }
+      if (0 == c_strcasecmp (name, "Content-Length"))
+        *body_len = str_to_wgint (value, NULL, 10);
+      /* Field names must be in lower case.  */
+      for (q = name; *q; q++)
+        *q = c_tolower (*q);
+      set_nv (nva + (*nvlen)++, name, value);
+    }
+  if (!host)
+    {
+      memmove (nva + 3, nva + 4, (*nvlen - 4) * sizeof (nghttp2_nv));
+      (*nvlen)--;
+    }
+  return nva;
+}
+
+/* Queue the request whose fields are NVA on a new stream, with the
+   body in CTX->body if BODY.  Returns the stream, or NULL on error.  */
+
+static struct http2_stream *
+http2_submit (struct http2_context *ctx, nghttp2_nv *nva, int nvlen,
+              bool head_only, bool body)
+{
+  struct http2_stream *st = xnew0 (struct http2_stream);
+  nghttp2_data_provider provider;
+  int32_t id;
+
+  provider.source.ptr = ctx;
+  provider.read_callback = read_request_body;
+  id = nghttp2_submit_request (ctx->session, NULL, nva, nvlen,
+                               body ? &provider : NULL, st);
+  if (id < 0)
+    {
+      set_error (ctx, xstrdup (nghttp2_strerror (id)));
+      xfree (st);
+      return NULL;
+    }
+  st->id = id;
+  st->head_only = head_only;
+  return st;
+}
+
+/* If the request in CTX->req has been sent ahead, make its stream the
+   current one and return true.  The requests sent before it are for
+   URLs that have been passed over, and are cancelled.  */
+
+static bool
+http2_take_ahead (struct http2_context *ctx)
+{
+  struct http2_stream *st;
+
+  for (st = ctx->ahead; st; st = st->next)
+    if (st->request_len == ctx->req.len
+        && 0 == memcmp (st->request, ctx->req.data, ctx->req.len))
+      break;
+  if (!st)
+    return false;
+
+  while (ctx->ahead != st)
+    {
+      struct http2_stream *passed = ctx->ahead;
+      ctx->ahead = passed->next;
+      stream_drop (ctx, passed);
+      ctx->nahead--;
+    }
+  ctx->ahead = st->next;
+  ctx->nahead--;
+  st->next = NULL;
+
+  /* Refused, after a GOAWAY for instance: send it again.  */
+  if (st->reset)
+    {
+      stream_drop (ctx, st);
+      return false;
+    }
+  ctx->cur = st;
+  stream_open_window (ctx, st);
+  DEBUGP (("Reading the response of HTTP/2 stream %d, sent ahead.\n",
+           (int) st->id));
+  return true;
+}
+
+/* Implementation of the transport.  */
+
+static int
+http2_write (int fd _GL_UNUSED, char *buf, int bufsize, void *arg)
+{
+  struct http2_context *ctx = arg;
+
+  if (ctx->broken)
+    return -1;
+  if (ctx->cur)
+    http2_new_request (ctx);
+
+  if (!ctx->nva)
+    {
+      /* Look for the end of the head, which may span the writes.  */
+      int i, start = MAX (ctx->req.len - 3, 0);
+      buffer_add (&ctx->req, buf, bufsize);
+      for (i = start; i + 4 <= ctx->req.len; i++)
+        if (0 == memcmp (ctx->req.data + i, "\r\n\r\n", 4))
+          break;
+      if (i + 4 > ctx->req.len)
+        return bufsize;
+      /* Whatever follows the head is the start of the body.  */
+      buffer_add (&ctx->body, ctx->req.data + i + 4, ctx->req.len - i - 4);
+      ctx->req.len = i + 4;
+      if (ctx->body.len == 0 && http2_take_ahead (ctx))
+        {
+          ctx->req.len = 0;
+          return bufsize;
+        }
+      ctx->nva = parse_request (ctx->req.data, ctx->req.len, &ctx->nvlen,
+                                &ctx->head_only, &ctx->req_body);
+    }
+  else
+    buffer_add (&ctx->body, buf, bufsize);
+
+  if (ctx->body.len < ctx->req_body)
+    return bufsize;
+  ctx->cur = http2_submit (ctx, ctx->nva, ctx->nvlen, ctx->head_only,
+                           ctx->req_body > 0);
+  xfree (ctx->nva);
+  if (!ctx->cur)
+    return -1;
+  DEBUGP (("Sending the request on HTTP/2 stream %d.\n", (int) ctx->cur->id));
+  if (http2_send (ctx) < 0)
+    return -1;
+  return bufsize;
+}
+
+/* Wait until there is something for gethttp to read.  Returns false
+   on error.  */
+
+static bool
+http2_fill (struct http2_context *ctx)
+{
+  struct http2_stream *st = ctx->cur;
+
+  /* The end of the response reads as the end of the file.  */
+  while (st && st->out.pos == st->out.len)
+    {
+      if (st->reset)
+        {
+          set_error (ctx, aprintf (_("HTTP/2 stream reset: %s"),
+                                   nghttp2_http2_strerror (st->reset)));
+          return false;
+        }
+      if (st->closed)
+        return true;
+      if (http2_pump (ctx) < 0)
+        return false;
+    }
+  return true;
+}
+
+static int
+http2_read (int fd _GL_UNUSED, char *buf, int bufsize, void *arg)
+{
+  struct http2_context *ctx = arg;
+  struct http2_stream *st = ctx->cur;
+  int len;
+
+  if (!http2_fill (ctx))
+    return -1;
+  if (!st)
+    return 0;
+  len = MIN (bufsize, st->out.len - st->out.pos);
+  memcpy (buf, st->out.data + st->out.pos, len);
+  st->out.pos += len;
+  if (st->out.pos == st->out.len)
+    st->out.pos = st->out.len = 0;
+  return len;
+}
+
+static int
+http2_peek (int fd _GL_UNUSED, char *buf, int bufsize, void *arg)
+{
+  struct http2_context *ctx = arg;
+  struct http2_stream *st = ctx->cur;
+  int len;
+
+  if (!http2_fill (ctx))
+    return -1;
+  if (!st)
+    return 0;
+  len = MIN (bufsize, st->out.len - st->out.pos);
+  memcpy (buf, st->out.data + st->out.pos, len);
+  return len;
+}
+
+static int
+http2_poll (int fd, double timeout, int wait_for, void *arg)
+{
+  struct http2_context *ctx = arg;
+  struct http2_stream *st = ctx->cur;
+
+  /* Requests are written to memory first.  */
+  if (wait_for != WAIT_FOR_READ)
+    return 1;
+  if (!st || st->out.pos < st->out.len || st->closed || ctx->broken)
+    return 1;
+  if (ctx->lower->poller)
+    return ctx->lower->poller (fd, timeout, wait_for, ctx->lower_ctx);
+  return select_fd (fd, timeout, wait_for);
+}
+
+static const char *
+http2_errstr (int fd, void *arg)
+{
+  struct http2_context *ctx = arg;
+
+  if (ctx->error)
+    return ctx->error;
+  if (ctx->lower->errstr)
+    return ctx->lower->errstr (fd, ctx->lower_ctx);
+  return NULL;
+}
+
+static void
+http2_close (int fd, void *arg)
+{
+  struct http2_context *ctx = arg;
+
+  if (!ctx->broken)
+    {
+      nghttp2_session_terminate_session (ctx->session, NGHTTP2_NO_ERROR);
+      http2_send (ctx);
+    }
+  nghttp2_session_del (ctx->session);
+  while (ctx->ahead)
+    {
+      struct http2_stream *st = ctx->ahead;
+      ctx->ahead = st->next;
+      stream_free (st);
+    }
+  if (ctx->cur)
+    stream_free (ctx->cur);
+  xfree (ctx->req.data);
+  xfree (ctx->nva);
+  xfree (ctx->body.data);
+  xfree (ctx->error);
+
+  DEBUGP (("Closing HTTP/2 connection on socket %d.\n", fd));
+  if (ctx->lower->closer)
+    ctx->lower->closer (fd, ctx->lower_ctx);
+  else
+    close (fd);
+  xfree (ctx);
+}
+
+static struct transport_implementation http2_transport = {
+  http2_read, http2_write, http2_poll,
+  http2_peek, http2_errstr, http2_close
+};
+
+/* Start speaking HTTP/2 on FD, a TLS connection for which the server
+   has chosen HTTP/2 (see ssl_http2_selected).  Returns false on
+   failure, in which case FD should be closed.  */
+
+bool
+http2_start (int fd)
+{
+  struct http2_context *ctx;
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_option *option;
+  nghttp2_settings_entry settings[] = {
+    { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+    { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_AHEAD_WINDOW },
+  };
+  int res;
+
+  ctx = xnew0 (struct http2_context);
+  ctx->fd = fd;
+  ctx->lower = fd_transport_implementation (fd);
+  ctx->lower_ctx = fd_transport_context (fd);
+
+  if (nghttp2_session_callbacks_new (&callbacks) != 0)
+    {
+      xfree (ctx);
+      return false;
+    }
+  nghttp2_session_callbacks_set_send_callback (callbacks, send_callback);
+  nghttp2_session_callbacks_set_on_header_callback (callbacks,
+                                                    on_header_callback);
+  nghttp2_session_callbacks_set_on_frame_recv_callback
+    (callbacks, on_frame_recv_callback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback
+    (callbacks, on_data_chunk_recv_callback);
+  nghttp2_session_callbacks_set_on_stream_close_callback
+    (callbacks, on_stream_close_callback);
+  if (nghttp2_option_new (&option) != 0)
+    {
+      nghttp2_session_callbacks_del (callbacks);
+      xfree (ctx);
+      return false;
+    }
+  /* The windows of the streams sent ahead are only given back once
+     their responses are read.  */
+  nghttp2_option_set_no_auto_window_update (option, 1);
+  res = nghttp2_session_client_new2 (&ctx->session, callbacks, ctx, option);
+  nghttp2_option_del (option);
+  nghttp2_session_callbacks_del (callbacks);
+  if (res != 0)
+    {
+      xfree (ctx);
+      return false;
+    }
+
+  /* The connection preface.  */
+  nghttp2_submit_settings (ctx->session, NGHTTP2_FLAG_NONE,
+                           settings, countof (settings));
+  nghttp2_submit_window_update (ctx->session, NGHTTP2_FLAG_NONE, 0,
+                                HTTP2_WINDOW_SIZE
+                                - NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE);
+
+  fd_register_transport (fd, &http2_transport, ctx);
+  DEBUGP (("Speaking HTTP/2 on socket %d.\n", fd));
+  return http2_send (ctx) == 0;
+}
+
+/* Return true if FD speaks HTTP/2.  */
+
+bool
+http2_connection_p (int fd)
+{
+  return fd_transport_implementation (fd) == &http2_transport;
+}
+
+/* Return true if the HTTP/2 connection FD can take another request.
+   This is the counterpart of test_socket_open, which can't tell
+   frames such as PING from the server closing the connection.  */
+
+bool
+http2_connection_open (int fd)
+{
+  struct http2_context *ctx = fd_transport_context (fd);
+
+  /* Process whatever the server has sent since the last response.  */
+  while (!ctx->broken && select_fd (fd, 0, WAIT_FOR_READ) > 0)
+    if (http2_pump (ctx) < 0)
+      break;
+  return !ctx->broken && !ctx->goaway
+    && nghttp2_session_want_read (ctx->session);
+}
+
+/* Send REQUEST, the LEN bytes of the head of a request without a body
+   as gethttp writes it, ahead on the HTTP/2 connection FD.  Returns
+   true if it has been sent ahead, now or before, and false if the
+   connection can't take it now.  */
+
+bool
+http2_send_ahead (int fd, const char *request, int len)
+{
+  struct http2_context *ctx = fd_transport_context (fd);
+  struct http2_stream *st, **tail;
+  nghttp2_nv *nva;
+  int nvlen;
+  bool head_only;
+  wgint body_len;
+  char *head;
+
+  if (ctx->broken || ctx->goaway)
+    return false;
+  for (tail = &ctx->ahead; *tail; tail = &(*tail)->next)
+    if ((*tail)->request_len == len
+        && 0 == memcmp ((*tail)->request, request, len))
+      return true;
+  /* Keep a stream for the request of gethttp.  */
+  if (ctx->nahead >= HTTP2_AHEAD_MAX
+      || (uint32_t) ctx->nahead + 1
+         >= nghttp2_session_get_remote_settings
+              (ctx->session, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS))
+    return false;
+
+  head = xmemdup (request, len);
+  nva = parse_request (head, len, &nvlen, &head_only, &body_len);
+  st = http2_submit (ctx, nva, nvlen, head_only, false);
+  xfree (nva);
+  xfree (head);
+  if (!st)
+    return false;
+  st->request = xmemdup (request, len);
+  st->request_len = len;
+  *tail = st;
+  ctx->nahead++;
+  DEBUGP (("Sending a request ahead on HTTP/2 stream %d.\n", (int) st->id));
+  return http2_send (ctx) == 0;
+}
+
+#endif /* HAVE_NGHTTP2 */
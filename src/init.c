@@ -66,6 +66,7 @@ as that of the covered work.  */
 #include "convert.h"            /* for convert_cleanup */
 #include "res.h"                /* for res_cleanup */
 #include "http.h"               /* for http_cleanup */
+#include "ftp.h"                /* for ftp_cache_cleanup */
 #include "retr.h"               /* for output_stream */
 #include "warc.h"               /* for warc_close */
 #include "spider.h"             /* for spider_cleanup */
@@ -117,6 +118,9 @@ CMD_DECLARE (cmd_spec_secure_protocol);
 CMD_DECLARE (cmd_spec_timeout);
 CMD_DECLARE (cmd_spec_useragent);
 CMD_DECLARE (cmd_spec_verbose);
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
+CMD_DECLARE (cmd_spec_warc_compression);
+#endif
 CMD_DECLARE (cmd_check_cert);
 
 /* List of recognized commands, each consisting of name, place and
@@ -195,6 +199,8 @@ static const struct {
   { "followftp",        &opt.follow_ftp,        cmd_boolean },
   { "followtags",       &opt.follow_tags,       cmd_vector },
   { "forcehtml",        &opt.force_html,        cmd_boolean },
+  { "ftpconnections",   &opt.ftp_connections,   cmd_number },
+  { "ftplistingcache",  &opt.ftp_listing_cache, cmd_file },
   { "ftppasswd",        &opt.ftp_passwd,        cmd_string }, /* deprecated */
   { "ftppassword",      &opt.ftp_passwd,        cmd_string },
   { "ftpproxy",         &opt.ftp_proxy,         cmd_string },
@@ -216,6 +222,10 @@ static const struct {
 #endif
   { "htmlextension",    &opt.adjust_extension,  cmd_boolean }, /* deprecated */
   { "htmlify",          NULL,                   cmd_spec_htmlify },
+#ifdef HAVE_NGHTTP2
+  { "http2",            &opt.http2,             cmd_boolean },
+#endif
+  { "httpcache",        &opt.http_cache,        cmd_directory },
   { "httpkeepalive",    &opt.http_keep_alive,   cmd_boolean },
   { "httppasswd",       &opt.http_passwd,       cmd_string }, /* deprecated */
   { "httppassword",     &opt.http_passwd,       cmd_string },
@@ -230,6 +240,7 @@ static const struct {
   { "ignorelength",     &opt.ignore_length,     cmd_boolean },
   { "ignoretags",       &opt.ignore_tags,       cmd_vector },
   { "includedirectories", &opt.includes,        cmd_directory_vector },
+  { "incrementalsave",  &opt.incremental_save,  cmd_boolean },
 #ifdef ENABLE_IPV6
   { "inet4only",        &opt.ipv4_only,         cmd_boolean },
   { "inet6only",        &opt.ipv6_only,         cmd_boolean },
@@ -242,10 +253,14 @@ static const struct {
   { "keepbadhash",      &opt.keep_badhash,      cmd_boolean },
   { "keepsessioncookies", &opt.keep_session_cookies, cmd_boolean },
   { "limitrate",        &opt.limit_rate,        cmd_bytes },
+  { "limitrateperconnection", &opt.limit_rate_per_connection, cmd_bytes },
+  { "limitrateperhost", &opt.limit_rate_per_host, cmd_bytes },
+  { "linkmapfile",      &opt.link_map_file,     cmd_file },
   { "loadcookies",      &opt.cookies_input,     cmd_file },
   { "localencoding",    &opt.locale,            cmd_string },
   { "logfile",          &opt.lfilename,         cmd_file },
   { "login",            &opt.ftp_user,          cmd_string },/* deprecated*/
+  { "maxcrawldelay",    &opt.max_crawl_delay,   cmd_time },
   { "maxredirect",      &opt.max_redirect,      cmd_number },
 #ifdef HAVE_METALINK
   { "metalinkindex",    &opt.metalink_index,     cmd_number_inf },
@@ -269,6 +284,7 @@ static const struct {
 #endif
   { "postdata",         &opt.post_data,         cmd_string },
   { "postfile",         &opt.post_file_name,    cmd_file },
+  { "preallocate",      &opt.preallocate,       cmd_boolean },
   { "preferfamily",     NULL,                   cmd_spec_prefer_family },
 #ifdef HAVE_METALINK
   { "preferredlocation", &opt.preferred_location, cmd_string },
@@ -320,6 +336,7 @@ static const struct {
   { "strictcomments",   &opt.strict_comments,   cmd_boolean },
   { "timeout",          NULL,                   cmd_spec_timeout },
   { "timestamping",     &opt.timestamping,      cmd_boolean },
+  { "timinglog",        &opt.timing_log,        cmd_file },
   { "tries",            &opt.ntry,              cmd_number_inf },
   { "trustservernames", &opt.trustservernames,  cmd_boolean },
   { "unlink",           &opt.unlink_requested,  cmd_boolean },
@@ -333,15 +350,20 @@ static const struct {
   { "waitretry",        &opt.waitretry,         cmd_time },
   { "warccdx",          &opt.warc_cdx_enabled,  cmd_boolean },
   { "warccdxdedup",     &opt.warc_cdx_dedup_filename,  cmd_file },
-#ifdef HAVE_LIBZ
-  { "warccompression",  &opt.warc_compression_enabled, cmd_boolean },
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
+  { "warccompression",  NULL,                   cmd_spec_warc_compression },
 #endif
+  { "warcdedupindex",   &opt.warc_cdx_dedup_index, cmd_file },
   { "warcdigests",      &opt.warc_digests_enabled, cmd_boolean },
   { "warcfile",         &opt.warc_filename,     cmd_file },
   { "warcheader",       NULL,                   cmd_spec_warc_header },
   { "warckeeplog",      &opt.warc_keep_log,     cmd_boolean },
   { "warcmaxsize",      &opt.warc_maxsize,      cmd_bytes },
+  { "warcshards",       &opt.warc_shards,       cmd_number },
   { "warctempdir",      &opt.warc_tempdir,      cmd_directory },
+#ifdef HAVE_LIBZSTD
+  { "warczstddictionary", &opt.warc_zstd_dictionary, cmd_file },
+#endif
 #ifdef USE_WATT32
   { "wdebug",           &opt.wdebug,            cmd_boolean },
 #endif
@@ -420,6 +442,7 @@ defaults (void)
 
   opt.dns_cache = true;
   opt.ftp_pasv = true;
+  opt.ftp_connections = 1;
   /* 2014-09-07  Darshit Shah  <darnir@gmail.com>
    * opt.retr_symlinks is set to true by default. Creating symbolic links on the
    * local filesystem pose a security threat by malicious FTP Servers that
@@ -462,6 +485,7 @@ defaults (void)
   opt.max_redirect = 20;
 
   opt.waitretry = 10;
+  opt.max_crawl_delay = 60;
 
 #ifdef ENABLE_IRI
   opt.enable_iri = true;
@@ -475,14 +499,16 @@ defaults (void)
   opt.show_all_dns_entries = false;
 
   opt.warc_maxsize = 0; /* 1024 * 1024 * 1024; */
+  opt.warc_shards = 1;
 #ifdef HAVE_LIBZ
-  opt.warc_compression_enabled = true;
+  opt.warc_compression = warc_compression_gzip;
 #else
-  opt.warc_compression_enabled = false;
+  opt.warc_compression = warc_compression_none;
 #endif
   opt.warc_digests_enabled = true;
   opt.warc_cdx_enabled = false;
   opt.warc_cdx_dedup_filename = NULL;
+  opt.warc_cdx_dedup_index = NULL;
   opt.warc_tempdir = NULL;
   opt.warc_keep_log = true;
 
@@ -496,6 +522,11 @@ defaults (void)
   opt.hsts = true;
 #endif
 
+#ifdef HAVE_NGHTTP2
+  /* HTTP/2 is used whenever the server agrees to it */
+  opt.http2 = true;
+#endif
+
 #ifdef ENABLE_XATTR
   opt.enable_xattr = true;
 #else
@@ -1588,6 +1619,52 @@ cmd_spec_recursive (const char *com, const char *val, void *place_ignored _GL_UN
   return true;
 }
 
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
+/* Set --warc-compression: a boolean, which selects gzip when it is
+   available, or the name of the compression method.  */
+
+static bool
+cmd_spec_warc_compression (const char *com, const char *val,
+                           void *place_ignored _GL_UNUSED)
+{
+  static const struct decode_item choices[] = {
+    { "none", warc_compression_none },
+#ifdef HAVE_LIBZ
+    { "gzip", warc_compression_gzip },
+#endif
+#ifdef HAVE_LIBZSTD
+    { "zstd", warc_compression_zstd },
+#endif
+  };
+  int compression;
+
+  switch (cmd_boolean_internal (com, val, NULL))
+    {
+    case 0:
+      compression = warc_compression_none;
+      break;
+
+    case 1:
+#ifdef HAVE_LIBZ
+      compression = warc_compression_gzip;
+#else
+      compression = warc_compression_zstd;
+#endif
+      break;
+
+    default:
+      if (!decode_string (val, choices, countof (choices), &compression))
+        {
+          fprintf (stderr, _("%s: %s: Invalid value %s.\n"),
+                   exec_name, com, quote (val));
+          return false;
+        }
+    }
+  opt.warc_compression = compression;
+  return true;
+}
+#endif
+
 /* Validate --regex-type and set the choice.  */
 
 static bool
@@ -1927,6 +2004,7 @@ cleanup (void)
   convert_cleanup ();
   res_cleanup ();
   http_cleanup ();
+  ftp_cache_cleanup ();
   cleanup_html_url ();
   spider_cleanup ();
   host_cleanup ();
@@ -1937,11 +2015,16 @@ cleanup (void)
   xfree (opt.lfilename);
   xfree (opt.dir_prefix);
   xfree (opt.input_filename);
+  xfree (opt.link_map_file);
 #ifdef HAVE_METALINK
   xfree (opt.input_metalink);
   xfree (opt.preferred_location);
 #endif
   xfree (opt.output_document);
+  acceptable_cleanup ();
+  limit_bandwidth_cleanup ();
+  mkalldirs_cleanup ();
+  unique_name_cleanup ();
   free_vec (opt.accepts);
   free_vec (opt.rejects);
   free_vec ((char **)opt.excludes);
@@ -1953,6 +2036,8 @@ cleanup (void)
   xfree (opt.ftp_user);
   xfree (opt.ftp_passwd);
   xfree (opt.ftp_proxy);
+  xfree (opt.ftp_listing_cache);
+  xfree (opt.http_cache);
   xfree (opt.https_proxy);
   xfree (opt.http_proxy);
   free_vec (opt.no_proxy);
@@ -1962,6 +2047,8 @@ cleanup (void)
   xfree (opt.http_passwd);
   free_vec (opt.user_headers);
   free_vec (opt.warc_user_headers);
+  xfree (opt.warc_zstd_dictionary);
+  xfree (opt.warc_cdx_dedup_index);
 # ifdef HAVE_SSL
   xfree (opt.cert_file);
   xfree (opt.private_key);
@@ -1983,6 +2070,7 @@ cleanup (void)
   xfree (opt.body_data);
   xfree (opt.body_file);
   xfree (opt.rejected_log);
+  xfree (opt.timing_log);
   xfree (opt.use_askpass);
   xfree (opt.retry_on_http_error);
 
@@ -55,8 +55,10 @@ as that of the covered work.  */
 #include "convert.h"
 #include "spider.h"
 #include "http.h"               /* for save_cookies */
+#include "ftp.h"                /* for ftp_cache_save */
 #include "hsts.h"               /* for initializing hsts_store to NULL */
 #include "ptimer.h"
+#include "timing.h"             /* for timing_report */
 #include "warc.h"
 #include "version.h"
 #include "c-strcase.h"
@@ -306,6 +308,8 @@ static struct cmdline_option option_data[] =
     { "follow-tags", 0, OPT_VALUE, "followtags", -1 },
     { "force-directories", 'x', OPT_BOOLEAN, "dirstruct", -1 },
     { "force-html", 'F', OPT_BOOLEAN, "forcehtml", -1 },
+    { "ftp-connections", 0, OPT_VALUE, "ftpconnections", -1 },
+    { "ftp-listing-cache", 0, OPT_VALUE, "ftplistingcache", -1 },
     { "ftp-password", 0, OPT_VALUE, "ftppassword", -1 },
 #ifdef __VMS
     { "ftp-stmlf", 0, OPT_BOOLEAN, "ftpstmlf", -1 },
@@ -327,15 +331,20 @@ static struct cmdline_option option_data[] =
 #endif
     { "html-extension", 'E', OPT_BOOLEAN, "adjustextension", -1 }, /* deprecated */
     { "htmlify", 0, OPT_BOOLEAN, "htmlify", -1 },
+    { "http-cache", 0, OPT_VALUE, "httpcache", -1 },
     { "http-keep-alive", 0, OPT_BOOLEAN, "httpkeepalive", -1 },
     { "http-passwd", 0, OPT_VALUE, "httppassword", -1 }, /* deprecated */
     { "http-password", 0, OPT_VALUE, "httppassword", -1 },
     { "http-user", 0, OPT_VALUE, "httpuser", -1 },
+#ifdef HAVE_NGHTTP2
+    { "http2", 0, OPT_BOOLEAN, "http2", -1 },
+#endif
     { IF_SSL ("https-only"), 0, OPT_BOOLEAN, "httpsonly", -1 },
     { "ignore-case", 0, OPT_BOOLEAN, "ignorecase", -1 },
     { "ignore-length", 0, OPT_BOOLEAN, "ignorelength", -1 },
     { "ignore-tags", 0, OPT_VALUE, "ignoretags", -1 },
     { "include-directories", 'I', OPT_VALUE, "includedirectories", -1 },
+    { "incremental-save", 0, OPT_BOOLEAN, "incrementalsave", -1 },
 #ifdef ENABLE_IPV6
     { "inet4-only", '4', OPT_BOOLEAN, "inet4only", -1 },
     { "inet6-only", '6', OPT_BOOLEAN, "inet6only", -1 },
@@ -349,9 +358,13 @@ static struct cmdline_option option_data[] =
     { "keep-session-cookies", 0, OPT_BOOLEAN, "keepsessioncookies", -1 },
     { "level", 'l', OPT_VALUE, "reclevel", -1 },
     { "limit-rate", 0, OPT_VALUE, "limitrate", -1 },
+    { "limit-rate-per-connection", 0, OPT_VALUE, "limitrateperconnection", -1 },
+    { "limit-rate-per-host", 0, OPT_VALUE, "limitrateperhost", -1 },
+    { "link-map-file", 0, OPT_VALUE, "linkmapfile", -1 },
     { "load-cookies", 0, OPT_VALUE, "loadcookies", -1 },
     { "local-encoding", 0, OPT_VALUE, "localencoding", -1 },
     { "rejected-log", 0, OPT_VALUE, "rejectedlog", -1 },
+    { "max-crawl-delay", 0, OPT_VALUE, "maxcrawldelay", -1 },
     { "max-redirect", 0, OPT_VALUE, "maxredirect", -1 },
 #ifdef HAVE_METALINK
     { "metalink-index", 0, OPT_VALUE, "metalinkindex", -1 },
@@ -373,6 +386,7 @@ static struct cmdline_option option_data[] =
     { IF_SSL ("pinnedpubkey"), 0, OPT_VALUE, "pinnedpubkey", -1 },
     { "post-data", 0, OPT_VALUE, "postdata", -1 },
     { "post-file", 0, OPT_VALUE, "postfile", -1 },
+    { "preallocate", 0, OPT_BOOLEAN, "preallocate", -1 },
     { "prefer-family", 0, OPT_VALUE, "preferfamily", -1 },
 #ifdef HAVE_METALINK
     { "preferred-location", 0, OPT_VALUE, "preferredlocation", -1 },
@@ -416,6 +430,7 @@ static struct cmdline_option option_data[] =
     { "strict-comments", 0, OPT_BOOLEAN, "strictcomments", -1 },
     { "timeout", 'T', OPT_VALUE, "timeout", -1 },
     { "timestamping", 'N', OPT_BOOLEAN, "timestamping", -1 },
+    { "timing-log", 0, OPT_VALUE, "timinglog", -1 },
     { "if-modified-since", 0, OPT_BOOLEAN, "ifmodifiedsince", -1 },
     { "tries", 't', OPT_VALUE, "tries", -1 },
     { "unlink", 0, OPT_BOOLEAN, "unlink", -1 },
@@ -429,16 +444,21 @@ static struct cmdline_option option_data[] =
     { "wait", 'w', OPT_VALUE, "wait", -1 },
     { "waitretry", 0, OPT_VALUE, "waitretry", -1 },
     { "warc-cdx", 0, OPT_BOOLEAN, "warccdx", -1 },
-#ifdef HAVE_LIBZ
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
     { "warc-compression", 0, OPT_BOOLEAN, "warccompression", -1 },
 #endif
     { "warc-dedup", 0, OPT_VALUE, "warccdxdedup", -1 },
+    { "warc-dedup-index", 0, OPT_VALUE, "warcdedupindex", -1 },
     { "warc-digests", 0, OPT_BOOLEAN, "warcdigests", -1 },
     { "warc-file", 0, OPT_VALUE, "warcfile", -1 },
     { "warc-header", 0, OPT_VALUE, "warcheader", -1 },
     { "warc-keep-log", 0, OPT_BOOLEAN, "warckeeplog", -1 },
     { "warc-max-size", 0, OPT_VALUE, "warcmaxsize", -1 },
+    { "warc-shards", 0, OPT_VALUE, "warcshards", -1 },
     { "warc-tempdir", 0, OPT_VALUE, "warctempdir", -1 },
+#ifdef HAVE_LIBZSTD
+    { "warc-zstd-dictionary", 0, OPT_VALUE, "warczstddictionary", -1 },
+#endif
 #ifdef USE_WATT32
     { "wdebug", 0, OPT_BOOLEAN, "wdebug", -1 },
 #endif
@@ -616,6 +636,9 @@ Logging and input file:\n"),
        --no-config                 do not read any config file\n"),
     N_("\
        --rejected-log=FILE         log reasons for URL rejection to FILE\n"),
+    N_("\
+       --timing-log=FILE           log the time taken by each phase of HTTP\n\
+                                     requests to FILE as JSON\n"),
     "\n",
 
     N_("\
@@ -635,6 +658,9 @@ Download:\n"),
   -c,  --continue                  resume getting a partially-downloaded file\n"),
     N_("\
        --start-pos=OFFSET          start downloading from zero-based position OFFSET\n"),
+    N_("\
+       --preallocate               reserve the disk space of files of known size\n\
+                                     and write them in large blocks\n"),
     N_("\
        --progress=TYPE             select progress gauge type\n"),
     N_("\
@@ -672,6 +698,8 @@ Download:\n"),
        --waitretry=SECONDS         wait 1..SECONDS between retries of a retrieval\n"),
     N_("\
        --random-wait               wait from 0.5*WAIT...1.5*WAIT secs between retrievals\n"),
+    N_("\
+       --max-crawl-delay=SECONDS   wait at most SECONDS for a robots.txt Crawl-delay\n"),
     N_("\
        --no-proxy                  explicitly turn off proxy\n"),
     N_("\
@@ -679,7 +707,13 @@ Download:\n"),
     N_("\
        --bind-address=ADDRESS      bind to ADDRESS (hostname or IP) on local host\n"),
     N_("\
-       --limit-rate=RATE           limit download rate to RATE\n"),
+       --limit-rate=RATE           limit total download rate to RATE\n"),
+    N_("\
+       --limit-rate-per-host=RATE  limit download rate from each server address\n\
+                                     to RATE\n"),
+    N_("\
+       --limit-rate-per-connection=RATE\n\
+                                   limit download rate of each connection to RATE\n"),
     N_("\
        --no-dns-cache              disable caching DNS lookups\n"),
     N_("\
@@ -754,6 +788,9 @@ HTTP options:\n"),
        --http-password=PASS        set http password to PASS\n"),
     N_("\
        --no-cache                  disallow server-cached data\n"),
+    N_("\
+       --http-cache=DIR            keep responses in DIR and reuse them while\n\
+                                     they are fresh\n"),
     N_ ("\
        --default-page=NAME         change the default page name (normally\n\
                                      this is 'index.html'.)\n"),
@@ -785,6 +822,9 @@ HTTP options:\n"),
        --save-cookies=FILE         save cookies to FILE after session\n"),
     N_("\
        --keep-session-cookies      load and save session (non-permanent) cookies\n"),
+    N_("\
+       --incremental-save          append changed cookies and HSTS entries to\n\
+                                     their files instead of rewriting them\n"),
     N_("\
        --post-data=STRING          use the POST method; send STRING as the data\n"),
     N_("\
@@ -814,6 +854,11 @@ HTTPS (SSL/TLS) options:\n"),
                                      SSLv3, TLSv1, TLSv1_1, TLSv1_2 and PFS\n"),
     N_("\
        --https-only                only follow secure HTTPS links\n"),
+#ifdef HAVE_NGHTTP2
+    N_("\
+       --no-http2                  don't use HTTP/2, even if the server\n\
+                                     supports it\n"),
+#endif
     N_("\
        --no-check-certificate      don't validate the server's certificate\n"),
     N_("\
@@ -866,6 +911,12 @@ FTP options:\n"),
        --ftp-user=USER             set ftp user to USER\n"),
     N_("\
        --ftp-password=PASS         set ftp password to PASS\n"),
+    N_("\
+       --ftp-connections=N         retrieve the files of a directory over N\n\
+                                     connections\n"),
+    N_("\
+       --ftp-listing-cache=FILE    reuse the listings, cached in FILE, of\n\
+                                     directories that haven't changed\n"),
     N_("\
        --no-remove-listing         don't remove '.listing' files\n"),
     N_("\
@@ -900,13 +951,26 @@ WARC options:\n"),
        --warc-header=STRING        insert STRING into the warcinfo record\n"),
     N_("\
        --warc-max-size=NUMBER      set maximum size of WARC files to NUMBER\n"),
+    N_("\
+       --warc-shards=NUMBER        spread the records over NUMBER WARC files\n"),
     N_("\
        --warc-cdx                  write CDX index files\n"),
     N_("\
        --warc-dedup=FILENAME       do not store records listed in this CDX file\n"),
+    N_("\
+       --warc-dedup-index=FILENAME search the --warc-dedup records through\n\
+                                     this index, building it if needed\n"),
 #ifdef HAVE_LIBZ
     N_("\
        --no-warc-compression       do not compress WARC files with GZIP\n"),
+#endif
+#ifdef HAVE_LIBZSTD
+    N_("\
+       --warc-compression=TYPE     compress WARC files with TYPE: gzip, zstd\n\
+                                     or none\n"),
+    N_("\
+       --warc-zstd-dictionary=FILE compress WARC files with the zstd\n\
+                                     dictionary in FILE\n"),
 #endif
     N_("\
        --no-warc-digests           do not calculate SHA1 digests\n"),
@@ -930,6 +994,9 @@ Recursive download:\n"),
                                      local files\n"),
     N_("\
        --convert-file-only         convert the file part of the URLs only (usually known as the basename)\n"),
+    N_("\
+       --link-map-file=FILE        remember the converted links in FILE and only\n\
+                                     convert changed files on later runs\n"),
     N_("\
        --backups=N                 before writing file X, rotate up to N backup files\n"),
 
@@ -2197,9 +2264,15 @@ only if outputting to a regular file.\n"));
                    human_readable (opt.quota, 10, 1));
     }
 
+  if (opt.timing_log)
+    timing_report ();
+
   if (opt.cookies_output)
     save_cookies ();
 
+  if (opt.ftp_listing_cache)
+    ftp_cache_save ();
+
 #ifdef HAVE_HSTS
   if (opt.hsts && hsts_store)
     save_hsts ();
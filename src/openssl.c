@@ -531,10 +531,14 @@ _sni_hostname(const char *hostname)
    fd_register_transport, so that subsequent calls to fd_read,
    fd_write, etc., will use the corresponding SSL functions.
 
+   If HTTP2 is true, HTTP/2 is offered to the server along with
+   HTTP/1.1 using ALPN; see ssl_http2_selected.
+
    Returns true on success, false on failure.  */
 
 bool
-ssl_connect_wget (int fd, const char *hostname, int *continue_session)
+ssl_connect_wget (int fd, const char *hostname, int *continue_session,
+                  bool http2)
 {
   SSL *conn;
   struct scwt_context scwt_ctx;
@@ -572,6 +576,16 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
         goto error;
     }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  if (http2)
+    {
+      static const unsigned char alpn[] = "\x02h2\x08http/1.1";
+      /* Unlike most of OpenSSL, this returns 0 on success.  */
+      if (SSL_set_alpn_protos (conn, alpn, sizeof (alpn) - 1))
+        goto error;
+    }
+#endif
+
 #ifndef FD_TO_SOCKET
 # define FD_TO_SOCKET(X) (X)
 #endif
@@ -610,6 +624,24 @@ ssl_connect_wget (int fd, const char *hostname, int *continue_session)
   return false;
 }
 
+/* Return true if the server on FD, connected with ssl_connect_wget,
+   has chosen HTTP/2 among the protocols offered to it.  */
+
+bool
+ssl_http2_selected (int fd)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  struct openssl_transport_context *ctx = fd_transport_context (fd);
+  const unsigned char *proto;
+  unsigned int len;
+
+  SSL_get0_alpn_selected (ctx->conn, &proto, &len);
+  return len == 2 && 0 == memcmp (proto, "h2", 2);
+#else
+  return false;
+#endif
+}
+
 #define ASTERISK_EXCLUDES_DOT   /* mandated by rfc2818 */
 
 /* Return true is STRING (case-insensitively) matches PATTERN, false
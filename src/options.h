@@ -122,8 +122,15 @@ struct options
   char *warc_filename;          /* WARC output filename */
   char *warc_tempdir;           /* WARC temp dir */
   char *warc_cdx_dedup_filename;/* CDX file to be used for deduplication. */
+  char *warc_cdx_dedup_index;   /* Binary index of that CDX file. */
   wgint warc_maxsize;           /* WARC max archive size */
-  bool warc_compression_enabled;/* For GZIP compression. */
+  int warc_shards;              /* Number of WARC files written at once. */
+  enum {
+    warc_compression_none,
+    warc_compression_gzip,
+    warc_compression_zstd
+  } warc_compression;           /* How WARC records are compressed. */
+  char *warc_zstd_dictionary;   /* Dictionary for zstd compression. */
   bool warc_digests_enabled;    /* For SHA1 digests. */
   bool warc_cdx_enabled;        /* Create CDX files? */
   bool warc_keep_log;           /* Store the log file in a WARC record. */
@@ -138,16 +145,26 @@ struct options
 
   bool always_rest;             /* Always use REST. */
   wgint start_pos;              /* Start position of a download. */
+  bool preallocate;             /* Reserve the space of files of known
+                                   size, and write them in large
+                                   blocks. */
   char *ftp_user;               /* FTP username */
   char *ftp_passwd;             /* FTP password */
   bool netrc;                   /* Whether to read .netrc. */
   bool ftp_glob;                /* FTP globbing */
   bool ftp_pasv;                /* Passive FTP. */
+  int ftp_connections;          /* Number of connections over which
+                                   the files of an FTP directory are
+                                   retrieved. */
+  char *ftp_listing_cache;      /* File caching the FTP directory
+                                   listings between runs. */
 
   char *http_user;              /* HTTP username. */
   char *http_passwd;            /* HTTP password. */
   char **user_headers;          /* User-defined header(s). */
   bool http_keep_alive;         /* whether we use keep-alive */
+  char *http_cache;             /* Directory caching HTTP responses
+                                   between runs. */
 
   bool use_proxy;               /* Do we use proxy? */
   bool allow_cache;             /* Do we allow server-side caching? */
@@ -168,9 +185,14 @@ struct options
   double wait;                  /* The wait period between retrievals. */
   double waitretry;             /* The wait period between retries. - HEH */
   bool use_robots;              /* Do we heed robots.txt? */
+  double max_crawl_delay;       /* The longest Crawl-delay of robots.txt
+                                   that is honored. */
 
   wgint limit_rate;             /* Limit the download rate to this
                                    many bps. */
+  wgint limit_rate_per_host;    /* Limit the rate from each server. */
+  wgint limit_rate_per_connection; /* Limit the rate of each
+                                      connection. */
   SUM_SIZE_INT quota;           /* Maximum file size to download and
                                    store. */
 
@@ -201,6 +223,9 @@ struct options
                                    locally? */
   bool convert_file_only;       /* Convert only the file portion of the URI (i.e. basename).
                                    Leave everything else untouched. */
+  char *link_map_file;          /* File recording the conversions of
+                                   previous runs, so that unchanged
+                                   files are not converted again. */
 
   bool remove_listing;          /* Do we remove .listing files
                                    generated by FTP? */
@@ -266,6 +291,8 @@ struct options
   bool keep_badhash;            /* Keep files with checksum mismatch. */
   bool keep_session_cookies;    /* whether session cookies should be
                                    saved and loaded. */
+  bool incremental_save;        /* append the changes to the cookie
+                                   and HSTS files */
 
   char *post_data;              /* POST query string */
   char *post_file_name;         /* File to post */
@@ -327,11 +354,17 @@ struct options
   bool report_bps;              /*Output bandwidth in bits format*/
 
   char *rejected_log;           /* The file to log rejected URLS to. */
+  char *timing_log;             /* The file to log the timings of
+                                   requests to. */
 
 #ifdef HAVE_HSTS
   bool hsts;
   char *hsts_file;
 #endif
+
+#ifdef HAVE_NGHTTP2
+  bool http2;                   /* whether to offer HTTP/2 over TLS */
+#endif
 };
 
 extern struct options opt;
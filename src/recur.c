@@ -43,6 +43,7 @@ as that of the covered work.  */
 #include "utils.h"
 #include "retr.h"
 #include "ftp.h"
+#include "http.h"
 #include "host.h"
 #include "hash.h"
 #include "res.h"
@@ -69,6 +70,8 @@ struct queue_element {
 struct url_queue {
   struct queue_element *head;
   struct queue_element *tail;
+  struct queue_element *ahead;  /* the last one whose request has been
+                                   sent ahead, if still queued */
   int count, maxcount;
 };
 
@@ -143,6 +146,8 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   queue->head = queue->head->next;
   if (!queue->head)
     queue->tail = NULL;
+  if (queue->ahead == qel)
+    queue->ahead = NULL;
 
   *i = qel->iri;
   *url = qel->url;
@@ -161,6 +166,30 @@ url_dequeue (struct url_queue *queue, struct iri **i,
   return true;
 }
 
+/* Send the requests for the URLs at the head of the queue ahead, so
+   that those on the server of the current HTTP/2 connection are
+   retrieved concurrently.  The URLs are offered to http_send_ahead in
+   the order of the queue, each of them once, up to the first one that
+   can't be sent.  */
+
+static void
+url_queue_send_ahead (struct url_queue *queue)
+{
+  struct queue_element *qel;
+
+  qel = queue->ahead ? queue->ahead->next : queue->head;
+  for (; qel; qel = qel->next)
+    {
+      /* Skip what the loop of retrieve_tree doesn't retrieve again.  */
+      bool downloaded = dl_url_file_map
+        && hash_table_contains (dl_url_file_map, qel->url);
+
+      if (!downloaded && !http_send_ahead (qel->url, qel->referer, qel->iri))
+        break;
+      queue->ahead = qel;
+    }
+}
+
 static void blacklist_add (struct hash_table *blacklist, const char *url)
 {
   char *url_unescaped = xstrdup (url);
@@ -281,6 +310,7 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
 
       /* Get the next URL from the queue... */
 
+      url_queue_send_ahead (queue);
       if (!url_dequeue (queue, (struct iri **) &i,
                         (const char **)&url, (const char **)&referer,
                         &depth, &html_allowed, &css_allowed))
@@ -426,6 +456,10 @@ retrieve_tree (struct url *start_url_parsed, struct iri *pi)
             = is_css ? get_urls_css_file (file, url) :
                        get_urls_html (file, url, &meta_disallow_follow, i);
 
+          /* Let the link conversion code know where the links are,
+             so it needn't parse the file again.  */
+          register_links (file, url, children);
+
           if (opt.use_robots && meta_disallow_follow)
             {
               free_urlpos (children);
@@ -734,6 +768,7 @@ download_child (const struct urlpos *upos, struct url *parent, int depth,
   if (opt.use_robots && u_scheme_like_http)
     {
       struct robot_specs *specs = res_get_specs (u->host, u->port);
+      bool allowed;
       if (!specs)
         {
           char *rfile;
@@ -764,8 +799,17 @@ download_child (const struct urlpos *upos, struct url *parent, int depth,
         }
 
       /* Now that we have (or don't have) robots.txt specs, we can
-         check what they say.  */
-      if (!res_match_path (specs, u->path))
+         check what they say.  The rules apply to the path and the
+         query together.  */
+      if (u->query)
+        {
+          char *path = concat_strings (u->path, "?", u->query, (char *) 0);
+          allowed = res_match_path (specs, path);
+          xfree (path);
+        }
+      else
+        allowed = res_match_path (specs, u->path);
+      if (!allowed)
         {
           DEBUGP (("Not following %s because robots.txt forbids it.\n", url));
           blacklist_add (blacklist, url);
@@ -58,6 +58,15 @@ as that of the covered work.  */
 
    * We don't recognize sole CR as the line ending.
 
+   * As in RFC 9309 rather than the draft, the most specific rule,
+     i.e. the one with the longest path, decides whether a path is
+     allowed, with `Allow' winning a tie, instead of the first rule
+     that matches.  `*' in a rule matches any sequence of characters,
+     and a rule ending with `$' must match the whole path.
+
+   * The `Crawl-delay' field is honored: requests to a host are spaced
+     at least that many seconds apart, up to --max-crawl-delay.
+
    * We don't implement expiry mechanism for /robots.txt specs.  I
      consider it non-necessary for a relatively short-lived
      application such as Wget.  Besides, it is highly questionable
@@ -81,6 +90,7 @@ as that of the covered work.  */
 #include "url.h"
 #include "retr.h"
 #include "res.h"
+#include "ptimer.h"
 #include "c-strcase.h"
 
 #ifdef TESTING
@@ -88,19 +98,81 @@ as that of the covered work.  */
 #endif
 
 struct path_info {
-  char *path;
+  char *path;                   /* the rule, with %-escapes decoded
+                                   and without a trailing `$' */
   bool allowedp;
   bool user_agent_exact_p;
+  bool anchored;                /* whether the rule ended with `$' */
+  int length;                   /* how specific the rule is */
+};
+
+/* The rules whose paths contain no wildcards are kept in a trie, so
+   that the longest of them matching a path is found in one walk down
+   the path.  */
+struct res_node {
+  struct res_node *child;       /* the first node one character
+                                   deeper */
+  struct res_node *next;        /* the next node at the same depth */
+  char c;
+  int rule;                     /* index of the rule ending here, or
+                                   -1 */
+  int anchored_rule;            /* the same for rules ending with
+                                   `$' */
 };
 
 struct robot_specs {
   int count;
   int size;
   struct path_info *paths;
+
+  struct res_node *trie;        /* the rules without wildcards */
+  int *wildcards;               /* indices of the other rules */
+  int wildcard_count;
+
+  double crawl_delay;           /* seconds between requests */
+  bool crawl_delay_exact;       /* whether it was given for "wget" */
+  struct ptimer *last_request;  /* started at the last request */
 };
 
 /* Parsing the robot spec. */
 
+/* If C is '%' and (ptr[1], ptr[2]) form a hexadecimal number, and if
+   that number is not a numerical representation of '/', decode C and
+   advance the pointer.  */
+
+#define DECODE_MAYBE(c, ptr) do {                               \
+  if (c == '%' && c_isxdigit (ptr[1]) && c_isxdigit (ptr[2]))       \
+    {                                                           \
+      char decoded = X2DIGITS_TO_NUM (ptr[1], ptr[2]);          \
+      if (decoded != '/')                                       \
+        {                                                       \
+          c = decoded;                                          \
+          ptr += 2;                                             \
+        }                                                       \
+    }                                                           \
+} while (0)
+
+/* Return a copy of the path between B and E with its %-escapes
+   decoded, except for those of '/'.  */
+
+static char *
+decode_path (const char *b, const char *e)
+{
+  char *path = xmalloc (e - b + 1);
+  char *q = path;
+  const char *p;
+
+  for (p = b; p < e; p++)
+    {
+      char c = *p;
+      if (c == '%' && e - p > 2)
+        DECODE_MAYBE (c, p);
+      *q++ = c;
+    }
+  *q = '\0';
+  return path;
+}
+
 /* Check whether AGENT (a string of length LENGTH) equals "wget" or
    "*".  If it is either of them, *matches is set to one.  If it is
    "wget", *exact_match is set to one.  */
@@ -138,9 +210,17 @@ add_path (struct robot_specs *specs, const char *path_b, const char *path_e,
     /* Our path representation doesn't use a leading slash, so remove
        one from theirs. */
     ++path_b;
-  pp.path     = strdupdelim (path_b, path_e);
+  pp.anchored = path_b < path_e && path_e[-1] == '$';
+  if (pp.anchored)
+    --path_e;
+  else
+    /* Trailing wildcards add nothing to a prefix.  */
+    while (path_e > path_b && path_e[-1] == '*')
+      --path_e;
+  pp.path     = decode_path (path_b, path_e);
   pp.allowedp = allowedp;
   pp.user_agent_exact_p = exactp;
+  pp.length   = strlen (pp.path) + pp.anchored;
   ++specs->count;
   if (specs->count > specs->size)
     {
@@ -177,6 +257,73 @@ prune_non_exact (struct robot_specs *specs)
   specs->size  = cnt;
 }
 
+/* Add rule number I of SPECS to the trie of SPECS.  */
+
+static void
+trie_add (struct robot_specs *specs, int i)
+{
+  const struct path_info *pp = &specs->paths[i];
+  struct res_node *node = specs->trie;
+  const char *p;
+  int *slot;
+
+  for (p = pp->path; *p; p++)
+    {
+      struct res_node *child;
+      for (child = node->child; child; child = child->next)
+        if (child->c == *p)
+          break;
+      if (!child)
+        {
+          child = xnew0 (struct res_node);
+          child->c = *p;
+          child->rule = child->anchored_rule = -1;
+          child->next = node->child;
+          node->child = child;
+        }
+      node = child;
+    }
+
+  /* Of two rules for the same path, the first one counts, unless a
+     later one allows it.  */
+  slot = pp->anchored ? &node->anchored_rule : &node->rule;
+  if (*slot < 0 || (pp->allowedp && !specs->paths[*slot].allowedp))
+    *slot = i;
+}
+
+/* Build the trie and the list of wildcard rules of SPECS.  */
+
+static void
+compile_specs (struct robot_specs *specs)
+{
+  int i;
+
+  specs->trie = xnew0 (struct res_node);
+  specs->trie->rule = specs->trie->anchored_rule = -1;
+  for (i = 0; i < specs->count; i++)
+    if (strchr (specs->paths[i].path, '*'))
+      {
+        specs->wildcards = xrealloc (specs->wildcards,
+                                     (specs->wildcard_count + 1)
+                                     * sizeof (int));
+        specs->wildcards[specs->wildcard_count++] = i;
+      }
+    else
+      trie_add (specs, i);
+}
+
+static void
+free_trie (struct res_node *node)
+{
+  while (node)
+    {
+      struct res_node *next = node->next;
+      free_trie (node->child);
+      xfree (node);
+      node = next;
+    }
+}
+
 #define EOL(p) ((p) >= lineend)
 
 #define SKIP_SPACE(p) do {              \
@@ -350,6 +497,23 @@ res_parse (const char *source, int length)
             }
           ++record_count;
         }
+      else if (FIELD_IS ("crawl-delay"))
+        {
+          if (user_agent_applies
+              && (user_agent_exact || !specs->crawl_delay_exact))
+            {
+              char *value = strdupdelim (value_b, value_e);
+              char *endp;
+              double delay = strtod (value, &endp);
+              if (endp != value && delay >= 0)
+                {
+                  specs->crawl_delay = delay;
+                  specs->crawl_delay_exact = user_agent_exact;
+                }
+              xfree (value);
+            }
+          ++record_count;
+        }
       else
         {
           DEBUGP (("Ignoring unknown field at line %d\n", line_count));
@@ -366,6 +530,8 @@ res_parse (const char *source, int length)
       /* We've encountered an exactly matching user-agent.  Throw out
          all the stuff with user-agent: *.  */
       prune_non_exact (specs);
+      if (!specs->crawl_delay_exact)
+        specs->crawl_delay = 0;
     }
   else if (specs->size > specs->count)
     {
@@ -376,6 +542,7 @@ res_parse (const char *source, int length)
       specs->size = specs->count;
     }
 
+  compile_specs (specs);
   return specs;
 }
 
@@ -405,72 +572,162 @@ free_specs (struct robot_specs *specs)
   for (i = 0; i < specs->count; i++)
     xfree (specs->paths[i].path);
   xfree (specs->paths);
+  free_trie (specs->trie);
+  xfree (specs->wildcards);
+  if (specs->last_request)
+    ptimer_destroy (specs->last_request);
   xfree (specs);
 }
 
 /* Matching of a path according to the specs. */
 
-/* If C is '%' and (ptr[1], ptr[2]) form a hexadecimal number, and if
-   that number is not a numerical representation of '/', decode C and
-   advance the pointer.  */
-
-#define DECODE_MAYBE(c, ptr) do {                               \
-  if (c == '%' && c_isxdigit (ptr[1]) && c_isxdigit (ptr[2]))       \
-    {                                                           \
-      char decoded = X2DIGITS_TO_NUM (ptr[1], ptr[2]);          \
-      if (decoded != '/')                                       \
-        {                                                       \
-          c = decoded;                                          \
-          ptr += 2;                                             \
-        }                                                       \
-    }                                                           \
-} while (0)
-
-/* The inner matching engine: return true if RECORD_PATH matches
-   URL_PATH.  The rules for matching are described at
-   <http://www.robotstxt.org/norobots-rfc.txt>, section 3.2.2.  */
+/* Return true if the rule PATH, which contains wildcards, matches
+   URL_PATH.  Unless ANCHORED, PATH only needs to match a prefix of
+   URL_PATH.  */
 
 static bool
-matches (const char *record_path, const char *url_path)
+wildcard_matches (const char *path, bool anchored, const char *url_path)
 {
-  const char *rp = record_path;
-  const char *up = url_path;
+  const char *star = NULL, *resume = NULL;
 
-  for (; ; ++rp, ++up)
+  for (;;)
     {
-      char rc = *rp;
-      char uc = *up;
-      if (!rc)
-        return true;
-      if (!uc)
-        return false;
-      DECODE_MAYBE(rc, rp);
-      DECODE_MAYBE(uc, up);
-      if (rc != uc)
+      if (*path == '*')
+        {
+          star = ++path;
+          resume = url_path;
+          continue;
+        }
+      if (!*path)
+        {
+          if (!anchored || !*url_path)
+            return true;
+        }
+      else if (*url_path && *path == *url_path)
+        {
+          ++path;
+          ++url_path;
+          continue;
+        }
+      /* Let the last `*' take one more character, if there is one.  */
+      if (!star || !*resume)
         return false;
+      path = star;
+      url_path = ++resume;
     }
 }
 
-/* Iterate through all paths in SPECS.  For the first one that
-   matches, return its allow/reject status.  If none matches,
-   retrieval is by default allowed.  */
+/* Find the most specific rule of SPECS that matches PATH and return
+   its allow/reject status.  If none matches, retrieval is by default
+   allowed.
+
+   The rules without wildcards are looked up by walking down the trie
+   along PATH, decoding it on the way, so that the time taken depends
+   only on the length of PATH.  The deepest rule passed is the most
+   specific of them; the wildcard rules are then checked against it.  */
 
 bool
 res_match_path (const struct robot_specs *specs, const char *path)
 {
+  const struct res_node *node;
+  const char *p = path;
+  int best = -1;
   int i;
+
   if (!specs)
     return true;
-  for (i = 0; i < specs->count; i++)
-    if (matches (specs->paths[i].path, path))
-      {
-        bool allowedp = specs->paths[i].allowedp;
-        DEBUGP (("%s path %s because of rule %s.\n",
-                 allowedp ? "Allowing" : "Rejecting",
-                 path, quote (specs->paths[i].path)));
-        return allowedp;
-      }
-  return true;
+
+  node = specs->trie;
+  while (node)
+    {
+      char c;
+
+      if (node->rule >= 0)
+        best = node->rule;
+      if (!*p)
+        {
+          if (node->anchored_rule >= 0)
+            best = node->anchored_rule;
+          break;
+        }
+      c = *p;
+      DECODE_MAYBE (c, p);
+      ++p;
+      for (node = node->child; node; node = node->next)
+        if (node->c == c)
+          break;
+    }
+
+  if (specs->wildcard_count)
+    {
+      char *decoded = decode_path (path, path + strlen (path));
+      for (i = 0; i < specs->wildcard_count; i++)
+        {
+          int w = specs->wildcards[i];
+          const struct path_info *pw = &specs->paths[w];
+          if ((best < 0
+               || pw->length > specs->paths[best].length
+               || (pw->length == specs->paths[best].length
+                   && pw->allowedp && !specs->paths[best].allowedp))
+              && wildcard_matches (pw->path, pw->anchored, decoded))
+            best = w;
+        }
+      xfree (decoded);
+    }
+
+  if (best < 0)
+    return true;
+
+  DEBUGP (("%s path %s because of rule %s%s.\n",
+           specs->paths[best].allowedp ? "Allowing" : "Rejecting",
+           path, quote (specs->paths[best].path),
+           specs->paths[best].anchored ? "$" : ""));
+  return specs->paths[best].allowedp;
+}
+
+/* Return the delay between requests that the robots.txt of HOST:PORT
+   asks for, cut down to --max-crawl-delay, or 0 if there is none.  */
+
+double
+res_get_crawl_delay (const char *host, int port)
+{
+  struct robot_specs *specs;
+
+  if (!opt.use_robots)
+    return 0;
+  specs = res_get_specs (host, port);
+  if (!specs || specs->crawl_delay <= 0 || opt.max_crawl_delay <= 0)
+    return 0;
+  return MIN (specs->crawl_delay, opt.max_crawl_delay);
+}
+
+/* Wait until the delay that the robots.txt of HOST:PORT asks for has
+   passed since the previous request to it.  */
+
+void
+res_crawl_delay (const char *host, int port)
+{
+  struct robot_specs *specs;
+  double delay = res_get_crawl_delay (host, port);
+
+  if (delay <= 0)
+    return;
+  specs = res_get_specs (host, port);
+
+  if (!specs->last_request)
+    specs->last_request = ptimer_new ();
+  else
+    {
+      double elapsed = ptimer_measure (specs->last_request);
+      if (elapsed < delay)
+        {
+          logprintf (LOG_VERBOSE,
+                     _("Waiting %.2f seconds for the crawl delay of %s.\n"),
+                     delay - elapsed, host);
+          xsleep (delay - elapsed);
+        }
+      ptimer_reset (specs->last_request);
+    }
 }
 
 /* Registering the specs. */
@@ -636,6 +893,58 @@ test_is_robots_txt_url(void)
   return NULL;
 }
 
+const char *
+test_res_match_path(void)
+{
+  unsigned i;
+  static const char robots[] =
+    "User-agent: *\n"
+    "Disallow: /\n"
+    "Crawl-delay: 30\n"
+    "\n"
+    "User-agent: Wget\n"
+    "Disallow: /private\n"
+    "Allow: /private/public\n"
+    "Disallow: /%7Euser/\n"
+    "Disallow: /*.cgi$\n"
+    "Allow: /cgi/*.cgi$\n"
+    "Disallow: /exact$\n"
+    "Disallow: /same\n"
+    "Allow: /same\n"
+    "Crawl-delay: 2.5\n";
+  static const struct {
+    const char *path;
+    bool allowed;
+  } test_array[] = {
+    { "index.html", true },
+    { "private", false },
+    { "private/x.html", false },
+    { "private/public/x.html", true },
+    { "~user/x.html", false },
+    { "%7euser/x.html", false },
+    { "scripts/run.cgi", false },
+    { "scripts/run.cgi?x=1", true },
+    { "scripts/run.cgi?x=1.cgi", false },
+    { "cgi/run.cgi", true },
+    { "exact", false },
+    { "exact/not", true },
+    { "same", true },
+  };
+  struct robot_specs *specs = res_parse (robots, strlen (robots));
+
+  for (i = 0; i < countof(test_array); ++i)
+    {
+      mu_assert ("test_res_match_path: wrong result",
+                 res_match_path (specs, test_array[i].path)
+                 == test_array[i].allowed);
+    }
+  mu_assert ("test_res_match_path: wrong crawl delay",
+             specs->crawl_delay == 2.5);
+
+  free_specs (specs);
+  return NULL;
+}
+
 #endif /* TESTING */
 
 /*
@@ -37,6 +37,8 @@ struct robot_specs *res_parse (const char *, int);
 struct robot_specs *res_parse_from_file (const char *);
 
 bool res_match_path (const struct robot_specs *, const char *);
+double res_get_crawl_delay (const char *, int);
+void res_crawl_delay (const char *, int);
 
 void res_register_specs (const char *, int, struct robot_specs *);
 struct robot_specs *res_get_specs (const char *, int);
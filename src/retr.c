@@ -37,9 +37,14 @@ as that of the covered work.  */
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #ifdef VMS
 # include <unixio.h>            /* For delete(). */
 #endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "exits.h"
 #include "utils.h"
@@ -57,6 +62,12 @@ as that of the covered work.  */
 #include "html-url.h"
 #include "iri.h"
 #include "hsts.h"
+#include "arena.h"
+#include "warc.h"
+
+#ifdef TESTING
+#include "test.h"
+#endif
 
 /* Total size of downloaded files.  Used to enforce quota.  */
 SUM_SIZE_INT total_downloaded_bytes;
@@ -72,81 +83,278 @@ FILE *output_stream;
    i.e. not `-' or a device file. */
 bool output_stream_regular;
 
+/* Bandwidth limiting is done with token buckets: a bucket fills up at
+   its rate, holding up to LIMIT_BURST seconds' worth of bytes, and
+   every read takes the bytes it got from the bucket.  When a read
+   leaves the bucket in debt, the reader sleeps until the debt would
+   be repaid.  --limit-rate is enforced with a single bucket shared by
+   all the transfers of the process, --limit-rate-per-host with a
+   bucket for every server address and --limit-rate-per-connection
+   with a bucket that lives as long as a single transfer.  The
+   shared buckets outlive the transfers, so that a new transfer
+   doesn't start with a fresh allowance.  */
+
+/* How many seconds' worth of bytes a bucket holds when full.  */
+#define LIMIT_BURST 0.1
+
+/* Debts shorter than this many seconds are carried over to the next
+   read rather than slept off, to avoid lots of tiny sleeps.  */
+#define LIMIT_MIN_SLEEP 0.01
+
 static struct {
-  wgint chunk_bytes;
-  double chunk_start;
-  double sleep_adjust;
+  struct ptimer *clock;         /* time base of all the buckets */
+  struct limit_bucket total;    /* --limit-rate */
+  struct hash_table *hosts;     /* server address -> --limit-rate-per-host
+                                   bucket */
 } limit_data;
 
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LIMIT_LOCK() pthread_mutex_lock (&limit_lock)
+# define LIMIT_UNLOCK() pthread_mutex_unlock (&limit_lock)
+#else
+# define LIMIT_LOCK()
+# define LIMIT_UNLOCK()
+#endif
+
+/* Start B out full, filling up at RATE bytes per second.  */
+
 static void
-limit_bandwidth_reset (void)
+limit_bucket_init (struct limit_bucket *b, wgint rate, double now)
+{
+  b->rate = rate;
+  b->tokens = rate * LIMIT_BURST;
+  b->last = now;
+}
+
+/* Take BYTES from the bucket B at time NOW and return the number of
+   seconds to wait before the bucket is out of debt.  */
+
+static double
+limit_bucket_take (struct limit_bucket *b, wgint bytes, double now)
+{
+  double burst = b->rate * LIMIT_BURST;
+
+  if (now > b->last)
+    {
+      b->tokens += (now - b->last) * b->rate;
+      if (b->tokens > burst)
+        b->tokens = burst;
+      b->last = now;
+    }
+  b->tokens -= bytes;
+  return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+/* Return the lowest of the configured rate limits, or 0 if there are
+   none.  Used for sizing buffers so that a single read never puts a
+   bucket in debt for more than a second.  */
+
+wgint
+limit_bandwidth_rate (void)
+{
+  wgint rate = opt.limit_rate;
+  if (opt.limit_rate_per_host && (!rate || opt.limit_rate_per_host < rate))
+    rate = opt.limit_rate_per_host;
+  if (opt.limit_rate_per_connection
+      && (!rate || opt.limit_rate_per_connection < rate))
+    rate = opt.limit_rate_per_connection;
+  return rate;
+}
+
+static double
+limit_now (void)
 {
-  xzero (limit_data);
+  if (!limit_data.clock)
+    limit_data.clock = ptimer_new ();
+  return ptimer_measure (limit_data.clock);
+}
+
+/* Prepare LS for a transfer reading from FD.  */
+
+void
+limit_bandwidth_start (struct limit_state *ls, int fd)
+{
+  double now;
+
+  LIMIT_LOCK ();
+  now = limit_now ();
+  if (opt.limit_rate && !limit_data.total.rate)
+    limit_bucket_init (&limit_data.total, opt.limit_rate, now);
+
+  ls->host = NULL;
+  if (opt.limit_rate_per_host)
+    {
+      ip_address ip;
+      /* Not print_address, whose static buffer the main thread may be
+         using at the same time.  */
+      char addr[64];
+      if (socket_ip_address (fd, &ip, ENDPOINT_PEER)
+          && inet_ntop (ip.family, IP_INADDR_DATA (&ip), addr, sizeof addr))
+        {
+          if (!limit_data.hosts)
+            limit_data.hosts = make_string_hash_table (0);
+          ls->host = hash_table_get (limit_data.hosts, addr);
+          if (!ls->host)
+            {
+              ls->host = xnew (struct limit_bucket);
+              limit_bucket_init (ls->host, opt.limit_rate_per_host, now);
+              hash_table_put (limit_data.hosts, xstrdup (addr), ls->host);
+            }
+        }
+    }
+
+  if (opt.limit_rate_per_connection)
+    limit_bucket_init (&ls->conn, opt.limit_rate_per_connection, now);
+  LIMIT_UNLOCK ();
 }
 
 /* Limit the bandwidth by pausing the download for an amount of time.
-   BYTES is the number of bytes received from the network, and TIMER
-   is the timer that started at the beginning of download.  */
+   BYTES is the number of bytes received from the network, and LS the
+   buckets of the transfer.  */
 
-static void
-limit_bandwidth (wgint bytes, struct ptimer *timer)
+void
+limit_bandwidth (wgint bytes, struct limit_state *ls)
 {
-  double delta_t = ptimer_read (timer) - limit_data.chunk_start;
-  double expected;
+  double now, wait = 0, w;
 
-  limit_data.chunk_bytes += bytes;
+  LIMIT_LOCK ();
+  now = limit_now ();
+  if (opt.limit_rate)
+    wait = limit_bucket_take (&limit_data.total, bytes, now);
+  if (ls->host && (w = limit_bucket_take (ls->host, bytes, now)) > wait)
+    wait = w;
+  LIMIT_UNLOCK ();
+  if (opt.limit_rate_per_connection
+      && (w = limit_bucket_take (&ls->conn, bytes, now)) > wait)
+    wait = w;
+
+  if (wait < LIMIT_MIN_SLEEP)
+    return;
+  DEBUGP (("\nsleeping %.2f ms for %s bytes\n",
+           wait * 1000, number_to_static_string (bytes)));
+  xsleep (wait);
+}
 
-  /* Calculate the amount of time we expect downloading the chunk
-     should take.  If in reality it took less time, sleep to
-     compensate for the difference.  */
-  expected = (double) limit_data.chunk_bytes / opt.limit_rate;
+/* Free the per-host buckets.  */
 
-  if (expected > delta_t)
+void
+limit_bandwidth_cleanup (void)
+{
+  if (limit_data.hosts)
     {
-      double slp = expected - delta_t + limit_data.sleep_adjust;
-      double t0, t1;
-      if (slp < 0.2)
+      hash_table_iterator iter;
+      for (hash_table_iterate (limit_data.hosts, &iter);
+           hash_table_iter_next (&iter); )
         {
-          DEBUGP (("deferring a %.2f ms sleep (%s/%.2f).\n",
-                   slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-                   delta_t));
-          return;
+          xfree (iter.key);
+          xfree (iter.value);
         }
-      DEBUGP (("\nsleeping %.2f ms for %s bytes, adjust %.2f ms\n",
-               slp * 1000, number_to_static_string (limit_data.chunk_bytes),
-               limit_data.sleep_adjust));
-
-      t0 = ptimer_read (timer);
-      xsleep (slp);
-      t1 = ptimer_measure (timer);
-
-      /* Due to scheduling, we probably slept slightly longer (or
-         shorter) than desired.  Calculate the difference between the
-         desired and the actual sleep, and adjust the next sleep by
-         that amount.  */
-      limit_data.sleep_adjust = slp - (t1 - t0);
-      /* If sleep_adjust is very large, it's likely due to suspension
-         and not clock inaccuracy.  Don't enforce those.  */
-      if (limit_data.sleep_adjust > 0.5)
-        limit_data.sleep_adjust = 0.5;
-      else if (limit_data.sleep_adjust < -0.5)
-        limit_data.sleep_adjust = -0.5;
+      hash_table_destroy (limit_data.hosts);
+      limit_data.hosts = NULL;
+    }
+  if (limit_data.clock)
+    {
+      ptimer_destroy (limit_data.clock);
+      limit_data.clock = NULL;
     }
+}
+
+/* With --preallocate, the disk space of a file whose size is known is
+   reserved before it's written, and its data is collected into blocks
+   of WRITE_BEHIND_BLOCK bytes, aligned in the file, rather than
+   flushed after every read.  Each block is written at once, and the
+   kernel is asked to start writing it to disk right away, so that
+   dirty pages don't pile up until writing them stalls the download.  */
 
-  limit_data.chunk_bytes = 0;
-  limit_data.chunk_start = ptimer_read (timer);
+#define WRITE_BEHIND_BLOCK (1024 * 1024)
+
+struct write_behind {
+  FILE *fp;
+  char *buf;
+  int len;                      /* bytes collected in BUF */
+  int size;                     /* bytes BUF takes up to the next block */
+  wgint offset;                 /* position of BUF in the file */
+};
+
+/* Start collecting the data to be written to FP in WB, if FP is a
+   regular file, and reserve LENGTH bytes for it.  The size of the
+   file is left alone, so that a download that's interrupted can still
+   be continued.  */
+
+static bool
+write_behind_start (struct write_behind *wb, FILE *fp, wgint length)
+{
+  struct stat st;
+
+  if (fflush (fp) != 0 || fstat (fileno (fp), &st) != 0
+      || !S_ISREG (st.st_mode))
+    return false;
+
+#if defined HAVE_FALLOCATE && defined FALLOC_FL_KEEP_SIZE
+  if (fallocate (fileno (fp), FALLOC_FL_KEEP_SIZE, st.st_size, length) < 0)
+    DEBUGP (("Cannot preallocate %s bytes: %s\n",
+             number_to_static_string (length), strerror (errno)));
+#endif
+
+  wb->fp = fp;
+  wb->buf = xmalloc (WRITE_BEHIND_BLOCK);
+  wb->len = 0;
+  wb->offset = st.st_size;
+  wb->size = WRITE_BEHIND_BLOCK - wb->offset % WRITE_BEHIND_BLOCK;
+  return true;
+}
+
+/* Write out the data collected in WB.  */
+
+static bool
+write_behind_flush (struct write_behind *wb)
+{
+  if (!wb->len)
+    return true;
+  if (fwrite (wb->buf, 1, wb->len, wb->fp) < (size_t) wb->len
+      || fflush (wb->fp) != 0)
+    return false;
+#if defined HAVE_SYNC_FILE_RANGE && defined SYNC_FILE_RANGE_WRITE
+  sync_file_range (fileno (wb->fp), wb->offset, wb->len,
+                   SYNC_FILE_RANGE_WRITE);
+#endif
+  wb->offset += wb->len;
+  wb->len = 0;
+  wb->size = WRITE_BEHIND_BLOCK;
+  return true;
+}
+
+/* Add BUFSIZE bytes of BUF to WB, writing out the blocks filled.  */
+
+static bool
+write_behind_add (struct write_behind *wb, const char *buf, int bufsize)
+{
+  while (bufsize > 0)
+    {
+      int n = MIN (bufsize, wb->size - wb->len);
+      memcpy (wb->buf + wb->len, buf, n);
+      wb->len += n;
+      buf += n;
+      bufsize -= n;
+      if (wb->len == wb->size && !write_behind_flush (wb))
+        return false;
+    }
+  return true;
 }
 
 /* Write data in BUF to OUT.  However, if *SKIP is non-zero, skip that
    amount of data and decrease SKIP.  Increment *TOTAL by the amount
-   of data written.  If OUT2 is not NULL, also write BUF to OUT2.
+   of data written.  If OUT2 is not NULL, also write BUF to the WARC
+   temporary file OUT2.  If WB is not NULL, the data for OUT is
+   collected there instead.
    In case of error writing to OUT, -1 is returned.  In case of error
    writing to OUT2, -2 is returned.  Return 1 if the whole BUF was
    skipped.  */
 
 static int
 write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
-            wgint *skip, wgint *written)
+            wgint *skip, wgint *written, struct write_behind *wb)
 {
   if (out == NULL && out2 == NULL)
     return 1;
@@ -164,10 +372,15 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
         return 1;
     }
 
-  if (out != NULL)
+  if (wb != NULL)
+    {
+      if (!write_behind_add (wb, buf, bufsize))
+        return -1;
+    }
+  else if (out != NULL)
     fwrite (buf, 1, bufsize, out);
-  if (out2 != NULL)
-    fwrite (buf, 1, bufsize, out2);
+  if (out2 != NULL && !warc_tempfile_write (out2, buf, bufsize))
+    return -2;
   *written += bufsize;
 
   /* Immediately flush the downloaded data.  This should not hinder
@@ -184,15 +397,11 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
      actual justification.  (Also, why 16K?  Anyone test other values?)
   */
 #ifndef __VMS
-  if (out != NULL)
+  if (out != NULL && wb == NULL)
     fflush (out);
-  if (out2 != NULL)
-    fflush (out2);
 #endif /* ndef __VMS */
   if (out != NULL && ferror (out))
     return -1;
-  else if (out2 != NULL && ferror (out2))
-    return -2;
   else
     return 0;
 }
@@ -212,7 +421,8 @@ write_data (FILE *out, FILE *out2, const char *buf, int bufsize,
    the amount of data written to disk.  The time it took to download
    the data is stored to ELAPSED.
 
-   If OUT2 is non-NULL, the contents is also written to OUT2.
+   If OUT2 is non-NULL, the contents is also written to OUT2, a
+   temporary file created by warc_tempfile.
    OUT2 will get an exact copy of the response: if this is a chunked
    response, everything -- including the chunk headers -- is written
    to OUT2.  (OUT will only get the unchunked response.)
@@ -257,6 +467,13 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
   wgint sum_written = 0;
   wgint remaining_chunk_size = 0;
 
+  /* The lowest rate limit that applies, and the state of the limiter.  */
+  wgint limit_rate;
+  struct limit_state limit_state;
+
+  /* The data to be written to OUT, with --preallocate.  */
+  struct write_behind write_behind, *wb = NULL;
+
   if (flags & rb_skip_startpos)
     skip = startpos;
 
@@ -275,13 +492,18 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       progress_interactive = progress_interactive_p (progress);
     }
 
-  if (opt.limit_rate)
-    limit_bandwidth_reset ();
+  limit_rate = limit_bandwidth_rate ();
+  if (limit_rate)
+    limit_bandwidth_start (&limit_state, fd);
 
-  /* A timer is needed for tracking progress, for throttling, and for
-     tracking elapsed time.  If either of these are requested, start
-     the timer.  */
-  if (progress || opt.limit_rate || elapsed)
+  /* A body of unknown length is written as it comes.  */
+  if (opt.preallocate && out && toread - skip > 0
+      && write_behind_start (&write_behind, out, toread - skip))
+    wb = &write_behind;
+
+  /* A timer is needed for tracking progress and for tracking elapsed
+     time.  If either of these are requested, start the timer.  */
+  if (progress || elapsed)
     {
       timer = ptimer_new ();
       last_successful_read_tm = 0;
@@ -291,8 +513,8 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
      with --limit-rate=2k, it doesn't make sense to slurp in 16K of
      data and then sleep for 8s.  With buffer size equal to the limit,
      we never have to sleep for more than one second.  */
-  if (opt.limit_rate && opt.limit_rate < dlbufsize)
-    dlbufsize = opt.limit_rate;
+  if (limit_rate && limit_rate < dlbufsize)
+    dlbufsize = limit_rate;
 
   /* Read from FD while there is data to read.  Normally toread==0
      means that it is unknown how much data is to arrive.  However, if
@@ -315,7 +537,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   break;
                 }
               else if (out2 != NULL)
-                fwrite (line, 1, strlen (line), out2);
+                warc_tempfile_write (out2, line, strlen (line));
 
               remaining_chunk_size = strtol (line, &endl, 16);
               xfree (line);
@@ -329,7 +551,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   else
                     {
                       if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
+                        warc_tempfile_write (out2, line, strlen (line));
                       xfree (line);
                     }
                   break;
@@ -371,7 +593,7 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
       else if (ret <= 0)
         break;                  /* EOF or read error */
 
-      if (progress || opt.limit_rate || elapsed)
+      if (progress || elapsed)
         {
           ptimer_measure (timer);
           if (ret > 0)
@@ -383,10 +605,11 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
           int write_res;
 
           sum_read += ret;
-          write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written);
+          write_res = write_data (out, out2, dlbuf, ret, &skip, &sum_written,
+                                  wb);
           if (write_res < 0)
             {
-              ret = (write_res == -3) ? -3 : -2;
+              ret = (write_res == -2) ? -3 : -2;
               goto out;
             }
           if (chunked)
@@ -403,15 +626,15 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
                   else
                     {
                       if (out2 != NULL)
-                        fwrite (line, 1, strlen (line), out2);
+                        warc_tempfile_write (out2, line, strlen (line));
                       xfree (line);
                     }
                 }
             }
         }
 
-      if (opt.limit_rate)
-        limit_bandwidth (ret, timer);
+      if (limit_rate)
+        limit_bandwidth (ret, &limit_state);
 
       if (progress)
         progress_update (progress, ret, ptimer_read (timer));
@@ -425,6 +648,13 @@ fd_read_body (const char *downloaded_filename, int fd, FILE *out, wgint toread,
     ret = -1;
 
  out:
+  if (wb)
+    {
+      if (!write_behind_flush (wb) && ret >= -1)
+        ret = -2;
+      xfree (wb->buf);
+    }
+
   if (progress)
     progress_finish (progress, ptimer_read (timer));
 
@@ -973,7 +1203,11 @@ retrieve_url (struct url * orig_parsed, const char *origurl, char **file,
           DEBUGP (("[Couldn't fallback to non-utf8 for %s\n", quote (url)));
     }
 
-  if (local_file && u && (*dt & RETROKF || opt.content_on_error))
+  /* The downloads are only looked up again by recursive retrieval and
+     link conversion.  Not recording them otherwise keeps memory from
+     growing with every URL of a long --input-file.  */
+  if (local_file && u && (*dt & RETROKF || opt.content_on_error)
+      && (opt.recursive || opt.page_requisites || opt.convert_links))
     {
       register_download (u->url, local_file);
 
@@ -1030,7 +1264,8 @@ uerr_t
 retrieve_from_file (const char *file, bool html, int *count)
 {
   uerr_t status;
-  struct urlpos *url_list, *cur_url;
+  struct urlpos *url_list = NULL, *cur_url;
+  struct urls_file *urls = NULL;
   struct iri *iri = iri_new();
 
   char *input_file, *url_file = NULL;
@@ -1085,12 +1320,16 @@ retrieve_from_file (const char *file, bool html, int *count)
   else
     input_file = (char *) file;
 
-  url_list = (html ? get_urls_html (input_file, NULL, NULL, iri)
-              : get_urls_file (input_file));
-
-  xfree (url_file);
+  /* A list of URLs is read as it is being retrieved, rather than all
+     at once; HTML has to be parsed in one go.  */
+  if (html)
+    url_list = get_urls_html (input_file, NULL, NULL, iri);
+  else
+    urls = urls_file_open (input_file);
 
-  for (cur_url = url_list; cur_url; cur_url = cur_url->next, ++*count)
+  for (cur_url = urls ? urls_file_next (urls) : url_list;
+       cur_url;
+       cur_url = urls ? urls_file_next (urls) : cur_url->next, ++*count)
     {
       char *filename = NULL, *new_file = NULL, *proxy;
       int dt = 0;
@@ -1158,6 +1397,9 @@ Removing file due to --delete-after in retrieve_from_file():\n"));
 
   /* Free the linked list of URL-s.  */
   free_urlpos (url_list);
+  if (urls)
+    urls_file_close (urls);
+  xfree (url_file);
 
   iri_free (iri);
 
@@ -1219,19 +1461,25 @@ sleep_between_retrievals (int count)
     }
 }
 
-/* Free the linked list of urlpos.  */
+/* Free the linked list of urlpos.  The elements of the lists built by
+   the get_urls_* functions are allocated from an arena, and are freed
+   all at once along with it.  */
 void
 free_urlpos (struct urlpos *l)
 {
+  struct arena *arena = l ? l->arena : NULL;
+
   while (l)
     {
       struct urlpos *next = l->next;
       if (l->url)
         url_free (l->url);
       xfree (l->local_name);
-      xfree (l);
+      if (!l->arena)
+        xfree (l);
       l = next;
     }
+  arena_free (arena);
 }
 
 /* Rotate FNAME opt.backups times */
@@ -1385,3 +1633,30 @@ input_file_url (const char *input_file)
   else
     return false;
 }
+
+#ifdef TESTING
+
+const char *
+test_limit_bucket (void)
+{
+  struct limit_bucket b;
+
+  /* 10000 B/s, so a full bucket holds 1000 bytes.  */
+  limit_bucket_init (&b, 10000, 0);
+  mu_assert ("a full bucket lets a burst through",
+             limit_bucket_take (&b, 1000, 0) == 0);
+  mu_assert ("an empty bucket makes the reader wait",
+             limit_bucket_take (&b, 500, 0) == 0.05);
+  mu_assert ("the bucket is refilled with time",
+             limit_bucket_take (&b, 500, 0.1) == 0);
+  mu_assert ("the refill stops at the burst size",
+             limit_bucket_take (&b, 2000, 10.1) == 0.1);
+  mu_assert ("the debt carries over to the next read",
+             limit_bucket_take (&b, 1000, 10.1) == 0.2);
+  mu_assert ("time going backwards doesn't refill the bucket",
+             limit_bucket_take (&b, 0, 10) == 0.2);
+
+  return NULL;
+}
+
+#endif /* TESTING */
@@ -54,6 +54,25 @@ enum {
 
 int fd_read_body (const char *, int, FILE *, wgint, wgint, wgint *, wgint *, double *, int, FILE *);
 
+/* A token bucket of the bandwidth limiter.  */
+struct limit_bucket {
+  double rate;                  /* bytes per second */
+  double tokens;                /* bytes that may be read without
+                                   waiting; negative when in debt */
+  double last;                  /* time of the last refill */
+};
+
+/* The buckets a transfer reads through.  */
+struct limit_state {
+  struct limit_bucket *host;    /* bucket of the server, if limited */
+  struct limit_bucket conn;     /* bucket of the connection, if limited */
+};
+
+wgint limit_bandwidth_rate (void);
+void limit_bandwidth_start (struct limit_state *, int);
+void limit_bandwidth (wgint, struct limit_state *);
+void limit_bandwidth_cleanup (void);
+
 typedef const char *(*hunk_terminator_t) (const char *, const char *, int);
 
 char *fd_read_hunk (int, hunk_terminator_t, long, long);
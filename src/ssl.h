@@ -33,7 +33,8 @@ as that of the covered work.  */
 #define GEN_SSLFUNC_H
 
 bool ssl_init (void);
-bool ssl_connect_wget (int, const char *, int *);
+bool ssl_connect_wget (int, const char *, int *, bool);
 bool ssl_check_certificate (int, const char *);
+bool ssl_http2_selected (int);
 
 #endif /* GEN_SSLFUNC_H */
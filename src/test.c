@@ -31,6 +31,7 @@ as that of the covered work.  */
 #include "wget.h"
 
 #include <stdio.h>
+#include <string.h>
 #ifdef ENABLE_NLS
 # include <locale.h>
 #endif
@@ -53,22 +54,33 @@ all_tests(void)
   mu_run_test (test_find_key_values);
   mu_run_test (test_has_key);
 #endif
+  mu_run_test (test_arena);
   mu_run_test (test_parse_content_disposition);
   mu_run_test (test_parse_range_header);
   mu_run_test (test_subdir_p);
   mu_run_test (test_dir_matches_p);
+  mu_run_test (test_acceptable);
   mu_run_test (test_commands_sorted);
   mu_run_test (test_cmd_spec_restrict_file_names);
   mu_run_test (test_path_simplify);
   mu_run_test (test_append_uri_pathel);
   mu_run_test (test_are_urls_equal);
+  mu_run_test (test_url_parse);
+  mu_run_test (test_mkalldirs);
   mu_run_test (test_is_robots_txt_url);
+  mu_run_test (test_res_match_path);
+  mu_run_test (test_limit_bucket);
 #ifdef HAVE_HSTS
   mu_run_test (test_hsts_new_entry);
   mu_run_test (test_hsts_url_rewrite_superdomain);
   mu_run_test (test_hsts_url_rewrite_congruent);
   mu_run_test (test_hsts_read_database);
+  mu_run_test (test_hsts_read_log);
 #endif
+  mu_run_test (test_cookies_incremental_save);
+  mu_run_test (test_ftp_parse_mlsd);
+  mu_run_test (test_warc_cdx_index);
+  mu_run_test (test_timing_percentile);
 
   return NULL;
 }
@@ -76,7 +88,7 @@ all_tests(void)
 const char *program_name; /* Needed by lib/error.c. */
 
 int
-main (int argc _GL_UNUSED, const char *argv[])
+main (int argc, const char *argv[])
 {
   const char *result;
 
@@ -91,6 +103,14 @@ main (int argc _GL_UNUSED, const char *argv[])
 
   program_name = argv[0];
 
+  /* "unit-tests --benchmark" times some hot code paths instead. */
+  if (argc > 1 && !strcmp (argv[1], "--benchmark"))
+    {
+      bench_url_parse ();
+      bench_acceptable ();
+      return 0;
+    }
+
   result = all_tests();
 
   if (result != NULL)
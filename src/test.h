@@ -44,6 +44,7 @@ do { \
 } while (0)
 
 
+const char *test_arena (void);
 const char *test_has_key (void);
 const char *test_find_key_value (void);
 const char *test_find_key_values (void);
@@ -52,15 +53,28 @@ const char *test_parse_range_header(void);
 const char *test_commands_sorted(void);
 const char *test_cmd_spec_restrict_file_names(void);
 const char *test_is_robots_txt_url(void);
+const char *test_res_match_path(void);
+const char *test_limit_bucket(void);
 const char *test_path_simplify (void);
 const char *test_append_uri_pathel(void);
 const char *test_are_urls_equal(void);
+const char *test_url_parse (void);
+const char *test_mkalldirs (void);
 const char *test_subdir_p(void);
 const char *test_dir_matches_p(void);
+const char *test_acceptable(void);
 const char *test_hsts_new_entry(void);
 const char *test_hsts_url_rewrite_superdomain(void);
 const char *test_hsts_url_rewrite_congruent(void);
 const char *test_hsts_read_database(void);
+const char *test_hsts_read_log(void);
+const char *test_cookies_incremental_save(void);
+const char *test_ftp_parse_mlsd(void);
+const char *test_warc_cdx_index(void);
+const char *test_timing_percentile(void);
+
+void bench_url_parse (void);
+void bench_acceptable (void);
 
 #endif /* TEST_H */
 
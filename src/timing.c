@@ -0,0 +1,325 @@
+/* Per-request timing of the phases of HTTP requests.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+/* With --timing-log, the time spent in every phase of an HTTP request
+   (resolving the host, connecting, the TLS handshake, waiting for the
+   response header and reading the body) is measured and written to
+   the log as a line of JSON:
+
+     {"url":"http://example.com/","start":"2017-05-02T10:14:06Z",
+      "status":200,"bytes":1270,"dns":0.812,"connect":0.154,"tls":null,
+      "ttfb":12.407,"transfer":0.093,"total":13.690}
+
+   all times being in milliseconds.  Phases which did not take place,
+   such as the connection to a host when a persistent connection is
+   reused, are null.  When Wget exits, the percentiles of the times of
+   all the requests are printed.  */
+
+#include "wget.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "utils.h"
+#include "url.h"
+#include "ptimer.h"
+#include "timing.h"
+#ifdef TESTING
+#include "test.h"
+#endif
+
+static const char *phase_names[TIMING_PHASES] = {
+  "dns", "connect", "tls", "ttfb", "transfer"
+};
+
+/* The request being timed.  */
+static struct {
+  bool active;                  /* whether a request is being timed */
+  time_t start;                 /* when it was started */
+  double started[TIMING_PHASES]; /* when each running phase started,
+                                    -1 if it isn't running */
+  double spent[TIMING_PHASES];  /* time spent in each phase, -1 if it
+                                   didn't take place */
+} record;
+
+static struct ptimer *timer;
+static FILE *timing_fp;
+
+/* Whether the timing log could not be opened.  */
+static bool timing_failed;
+
+/* The times of all the requests, for the summary printed at exit.
+   The total time of the requests is kept after their phases.  */
+static double *samples[TIMING_PHASES + 1];
+static int sample_count[TIMING_PHASES + 1];
+static int sample_size[TIMING_PHASES + 1];
+
+/* Start timing a request.  */
+void
+timing_begin (void)
+{
+  int i;
+
+  if (!opt.timing_log || timing_failed)
+    return;
+  if (!timing_fp)
+    {
+      timing_fp = fopen (opt.timing_log, "w");
+      if (!timing_fp)
+        {
+          logprintf (LOG_NOTQUIET, "%s: %s\n", opt.timing_log,
+                     strerror (errno));
+          timing_failed = true;
+          return;
+        }
+    }
+  if (!timer)
+    timer = ptimer_new ();
+  else
+    ptimer_reset (timer);
+
+  record.active = true;
+  record.start = time (NULL);
+  for (i = 0; i < TIMING_PHASES; i++)
+    record.started[i] = record.spent[i] = -1;
+}
+
+/* Start timing PHASE of the request.  */
+void
+timing_start (enum timing_phase phase)
+{
+  if (!record.active)
+    return;
+  record.started[phase] = ptimer_measure (timer);
+}
+
+/* Stop timing PHASE of the request.  A phase may take place more than
+   once, as when connecting to the next address of a host after the
+   first did not answer, in which case its times are added up.  */
+void
+timing_stop (enum timing_phase phase)
+{
+  double elapsed;
+
+  if (!record.active || record.started[phase] < 0)
+    return;
+  elapsed = ptimer_measure (timer) - record.started[phase];
+  record.started[phase] = -1;
+  if (record.spent[phase] < 0)
+    record.spent[phase] = 0;
+  record.spent[phase] += elapsed;
+}
+
+/* Adds the time SECS to the samples of phase I.  */
+static void
+add_sample (int i, double secs)
+{
+  if (sample_count[i] == sample_size[i])
+    {
+      sample_size[i] = sample_size[i] ? sample_size[i] * 2 : 64;
+      samples[i] = xrealloc (samples[i],
+                             sample_size[i] * sizeof (double));
+    }
+  samples[i][sample_count[i]++] = secs;
+}
+
+/* Writes the time SECS to FP in milliseconds, or null if it is
+   negative.  The number is formatted by hand so that the decimal
+   separator of the locale doesn't get into the JSON.  */
+static void
+write_msecs (FILE *fp, double secs)
+{
+  wgint usecs;
+
+  if (secs < 0)
+    {
+      fputs ("null", fp);
+      return;
+    }
+  usecs = (wgint) (secs * 1000000 + 0.5);
+  fprintf (fp, "%s.%03d", number_to_static_string (usecs / 1000),
+           (int) (usecs % 1000));
+}
+
+/* Writes S to FP as a JSON string.  */
+static void
+write_json_string (FILE *fp, const char *s)
+{
+  putc ('"', fp);
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        fprintf (fp, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (fp, "\\u%04x", c);
+      else
+        putc (c, fp);
+    }
+  putc ('"', fp);
+}
+
+/* Finish timing the request for U, which got a response with status
+   STATUS, or 0 if there was none, and a body of BYTES bytes.  Its
+   times are written to the timing log.  */
+void
+timing_end (const struct url *u, int status, wgint bytes)
+{
+  double total;
+  char *url;
+  char start[32];
+  int i;
+
+  if (!record.active)
+    return;
+  for (i = 0; i < TIMING_PHASES; i++)
+    timing_stop (i);
+  total = ptimer_measure (timer);
+  record.active = false;
+
+  for (i = 0; i < TIMING_PHASES; i++)
+    if (record.spent[i] >= 0)
+      add_sample (i, record.spent[i]);
+  add_sample (TIMING_PHASES, total);
+
+  url = url_string (u, URL_AUTH_HIDE_PASSWD);
+  strftime (start, sizeof (start), "%Y-%m-%dT%H:%M:%SZ",
+            gmtime (&record.start));
+
+  fputs ("{\"url\":", timing_fp);
+  write_json_string (timing_fp, url);
+  fprintf (timing_fp, ",\"start\":\"%s\",\"status\":%d,\"bytes\":%s",
+           start, status, number_to_static_string (bytes));
+  for (i = 0; i < TIMING_PHASES; i++)
+    {
+      fprintf (timing_fp, ",\"%s\":", phase_names[i]);
+      write_msecs (timing_fp, record.spent[i]);
+    }
+  fputs (",\"total\":", timing_fp);
+  write_msecs (timing_fp, total);
+  fputs ("}\n", timing_fp);
+  /* Keep the log usable while a long run is still going on.  */
+  fflush (timing_fp);
+
+  xfree (url);
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Returns the Pth percentile of the N values SORTED, sorted in
+   ascending order, by the nearest-rank method.  */
+static double
+percentile (const double *sorted, int n, int p)
+{
+  int rank = (int) (((double) p * n + 99) / 100);
+  if (rank < 1)
+    rank = 1;
+  return sorted[rank - 1];
+}
+
+/* Prints the percentiles of the times of the requests, and closes the
+   timing log.  */
+void
+timing_report (void)
+{
+  int i;
+
+  if (sample_count[TIMING_PHASES])
+    {
+      logprintf (LOG_NOTQUIET,
+                 _("Request timings in milliseconds (%d requests):\n"),
+                 sample_count[TIMING_PHASES]);
+      logprintf (LOG_NOTQUIET, "  %-9s %7s %10s %10s %10s %10s\n",
+                 "", "count", "p50", "p90", "p99", "max");
+      for (i = 0; i <= TIMING_PHASES; i++)
+        {
+          double *s = samples[i];
+          int n = sample_count[i];
+
+          if (!n)
+            continue;
+          qsort (s, n, sizeof (double), cmp_double);
+          logprintf (LOG_NOTQUIET, "  %-9s %7d %10.3f %10.3f %10.3f %10.3f\n",
+                     i < TIMING_PHASES ? phase_names[i] : "total", n,
+                     percentile (s, n, 50) * 1000,
+                     percentile (s, n, 90) * 1000,
+                     percentile (s, n, 99) * 1000,
+                     s[n - 1] * 1000);
+        }
+    }
+
+  for (i = 0; i <= TIMING_PHASES; i++)
+    {
+      xfree (samples[i]);
+      sample_count[i] = sample_size[i] = 0;
+    }
+  if (timer)
+    {
+      ptimer_destroy (timer);
+      timer = NULL;
+    }
+  if (timing_fp)
+    {
+      if (fclose (timing_fp) < 0)
+        logprintf (LOG_NOTQUIET, _("Error closing %s: %s\n"),
+                   quote (opt.timing_log), strerror (errno));
+      timing_fp = NULL;
+    }
+}
+
+#ifdef TESTING
+
+const char *
+test_timing_percentile (void)
+{
+  static const double values[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+  static const double one[] = { 42 };
+
+  mu_assert ("test_timing_percentile: wrong p50",
+             percentile (values, 10, 50) == 5);
+  mu_assert ("test_timing_percentile: wrong p90",
+             percentile (values, 10, 90) == 9);
+  mu_assert ("test_timing_percentile: wrong p99",
+             percentile (values, 10, 99) == 10);
+  mu_assert ("test_timing_percentile: wrong p0",
+             percentile (values, 10, 0) == 1);
+  mu_assert ("test_timing_percentile: wrong p50 of one",
+             percentile (one, 1, 50) == 42);
+  return NULL;
+}
+
+#endif /* TESTING */
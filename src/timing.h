@@ -0,0 +1,52 @@
+/* Declarations for timing.c.
+   Copyright (C) 2017 Free Software Foundation, Inc.
+
+This file is part of GNU Wget.
+
+GNU Wget is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+GNU Wget is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Wget.  If not, see <http://www.gnu.org/licenses/>.
+
+Additional permission under GNU GPL version 3 section 7
+
+If you modify this program, or any covered work, by linking or
+combining it with the OpenSSL project's OpenSSL library (or a
+modified version of that library), containing parts covered by the
+terms of the OpenSSL or SSLeay licenses, the Free Software Foundation
+grants you additional permission to convey the resulting work.
+Corresponding Source for a non-source form of such a combination
+shall include the source code for the parts of OpenSSL used as well
+as that of the covered work.  */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+/* The phases of a request whose duration is recorded.  */
+enum timing_phase
+{
+  TIMING_DNS,                   /* resolving the host name */
+  TIMING_CONNECT,               /* establishing the TCP connection */
+  TIMING_TLS,                   /* the TLS handshake */
+  TIMING_TTFB,                  /* waiting for the response header */
+  TIMING_TRANSFER,              /* reading the response body */
+  TIMING_PHASES
+};
+
+struct url;
+
+void timing_begin (void);
+void timing_start (enum timing_phase);
+void timing_stop (enum timing_phase);
+void timing_end (const struct url *, int, wgint);
+void timing_report (void);
+
+#endif /* TIMING_H */
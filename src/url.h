@@ -99,6 +99,11 @@ struct url
   /* Username and password (unquoted). */
   char *user;
   char *passwd;
+
+  /* The strings above are allocated in one block along with the
+     struct; this tells which of them have since been replaced by
+     url_set_dir or url_set_file.  Private to url.c.  */
+  unsigned int replaced;
 };
 
 /* Function declarations */
@@ -128,6 +133,8 @@ char *url_file_name (const struct url *, char *);
 char *uri_merge (const char *, const char *);
 
 int mkalldirs (const char *);
+int mkalldirs_again (const char *);
+void mkalldirs_cleanup (void);
 
 char *rewrite_shorthand_url (const char *);
 bool schemes_are_similar_p (enum url_scheme a, enum url_scheme b);
@@ -61,6 +61,7 @@ as that of the covered work.  */
 #include <sys/time.h>
 
 #include <sys/stat.h>
+#include <sys/file.h>
 
 /* For TIOCGWINSZ and friends: */
 #ifndef WINDOWS
@@ -108,6 +109,7 @@ as that of the covered work.  */
 #endif /* def __VMS */
 
 #ifdef TESTING
+#include "ptimer.h"
 #include "test.h"
 #endif
 
@@ -673,6 +675,13 @@ file_size (const char *filename)
 
 #ifdef UNIQ_SEP
 
+/* For every PREFIX given to unique_name_1, how many of the names
+   PREFIX.1, PREFIX.2, etc. were found to exist, all of them.  Files
+   aren't removed during a run, except with --delete-after, so a name
+   asked for again, as index.html is when mirroring lots of directory
+   listings into one directory, doesn't need those checked again.  */
+static struct hash_table *unique_counts;
+
 /* stat file names named PREFIX.1, PREFIX.2, etc., until one that
    doesn't exist is found.  Return a freshly allocated copy of the
    unused file name.  */
@@ -684,17 +693,46 @@ unique_name_1 (const char *prefix)
   int plen = strlen (prefix);
   char *template = (char *)alloca (plen + 1 + 24);
   char *template_tail = template + plen;
+  char *old_prefix = NULL;
+  void *taken;
 
   memcpy (template, prefix, plen);
   *template_tail++ = UNIQ_SEP;
 
+  if (!opt.delete_after)
+    {
+      if (!unique_counts)
+        unique_counts = make_string_hash_table (0);
+      if (hash_table_get_pair (unique_counts, prefix, &old_prefix, &taken))
+        count = (intptr_t) taken + 1;
+    }
+
   do
     number_to_string (template_tail, count++);
   while (file_exists_p (template, NULL));
 
+  if (unique_counts && !opt.delete_after)
+    hash_table_put (unique_counts, old_prefix ? old_prefix : xstrdup (prefix),
+                    (void *)(intptr_t) (count - 2));
   return xstrdup (template);
 }
 
+/* Forget the numbers given by unique_name.  */
+
+void
+unique_name_cleanup (void)
+{
+  if (unique_counts)
+    {
+      hash_table_iterator iter;
+      for (hash_table_iterate (unique_counts, &iter);
+           hash_table_iter_next (&iter); )
+        xfree (iter.key);
+      hash_table_destroy (unique_counts);
+      unique_counts = NULL;
+    }
+}
+
 /* Return a unique file name, based on FILE.
 
    More precisely, if FILE doesn't exist, it is returned unmodified.
@@ -738,6 +776,11 @@ unique_name (const char *file, bool allow_passthrough)
   return allow_passthrough ? (char *)file : xstrdup (file);
 }
 
+void
+unique_name_cleanup (void)
+{
+}
+
 #endif /* def UNIQ_SEP [else] */
 
 /* Create a file based on NAME, except without overwriting an existing
@@ -963,46 +1006,6 @@ open_stat(const char *fname, int flags, mode_t mode, file_stats_t *fstats)
   return fd;
 }
 
-/* Create DIRECTORY.  If some of the pathname components of DIRECTORY
-   are missing, create them first.  In case any mkdir() call fails,
-   return its error status.  Returns 0 on successful completion.
-
-   The behaviour of this function should be identical to the behaviour
-   of `mkdir -p' on systems where mkdir supports the `-p' option.  */
-int
-make_directory (const char *directory)
-{
-  int i, ret, quit = 0;
-  char *dir;
-
-  /* Make a copy of dir, to be able to write to it.  Otherwise, the
-     function is unsafe if called with a read-only char *argument.  */
-  STRDUP_ALLOCA (dir, directory);
-
-  /* If the first character of dir is '/', skip it (and thus enable
-     creation of absolute-pathname directories.  */
-  for (i = (*dir == '/'); 1; ++i)
-    {
-      for (; dir[i] && dir[i] != '/'; i++)
-        ;
-      if (!dir[i])
-        quit = 1;
-      dir[i] = '\0';
-      /* Check whether the directory already exists.  Allow creation of
-         of intermediate directories to fail, as the initial path components
-         are not necessarily directories!  */
-      if (!file_exists_p (dir, NULL))
-        ret = mkdir (dir, 0777);
-      else
-        ret = 0;
-      if (quit)
-        break;
-      else
-        dir[i] = '/';
-    }
-  return ret;
-}
-
 /* Merge BASE with FILE.  BASE can be a directory or a file name, FILE
    should be a file name.
 
@@ -1029,6 +1032,109 @@ file_merge (const char *base, const char *file)
   return result;
 }
 
+/* Support for files that are saved by appending records to them, such
+   as the cookie and HSTS databases with --incremental-save.  Records
+   are lines; a line not terminated by a newline is one whose writer
+   didn't get to finish it.  */
+
+/* Remove a partially written line from the end of the file open on
+   FD, which is SIZE bytes long.  Returns false if it could not be
+   removed, in which case records must not be appended to the file, or
+   they would be glued to it.  */
+
+static bool
+drop_unfinished_line (int fd, off_t size)
+{
+  char buf[512];
+  off_t end = size;
+
+  while (end > 0)
+    {
+      off_t n = MIN (end, (off_t) sizeof (buf));
+      off_t i;
+
+      if (lseek (fd, end - n, SEEK_SET) < 0 || read (fd, buf, n) != n)
+        return false;
+      for (i = n; i > 0; i--)
+        if (buf[i - 1] == '\n')
+          return end - n + i == size || ftruncate (fd, end - n + i) == 0;
+      end -= n;
+    }
+  return size == 0 || ftruncate (fd, 0) == 0;
+}
+
+/* Open FILE for appending records to it, creating it if needed, and
+   lock it against other processes writing to it.  The stream is also
+   open for reading from the start of the file.  The lock is released
+   when the stream is closed.  Returns NULL on error, including when
+   a partially written record at the end of FILE cannot be removed.  */
+
+FILE *
+journal_open (const char *file)
+{
+  for (;;)
+    {
+      struct stat st, cur;
+      FILE *fp = fopen (file, "a+");
+
+      if (!fp)
+        return NULL;
+      if (flock (fileno (fp), LOCK_EX) < 0 || fstat (fileno (fp), &st) < 0)
+        {
+          fclose (fp);
+          return NULL;
+        }
+      /* Another process may have replaced FILE while we were waiting
+         for the lock; the file we have opened is then not FILE any
+         more.  */
+      if (stat (file, &cur) == 0
+          && cur.st_dev == st.st_dev && cur.st_ino == st.st_ino)
+        {
+          if (!drop_unfinished_line (fileno (fp), st.st_size))
+            {
+              fclose (fp);
+              return NULL;
+            }
+          fseek (fp, 0, SEEK_SET);
+          return fp;
+        }
+      fclose (fp);
+    }
+}
+
+/* Replace FILE, which is held open by journal_open, with what DUMP
+   writes when called with ARG.  It is written to a temporary file that
+   is renamed over FILE, so that FILE remains complete if Wget is
+   interrupted, and keeps the permissions of FILE.  */
+
+bool
+journal_replace (const char *file, void (*dump) (FILE *, void *), void *arg)
+{
+  char *tmp = aprintf ("%s.%ld.tmp", file, (long) getpid ());
+  struct stat st;
+  bool ok;
+  FILE *fp;
+
+  fp = fopen (tmp, "w");
+  if (!fp)
+    {
+      xfree (tmp);
+      return false;
+    }
+  if (stat (file, &st) == 0)
+    chmod (tmp, st.st_mode & 07777);
+  dump (fp, arg);
+  ok = !ferror (fp);
+  if (fclose (fp) < 0)
+    ok = false;
+  if (ok && rename (tmp, file) < 0)
+    ok = false;
+  if (!ok)
+    unlink (tmp);
+  xfree (tmp);
+  return ok;
+}
+
 /* Like fnmatch, but performs a case-insensitive match.  */
 
 int
@@ -1053,7 +1159,179 @@ fnmatch_nocase (const char *pattern, const char *string, int flags)
 #endif
 }
 
-static bool in_acclist (const char *const *, const char *, bool);
+/* A list of accept or reject patterns, compiled so that a file name
+   is matched against all of them at once instead of one by one.
+
+   A pattern without wildcards matches the names that end with it, and
+   so does "*TAIL" where TAIL has no wildcards.  Such tails are kept in
+   a hash table, which is probed with the end of the name once for
+   each distinct tail length.  Likewise "HEAD*" patterns are probed
+   with the beginnings of names.  Only the remaining patterns are
+   matched by fnmatch, one at a time.  */
+
+struct acclist {
+  char **patterns;              /* the list this was compiled from */
+  bool fold_case;               /* whether it was compiled for
+                                   --ignore-case */
+
+  struct hash_table *tails;     /* the tails names may end with */
+  int *tail_lengths;            /* their distinct lengths */
+  int tail_length_count;
+
+  struct hash_table *heads;     /* the heads names may begin with */
+  int *head_lengths;
+  int head_length_count;
+
+  const char **globs;           /* the patterns for fnmatch */
+  int glob_count;
+};
+
+static struct acclist *accepts_compiled, *rejects_compiled;
+
+/* Add LEN to the LENGTHS array of COUNT distinct lengths.  */
+static void
+add_length (int **lengths, int *count, int len)
+{
+  int i;
+  for (i = 0; i < *count; i++)
+    if ((*lengths)[i] == len)
+      return;
+  *lengths = xrealloc (*lengths, (*count + 1) * sizeof (int));
+  (*lengths)[(*count)++] = len;
+}
+
+/* Return true if the first LEN characters of S are free of wildcards
+   and of the backslash, which fnmatch treats as an escape.  */
+static bool
+literal_p (const char *s, size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+    if (strchr ("*?[]\\", s[i]))
+      return false;
+  return true;
+}
+
+static struct acclist *
+acclist_compile (char **patterns)
+{
+  struct acclist *al = xnew0 (struct acclist);
+  char **p;
+
+  al->patterns = patterns;
+  al->fold_case = opt.ignore_case;
+  if (al->fold_case)
+    {
+      al->tails = make_nocase_string_hash_table (0);
+      al->heads = make_nocase_string_hash_table (0);
+    }
+  else
+    {
+      al->tails = make_string_hash_table (0);
+      al->heads = make_string_hash_table (0);
+    }
+
+  for (p = patterns; *p; p++)
+    {
+      const char *pat = *p;
+      size_t len = strlen (pat);
+
+      if (!has_wildcards_p (pat))
+        {
+          hash_table_put (al->tails, pat, pat);
+          add_length (&al->tail_lengths, &al->tail_length_count, len);
+        }
+      else if (*pat == '*' && literal_p (pat + 1, len - 1))
+        {
+          hash_table_put (al->tails, pat + 1, pat);
+          add_length (&al->tail_lengths, &al->tail_length_count, len - 1);
+        }
+      else if (pat[len - 1] == '*' && literal_p (pat, len - 1))
+        {
+          char *head = strdupdelim (pat, pat + len - 1);
+          if (hash_table_contains (al->heads, head))
+            xfree (head);
+          else
+            hash_table_put (al->heads, head, pat);
+          add_length (&al->head_lengths, &al->head_length_count, len - 1);
+        }
+      else
+        {
+          al->globs = xrealloc (al->globs,
+                                (al->glob_count + 1) * sizeof (char *));
+          al->globs[al->glob_count++] = pat;
+        }
+    }
+  return al;
+}
+
+static void
+acclist_free (struct acclist *al)
+{
+  hash_table_iterator iter;
+
+  if (!al)
+    return;
+  hash_table_destroy (al->tails);
+  for (hash_table_iterate (al->heads, &iter); hash_table_iter_next (&iter); )
+    xfree (iter.key);
+  hash_table_destroy (al->heads);
+  xfree (al->tail_lengths);
+  xfree (al->head_lengths);
+  xfree (al->globs);
+  xfree (al);
+}
+
+/* Return the compiled form of PATTERNS, kept in *CACHE.  It is compiled
+   the first time it is needed, once the options have been set, and
+   again only if the list or --ignore-case changes.  */
+static const struct acclist *
+acclist_get (struct acclist **cache, char **patterns)
+{
+  if (!*cache || (*cache)->patterns != patterns
+      || (*cache)->fold_case != opt.ignore_case)
+    {
+      acclist_free (*cache);
+      *cache = acclist_compile (patterns);
+    }
+  return *cache;
+}
+
+/* Return true if the file name S matches any of the patterns of AL.  */
+static bool
+acclist_match (const struct acclist *al, const char *s)
+{
+  int len = strlen (s);
+  int i;
+
+  for (i = 0; i < al->tail_length_count; i++)
+    if (al->tail_lengths[i] <= len
+        && hash_table_contains (al->tails, s + len - al->tail_lengths[i]))
+      return true;
+
+  if (al->head_length_count)
+    {
+      char *head = alloca (len + 1);
+      for (i = 0; i < al->head_length_count; i++)
+        if (al->head_lengths[i] <= len)
+          {
+            memcpy (head, s, al->head_lengths[i]);
+            head[al->head_lengths[i]] = '\0';
+            if (hash_table_contains (al->heads, head))
+              return true;
+          }
+    }
+
+  for (i = 0; i < al->glob_count; i++)
+    {
+      int res = al->fold_case
+        ? fnmatch_nocase (al->globs[i], s, 0) : fnmatch (al->globs[i], s, 0);
+      /* fnmatch returns 0 if the pattern *does* match the string.  */
+      if (res == 0)
+        return true;
+    }
+  return false;
+}
 
 /* Determine whether a file is acceptable to be followed, according to
    lists of patterns to accept/reject.  */
@@ -1068,20 +1346,25 @@ acceptable (const char *s)
   if ((p = strrchr (s, '/')))
     s = p + 1;
 
-  if (opt.accepts)
-    {
-      if (opt.rejects)
-        return (in_acclist ((const char *const *)opt.accepts, s, true)
-                && !in_acclist ((const char *const *)opt.rejects, s, true));
-      else
-        return in_acclist ((const char *const *)opt.accepts, s, true);
-    }
-  else if (opt.rejects)
-    return !in_acclist ((const char *const *)opt.rejects, s, true);
+  if (opt.accepts
+      && !acclist_match (acclist_get (&accepts_compiled, opt.accepts), s))
+    return false;
+  if (opt.rejects
+      && acclist_match (acclist_get (&rejects_compiled, opt.rejects), s))
+    return false;
 
   return true;
 }
 
+/* Free the compiled accept/reject lists.  */
+void
+acceptable_cleanup (void)
+{
+  acclist_free (accepts_compiled);
+  acclist_free (rejects_compiled);
+  accepts_compiled = rejects_compiled = NULL;
+}
+
 /* Determine whether an URL is acceptable to be followed, according to
    regex patterns to accept/reject.  */
 bool
@@ -1189,44 +1472,6 @@ match_tail (const char *string, const char *tail, bool fold_case)
     return !strcasecmp (string + pos, tail);
 }
 
-/* Checks whether string S matches each element of ACCEPTS.  A list
-   element are matched either with fnmatch() or match_tail(),
-   according to whether the element contains wildcards or not.
-
-   If the BACKWARD is false, don't do backward comparison -- just compare
-   them normally.  */
-static bool
-in_acclist (const char *const *accepts, const char *s, bool backward)
-{
-  for (; *accepts; accepts++)
-    {
-      if (has_wildcards_p (*accepts))
-        {
-          int res = opt.ignore_case
-            ? fnmatch_nocase (*accepts, s, 0) : fnmatch (*accepts, s, 0);
-          /* fnmatch returns 0 if the pattern *does* match the string.  */
-          if (res == 0)
-            return true;
-        }
-      else
-        {
-          if (backward)
-            {
-              if (match_tail (s, *accepts, opt.ignore_case))
-                return true;
-            }
-          else
-            {
-              int cmp = opt.ignore_case
-                ? strcasecmp (s, *accepts) : strcmp (s, *accepts);
-              if (cmp == 0)
-                return true;
-            }
-        }
-    }
-  return false;
-}
-
 /* Return the location of STR's suffix (file extension).  Examples:
    suffix ("foo.bar")       -> "bar"
    suffix ("foo.bar.baz")   -> "baz"
@@ -2960,4 +3205,112 @@ test_dir_matches_p(void)
   return NULL;
 }
 
+const char *
+test_acceptable(void)
+{
+  static char *accepts[] = { "html", "*.png", "IMG_*", "x?z", "*.[ch]",
+                             "*", NULL };
+  static char *rejects[] = { ".gif", "*.tmp", "draft*", "*~*", "a\\*",
+                             NULL };
+  static struct {
+    const char *file;
+    int accept_count;           /* how many of ACCEPTS to use */
+    bool ignore_case;
+    bool result;
+  } test_array[] = {
+    { "index.html", 5, false, true },
+    { "dir/index.html", 5, false, true },
+    { "index.HTML", 5, false, false },
+    { "index.HTML", 5, true, true },
+    { "logo.png", 5, false, true },
+    { "logo.pngx", 5, false, false },
+    { "IMG_0001.jpg", 5, false, true },
+    { "img_0001.jpg", 5, true, true },
+    { "xyz", 5, false, true },
+    { "main.c", 5, false, true },
+    { "main.o", 5, false, false },
+    { "main.o", 6, false, true },
+    { "anim.gif", 6, false, false },
+    { "page.tmp", 6, false, false },
+    { "draft-page.html", 6, false, false },
+    { "page.html~1", 6, false, false },
+    { "a*", 6, false, false },
+    { "ab", 6, false, true },
+  };
+  char **saved_accepts = opt.accepts, **saved_rejects = opt.rejects;
+  bool saved_ignore_case = opt.ignore_case;
+  unsigned i;
+
+  opt.rejects = rejects;
+  for (i = 0; i < countof(test_array); ++i)
+    {
+      char *last = accepts[test_array[i].accept_count];
+      bool res;
+
+      accepts[test_array[i].accept_count] = NULL;
+      opt.accepts = accepts;
+      opt.ignore_case = test_array[i].ignore_case;
+      acceptable_cleanup ();
+      res = acceptable (test_array[i].file);
+      accepts[test_array[i].accept_count] = last;
+
+      mu_assert ("test_acceptable: wrong result",
+                 res == test_array[i].result);
+    }
+
+  acceptable_cleanup ();
+  opt.accepts = saved_accepts;
+  opt.rejects = saved_rejects;
+  opt.ignore_case = saved_ignore_case;
+  return NULL;
+}
+
+/* Micro-benchmark of acceptable with a long reject list, as given by
+   -R, run by "unit-tests --benchmark".  */
+
+void
+bench_acceptable (void)
+{
+  static const char *names[] = {
+    "index.html", "logo.png", "tmp17_backup.tar", "notes.e150",
+    "archive.g42", "dir/page.php", "photo.e199x", "README",
+  };
+  enum { PATTERNS = 200 };
+  char *rejects[3 * PATTERNS + 1];
+  char **saved_rejects = opt.rejects;
+  const int rounds = 25000;
+  struct ptimer *timer;
+  double secs;
+  int i, kept = 0;
+  unsigned j;
+
+  /* Suffixes, tails and heads, the kinds found in long -R lists.  */
+  for (i = 0; i < PATTERNS; i++)
+    {
+      rejects[3 * i] = aprintf (".e%d", i);
+      rejects[3 * i + 1] = aprintf ("*.g%d", i);
+      rejects[3 * i + 2] = aprintf ("tmp%d_*", i);
+    }
+  rejects[3 * PATTERNS] = NULL;
+  opt.rejects = rejects;
+  acceptable_cleanup ();
+
+  timer = ptimer_new ();
+  for (i = 0; i < rounds; i++)
+    for (j = 0; j < countof (names); j++)
+      kept += acceptable (names[j]);
+  secs = ptimer_measure (timer);
+  ptimer_destroy (timer);
+
+  printf ("acceptable: %d names against %d patterns in %.3f seconds"
+          " (%.0f names/s, %d kept)\n",
+          rounds * (int) countof (names), 3 * PATTERNS, secs,
+          secs > 0 ? rounds * countof (names) / secs : 0, kept);
+
+  acceptable_cleanup ();
+  opt.rejects = saved_rejects;
+  for (i = 0; i < 3 * PATTERNS; i++)
+    xfree (rejects[i]);
+}
+
 #endif /* TESTING */
@@ -89,16 +89,19 @@ int remove_link (const char *);
 bool file_exists_p (const char *, file_stats_t *);
 bool file_non_directory_p (const char *);
 wgint file_size (const char *);
-int make_directory (const char *);
 char *unique_name (const char *, bool);
+void unique_name_cleanup (void);
 FILE *unique_create (const char *, bool, char **);
 FILE *fopen_excl (const char *, int);
 FILE *fopen_stat (const char *, const char *, file_stats_t *);
 int   open_stat  (const char *, int, mode_t, file_stats_t *);
 char *file_merge (const char *, const char *);
+FILE *journal_open (const char *);
+bool journal_replace (const char *, void (*) (FILE *, void *), void *);
 
 int fnmatch_nocase (const char *, const char *, int);
 bool acceptable (const char *);
+void acceptable_cleanup (void);
 bool accept_url (const char *);
 bool accdir (const char *s);
 char *suffix (const char *s);
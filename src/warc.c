@@ -37,6 +37,7 @@ as that of the covered work.  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <tmpdir.h>
 #include <sha1.h>
@@ -45,6 +46,9 @@ as that of the covered work.  */
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
 
 #ifdef HAVE_LIBUUID
 #include <uuid/uuid.h>
@@ -54,6 +58,16 @@ as that of the covered work.  */
 
 #include "warc.h"
 #include "exits.h"
+#include "nproc.h"
+
+#ifdef TESTING
+#include "init.h"               /* for home_dir */
+#include "test.h"
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #ifdef WINDOWS
 /* we need this on Windows to have O_TEMPORARY defined */
@@ -77,8 +91,31 @@ static FILE *warc_log_fp;
    warcinfo uuid of every file in this crawl). */
 static FILE *warc_manifest_fp;
 
-/* The current WARC file (or NULL, if WARC is disabled). */
-static FILE *warc_current_file;
+/* A WARC file being written, with its CDX file.  With --warc-shards,
+   records are spread over several of them.  */
+struct warc_shard
+{
+  int index;                    /* the shard number */
+  FILE *file;                   /* the current WARC file, or NULL */
+  char *filename;               /* the name of the current WARC file */
+  int file_number;              /* its serial number, used in FILENAME */
+  char warcinfo_uuid_str[48];   /* the id of its warcinfo record */
+  FILE *cdx_file;               /* the CDX file, or NULL */
+  off_t last_record_offset;     /* the offset of the last record */
+  off_t written;                /* uncompressed bytes written so far */
+};
+
+/* The shards, and the shard of the record being written (or NULL, if
+   WARC is disabled). */
+static struct warc_shard *warc_shards;
+static int warc_shard_count;
+static struct warc_shard *warc_current_shard;
+
+/* The id of the last record that started a group of records, which
+   are written to the same shard, and whether the record being written
+   belongs to that group.  A file is never rotated within a group.  */
+static char warc_shard_group_uuid[48];
+static bool warc_shard_group_continues;
 
 #ifdef HAVE_LIBZ
 /* The gzip stream for the current WARC file
@@ -90,29 +127,94 @@ static off_t warc_current_gzfile_offset;
 
 /* The uncompressed size (so far) of the current record. */
 static off_t warc_current_gzfile_uncompressed_size;
-# endif
+#endif
 
-/* This is true until a warc_write_* method fails. */
-static bool warc_write_ok;
+#ifdef HAVE_LIBZSTD
+/* The zstd stream of the current record, if it is too large to be
+   compressed in memory (or NULL).  */
+static ZSTD_CCtx *warc_current_zstream;
 
-/* The current CDX file (or NULL, if CDX is disabled). */
-static FILE *warc_current_cdx_file;
+/* The context used to compress records in the main thread. */
+static ZSTD_CCtx *warc_zstd_cctx;
 
-/* The record id of the warcinfo record of the current WARC file.  */
-static char warc_current_warcinfo_uuid_str[48];
+/* The dictionary given with --warc-zstd-dictionary (or NULL), which is
+   stored at the start of every WARC file, and the records compressed
+   with it.  */
+static char *warc_zstd_dictionary;
+static size_t warc_zstd_dictionary_size;
+static ZSTD_CDict *warc_zstd_cdict;
+#endif
 
-/* The file name of the current WARC file. */
-static char *warc_current_filename;
+#if defined HAVE_LIBZ || defined HAVE_LIBZSTD
+# define HAVE_WARC_COMPRESSION 1
 
-/* The serial number of the current WARC file.  This number is
-   incremented each time a new file is opened and is used in the
-   WARC file's filename. */
-static int warc_current_file_number;
+/* Records are normally compressed in memory, each into its own gzip
+   member or zstd frame, by a pool of compression workers.  The main
+   thread writes them to the WARC file in the order of the records.
+   A record that grows larger than WARC_ZRECORD_MAX is instead
+   compressed as a stream, once the queued records have been
+   written.  */
+
+#define WARC_ZRECORD_MAX (8 * 1024 * 1024)
+
+/* How much compressed data may be queued before the main thread waits
+   for the workers to catch up.  */
+#define WARC_ZQUEUE_MAX (64 * 1024 * 1024)
+
+struct warc_zrecord
+{
+  char *data;                   /* the uncompressed record */
+  size_t size;
+  size_t allocated;
+  char *compressed;             /* the gzip member or zstd frame */
+  size_t compressed_size;
+  size_t compressed_bound;      /* upper bound of COMPRESSED_SIZE */
+  char *cdx_head;               /* CDX line up to the offset, or NULL */
+  char *cdx_tail;               /* CDX line after the offset */
+  bool done;                    /* the compression is finished */
+  bool failed;
+  struct warc_shard *shard;     /* the shard the record belongs to */
+  struct warc_zrecord *next;
+};
+
+/* The record being written, if it is compressed in memory. */
+static struct warc_zrecord *warc_current_zrecord;
+
+/* The records waiting to be written, and the first of them that no
+   worker has picked up yet.  */
+static struct warc_zrecord *warc_zqueue_head, *warc_zqueue_tail;
+static struct warc_zrecord *warc_zqueue_next;
+
+/* The largest size the queued records can take in the WARC file. */
+static off_t warc_zqueue_size;
+
+/* The record completed last, as long as it is in the queue. */
+static struct warc_zrecord *warc_zqueue_last;
+
+#ifdef HAVE_PTHREAD
+/* The compression workers; -1 until they are started. */
+static pthread_t *warc_zworkers;
+static int warc_zworker_count = -1;
+static bool warc_zworker_shutdown;
+static pthread_mutex_t warc_zqueue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warc_zqueue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t warc_zqueue_done = PTHREAD_COND_INITIALIZER;
+#endif
+#endif /* HAVE_LIBZ || HAVE_LIBZSTD */
+
+/* This is true until a warc_write_* method fails. */
+static bool warc_write_ok;
 
 /* The table of CDX records, if deduplication is enabled. */
 static struct hash_table * warc_cdx_dedup_table;
 
 static bool warc_start_new_file (bool meta);
+static bool warc_write_record (const char *record_type,
+                               const char *resource_uuid,
+                               const char *url, const char *timestamp_str,
+                               const char *concurrent_to_uuid,
+                               const ip_address *ip, const char *content_type,
+                               FILE *body, off_t payload_offset);
 
 
 struct warc_cdx_record
@@ -138,22 +240,714 @@ warc_cmp_sha1_digest (const void *digest1, const void *digest2)
 }
 
 
+/* Temporary files created by warc_tempfile.  Data written with
+   warc_tempfile_write is kept in memory until the record grows beyond
+   WARC_TEMPFILE_MEMORY bytes, and is digested as it arrives, so that
+   the record digests are known as soon as the transfer ends.  Files
+   written directly with stdio are read back when the record is
+   written, as before.  */
+
+#define WARC_TEMPFILE_MEMORY (256 * 1024)
+
+/* Size of the buffers used to spill and copy record data.  */
+#define WARC_COPY_BUFSIZE (64 * 1024)
+
+struct warc_tempfile
+{
+  FILE *fp;                     /* the backing file */
+  struct warc_tempfile *next;
+
+  bool tracked;                 /* written through warc_tempfile_write */
+  bool spilled;                 /* data lives in FP instead of DATA */
+  char *data;                   /* in-memory copy of the record */
+  size_t data_size;             /* allocated size of DATA */
+  off_t size;                   /* amount of data written */
+
+  off_t payload_offset;         /* start of the payload, or -1 */
+  struct sha1_ctx block_ctx;    /* digest of the whole block */
+  struct sha1_ctx head_ctx;     /* digest of the data before the payload */
+  struct sha1_ctx payload_ctx;  /* digest of the payload */
+};
+
+/* The temporary files that are currently open. */
+static struct warc_tempfile *warc_tempfiles;
+
+static struct warc_tempfile *
+warc_tempfile_lookup (FILE *fp)
+{
+  struct warc_tempfile *tmp;
+  for (tmp = warc_tempfiles; tmp; tmp = tmp->next)
+    if (tmp->fp == fp)
+      return tmp;
+  return NULL;
+}
+
+/* Moves the in-memory data of TMP to its backing file.  Returns false
+   on write error.  */
+static bool
+warc_tempfile_spill (struct warc_tempfile *tmp)
+{
+  if (tmp->spilled)
+    return true;
+  tmp->spilled = true;
+  setvbuf (tmp->fp, NULL, _IOFBF, WARC_COPY_BUFSIZE);
+  if (tmp->size > 0
+      && fwrite (tmp->data, 1, tmp->size, tmp->fp) != (size_t) tmp->size)
+    return false;
+  xfree (tmp->data);
+  tmp->data_size = 0;
+  return true;
+}
+
+/* Appends SIZE bytes of DATA to the temporary file FP and updates its
+   digests.  FP must have been created with warc_tempfile, and should
+   not also be written to directly.  Returns false on write error.  */
+bool
+warc_tempfile_write (FILE *fp, const void *data, size_t size)
+{
+  struct warc_tempfile *tmp = warc_tempfile_lookup (fp);
+
+  if (tmp == NULL)
+    return fwrite (data, 1, size, fp) == size;
+
+  tmp->tracked = true;
+  if (size == 0)
+    return true;
+
+  if (opt.warc_digests_enabled)
+    {
+      sha1_process_bytes (data, size, &tmp->block_ctx);
+      if (tmp->payload_offset >= 0)
+        sha1_process_bytes (data, size, &tmp->payload_ctx);
+    }
+
+  if (!tmp->spilled && tmp->size + size > WARC_TEMPFILE_MEMORY)
+    if (!warc_tempfile_spill (tmp))
+      return false;
+
+  if (tmp->spilled)
+    {
+      tmp->size += size;
+      return fwrite (data, 1, size, fp) == size;
+    }
+
+  if (tmp->size + size > tmp->data_size)
+    {
+      size_t new_size = tmp->data_size ? tmp->data_size : 8192;
+      while (new_size < tmp->size + size)
+        new_size <<= 1;
+      tmp->data = xrealloc (tmp->data, new_size);
+      tmp->data_size = new_size;
+    }
+  memcpy (tmp->data + tmp->size, data, size);
+  tmp->size += size;
+  return true;
+}
+
+/* Marks the current end of the temporary file FP as the start of the
+   payload, whose digest is computed separately.  Returns the offset
+   of the payload.  */
+off_t
+warc_tempfile_start_payload (FILE *fp)
+{
+  struct warc_tempfile *tmp = warc_tempfile_lookup (fp);
+
+  if (tmp == NULL)
+    return ftello (fp);
+
+  tmp->tracked = true;
+  tmp->payload_offset = tmp->size;
+  tmp->head_ctx = tmp->block_ctx;
+  sha1_init_ctx (&tmp->payload_ctx);
+  return tmp->payload_offset;
+}
+
+/* Closes the temporary file FP and releases its resources. */
+void
+warc_tempfile_close (FILE *fp)
+{
+  struct warc_tempfile **link;
+
+  for (link = &warc_tempfiles; *link; link = &(*link)->next)
+    if ((*link)->fp == fp)
+      {
+        struct warc_tempfile *tmp = *link;
+        *link = tmp->next;
+        xfree (tmp->data);
+        xfree (tmp);
+        break;
+      }
+  fclose (fp);
+}
+
+
+
+/* Prints a CDX line for a record at OFFSET in the current WARC file of
+   SHARD.  HEAD and TAIL are the parts of the line before and after the
+   offset.  */
+static void
+warc_write_cdx_line (struct warc_shard *shard, const char *head,
+                     off_t offset, const char *tail)
+{
+  char offset_string[MAX_INT_TO_STRING_LEN(off_t)];
+
+  number_to_string (offset_string, offset);
+  fprintf (shard->cdx_file, "%s%s%s", head, offset_string, tail);
+  fflush (shard->cdx_file);
+}
+
+
+#define EXTRA_GZIP_HEADER_SIZE 14
+#define GZIP_STATIC_HEADER_SIZE  10
+#define FLG_FEXTRA          0x04
+#define OFF_FLG             3
+
+#ifdef HAVE_LIBZ
+/* Fills EXTRA_HEADER with the extra GZIP header field of a record.
+   The WARC standard suggests that we add 'skip length' data in the
+   extra header field of the GZIP stream: the size of the gzip member
+   in the WARC file, followed by the size of the uncompressed record.  */
+static void
+warc_gz_extra_header (char *extra_header, off_t compressed_size,
+                      off_t uncompressed_size)
+{
+  /* XLEN, the length of the extra header fields.  */
+  extra_header[0]  = ((EXTRA_GZIP_HEADER_SIZE - 2) & 255);
+  extra_header[1]  = ((EXTRA_GZIP_HEADER_SIZE - 2) >> 8) & 255;
+  /* The extra header field identifier for the WARC skip length. */
+  extra_header[2]  = 's';
+  extra_header[3]  = 'l';
+  /* The size of the field value (8 bytes).  */
+  extra_header[4]  = (8 & 255);
+  extra_header[5]  = ((8 >> 8) & 255);
+  /* The size of the gzip member.  */
+  extra_header[6]  = (compressed_size & 255);
+  extra_header[7]  = (compressed_size >> 8) & 255;
+  extra_header[8]  = (compressed_size >> 16) & 255;
+  extra_header[9]  = (compressed_size >> 24) & 255;
+  /* The size of the uncompressed record.  */
+  extra_header[10] = (uncompressed_size & 255);
+  extra_header[11] = (uncompressed_size >> 8) & 255;
+  extra_header[12] = (uncompressed_size >> 16) & 255;
+  extra_header[13] = (uncompressed_size >> 24) & 255;
+}
+
+/* Compresses the data of REC into a gzip member, laid out as
+   warc_write_end_record lays out a streamed record: the static
+   header, the extra header field, then the compressed data.  */
+static void
+warc_gz_compress (struct warc_zrecord *rec)
+{
+  z_stream zs;
+  size_t bound;
+
+  memset (&zs, 0, sizeof (zs));
+  if (deflateInit2 (&zs, 9, Z_DEFLATED, MAX_WBITS + 16, 8,
+                    Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      rec->failed = true;
+      return;
+    }
+
+  /* Leave room for the extra header field in front of the stream. */
+  bound = EXTRA_GZIP_HEADER_SIZE + deflateBound (&zs, rec->size);
+  rec->compressed = xmalloc (bound);
+  zs.next_in = (Bytef *) rec->data;
+  zs.avail_in = rec->size;
+  zs.next_out = (Bytef *) rec->compressed + EXTRA_GZIP_HEADER_SIZE;
+  zs.avail_out = bound - EXTRA_GZIP_HEADER_SIZE;
+  if (deflate (&zs, Z_FINISH) != Z_STREAM_END)
+    rec->failed = true;
+  rec->compressed_size = EXTRA_GZIP_HEADER_SIZE + zs.total_out;
+  deflateEnd (&zs);
+
+  /* Move the static header to the front, set its FEXTRA flag and
+     put the extra header field right after it.  */
+  memmove (rec->compressed, rec->compressed + EXTRA_GZIP_HEADER_SIZE,
+           GZIP_STATIC_HEADER_SIZE);
+  rec->compressed[OFF_FLG] |= FLG_FEXTRA;
+  warc_gz_extra_header (rec->compressed + GZIP_STATIC_HEADER_SIZE,
+                        rec->compressed_size, rec->size);
+}
+
+/* Starts a gzip stream at the current end of the WARC file for a
+   record that is too large to be compressed in memory, and feeds it
+   the data of REC.  */
+static bool
+warc_gz_open_stream (struct warc_zrecord *rec)
+{
+  FILE *file = warc_current_shard->file;
+
+  /* Record the starting offset of the new record. */
+  warc_current_gzfile_offset = ftello (file);
+
+  /* Reserve space for the extra GZIP header field.
+     In warc_write_end_record we will fill this space
+     with information about the uncompressed and
+     compressed size of the record. */
+  fseek (file, EXTRA_GZIP_HEADER_SIZE, SEEK_CUR);
+  fflush (file);
+
+  /* Start a new GZIP stream. */
+  warc_current_gzfile = gzdopen (dup (fileno (file)), "wb9");
+  warc_current_gzfile_uncompressed_size = rec->size;
+
+  if (warc_current_gzfile == NULL)
+    {
+      logprintf (LOG_NOTQUIET,
+_("Error opening GZIP stream to WARC file.\n"));
+      return false;
+    }
+
+  return gzwrite (warc_current_gzfile, rec->data, rec->size)
+         == (int) rec->size;
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_LIBZSTD
+/* The magic number of the skippable frame that holds the dictionary
+   at the start of a .warc.zst file.  */
+#define WARC_ZSTD_DICTIONARY_MAGIC 0x184D2A5D
+
+/* Compresses the data of REC into a zstd frame, with the context
+   CCTX and the dictionary, if there is one.  */
+static void
+warc_zstd_compress (struct warc_zrecord *rec, ZSTD_CCtx *cctx)
+{
+  size_t bound = ZSTD_compressBound (rec->size);
+  size_t result;
+
+  rec->compressed = xmalloc (bound);
+  if (warc_zstd_cdict)
+    result = ZSTD_compress_usingCDict (cctx, rec->compressed, bound,
+                                       rec->data, rec->size,
+                                       warc_zstd_cdict);
+  else
+    result = ZSTD_compressCCtx (cctx, rec->compressed, bound,
+                                rec->data, rec->size, ZSTD_CLEVEL_DEFAULT);
+  if (ZSTD_isError (result))
+    rec->failed = true;
+  else
+    rec->compressed_size = result;
+}
+
+/* Compresses SIZE bytes of BUFFER through the zstd stream of the
+   current record and writes the output to the WARC file.  MODE is
+   ZSTD_e_end to finish the frame.  */
+static bool
+warc_zstd_stream_write (const char *buffer, size_t size,
+                        ZSTD_EndDirective mode)
+{
+  ZSTD_inBuffer in = { buffer, size, 0 };
+  char out_data[16384];
+  size_t remaining;
 
-/* Writes SIZE bytes from BUFFER to the current WARC file,
-   through gzwrite if compression is enabled.
+  do
+    {
+      ZSTD_outBuffer out = { out_data, sizeof (out_data), 0 };
+
+      remaining = ZSTD_compressStream2 (warc_current_zstream, &out, &in, mode);
+      if (ZSTD_isError (remaining))
+        return false;
+      if (out.pos > 0
+          && fwrite (out_data, 1, out.pos,
+                     warc_current_shard->file) != out.pos)
+        return false;
+    }
+  while (mode == ZSTD_e_end ? remaining > 0 : in.pos < in.size);
+
+  return true;
+}
+
+/* Starts a zstd stream at the current end of the WARC file for a
+   record that is too large to be compressed in memory, and feeds it
+   the data of REC.  */
+static bool
+warc_zstd_open_stream (struct warc_zrecord *rec)
+{
+  warc_current_zstream = ZSTD_createCCtx ();
+  if (warc_current_zstream == NULL)
+    return false;
+
+  if (warc_zstd_cdict)
+    ZSTD_CCtx_refCDict (warc_current_zstream, warc_zstd_cdict);
+  else
+    ZSTD_CCtx_setParameter (warc_current_zstream, ZSTD_c_compressionLevel,
+                            ZSTD_CLEVEL_DEFAULT);
+
+  return warc_zstd_stream_write (rec->data, rec->size, ZSTD_e_continue);
+}
+
+/* Writes the dictionary, if there is one, in a skippable frame at the
+   start of the current WARC file, where readers of .warc.zst files
+   expect it.  */
+static bool
+warc_zstd_write_dictionary (void)
+{
+  FILE *file = warc_current_shard->file;
+  unsigned char header[8];
+  unsigned long magic = WARC_ZSTD_DICTIONARY_MAGIC;
+  size_t size = warc_zstd_dictionary_size;
+  int i;
+
+  if (warc_zstd_dictionary == NULL)
+    return true;
+
+  for (i = 0; i < 4; i++)
+    {
+      header[i] = (magic >> (8 * i)) & 255;
+      header[4 + i] = (size >> (8 * i)) & 255;
+    }
+  return fwrite (header, 1, sizeof (header), file) == sizeof (header)
+         && fwrite (warc_zstd_dictionary, 1, size, file) == size;
+}
+
+/* Loads the dictionary given with --warc-zstd-dictionary.  */
+static bool
+warc_zstd_load_dictionary (void)
+{
+  struct file_memory *fm = wget_read_file (opt.warc_zstd_dictionary);
+
+  if (fm == NULL)
+    return false;
+
+  warc_zstd_dictionary_size = fm->length;
+  warc_zstd_dictionary = xmemdup (fm->content, fm->length);
+  wget_read_file_free (fm);
+
+  warc_zstd_cdict = ZSTD_createCDict (warc_zstd_dictionary,
+                                      warc_zstd_dictionary_size,
+                                      ZSTD_CLEVEL_DEFAULT);
+  return warc_zstd_cdict != NULL;
+}
+#endif /* HAVE_LIBZSTD */
+
+#ifdef HAVE_WARC_COMPRESSION
+/* Returns the largest size that a record of SIZE bytes can take once
+   compressed.  */
+static size_t
+warc_zrecord_bound (size_t size)
+{
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_compression == warc_compression_zstd)
+    return ZSTD_compressBound (size);
+#endif
+#ifdef HAVE_LIBZ
+  /* deflateBound plus the gzip wrapper and the extra header field. */
+  return compressBound (size) + 18 + EXTRA_GZIP_HEADER_SIZE;
+#else
+  return size;
+#endif
+}
+
+/* Compresses the data of REC with the configured method.  ZSTD_CCTX
+   is the zstd context of the calling thread.  This runs in the
+   compression workers.  */
+static void
+warc_zrecord_compress (struct warc_zrecord *rec, void *zstd_cctx _GL_UNUSED)
+{
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_compression == warc_compression_zstd)
+    {
+      if (zstd_cctx)
+        warc_zstd_compress (rec, zstd_cctx);
+      else
+        rec->failed = true;
+    }
+#endif
+#ifdef HAVE_LIBZ
+  if (opt.warc_compression == warc_compression_gzip)
+    warc_gz_compress (rec);
+#endif
+  xfree (rec->data);
+}
+
+/* Returns a new zstd compression context if records are compressed
+   with zstd, NULL otherwise.  */
+static void *
+warc_zrecord_context (void)
+{
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_compression == warc_compression_zstd)
+    return ZSTD_createCCtx ();
+#endif
+  return NULL;
+}
+
+/* Frees a context returned by warc_zrecord_context.  */
+static void
+warc_zrecord_context_free (void *zstd_cctx _GL_UNUSED)
+{
+#ifdef HAVE_LIBZSTD
+  ZSTD_freeCCtx (zstd_cctx);
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+/* Compresses the queued records, picking them up in order, until
+   warc_zworkers_stop is called.  */
+static void *
+warc_zworker_run (void *arg _GL_UNUSED)
+{
+  void *zstd_cctx = warc_zrecord_context ();
+
+  pthread_mutex_lock (&warc_zqueue_lock);
+  while (1)
+    {
+      struct warc_zrecord *rec;
+
+      while (!warc_zqueue_next && !warc_zworker_shutdown)
+        pthread_cond_wait (&warc_zqueue_ready, &warc_zqueue_lock);
+      rec = warc_zqueue_next;
+      if (!rec)
+        break;
+      warc_zqueue_next = rec->next;
+      pthread_mutex_unlock (&warc_zqueue_lock);
+
+      warc_zrecord_compress (rec, zstd_cctx);
+
+      pthread_mutex_lock (&warc_zqueue_lock);
+      rec->done = true;
+      pthread_cond_broadcast (&warc_zqueue_done);
+    }
+  pthread_mutex_unlock (&warc_zqueue_lock);
+
+  warc_zrecord_context_free (zstd_cctx);
+  return NULL;
+}
+
+/* Starts one compression worker per CPU.  With a single CPU, the
+   records are compressed in the main thread.  */
+static void
+warc_zworkers_start (void)
+{
+  unsigned long n = num_processors (NPROC_CURRENT_OVERRIDABLE);
+
+  warc_zworker_count = 0;
+  if (n < 2)
+    return;
+
+  warc_zworkers = xnew_array (pthread_t, n);
+  while (warc_zworker_count < (int) n
+         && pthread_create (&warc_zworkers[warc_zworker_count], NULL,
+                            warc_zworker_run, NULL) == 0)
+    warc_zworker_count++;
+  DEBUGP (("Compressing WARC records with %d threads.\n",
+           warc_zworker_count));
+}
+
+/* Stops the compression workers.  The queue must be empty.  */
+static void
+warc_zworkers_stop (void)
+{
+  if (warc_zworker_count < 0)
+    return;
+
+  pthread_mutex_lock (&warc_zqueue_lock);
+  warc_zworker_shutdown = true;
+  pthread_cond_broadcast (&warc_zqueue_ready);
+  pthread_mutex_unlock (&warc_zqueue_lock);
+
+  while (warc_zworker_count > 0)
+    pthread_join (warc_zworkers[--warc_zworker_count], NULL);
+  xfree (warc_zworkers);
+  warc_zworker_count = -1;
+  warc_zworker_shutdown = false;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Writes the compressed record REC to the current WARC file, along
+   with its CDX line, and frees it.  */
+static void
+warc_zqueue_write_record (struct warc_zrecord *rec)
+{
+  if (rec->failed)
+    {
+      logprintf (LOG_NOTQUIET, _("Error compressing WARC record.\n"));
+      warc_write_ok = false;
+    }
+  else if (warc_write_ok)
+    {
+      struct warc_shard *shard = rec->shard;
+      off_t offset = ftello (shard->file);
+
+      if (fwrite (rec->compressed, 1, rec->compressed_size, shard->file)
+          != rec->compressed_size)
+        warc_write_ok = false;
+      else if (rec->cdx_head)
+        warc_write_cdx_line (shard, rec->cdx_head, offset, rec->cdx_tail);
+      shard->last_record_offset = offset;
+    }
+
+  if (rec == warc_zqueue_last)
+    warc_zqueue_last = NULL;
+  xfree (rec->data);
+  xfree (rec->compressed);
+  xfree (rec->cdx_head);
+  xfree (rec->cdx_tail);
+  xfree (rec);
+}
+
+/* Writes the records at the head of the queue whose compression is
+   finished.  If WAIT is true, waits for all the queued records to be
+   written; otherwise waits only while too much data is queued.  */
+static void
+warc_zqueue_write (bool wait)
+{
+  while (warc_zqueue_head)
+    {
+      struct warc_zrecord *rec = warc_zqueue_head;
+
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock (&warc_zqueue_lock);
+      while (!rec->done && (wait || warc_zqueue_size > WARC_ZQUEUE_MAX))
+        pthread_cond_wait (&warc_zqueue_done, &warc_zqueue_lock);
+      if (!rec->done)
+        {
+          pthread_mutex_unlock (&warc_zqueue_lock);
+          break;
+        }
+#endif
+      warc_zqueue_head = rec->next;
+      if (!warc_zqueue_head)
+        warc_zqueue_tail = NULL;
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock (&warc_zqueue_lock);
+#endif
+
+      warc_zqueue_size -= rec->compressed_bound;
+      warc_zqueue_write_record (rec);
+    }
+}
+
+/* Hands the current record to the compression workers, and writes the
+   records that are ready.  */
+static void
+warc_zqueue_submit (void)
+{
+  struct warc_zrecord *rec = warc_current_zrecord;
+
+  warc_current_zrecord = NULL;
+  rec->compressed_bound = warc_zrecord_bound (rec->size);
+
+#ifdef HAVE_PTHREAD
+  if (warc_zworker_count < 0)
+    warc_zworkers_start ();
+  if (warc_zworker_count == 0)
+#endif
+    {
+#ifdef HAVE_LIBZSTD
+      if (warc_zstd_cctx == NULL)
+        warc_zstd_cctx = warc_zrecord_context ();
+      warc_zrecord_compress (rec, warc_zstd_cctx);
+#else
+      warc_zrecord_compress (rec, NULL);
+#endif
+      rec->done = true;
+    }
+
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&warc_zqueue_lock);
+#endif
+  if (warc_zqueue_tail)
+    warc_zqueue_tail->next = rec;
+  else
+    warc_zqueue_head = rec;
+  warc_zqueue_tail = rec;
+#ifdef HAVE_PTHREAD
+  if (!rec->done)
+    {
+      if (!warc_zqueue_next)
+        warc_zqueue_next = rec;
+      pthread_cond_signal (&warc_zqueue_ready);
+    }
+  pthread_mutex_unlock (&warc_zqueue_lock);
+#endif
+
+  warc_zqueue_size += rec->compressed_bound;
+  warc_zqueue_last = rec;
+  warc_zqueue_write (false);
+}
+
+/* Switches the current record, which has become too large to keep in
+   memory, to streaming compression: writes the queued records, then
+   starts a stream at the end of the WARC file and feeds it the data
+   collected so far.  */
+static bool
+warc_zrecord_open_stream (void)
+{
+  struct warc_zrecord *rec = warc_current_zrecord;
+  bool ok = false;
+
+  warc_current_zrecord = NULL;
+  warc_zqueue_write (true);
+  warc_current_shard->last_record_offset = ftello (warc_current_shard->file);
+
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_compression == warc_compression_zstd)
+    ok = warc_zstd_open_stream (rec);
+#endif
+#ifdef HAVE_LIBZ
+  if (opt.warc_compression == warc_compression_gzip)
+    ok = warc_gz_open_stream (rec);
+#endif
+
+  xfree (rec->data);
+  xfree (rec);
+  if (!ok)
+    warc_write_ok = false;
+  return warc_write_ok;
+}
+#endif /* HAVE_WARC_COMPRESSION */
+
+/* Writes SIZE bytes from BUFFER to the current WARC file, through
+   the compressor if compression is enabled.
    Returns the number of uncompressed bytes written.  */
 static size_t
 warc_write_buffer (const char *buffer, size_t size)
 {
+#ifdef HAVE_WARC_COMPRESSION
+  struct warc_zrecord *rec = warc_current_zrecord;
+#endif
+
+  warc_current_shard->written += size;
+
+#ifdef HAVE_WARC_COMPRESSION
+
+  if (rec && rec->size + size > WARC_ZRECORD_MAX)
+    {
+      if (!warc_zrecord_open_stream ())
+        return 0;
+      rec = NULL;
+    }
+
+  if (rec)
+    {
+      if (rec->size + size > rec->allocated)
+        {
+          size_t allocated = rec->allocated ? rec->allocated : 16384;
+          while (allocated < rec->size + size)
+            allocated <<= 1;
+          rec->data = xrealloc (rec->data, allocated);
+          rec->allocated = allocated;
+        }
+      memcpy (rec->data + rec->size, buffer, size);
+      rec->size += size;
+      return size;
+    }
+#endif
+#ifdef HAVE_LIBZSTD
+  if (warc_current_zstream)
+    return warc_zstd_stream_write (buffer, size, ZSTD_e_continue) ? size : 0;
+#endif
 #ifdef HAVE_LIBZ
   if (warc_current_gzfile)
     {
       warc_current_gzfile_uncompressed_size += size;
       return gzwrite (warc_current_gzfile, buffer, size);
     }
-  else
 #endif
-    return fwrite (buffer, 1, size, warc_current_file);
+  return fwrite (buffer, 1, size, warc_current_shard->file);
 }
 
 /* Writes STR to the current WARC file.
@@ -175,57 +969,46 @@ warc_write_string (const char *str)
 }
 
 
-#define EXTRA_GZIP_HEADER_SIZE 14
-#define GZIP_STATIC_HEADER_SIZE  10
-#define FLG_FEXTRA          0x04
-#define OFF_FLG             3
-
 /* Starts a new WARC record.  Writes the version header.
    If opt.warc_maxsize is set and the current file is becoming
    too large, this will open a new WARC file.
 
-   If compression is enabled, this will start a new
-   gzip stream in the current WARC file.
+   If compression is enabled, the record is collected in memory
+   until warc_write_end_record hands it to the compression workers.
 
    Returns false and set warc_write_ok to false if there
    is an error.  */
 static bool
 warc_write_start_record (void)
 {
+  struct warc_shard *shard = warc_current_shard;
+
   if (!warc_write_ok)
     return false;
 
-  fflush (warc_current_file);
-  if (opt.warc_maxsize > 0 && ftello (warc_current_file) >= opt.warc_maxsize)
-    warc_start_new_file (false);
-
-#ifdef HAVE_LIBZ
-  /* Start a GZIP stream, if required. */
-  if (opt.warc_compression_enabled)
+  fflush (shard->file);
+  if (opt.warc_maxsize > 0 && !warc_shard_group_continues)
     {
-      /* Record the starting offset of the new record. */
-      warc_current_gzfile_offset = ftello (warc_current_file);
-
-      /* Reserve space for the extra GZIP header field.
-         In warc_write_end_record we will fill this space
-         with information about the uncompressed and
-         compressed size of the record. */
-      fseek (warc_current_file, EXTRA_GZIP_HEADER_SIZE, SEEK_CUR);
-      fflush (warc_current_file);
-
-      /* Start a new GZIP stream. */
-      warc_current_gzfile = gzdopen (dup (fileno (warc_current_file)), "wb9");
-      warc_current_gzfile_uncompressed_size = 0;
+#ifdef HAVE_WARC_COMPRESSION
+      /* Write the queued records first if they might take the file
+         over the limit.  */
+      if (ftello (shard->file) + warc_zqueue_size >= opt.warc_maxsize)
+        warc_zqueue_write (true);
+#endif
+      if (ftello (shard->file) >= opt.warc_maxsize)
+        warc_start_new_file (false);
+    }
 
-      if (warc_current_gzfile == NULL)
-        {
-          logprintf (LOG_NOTQUIET,
-_("Error opening GZIP stream to WARC file.\n"));
-          warc_write_ok = false;
-          return false;
-        }
+#ifdef HAVE_WARC_COMPRESSION
+  warc_zqueue_last = NULL;
+  if (opt.warc_compression != warc_compression_none)
+    {
+      warc_current_zrecord = xnew0 (struct warc_zrecord);
+      warc_current_zrecord->shard = shard;
     }
+  else
 #endif
+    shard->last_record_offset = ftello (shard->file);
 
   warc_write_string ("WARC/1.0\r\n");
   return warc_write_ok;
@@ -272,57 +1055,106 @@ warc_write_block_from_file (FILE *data_in)
 {
   /* Add the Content-Length header. */
   char content_length[MAX_INT_TO_STRING_LEN(off_t)];
-  char buffer[BUFSIZ];
+  struct warc_tempfile *tmp = warc_tempfile_lookup (data_in);
+  char *buffer;
   size_t s;
 
-  fseeko (data_in, 0L, SEEK_END);
-  number_to_string (content_length, ftello (data_in));
+  if (tmp != NULL && tmp->tracked)
+    number_to_string (content_length, tmp->size);
+  else
+    {
+      fseeko (data_in, 0L, SEEK_END);
+      number_to_string (content_length, ftello (data_in));
+    }
   warc_write_header ("Content-Length", content_length);
 
   /* End of the WARC header section. */
   warc_write_string ("\r\n");
 
+  if (tmp != NULL && tmp->tracked && !tmp->spilled)
+    {
+      /* The record is still in memory. */
+      if (warc_write_ok && tmp->size > 0
+          && warc_write_buffer (tmp->data, tmp->size) < (size_t) tmp->size)
+        warc_write_ok = false;
+      return warc_write_ok;
+    }
+
   if (fseeko (data_in, 0L, SEEK_SET) != 0)
     warc_write_ok = false;
 
   /* Copy the data in the file to the WARC record. */
-  while (warc_write_ok && (s = fread (buffer, 1, BUFSIZ, data_in)) > 0)
+  buffer = xmalloc (WARC_COPY_BUFSIZE);
+  while (warc_write_ok
+         && (s = fread (buffer, 1, WARC_COPY_BUFSIZE, data_in)) > 0)
     {
       if (warc_write_buffer (buffer, s) < s)
         warc_write_ok = false;
     }
+  xfree (buffer);
 
   return warc_write_ok;
 }
 
 /* Run this method to close the current WARC record.
 
-   If compression is enabled, this method closes the
-   current GZIP stream and fills the extra GZIP header
-   with the uncompressed and compressed length of the
-   record. */
+   If compression is enabled, this method hands the record
+   to the compression workers or, for a large record, ends
+   the current zstd frame, or closes the current GZIP stream
+   and fills the extra GZIP header with the uncompressed and
+   compressed length of the record. */
 static bool
 warc_write_end_record (void)
 {
   warc_write_buffer ("\r\n\r\n", 4);
 
+#ifdef HAVE_WARC_COMPRESSION
+  if (warc_current_zrecord)
+    {
+      if (warc_write_ok)
+        warc_zqueue_submit ();
+      else
+        {
+          xfree (warc_current_zrecord->data);
+          xfree (warc_current_zrecord);
+        }
+      return warc_write_ok;
+    }
+#endif
+
+#ifdef HAVE_LIBZSTD
+  if (warc_current_zstream)
+    {
+      if (warc_write_ok
+          && !warc_zstd_stream_write (NULL, 0, ZSTD_e_end))
+        warc_write_ok = false;
+      ZSTD_freeCCtx (warc_current_zstream);
+      warc_current_zstream = NULL;
+      return warc_write_ok;
+    }
+#endif
+
 #ifdef HAVE_LIBZ
+
   /* We start a new gzip stream for each record.  */
   if (warc_write_ok && warc_current_gzfile)
     {
+      FILE *file = warc_current_shard->file;
       char extra_header[EXTRA_GZIP_HEADER_SIZE];
       char static_header[GZIP_STATIC_HEADER_SIZE];
       off_t current_offset, uncompressed_size, compressed_size;
       size_t result;
+      int gzresult = gzclose (warc_current_gzfile);
 
-      if (gzclose (warc_current_gzfile) != Z_OK)
+      warc_current_gzfile = NULL;
+      if (gzresult != Z_OK)
         {
           warc_write_ok = false;
           return false;
         }
 
-      fflush (warc_current_file);
-      fseeko (warc_current_file, 0, SEEK_END);
+      fflush (file);
+      fseeko (file, 0, SEEK_END);
 
       /* The WARC standard suggests that we add 'skip length' data in the
          extra header field of the GZIP stream.
@@ -340,17 +1172,16 @@ warc_write_end_record (void)
       */
 
       /* Calculate the uncompressed and compressed sizes. */
-      current_offset = ftello (warc_current_file);
+      current_offset = ftello (file);
       uncompressed_size = current_offset - warc_current_gzfile_offset;
       compressed_size = warc_current_gzfile_uncompressed_size;
 
       /* Go back to the static GZIP header. */
-      fseeko (warc_current_file, warc_current_gzfile_offset
+      fseeko (file, warc_current_gzfile_offset
               + EXTRA_GZIP_HEADER_SIZE, SEEK_SET);
 
       /* Read the header. */
-      result = fread (static_header, 1, GZIP_STATIC_HEADER_SIZE,
-                             warc_current_file);
+      result = fread (static_header, 1, GZIP_STATIC_HEADER_SIZE, file);
       if (result != GZIP_STATIC_HEADER_SIZE)
         {
           warc_write_ok = false;
@@ -362,38 +1193,20 @@ warc_write_end_record (void)
 
       /* Write the header back to the file, but starting at
          warc_current_gzfile_offset. */
-      fseeko (warc_current_file, warc_current_gzfile_offset, SEEK_SET);
-      fwrite (static_header, 1, GZIP_STATIC_HEADER_SIZE, warc_current_file);
+      fseeko (file, warc_current_gzfile_offset, SEEK_SET);
+      fwrite (static_header, 1, GZIP_STATIC_HEADER_SIZE, file);
 
       /* Prepare the extra GZIP header. */
-      /* XLEN, the length of the extra header fields.  */
-      extra_header[0]  = ((EXTRA_GZIP_HEADER_SIZE - 2) & 255);
-      extra_header[1]  = ((EXTRA_GZIP_HEADER_SIZE - 2) >> 8) & 255;
-      /* The extra header field identifier for the WARC skip length. */
-      extra_header[2]  = 's';
-      extra_header[3]  = 'l';
-      /* The size of the field value (8 bytes).  */
-      extra_header[4]  = (8 & 255);
-      extra_header[5]  = ((8 >> 8) & 255);
-      /* The size of the uncompressed record.  */
-      extra_header[6]  = (uncompressed_size & 255);
-      extra_header[7]  = (uncompressed_size >> 8) & 255;
-      extra_header[8]  = (uncompressed_size >> 16) & 255;
-      extra_header[9]  = (uncompressed_size >> 24) & 255;
-      /* The size of the compressed record.  */
-      extra_header[10] = (compressed_size & 255);
-      extra_header[11] = (compressed_size >> 8) & 255;
-      extra_header[12] = (compressed_size >> 16) & 255;
-      extra_header[13] = (compressed_size >> 24) & 255;
+      warc_gz_extra_header (extra_header, uncompressed_size, compressed_size);
 
       /* Write the extra header after the static header. */
-      fseeko (warc_current_file, warc_current_gzfile_offset
+      fseeko (file, warc_current_gzfile_offset
               + GZIP_STATIC_HEADER_SIZE, SEEK_SET);
-      fwrite (extra_header, 1, EXTRA_GZIP_HEADER_SIZE, warc_current_file);
+      fwrite (extra_header, 1, EXTRA_GZIP_HEADER_SIZE, file);
 
       /* Done, move back to the end of the file. */
-      fflush (warc_current_file);
-      fseeko (warc_current_file, 0, SEEK_END);
+      fflush (file);
+      fseeko (file, 0, SEEK_END);
     }
 #endif /* HAVE_LIBZ */
 
@@ -568,12 +1381,68 @@ warc_base32_sha1_digest (const char *sha1_digest, char *sha1_base32, size_t sha1
 }
 
 
+/* Calculates the block digest of the temporary file BODY and, if
+   payload_offset >= 0, the digest of the payload starting at the
+   provided offset.  The digests collected by warc_tempfile_write are
+   used if they cover the same payload; otherwise the file is read.
+   Returns 0 on success.  */
+static int
+warc_tempfile_digests (FILE *body, void *res_block, void *res_payload,
+                       off_t payload_offset)
+{
+  struct warc_tempfile *tmp = warc_tempfile_lookup (body);
+
+  if (tmp != NULL && tmp->tracked)
+    {
+      if (payload_offset < 0 || payload_offset == tmp->payload_offset)
+        {
+          sha1_finish_ctx (&tmp->block_ctx, res_block);
+          if (payload_offset >= 0)
+            sha1_finish_ctx (&tmp->payload_ctx, res_payload);
+          return 0;
+        }
+      if (!warc_tempfile_spill (tmp))
+        return 1;
+    }
+
+  rewind (body);
+  return warc_sha1_stream_with_payload (body, res_block, res_payload,
+                                        payload_offset);
+}
+
+/* Removes the payload starting at PAYLOAD_OFFSET from the temporary
+   file BODY, leaving only the headers.  Returns false on error.  */
+static bool
+warc_tempfile_drop_payload (FILE *body, off_t payload_offset)
+{
+  struct warc_tempfile *tmp = warc_tempfile_lookup (body);
+
+  if (tmp != NULL && tmp->tracked)
+    {
+      if (payload_offset != tmp->payload_offset)
+        tmp->tracked = false;
+      else
+        {
+          tmp->size = payload_offset;
+          tmp->block_ctx = tmp->head_ctx;
+          tmp->payload_offset = -1;
+          if (!tmp->spilled)
+            return true;
+        }
+      if (!warc_tempfile_spill (tmp))
+        return false;
+    }
+
+  fflush (body);
+  return ftruncate (fileno (body), payload_offset) == 0;
+}
+
 /* Sets the digest headers of the record.
    This method will calculate the block digest and, if payload_offset >= 0,
    will also calculate the payload digest of the payload starting at the
    provided offset.  */
 static void
-warc_write_digest_headers (FILE *file, long payload_offset)
+warc_write_digest_headers (FILE *file, off_t payload_offset)
 {
   if (opt.warc_digests_enabled)
     {
@@ -581,8 +1450,7 @@ warc_write_digest_headers (FILE *file, long payload_offset)
       char sha1_res_block[SHA1_DIGEST_SIZE];
       char sha1_res_payload[SHA1_DIGEST_SIZE];
 
-      rewind (file);
-      if (warc_sha1_stream_with_payload (file, sha1_res_block,
+      if (warc_tempfile_digests (file, sha1_res_block,
           sha1_res_payload, payload_offset) == 0)
         {
           char digest[BASE32_LENGTH(SHA1_DIGEST_SIZE) + 1 + 5];
@@ -742,7 +1610,7 @@ warc_uuid_str (char *urn_str)
 #endif
 
 /* Write a warcinfo record to the current file.
-   Updates warc_current_warcinfo_uuid_str. */
+   Updates warc_current_shard->warcinfo_uuid_str. */
 static bool
 warc_write_warcinfo_record (const char *filename)
 {
@@ -753,7 +1621,7 @@ warc_write_warcinfo_record (const char *filename)
   /* Write warc-info record as the first record of the file. */
   /* We add the record id of this info record to the other records in the
      file. */
-  warc_uuid_str (warc_current_warcinfo_uuid_str);
+  warc_uuid_str (warc_current_shard->warcinfo_uuid_str);
 
   warc_timestamp (timestamp, sizeof(timestamp));
 
@@ -763,7 +1631,7 @@ warc_write_warcinfo_record (const char *filename)
   warc_write_header ("WARC-Type", "warcinfo");
   warc_write_header ("Content-Type", "application/warc-fields");
   warc_write_header ("WARC-Date", timestamp);
-  warc_write_header ("WARC-Record-ID", warc_current_warcinfo_uuid_str);
+  warc_write_header ("WARC-Record-ID", warc_current_shard->warcinfo_uuid_str);
   warc_write_header ("WARC-Filename", filename_basename);
 
   xfree (filename_basename);
@@ -797,16 +1665,16 @@ warc_write_warcinfo_record (const char *filename)
   if (! warc_write_ok)
     logprintf (LOG_NOTQUIET, _("Error writing warcinfo record to WARC file.\n"));
 
-  fclose (warc_tmp);
+  warc_tempfile_close (warc_tmp);
   return warc_write_ok;
 }
 
 /* Opens a new WARC file.
    If META is true, generates a filename ending with 'meta.warc.gz'.
 
-   This method will:
+   This method will, for the current shard:
    1. close the current WARC file (if there is one);
-   2. increment warc_current_file_number;
+   2. increment the file number of the shard;
    3. open a new WARC file;
    4. write the initial warcinfo record.
 
@@ -817,78 +1685,100 @@ warc_start_new_file (bool meta)
 {
 #ifdef __VMS
 # define WARC_GZ "warc-gz"
+# define WARC_ZST "warc-zst"
 #else /* def __VMS */
 # define WARC_GZ "warc.gz"
+# define WARC_ZST "warc.zst"
 #endif /* def __VMS [else] */
 
-#ifdef HAVE_LIBZ
-  const char *extension = (opt.warc_compression_enabled ? WARC_GZ : "warc");
-#else
+  struct warc_shard *shard = warc_current_shard;
   const char *extension = "warc";
-#endif
-
-  int base_filename_length;
   char *new_filename;
 
+  if (opt.warc_compression == warc_compression_gzip)
+    extension = WARC_GZ;
+  else if (opt.warc_compression == warc_compression_zstd)
+    extension = WARC_ZST;
+
   if (opt.warc_filename == NULL)
     return false;
 
-  if (warc_current_file != NULL)
-    fclose (warc_current_file);
-
-  *warc_current_warcinfo_uuid_str = 0;
-  xfree (warc_current_filename);
-
-  warc_current_file_number++;
+  if (shard->file != NULL)
+    {
+#ifdef HAVE_WARC_COMPRESSION
+      warc_zqueue_write (true);
+#endif
+      fclose (shard->file);
+    }
 
-  base_filename_length = strlen (opt.warc_filename);
-  /* filename format:  base + "-" + 5 digit serial number + ".warc.gz" */
-  new_filename = xmalloc (base_filename_length + 1 + 5 + 8 + 1);
+  *shard->warcinfo_uuid_str = 0;
+  xfree (shard->filename);
 
-  warc_current_filename = new_filename;
+  shard->file_number++;
 
-  /* If max size is enabled, we add a serial number to the file names. */
+  /* If max size is enabled, we add a serial number to the file names,
+     and with several shards, the shard number.  */
   if (meta)
-    sprintf (new_filename, "%s-meta.%s", opt.warc_filename, extension);
+    new_filename = aprintf ("%s-meta.%s", opt.warc_filename, extension);
+  else if (warc_shard_count > 1 && opt.warc_maxsize > 0)
+    new_filename = aprintf ("%s-s%d-%05d.%s", opt.warc_filename,
+                            shard->index, shard->file_number, extension);
+  else if (warc_shard_count > 1)
+    new_filename = aprintf ("%s-s%d.%s", opt.warc_filename, shard->index,
+                            extension);
   else if (opt.warc_maxsize > 0)
-    {
-      sprintf (new_filename, "%s-%05d.%s", opt.warc_filename,
-               warc_current_file_number, extension);
-    }
+    new_filename = aprintf ("%s-%05d.%s", opt.warc_filename,
+                            shard->file_number, extension);
   else
-    sprintf (new_filename, "%s.%s", opt.warc_filename, extension);
+    new_filename = aprintf ("%s.%s", opt.warc_filename, extension);
+
+  shard->filename = new_filename;
 
   logprintf (LOG_VERBOSE, _("Opening WARC file %s.\n\n"), quote (new_filename));
 
   /* Open the WARC file. */
-  warc_current_file = fopen (new_filename, "wb+");
-  if (warc_current_file == NULL)
+  shard->file = fopen (new_filename, "wb+");
+  if (shard->file == NULL)
     {
       logprintf (LOG_NOTQUIET, _("Error opening WARC file %s.\n"),
                  quote (new_filename));
       return false;
     }
 
+#ifdef HAVE_LIBZSTD
+  if (opt.warc_compression == warc_compression_zstd
+      && !warc_zstd_write_dictionary ())
+    {
+      logprintf (LOG_NOTQUIET, _("Error writing WARC file %s.\n"),
+                 quote (new_filename));
+      return false;
+    }
+#endif
+
   if (! warc_write_warcinfo_record (new_filename))
     return false;
 
   /* Add warcinfo uuid to manifest. */
   if (warc_manifest_fp)
-    fprintf (warc_manifest_fp, "%s\n", warc_current_warcinfo_uuid_str);
+    fprintf (warc_manifest_fp, "%s\n", shard->warcinfo_uuid_str);
 
   return true;
 }
 
-/* Opens the CDX file for output. */
+/* Opens the CDX file of the current shard for output. */
 static bool
 warc_start_cdx_file (void)
 {
-  int filename_length = strlen (opt.warc_filename);
-  char *cdx_filename = alloca (filename_length + 4 + 1);
-  memcpy (cdx_filename, opt.warc_filename, filename_length);
-  memcpy (cdx_filename + filename_length, ".cdx", 5);
-  warc_current_cdx_file = fopen (cdx_filename, "a+");
-  if (warc_current_cdx_file == NULL)
+  struct warc_shard *shard = warc_current_shard;
+  char *cdx_filename;
+
+  if (warc_shard_count > 1)
+    cdx_filename = aprintf ("%s-s%d.cdx", opt.warc_filename, shard->index);
+  else
+    cdx_filename = aprintf ("%s.cdx", opt.warc_filename);
+  shard->cdx_file = fopen (cdx_filename, "a+");
+  xfree (cdx_filename);
+  if (shard->cdx_file == NULL)
     return false;
 
   /* Print the CDX header.
@@ -904,12 +1794,39 @@ warc_start_cdx_file (void)
    * g - file name
    * u - record-id
    */
-  fprintf (warc_current_cdx_file, " CDX a b a m s k r M V g u\n");
-  fflush (warc_current_cdx_file);
+  fprintf (shard->cdx_file, " CDX a b a m s k r M V g u\n");
+  fflush (shard->cdx_file);
 
   return true;
 }
 
+/* Selects the shard of the next record.  A record that is concurrent
+   to the record that started the current group of records goes to the
+   same shard, so that the records of a transaction stay together.  Any
+   other record starts a new group, in the shard that has been written
+   the least.  RECORD_UUID is the id of the record, or NULL.  */
+static void
+warc_select_shard (const char *record_uuid, const char *concurrent_to_uuid)
+{
+  int i;
+
+  warc_shard_group_continues =
+    concurrent_to_uuid != NULL
+    && strcmp (concurrent_to_uuid, warc_shard_group_uuid) == 0;
+  if (warc_shard_group_continues)
+    return;
+
+  snprintf (warc_shard_group_uuid, sizeof (warc_shard_group_uuid), "%s",
+            record_uuid ? record_uuid : "");
+  if (warc_shard_count < 2)
+    return;
+
+  warc_current_shard = &warc_shards[0];
+  for (i = 1; i < warc_shard_count; i++)
+    if (warc_shards[i].written < warc_current_shard->written)
+      warc_current_shard = &warc_shards[i];
+}
+
 #define CDX_FIELDSEP " \t\r\n"
 
 /* Parse the CDX header and find the field numbers of the original url,
@@ -957,78 +1874,340 @@ warc_parse_cdx_header (char *lineptr, int *field_num_original_url,
          && *field_num_record_id != -1;
 }
 
-/* Parse the CDX record and add it to the warc_cdx_dedup_table hash table. */
-static void
-warc_process_cdx_line (char *lineptr, int field_num_original_url,
-                       int field_num_checksum, int field_num_record_id)
+/* Parse the CDX record in LINEPTR.  On success, sets ORIGINAL_URL and
+   RECORD_ID to point into LINEPTR, stores the decoded checksum in
+   DIGEST and returns true.  */
+static bool
+warc_parse_cdx_line (char *lineptr, int field_num_original_url,
+                     int field_num_checksum, int field_num_record_id,
+                     char **original_url, char **record_id, char *digest)
 {
-  char *original_url = NULL;
   char *checksum = NULL;
-  char *record_id = NULL;
   char *token;
   char *save_ptr;
   int field_num = 0;
+  size_t checksum_l;
+  char *checksum_v;
+  bool valid;
+
+  *original_url = NULL;
+  *record_id = NULL;
 
   /* Read this line to get the fields we need. */
   token = strtok_r (lineptr, CDX_FIELDSEP, &save_ptr);
   while (token != NULL)
     {
-      char **val;
       if (field_num == field_num_original_url)
-        val = &original_url;
+        *original_url = token;
       else if (field_num == field_num_checksum)
-        val = &checksum;
+        checksum = token;
       else if (field_num == field_num_record_id)
-        val = &record_id;
-      else
-        val = NULL;
-
-      if (val != NULL)
-        *val = strdup (token);
+        *record_id = token;
 
       token = strtok_r (NULL, CDX_FIELDSEP, &save_ptr);
       field_num++;
     }
 
-  if (original_url != NULL && checksum != NULL && record_id != NULL)
+  if (*original_url == NULL || checksum == NULL || *record_id == NULL)
+    return false;
+
+  /* For some extra efficiency, we decode the base32 encoded
+     checksum value.  This should produce exactly SHA1_DIGEST_SIZE
+     bytes.  */
+  base32_decode_alloc (checksum, strlen (checksum), &checksum_v,
+                       &checksum_l);
+  valid = checksum_v != NULL && checksum_l == SHA1_DIGEST_SIZE;
+  if (valid)
+    memcpy (digest, checksum_v, SHA1_DIGEST_SIZE);
+  xfree (checksum_v);
+  return valid;
+}
+
+/* Parse the CDX record and add it to the warc_cdx_dedup_table hash table. */
+static void
+warc_process_cdx_line (char *lineptr, int field_num_original_url,
+                       int field_num_checksum, int field_num_record_id)
+{
+  char *original_url;
+  char *record_id;
+  char digest[SHA1_DIGEST_SIZE];
+
+  if (warc_parse_cdx_line (lineptr, field_num_original_url,
+                           field_num_checksum, field_num_record_id,
+                           &original_url, &record_id, digest))
+    {
+      /* This is a valid line with a valid checksum. */
+      struct warc_cdx_record *rec;
+      rec = xmalloc (sizeof (struct warc_cdx_record));
+      rec->url = xstrdup (original_url);
+      rec->uuid = xstrdup (record_id);
+      memcpy (rec->digest, digest, SHA1_DIGEST_SIZE);
+      hash_table_put (warc_cdx_dedup_table, rec->digest, rec);
+    }
+}
+
+/* A CDX index is a binary form of a CDX file, which is searched in
+   place instead of being loaded into warc_cdx_dedup_table:
+
+     magic       WARC_CDX_INDEX_MAGIC
+     count       number of records (8 bytes)
+     table       offset of the record table (8 bytes)
+     strings     for each record, its url and record id, each followed
+                 by a null byte
+     records     COUNT entries of WARC_CDX_INDEX_ENTRY_SIZE bytes, sorted
+                 by digest: the payload digest, then the offset of the
+                 strings of the record (8 bytes)
+
+   Numbers are stored in little-endian byte order.  */
+
+#define WARC_CDX_INDEX_MAGIC "WGETCDX1"
+#define WARC_CDX_INDEX_MAGIC_SIZE 8
+#define WARC_CDX_INDEX_HEADER_SIZE (WARC_CDX_INDEX_MAGIC_SIZE + 8 + 8)
+#define WARC_CDX_INDEX_ENTRY_SIZE (SHA1_DIGEST_SIZE + 8)
+
+/* The CDX index used for deduplication, if any. */
+static struct file_memory *warc_cdx_index;
+static wgint warc_cdx_index_count;
+static wgint warc_cdx_index_table;
+
+static void
+warc_cdx_index_put_number (unsigned char *buf, wgint value)
+{
+  int i;
+  for (i = 0; i < 8; i++)
+    buf[i] = (value >> (8 * i)) & 255;
+}
+
+static wgint
+warc_cdx_index_get_number (const unsigned char *buf)
+{
+  wgint value = 0;
+  int i;
+  for (i = 7; i >= 0; i--)
+    value = (value << 8) | buf[i];
+  return value;
+}
+
+struct warc_cdx_index_entry
+{
+  char digest[SHA1_DIGEST_SIZE];
+  wgint offset;
+};
+
+static int
+warc_cdx_index_entry_cmp (const void *a, const void *b)
+{
+  const struct warc_cdx_index_entry *e1 = a;
+  const struct warc_cdx_index_entry *e2 = b;
+  return memcmp (e1->digest, e2->digest, SHA1_DIGEST_SIZE);
+}
+
+/* Builds the CDX index INDEX_FILENAME from the records of the CDX file
+   F, whose header has been read.  The index is written to a temporary
+   file which is renamed when it is complete.  */
+static bool
+warc_build_cdx_index (FILE *f, const char *index_filename,
+                      int field_num_original_url, int field_num_checksum,
+                      int field_num_record_id)
+{
+  struct warc_cdx_index_entry *entries = NULL;
+  wgint count = 0, allocated = 0, i;
+  unsigned char header[WARC_CDX_INDEX_HEADER_SIZE];
+  char *lineptr = NULL;
+  size_t n = 0;
+  char *tmp_filename = aprintf ("%s.tmp", index_filename);
+  FILE *out = fopen (tmp_filename, "wb");
+  bool ok = out != NULL;
+
+  /* The header is written last, when the table offset is known. */
+  if (ok)
+    ok = fseeko (out, WARC_CDX_INDEX_HEADER_SIZE, SEEK_SET) == 0;
+
+  while (ok && getline (&lineptr, &n, f) != -1)
     {
-      /* For some extra efficiency, we decode the base32 encoded
-         checksum value.  This should produce exactly SHA1_DIGEST_SIZE
-         bytes.  */
-      size_t checksum_l;
-      char * checksum_v;
-      base32_decode_alloc (checksum, strlen (checksum), &checksum_v,
-                           &checksum_l);
-      xfree (checksum);
+      char *original_url;
+      char *record_id;
 
-      if (checksum_v != NULL && checksum_l == SHA1_DIGEST_SIZE)
+      if (count == allocated)
         {
-          /* This is a valid line with a valid checksum. */
-          struct warc_cdx_record *rec;
-          rec = xmalloc (sizeof (struct warc_cdx_record));
-          rec->url = original_url;
-          rec->uuid = record_id;
-          memcpy (rec->digest, checksum_v, SHA1_DIGEST_SIZE);
-          hash_table_put (warc_cdx_dedup_table, rec->digest, rec);
-          xfree (checksum_v);
+          allocated = allocated ? allocated * 2 : 4096;
+          entries = xrealloc (entries, allocated * sizeof (*entries));
         }
+      if (!warc_parse_cdx_line (lineptr, field_num_original_url,
+                                field_num_checksum, field_num_record_id,
+                                &original_url, &record_id,
+                                entries[count].digest))
+        continue;
+
+      entries[count++].offset = ftello (out);
+      fputs (original_url, out);
+      putc ('\0', out);
+      fputs (record_id, out);
+      ok = putc ('\0', out) != EOF;
+    }
+  xfree (lineptr);
+
+  qsort (entries, count, sizeof (*entries), warc_cdx_index_entry_cmp);
+
+  memcpy (header, WARC_CDX_INDEX_MAGIC, WARC_CDX_INDEX_MAGIC_SIZE);
+  warc_cdx_index_put_number (header + WARC_CDX_INDEX_MAGIC_SIZE, count);
+  if (ok)
+    warc_cdx_index_put_number (header + WARC_CDX_INDEX_MAGIC_SIZE + 8,
+                               ftello (out));
+
+  for (i = 0; ok && i < count; i++)
+    {
+      unsigned char entry[WARC_CDX_INDEX_ENTRY_SIZE];
+
+      memcpy (entry, entries[i].digest, SHA1_DIGEST_SIZE);
+      warc_cdx_index_put_number (entry + SHA1_DIGEST_SIZE, entries[i].offset);
+      ok = fwrite (entry, 1, sizeof (entry), out) == sizeof (entry);
+    }
+  xfree (entries);
+
+  if (ok)
+    ok = fseeko (out, 0, SEEK_SET) == 0
+      && fwrite (header, 1, sizeof (header), out) == sizeof (header);
+  if (out && fclose (out) != 0)
+    ok = false;
+  if (ok)
+    ok = rename (tmp_filename, index_filename) == 0;
+  if (!ok)
+    {
+      logprintf (LOG_NOTQUIET, _("Cannot write CDX index %s: %s\n"),
+                 quote (index_filename), strerror (errno));
+      unlink (tmp_filename);
+    }
+  xfree (tmp_filename);
+  return ok;
+}
+
+/* Maps the CDX index INDEX_FILENAME for deduplication.  */
+static bool
+warc_open_cdx_index (const char *index_filename)
+{
+  struct file_memory *fm = wget_read_file (index_filename);
+  const unsigned char *content;
+
+  if (fm == NULL)
+    return false;
+
+  content = (const unsigned char *) fm->content;
+  if (fm->length < WARC_CDX_INDEX_HEADER_SIZE
+      || memcmp (content, WARC_CDX_INDEX_MAGIC, WARC_CDX_INDEX_MAGIC_SIZE))
+    goto invalid;
+
+  warc_cdx_index_count =
+    warc_cdx_index_get_number (content + WARC_CDX_INDEX_MAGIC_SIZE);
+  warc_cdx_index_table =
+    warc_cdx_index_get_number (content + WARC_CDX_INDEX_MAGIC_SIZE + 8);
+  if (warc_cdx_index_count < 0
+      || warc_cdx_index_table < WARC_CDX_INDEX_HEADER_SIZE
+      || warc_cdx_index_table > fm->length
+      || (fm->length - warc_cdx_index_table) / WARC_CDX_INDEX_ENTRY_SIZE
+         != warc_cdx_index_count)
+    goto invalid;
+
+  warc_cdx_index = fm;
+  logprintf (LOG_VERBOSE, ngettext ("Using %s record from CDX index.\n\n",
+                                    "Using %s records from CDX index.\n\n",
+                                    warc_cdx_index_count),
+             number_to_static_string (warc_cdx_index_count));
+  return true;
+
+ invalid:
+  logprintf (LOG_NOTQUIET, _("Invalid CDX index %s.\n"),
+             quote (index_filename));
+  wget_read_file_free (fm);
+  return false;
+}
+
+/* Returns true if FILENAME is a CDX index rather than a CDX file. */
+static bool
+warc_is_cdx_index (const char *filename)
+{
+  char magic[WARC_CDX_INDEX_MAGIC_SIZE];
+  FILE *f = fopen (filename, "rb");
+  bool result;
+
+  if (f == NULL)
+    return false;
+  result = fread (magic, 1, sizeof (magic), f) == sizeof (magic)
+           && !memcmp (magic, WARC_CDX_INDEX_MAGIC, sizeof (magic));
+  fclose (f);
+  return result;
+}
+
+/* Returns true if the CDX index INDEX_FILENAME exists and is not older
+   than the CDX file FILENAME.  */
+static bool
+warc_cdx_index_is_current (const char *filename, const char *index_filename)
+{
+  struct stat st, index_st;
+
+  return stat (index_filename, &index_st) == 0
+         && stat (filename, &st) == 0
+         && index_st.st_mtime >= st.st_mtime;
+}
+
+/* Searches the CDX index for a record of URL with the payload digest
+   DIGEST.  Returns the record, which is valid until the next call, or
+   NULL.  */
+static struct warc_cdx_record *
+warc_cdx_index_find (const char *url, const char *digest)
+{
+  static struct warc_cdx_record rec;
+  const unsigned char *content = (const unsigned char *) warc_cdx_index->content;
+  const unsigned char *table = content + warc_cdx_index_table;
+  wgint lo = 0, hi = warc_cdx_index_count;
+
+  /* Find the first entry with DIGEST. */
+  while (lo < hi)
+    {
+      wgint mid = lo + (hi - lo) / 2;
+      if (memcmp (table + mid * WARC_CDX_INDEX_ENTRY_SIZE, digest,
+                  SHA1_DIGEST_SIZE) < 0)
+        lo = mid + 1;
       else
-        {
-          xfree (original_url);
-          xfree (checksum_v);
-          xfree (record_id);
-        }
+        hi = mid;
     }
-  else
+
+  for (; lo < warc_cdx_index_count; lo++)
     {
-      xfree(checksum);
-      xfree(original_url);
-      xfree(record_id);
+      const unsigned char *entry = table + lo * WARC_CDX_INDEX_ENTRY_SIZE;
+      wgint offset = warc_cdx_index_get_number (entry + SHA1_DIGEST_SIZE);
+      const char *strings, *end, *uuid;
+
+      if (memcmp (entry, digest, SHA1_DIGEST_SIZE) != 0)
+        break;
+      if (offset < WARC_CDX_INDEX_HEADER_SIZE
+          || offset >= warc_cdx_index_table)
+        continue;
+
+      /* Both strings must end before the table. */
+      strings = (const char *) content + offset;
+      end = (const char *) table;
+      uuid = memchr (strings, '\0', end - strings);
+      if (uuid == NULL || memchr (uuid + 1, '\0', end - uuid - 1) == NULL)
+        continue;
+      uuid++;
+
+      if (strcmp (strings, url) == 0)
+        {
+          rec.url = (char *) strings;
+          rec.uuid = (char *) uuid;
+          memcpy (rec.digest, digest, SHA1_DIGEST_SIZE);
+          return &rec;
+        }
     }
+  return NULL;
 }
 
 /* Loads the CDX file from opt.warc_cdx_dedup_filename and fills
-   the warc_cdx_dedup_table. */
+   the warc_cdx_dedup_table, or opens the CDX index, if that is what
+   the file is or if opt.warc_cdx_dedup_index is set.  In the latter
+   case the index is built first if it is missing or older than the
+   CDX file. */
 static bool
 warc_load_cdx_dedup_file (void)
 {
@@ -1040,6 +2219,14 @@ warc_load_cdx_dedup_file (void)
   int field_num_checksum = -1;
   int field_num_record_id = -1;
 
+  if (warc_is_cdx_index (opt.warc_cdx_dedup_filename))
+    return warc_open_cdx_index (opt.warc_cdx_dedup_filename);
+
+  if (opt.warc_cdx_dedup_index
+      && warc_cdx_index_is_current (opt.warc_cdx_dedup_filename,
+                                    opt.warc_cdx_dedup_index))
+    return warc_open_cdx_index (opt.warc_cdx_dedup_index);
+
   f = fopen (opt.warc_cdx_dedup_filename, "r");
   if (f == NULL)
     return false;
@@ -1069,6 +2256,21 @@ _("CDX file does not list checksums. (Missing column 'k'.)\n"));
         logprintf (LOG_NOTQUIET,
 _("CDX file does not list record ids. (Missing column 'u'.)\n"));
     }
+  else if (opt.warc_cdx_dedup_index)
+    {
+      bool ok;
+
+      logprintf (LOG_VERBOSE, _("Building CDX index %s.\n"),
+                 quote (opt.warc_cdx_dedup_index));
+      ok = warc_build_cdx_index (f, opt.warc_cdx_dedup_index,
+                                 field_num_original_url, field_num_checksum,
+                                 field_num_record_id)
+           && warc_open_cdx_index (opt.warc_cdx_dedup_index);
+
+      xfree (lineptr);
+      fclose (f);
+      return ok;
+    }
   else
     {
       int nrecords;
@@ -1112,6 +2314,9 @@ warc_find_duplicate_cdx_record (const char *url, char *sha1_digest_payload)
 {
   struct warc_cdx_record *rec_existing;
 
+  if (warc_cdx_index)
+    return warc_cdx_index_find (url, sha1_digest_payload);
+
   if (warc_cdx_dedup_table == NULL)
     return NULL;
 
@@ -1128,6 +2333,8 @@ warc_find_duplicate_cdx_record (const char *url, char *sha1_digest_payload)
 void
 warc_init (void)
 {
+  int i;
+
   warc_write_ok = true;
 
   if (opt.warc_filename != NULL)
@@ -1143,6 +2350,18 @@ warc_init (void)
             }
         }
 
+#ifdef HAVE_LIBZSTD
+      if (opt.warc_compression == warc_compression_zstd
+          && opt.warc_zstd_dictionary != NULL
+          && ! warc_zstd_load_dictionary ())
+        {
+          logprintf (LOG_NOTQUIET,
+                     _("Could not load zstd dictionary %s.\n"),
+                     quote (opt.warc_zstd_dictionary));
+          exit (WGET_EXIT_GENERIC_ERROR);
+        }
+#endif
+
       warc_manifest_fp = warc_tempfile ();
       if (warc_manifest_fp == NULL)
         {
@@ -1163,22 +2382,30 @@ warc_init (void)
           log_set_warc_log_fp (warc_log_fp);
         }
 
-      warc_current_file_number = -1;
-      if (! warc_start_new_file (false))
-        {
-          logprintf (LOG_NOTQUIET, _("Could not open WARC file.\n"));
-          exit (WGET_EXIT_GENERIC_ERROR);
-        }
-
-      if (opt.warc_cdx_enabled)
+      warc_shard_count = opt.warc_shards > 1 ? opt.warc_shards : 1;
+      warc_shards = xnew0_array (struct warc_shard, warc_shard_count);
+      for (i = 0; i < warc_shard_count; i++)
         {
-          if (! warc_start_cdx_file ())
+          warc_current_shard = &warc_shards[i];
+          warc_current_shard->index = i;
+          warc_current_shard->file_number = -1;
+          if (! warc_start_new_file (false))
             {
-              logprintf (LOG_NOTQUIET,
-                         _("Could not open CDX file for output.\n"));
+              logprintf (LOG_NOTQUIET, _("Could not open WARC file.\n"));
               exit (WGET_EXIT_GENERIC_ERROR);
             }
+
+          if (opt.warc_cdx_enabled)
+            {
+              if (! warc_start_cdx_file ())
+                {
+                  logprintf (LOG_NOTQUIET,
+                             _("Could not open CDX file for output.\n"));
+                  exit (WGET_EXIT_GENERIC_ERROR);
+                }
+            }
         }
+      warc_current_shard = &warc_shards[0];
     }
 }
 
@@ -1189,17 +2416,18 @@ warc_write_metadata (void)
   char manifest_uuid[48];
   FILE *warc_tmp_fp;
 
-  /* If there are multiple WARC files, the metadata should be written to a separate file. */
-  if (opt.warc_maxsize > 0)
+  /* If there are multiple WARC files, the metadata should be written to
+     a separate file, in place of the file of the first shard.  */
+  warc_current_shard = &warc_shards[0];
+  if (opt.warc_maxsize > 0 || warc_shard_count > 1)
     warc_start_new_file (true);
 
   warc_uuid_str (manifest_uuid);
 
   fflush (warc_manifest_fp);
-  warc_write_metadata_record (manifest_uuid,
-                              "metadata://gnu.org/software/wget/warc/MANIFEST.txt",
-                              NULL, NULL, NULL, "text/plain",
-                              warc_manifest_fp, -1);
+  warc_write_record ("metadata", manifest_uuid,
+                     "metadata://gnu.org/software/wget/warc/MANIFEST.txt",
+                     NULL, NULL, NULL, "text/plain", warc_manifest_fp, -1);
   /* warc_write_resource_record has closed warc_manifest_fp. */
 
   warc_tmp_fp = warc_tempfile ();
@@ -1211,18 +2439,17 @@ warc_write_metadata (void)
   fflush (warc_tmp_fp);
   fprintf (warc_tmp_fp, "%s\n", program_argstring);
 
-  warc_write_resource_record (NULL,
-                   "metadata://gnu.org/software/wget/warc/wget_arguments.txt",
-                              NULL, manifest_uuid, NULL, "text/plain",
-                              warc_tmp_fp, -1);
+  warc_write_record ("resource", NULL,
+                     "metadata://gnu.org/software/wget/warc/wget_arguments.txt",
+                     NULL, manifest_uuid, NULL, "text/plain", warc_tmp_fp, -1);
   /* warc_write_resource_record has closed warc_tmp_fp. */
 
   if (warc_log_fp != NULL)
     {
-      warc_write_resource_record (NULL,
-                              "metadata://gnu.org/software/wget/warc/wget.log",
-                                  NULL, manifest_uuid, NULL, "text/plain",
-                                  warc_log_fp, -1);
+      warc_write_record ("resource", NULL,
+                         "metadata://gnu.org/software/wget/warc/wget.log",
+                         NULL, manifest_uuid, NULL, "text/plain",
+                         warc_log_fp, -1);
       /* warc_write_resource_record has closed warc_log_fp. */
 
       warc_log_fp = NULL;
@@ -1235,19 +2462,47 @@ warc_write_metadata (void)
 void
 warc_close (void)
 {
-  if (warc_current_file != NULL)
+  int i;
+
+  if (warc_shards != NULL)
     {
       warc_write_metadata ();
-      *warc_current_warcinfo_uuid_str = 0;
-      fclose (warc_current_file);
+#ifdef HAVE_WARC_COMPRESSION
+      warc_zqueue_write (true);
+# ifdef HAVE_PTHREAD
+      warc_zworkers_stop ();
+# endif
+#endif
+#ifdef HAVE_LIBZSTD
+      ZSTD_freeCCtx (warc_zstd_cctx);
+      warc_zstd_cctx = NULL;
+      ZSTD_freeCDict (warc_zstd_cdict);
+      warc_zstd_cdict = NULL;
+      xfree (warc_zstd_dictionary);
+#endif
+      for (i = 0; i < warc_shard_count; i++)
+        {
+          struct warc_shard *shard = &warc_shards[i];
+
+          if (shard->file != NULL)
+            fclose (shard->file);
+          if (shard->cdx_file != NULL)
+            fclose (shard->cdx_file);
+          xfree (shard->filename);
+        }
+      xfree (warc_shards);
+      warc_current_shard = NULL;
     }
-  if (warc_current_cdx_file != NULL)
-    fclose (warc_current_cdx_file);
   if (warc_log_fp != NULL)
     {
-      fclose (warc_log_fp);
+      warc_tempfile_close (warc_log_fp);
       log_set_warc_log_fp (NULL);
     }
+  if (warc_cdx_index != NULL)
+    {
+      wget_read_file_free (warc_cdx_index);
+      warc_cdx_index = NULL;
+    }
 }
 
 /* Creates a temporary file for writing WARC output.
@@ -1257,6 +2512,8 @@ FILE *
 warc_tempfile (void)
 {
   char filename[100];
+  struct warc_tempfile *tmp;
+  FILE *fp;
   int fd;
 
   if (path_search (filename, 100, opt.warc_tempdir, "wget", true) == -1)
@@ -1274,7 +2531,7 @@ warc_tempfile (void)
     tfn = mktemp (filename);            /* Get unique name from template. */
     if (tfn == NULL)
       return NULL;
-    return fopen (tfn, "w+", "fop=tmd");    /* Create auto-delete temp file. */
+    fp = fopen (tfn, "w+", "fop=tmd");    /* Create auto-delete temp file. */
   }
 #else /* def __VMS */
   fd = mkostemp (filename, O_TEMPORARY);
@@ -1289,8 +2546,20 @@ warc_tempfile (void)
     }
 #endif
 
-  return fdopen (fd, "wb+");
+  fp = fdopen (fd, "wb+");
 #endif /* def __VMS [else] */
+
+  if (fp == NULL)
+    return NULL;
+
+  tmp = xnew0 (struct warc_tempfile);
+  tmp->fp = fp;
+  tmp->payload_offset = -1;
+  sha1_init_ctx (&tmp->block_ctx);
+  tmp->next = warc_tempfiles;
+  warc_tempfiles = tmp;
+
+  return fp;
 }
 
 
@@ -1307,6 +2576,8 @@ warc_write_request_record (const char *url, const char *timestamp_str,
                            const char *record_uuid, const ip_address *ip,
                            FILE *body, off_t payload_offset)
 {
+  warc_select_shard (record_uuid, NULL);
+
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "request");
   warc_write_header_uri ("WARC-Target-URI", url);
@@ -1314,12 +2585,13 @@ warc_write_request_record (const char *url, const char *timestamp_str,
   warc_write_date_header (timestamp_str);
   warc_write_header ("WARC-Record-ID", record_uuid);
   warc_write_ip_header (ip);
-  warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
+  warc_write_header ("WARC-Warcinfo-ID",
+                     warc_current_shard->warcinfo_uuid_str);
   warc_write_digest_headers (body, payload_offset);
   warc_write_block_from_file (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_tempfile_close (body);
 
   return warc_write_ok;
 }
@@ -1332,21 +2604,22 @@ warc_write_request_record (const char *url, const char *timestamp_str,
    response_code  is the HTTP response code (will be printed to CDX),
    payload_digest  is the sha1 digest of the payload,
    redirect_location  is the contents of the Location: header, or NULL (will be printed to CDX),
-   offset  is the position of the WARC record in the WARC file,
    warc_filename  is the filename of the WARC,
    response_uuid  is the uuid of the response.
+   The record must be the last one written.  If it is still being
+   compressed, the line is printed once the record is in the WARC file.
    Returns true on success, false on error. */
 static bool
 warc_write_cdx_record (const char *url, const char *timestamp_str,
                        const char *mime_type, int response_code,
                        const char *payload_digest, const char *redirect_location,
-                       off_t offset, const char *warc_filename _GL_UNUSED,
+                       const char *warc_filename _GL_UNUSED,
                        const char *response_uuid)
 {
   /* Transform the timestamp. */
   char timestamp_str_cdx[15];
-  char offset_string[MAX_INT_TO_STRING_LEN(off_t)];
   const char *checksum;
+  char *head, *tail;
 
   memcpy (timestamp_str_cdx     , timestamp_str     , 4); /* "YYYY" "-" */
   memcpy (timestamp_str_cdx +  4, timestamp_str +  5, 2); /* "mm"   "-" */
@@ -1369,14 +2642,24 @@ warc_write_cdx_record (const char *url, const char *timestamp_str,
   else
     redirect_location = url_escape(redirect_location);
 
-  number_to_string (offset_string, offset);
+  /* Print the CDX line, around the offset of the record. */
+  head = aprintf ("%s %s %s %s %d %s %s - ", url, timestamp_str_cdx, url,
+                  mime_type, response_code, checksum, redirect_location);
+  tail = aprintf (" %s %s\n", warc_current_shard->filename, response_uuid);
+
+#ifdef HAVE_WARC_COMPRESSION
+  if (warc_zqueue_last)
+    {
+      warc_zqueue_last->cdx_head = head;
+      warc_zqueue_last->cdx_tail = tail;
+      return true;
+    }
+#endif
 
-  /* Print the CDX line. */
-  fprintf (warc_current_cdx_file, "%s %s %s %s %d %s %s - %s %s %s\n", url,
-           timestamp_str_cdx, url, mime_type, response_code, checksum,
-           redirect_location, offset_string, warc_current_filename,
-           response_uuid);
-  fflush (warc_current_cdx_file);
+  warc_write_cdx_line (warc_current_shard, head,
+                       warc_current_shard->last_record_offset, tail);
+  xfree (head);
+  xfree (tail);
 
   return true;
 }
@@ -1405,13 +2688,18 @@ warc_write_revisit_record (const char *url, const char *timestamp_str,
 
   warc_uuid_str (revisit_uuid);
 
-  sha1_stream (body, sha1_res_block);
+  if (warc_tempfile_digests (body, sha1_res_block, NULL, -1) != 0)
+    {
+      warc_tempfile_close (body);
+      return false;
+    }
   warc_base32_sha1_digest (sha1_res_block, block_digest, sizeof(block_digest));
 
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "revisit");
   warc_write_header ("WARC-Record-ID", revisit_uuid);
-  warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
+  warc_write_header ("WARC-Warcinfo-ID",
+                     warc_current_shard->warcinfo_uuid_str);
   warc_write_header ("WARC-Concurrent-To", concurrent_to_uuid);
   warc_write_header ("WARC-Refers-To", refers_to);
   warc_write_header ("WARC-Profile", "http://netpreserve.org/warc/1.0/revisit/identical-payload-digest");
@@ -1425,7 +2713,7 @@ warc_write_revisit_record (const char *url, const char *timestamp_str,
   warc_write_block_from_file (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_tempfile_close (body);
 
   return warc_write_ok;
 }
@@ -1454,13 +2742,13 @@ warc_write_response_record (const char *url, const char *timestamp_str,
   char sha1_res_block[SHA1_DIGEST_SIZE];
   char sha1_res_payload[SHA1_DIGEST_SIZE];
   char response_uuid [48];
-  off_t offset;
+
+  warc_select_shard (NULL, concurrent_to_uuid);
 
   if (opt.warc_digests_enabled)
     {
       /* Calculate the block and payload digests. */
-      rewind (body);
-      if (warc_sha1_stream_with_payload (body, sha1_res_block, sha1_res_payload,
+      if (warc_tempfile_digests (body, sha1_res_block, sha1_res_payload,
           payload_offset) == 0)
         {
           /* Decide (based on url + payload digest) if we have seen this
@@ -1478,8 +2766,11 @@ warc_write_response_record (const char *url, const char *timestamp_str,
               /* Remove the payload from the file. */
               if (payload_offset > 0)
                 {
-                  if (ftruncate (fileno (body), payload_offset) == -1)
-                    return false;
+                  if (!warc_tempfile_drop_payload (body, payload_offset))
+                    {
+                      warc_tempfile_close (body);
+                      return false;
+                    }
                 }
 
               /* Send the original payload digest. */
@@ -1500,13 +2791,11 @@ warc_write_response_record (const char *url, const char *timestamp_str,
 
   warc_uuid_str (response_uuid);
 
-  fseeko (warc_current_file, 0L, SEEK_END);
-  offset = ftello (warc_current_file);
-
   warc_write_start_record ();
   warc_write_header ("WARC-Type", "response");
   warc_write_header ("WARC-Record-ID", response_uuid);
-  warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
+  warc_write_header ("WARC-Warcinfo-ID",
+                     warc_current_shard->warcinfo_uuid_str);
   warc_write_header ("WARC-Concurrent-To", concurrent_to_uuid);
   warc_write_header_uri ("WARC-Target-URI", url);
   warc_write_date_header (timestamp_str);
@@ -1517,13 +2806,13 @@ warc_write_response_record (const char *url, const char *timestamp_str,
   warc_write_block_from_file (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_tempfile_close (body);
 
   if (warc_write_ok && opt.warc_cdx_enabled)
     {
       /* Add this record to the CDX. */
       warc_write_cdx_record (url, timestamp_str, mime_type, response_code,
-      payload_digest, redirect_location, offset, warc_current_filename,
+      payload_digest, redirect_location, warc_current_shard->filename,
       response_uuid);
     }
 
@@ -1563,7 +2852,8 @@ warc_write_record (const char *record_type, const char *resource_uuid,
   warc_write_start_record ();
   warc_write_header ("WARC-Type", record_type);
   warc_write_header ("WARC-Record-ID", resource_uuid);
-  warc_write_header ("WARC-Warcinfo-ID", warc_current_warcinfo_uuid_str);
+  warc_write_header ("WARC-Warcinfo-ID",
+                     warc_current_shard->warcinfo_uuid_str);
   warc_write_header ("WARC-Concurrent-To", concurrent_to_uuid);
   warc_write_header_uri ("WARC-Target-URI", url);
   warc_write_date_header (timestamp_str);
@@ -1573,7 +2863,7 @@ warc_write_record (const char *record_type, const char *resource_uuid,
   warc_write_block_from_file (body);
   warc_write_end_record ();
 
-  fclose (body);
+  warc_tempfile_close (body);
 
   return warc_write_ok;
 }
@@ -1595,6 +2885,7 @@ warc_write_resource_record (const char *resource_uuid, const char *url,
                  const ip_address *ip, const char *content_type, FILE *body,
                  off_t payload_offset)
 {
+  warc_select_shard (resource_uuid, concurrent_to_uuid);
   return warc_write_record ("resource",
       resource_uuid, url, timestamp_str, concurrent_to_uuid,
       ip, content_type, body, payload_offset);
@@ -1617,7 +2908,148 @@ warc_write_metadata_record (const char *record_uuid, const char *url,
                  ip_address *ip, const char *content_type, FILE *body,
                  off_t payload_offset)
 {
+  warc_select_shard (record_uuid, concurrent_to_uuid);
   return warc_write_record ("metadata",
       record_uuid, url, timestamp_str, concurrent_to_uuid,
       ip, content_type, body, payload_offset);
 }
+
+#ifdef TESTING
+
+/* Writes LEN bytes of DATA to the file FILE.  */
+static bool
+write_test_file (const char *file, const char *data, size_t len)
+{
+  FILE *fp = fopen (file, "wb");
+  bool ok;
+
+  if (!fp)
+    return false;
+  ok = fwrite (data, 1, len, fp) == len;
+  return fclose (fp) == 0 && ok;
+}
+
+const char *
+test_warc_cdx_index (void)
+{
+  /* The records, in the order they appear in the CDX file, and the
+     first byte of their digests, whose other bytes are all 0x5a.  The
+     digests of the last two are the same.  */
+  static const struct {
+    const char *url;
+    const char *uuid;
+    unsigned char digest_byte;
+  } records[] = {
+    { "http://example.com/c", "<urn:uuid:c>", 0x80 },
+    { "http://example.com/a", "<urn:uuid:a>", 0x00 },
+    { "http://example.com/e", "<urn:uuid:e>", 0xff },
+    { "http://example.com/b", "<urn:uuid:b>", 0x40 },
+    { "http://example.com/d", "<urn:uuid:d>", 0xc0 },
+    { "http://example.com/d2", "<urn:uuid:d2>", 0xc0 },
+  };
+  char digest[SHA1_DIGEST_SIZE];
+  struct warc_cdx_record *rec;
+  struct file_memory *fm;
+  char *home = home_dir ();
+  char *file, *index;
+  char *lineptr = NULL;
+  size_t n = 0;
+  int url_field, checksum_field, record_id_field;
+  FILE *fp;
+  unsigned i;
+  bool ok;
+
+  if (!home)
+    return NULL;
+  file = aprintf ("%s/.wget-cdx-testing", home);
+  index = aprintf ("%s/.wget-cdx-testing.idx", home);
+  xfree (home);
+
+  fp = fopen (file, "w");
+  mu_assert ("test_warc_cdx_index: cannot write the CDX file", fp != NULL);
+  fputs (" CDX a k u\n", fp);
+  fputs ("not a valid line\n", fp);
+  for (i = 0; i < countof (records); i++)
+    {
+      char checksum[BASE32_LENGTH (SHA1_DIGEST_SIZE) + 1];
+
+      memset (digest, 0x5a, sizeof (digest));
+      digest[0] = records[i].digest_byte;
+      base32_encode (digest, sizeof (digest), checksum, sizeof (checksum));
+      fprintf (fp, "%s %s %s\n", records[i].url, checksum, records[i].uuid);
+    }
+  fclose (fp);
+
+  fp = fopen (file, "r");
+  mu_assert ("test_warc_cdx_index: cannot read the CDX file", fp != NULL);
+  getline (&lineptr, &n, fp);
+  warc_parse_cdx_header (lineptr, &url_field, &checksum_field,
+                         &record_id_field);
+  xfree (lineptr);
+  ok = warc_build_cdx_index (fp, index, url_field, checksum_field,
+                             record_id_field);
+  fclose (fp);
+  mu_assert ("test_warc_cdx_index: index not built", ok);
+  mu_assert ("test_warc_cdx_index: index not opened",
+             warc_open_cdx_index (index));
+  mu_assert ("test_warc_cdx_index: wrong record count",
+             warc_cdx_index_count == countof (records));
+
+  /* Every record is found, including the first and last of the
+     table.  */
+  for (i = 0; i < countof (records); i++)
+    {
+      memset (digest, 0x5a, sizeof (digest));
+      digest[0] = records[i].digest_byte;
+      rec = warc_cdx_index_find (records[i].url, digest);
+      mu_assert ("test_warc_cdx_index: record not found", rec != NULL);
+      mu_assert ("test_warc_cdx_index: wrong url",
+                 !strcmp (rec->url, records[i].url));
+      mu_assert ("test_warc_cdx_index: wrong record id",
+                 !strcmp (rec->uuid, records[i].uuid));
+    }
+
+  /* Digests before, between and after those of the table, and a
+     known digest with another URL.  */
+  memset (digest, 0x5a, sizeof (digest));
+  digest[0] = 0x00;
+  digest[1] = 0x00;
+  mu_assert ("test_warc_cdx_index: found digest before the first",
+             warc_cdx_index_find ("http://example.com/a", digest) == NULL);
+  digest[0] = 0x41;
+  mu_assert ("test_warc_cdx_index: found absent digest",
+             warc_cdx_index_find ("http://example.com/b", digest) == NULL);
+  memset (digest, 0xff, sizeof (digest));
+  mu_assert ("test_warc_cdx_index: found digest after the last",
+             warc_cdx_index_find ("http://example.com/e", digest) == NULL);
+  memset (digest, 0x5a, sizeof (digest));
+  digest[0] = 0x40;
+  mu_assert ("test_warc_cdx_index: found digest with another url",
+             warc_cdx_index_find ("http://example.com/x", digest) == NULL);
+
+  /* A truncated index and garbage are refused.  */
+  fm = warc_cdx_index;
+  warc_cdx_index = NULL;
+  ok = write_test_file (file, fm->content, fm->length - 1);
+  wget_read_file_free (fm);
+  mu_assert ("test_warc_cdx_index: cannot write truncated index", ok);
+  mu_assert ("test_warc_cdx_index: truncated index accepted",
+             !warc_open_cdx_index (file));
+  ok = write_test_file (file, WARC_CDX_INDEX_MAGIC "garbage",
+                        strlen (WARC_CDX_INDEX_MAGIC "garbage"));
+  mu_assert ("test_warc_cdx_index: cannot write garbage index", ok);
+  mu_assert ("test_warc_cdx_index: garbage index accepted",
+             !warc_open_cdx_index (file));
+  ok = write_test_file (file, "CDX a k u\n", 10);
+  mu_assert ("test_warc_cdx_index: cannot write CDX file", ok);
+  mu_assert ("test_warc_cdx_index: CDX file accepted as index",
+             !warc_open_cdx_index (file));
+
+  unlink (file);
+  unlink (index);
+  xfree (file);
+  xfree (index);
+  return NULL;
+}
+
+#endif /* TESTING */
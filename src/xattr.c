@@ -18,9 +18,11 @@
 #include "wget.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
+#include "utils.h"
 #include "xattr.h"
 
 #ifdef USE_XATTR
@@ -42,6 +44,27 @@ write_xattr_metadata (const char *name, const char *value, FILE *fp)
   return retval;
 }
 
+static char *
+read_xattr_metadata (const char *name, const char *file)
+{
+  ssize_t size;
+  char *value;
+
+  size = getxattr (file, name, NULL, 0);
+  if (size <= 0)
+    return NULL;
+
+  value = xmalloc (size + 1);
+  size = getxattr (file, name, value, size);
+  if (size <= 0)
+    {
+      xfree (value);
+      return NULL;
+    }
+  value[size] = '\0';
+  return value;
+}
+
 #else /* USE_XATTR */
 
 static int
@@ -54,6 +77,15 @@ write_xattr_metadata (const char *name, const char *value, FILE *fp)
   return 0;
 }
 
+static char *
+read_xattr_metadata (const char *name, const char *file)
+{
+  (void)name;
+  (void)file;
+
+  return NULL;
+}
+
 #endif /* USE_XATTR */
 
 int
@@ -77,3 +109,24 @@ set_file_metadata (const char *origin_url, const char *referrer_url, FILE *fp)
 
   return retval;
 }
+
+int
+set_file_etag (const char *etag, FILE *fp)
+{
+  /* The entity tag lets a later run with -N ask the server whether
+   * the file has changed with If-None-Match.  Attributes survive the
+   * file being truncated and written again, so one that is not known
+   * is stored empty rather than left over from an earlier version.
+   */
+  return write_xattr_metadata ("user.etag", etag ? etag : "", fp);
+}
+
+char *
+get_file_etag (const char *file)
+{
+  char *etag = read_xattr_metadata ("user.etag", file);
+
+  if (etag && !*etag)
+    xfree (etag);
+  return etag;
+}
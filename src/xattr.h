@@ -23,6 +23,12 @@
 /* Store metadata name/value attributes against fp. */
 int set_file_metadata (const char *origin_url, const char *referrer_url, FILE *fp);
 
+/* Store the entity tag of the remote file against fp, or forget it. */
+int set_file_etag (const char *etag, FILE *fp);
+
+/* Get the entity tag stored against the file named file. */
+char *get_file_etag (const char *file);
+
 #if defined(__linux)
 /* libc on Linux has fsetxattr (5 arguments). */
 #  include <sys/xattr.h>
@@ -32,6 +38,8 @@ int set_file_metadata (const char *origin_url, const char *referrer_url, FILE *f
 #  include <sys/xattr.h>
 #  define fsetxattr(file, name, buffer, size, flags) \
           fsetxattr ((file), (name), (buffer), (size), 0, (flags))
+#  define getxattr(path, name, buffer, size) \
+          getxattr ((path), (name), (buffer), (size), 0, 0)
 #  define USE_XATTR
 #elif defined(__FreeBSD_version) && (__FreeBSD_version > 500000)
 /* FreeBSD */
@@ -39,6 +47,8 @@ int set_file_metadata (const char *origin_url, const char *referrer_url, FILE *f
 #  include <sys/extattr.h>
 #  define fsetxattr(file, name, buffer, size, flags) \
           extattr_set_fd ((file), EXTATTR_NAMESPACE_USER, (name), (buffer), (size))
+#  define getxattr(path, name, buffer, size) \
+          extattr_get_file ((path), EXTATTR_NAMESPACE_USER, (name), (buffer), (size))
 #  define USE_XATTR
 #endif
 
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that link conversion gives the same results when it
+    reuses the links recorded while the documents were parsed during the
+    recursive retrieval: links to downloaded files become relative, the
+    others become complete, <base href> is emptied and meta refresh keeps
+    its timeout.
+"""
+############# File Definitions ###############################################
+index_FileContent = """<html>
+<head>
+    <meta http-equiv="refresh" content="30; URL=a/page.html">
+</head>
+<body>
+    <a href="a/page.html#top">page</a>
+    <a href='/a/other.html'>other</a>
+    <a href=missing.html>missing</a>
+    <img src="a/pic.png" srcset="a/pic.png 1x, a/pic2.png 2x">
+</body>
+</html>
+"""
+index_LocalFileContent = """<html>
+<head>
+    <meta http-equiv="refresh" content="30; URL=a/page.html">
+</head>
+<body>
+    <a href="a/page.html#top">page</a>
+    <a href='a/other.html'>other</a>
+    <a href="http://127.0.0.1:{{port}}/missing.html">missing</a>
+    <img src="a/pic.png" srcset="a/pic.png 1x, a/pic2.png 2x">
+</body>
+</html>
+"""
+
+page_FileContent = """<html>
+<head><base href="/a/"></head>
+<body><a href="../index.html">up</a> <a href="other.html">other</a></body>
+</html>
+"""
+page_LocalFileContent = """<html>
+<head><base href=""></head>
+<body><a href="../index.html">up</a> <a href="other.html">other</a></body>
+</html>
+"""
+
+other_FileContent = """<html><body><a href="page.html">page</a></body></html>
+"""
+
+index_File = WgetFile ("index.html", index_FileContent)
+index_LocalFile = WgetFile ("index.html", index_LocalFileContent)
+page_File = WgetFile ("a/page.html", page_FileContent)
+page_LocalFile = WgetFile ("a/page.html", page_LocalFileContent)
+other_File = WgetFile ("a/other.html", other_FileContent)
+pic_File = WgetFile ("a/pic.png", "png")
+pic2_File = WgetFile ("a/pic2.png", "png2")
+robots_File = WgetFile ("robots.txt", "")
+
+WGET_OPTIONS = "--no-host-directories -r --convert-links"
+WGET_URLS = [["index.html"]]
+
+Files = [[index_File, page_File, other_File, pic_File, pic2_File, robots_File]]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [index_LocalFile, page_LocalFile, other_File,
+                           pic_File, pic2_File, robots_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+import os
+
+"""
+    This test ensures that Wget sends the entity tags stored with local files
+    in If-None-Match headers with -N, recognizes unchanged files by them, and
+    keeps recursing into pages that were not modified.  It also ensures that
+    Wget stores the entity tags of the files it downloads, and clears a stored
+    one when the new version of a file comes without any.
+"""
+if os.getenv('XATTR_TESTS') is None:
+    exit (77)
+# Wget built with xattr support may still run on a file system, or an OS,
+# that can't store the entity tags of the local files.
+try:
+    from os import setxattr
+    from tempfile import NamedTemporaryFile
+    with NamedTemporaryFile (dir=".") as probe:
+        setxattr (probe.name, "user.etag", b'"probe"')
+except (ImportError, OSError):
+    exit (77)
+
+############# File Definitions ###############################################
+Index = """<html><body>
+<a href=\"a.txt\">A</a>
+<a href=\"b.txt\">B</a>
+<a href=\"c.txt\">C</a>
+</body></html>"""
+# Keep same length !
+Cont1 = """THIS IS 1 FILE"""
+Cont2 = """THIS IS 2 FILE"""
+
+# Local Wget files
+Index_Local = WgetFile ("index.html", Index, timestamp="1995-01-01 00:00:00",
+                        xattrs={"user.etag": '"index-1"'})
+A_Local = WgetFile ("a.txt", Cont1, timestamp="1995-01-01 00:00:00",
+                    xattrs={"user.etag": '"a-1"'})
+C_Local = WgetFile ("c.txt", Cont1, timestamp="1995-01-01 00:00:00",
+                    xattrs={"user.etag": '"c-1"'})
+
+Index_Rules = {
+    "ExpectHeader" : {
+        "If-Modified-Since" : "Sun, 01 Jan 1995 00:00:00 GMT",
+        "If-None-Match" : '"index-1"',
+    },
+    "Response": 304,
+}
+
+# The server ignores the conditional headers, and its time-stamp is newer,
+# but the entity tag shows that the file has not changed.
+A_Rules = {
+    "ExpectHeader" : {
+        "If-None-Match" : '"a-1"',
+    },
+    "SendHeader" : {
+        "ETag" : '"a-1"',
+        "Last-Modified" : "Thu, 01 Jan 2015 00:00:00 GMT",
+    },
+}
+
+B_Rules = {
+    "SendHeader" : {
+        "ETag" : '"b-1"',
+    },
+}
+
+# The new version of c.txt has no entity tag.
+C_Rules = {
+    "ExpectHeader" : {
+        "If-None-Match" : '"c-1"',
+    },
+}
+
+Index_File = WgetFile ("index.html", Index, rules=Index_Rules)
+A_File = WgetFile ("a.txt", Cont2, rules=A_Rules)
+B_File = WgetFile ("b.txt", Cont2, rules=B_Rules)
+C_File = WgetFile ("c.txt", Cont2 + " AGAIN", rules=C_Rules)
+
+WGET_OPTIONS = "-N -r -nH"
+WGET_URLS = [["index.html"]]
+
+Files = [[Index_File, A_File, B_File, C_File]]
+
+Existing_Files = [Index_Local, A_Local, C_Local]
+
+# The tags are checked after the run, along with the contents.
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [
+    Index_Local,
+    A_Local,
+    WgetFile ("b.txt", Cont2, xattrs={"user.etag": '"b-1"'}),
+    WgetFile ("c.txt", C_File.content, xattrs={"user.etag": ""}),
+]
+
+Request_List = [
+    [
+        "GET /index.html",
+        "GET /robots.txt",
+        "GET /a.txt",
+        "GET /b.txt",
+        "GET /c.txt",
+    ]
+]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
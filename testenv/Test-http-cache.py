@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+from tempfile import mkdtemp
+from shutil import rmtree
+from hashlib import sha256
+import os
+import time
+
+"""
+    This test ensures that Wget reads fresh responses from the HTTP cache
+    instead of requesting them again, and that it does not store responses
+    it is not allowed to.  A stale response is revalidated, and read from the
+    cache when the server answers 304 Not Modified.  A stored response is
+    only used for requests with the same values of the headers it varies on.
+    A response received with the chunked transfer coding is replayed from the
+    cache as it was received.
+"""
+############# File Definitions ###############################################
+File1 = "Still fresh for a minute."
+File2 = "Not to be stored."
+File3 = "Changed on the server, but the server says it isn't."
+File3_Cached = "As stored in the cache an hour ago."
+File4 = "Stored for Accept: */*."
+File5 = "Not the variant in the cache."
+File5_Cached = "Stored for Accept: text/html."
+File6 = "Sent in chunks of sixteen bytes, and stored as they came."
+
+Fresh_Rules = {
+    "SendHeader" : {
+        "Cache-Control" : "max-age=60",
+        "ETag" : '"fresh-1"',
+    },
+}
+
+NoStore_Rules = {
+    "SendHeader" : {
+        "Cache-Control" : "no-store",
+        "ETag" : '"no-store-1"',
+    },
+}
+
+# The second request for File3 must be answered from the cache, which the
+# 304 response made fresh again.
+Revalidate_Rules = {
+    "ExpectHeader" : {
+        "If-None-Match" : '"stale-1"',
+    },
+    "SendHeader" : {
+        "Cache-Control" : "max-age=60",
+    },
+    "Response" : 304,
+}
+
+Vary_Rules = {
+    "SendHeader" : {
+        "Cache-Control" : "max-age=60",
+        "Vary" : "Accept",
+    },
+}
+
+Chunked_Rules = {
+    "SendHeader" : {
+        "Cache-Control" : "max-age=60",
+        "Transfer-Encoding" : "chunked",
+    },
+}
+
+File1_File = WgetFile ("File1", File1, rules=Fresh_Rules)
+File1_Copy = WgetFile ("File1.1", File1)
+File2_File = WgetFile ("File2", File2, rules=NoStore_Rules)
+File2_Copy = WgetFile ("File2.1", File2)
+File3_File = WgetFile ("File3", File3, rules=Revalidate_Rules)
+File4_File = WgetFile ("File4", File4, rules=Vary_Rules)
+File4_Copy = WgetFile ("File4.1", File4)
+File5_File = WgetFile ("File5", File5)
+File6_File = WgetFile ("File6", File6, rules=Chunked_Rules)
+File6_Copy = WgetFile ("File6.1", File6)
+
+# Keep the cache out of the directory the files are downloaded to.
+CACHE = mkdtemp ()
+
+WGET_OPTIONS = "--http-cache=" + CACHE
+WGET_URLS = [["File1", "File2", "File1", "File2", "File3", "File3",
+              "File4", "File4", "File5", "File6", "File6"]]
+
+Files = [[File1_File, File2_File, File3_File, File4_File, File5_File,
+          File6_File]]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [File1_File, File1_Copy, File2_File, File2_Copy,
+                           WgetFile ("File3", File3_Cached),
+                           WgetFile ("File3.1", File3_Cached),
+                           File4_File, File4_Copy, File5_File,
+                           File6_File, File6_Copy]
+
+Request_List = [
+    [
+        "GET /File1",
+        "GET /File2",
+        "GET /File2",
+        "GET /File3",
+        "GET /File4",
+        "GET /File5",
+        "GET /File6",
+    ]
+]
+
+def store_entry (url, body, meta):
+    """ Put in the cache a response to URL received before this test. """
+    name = os.path.join (CACHE, sha256 (url.encode ('utf-8')).hexdigest ())
+    with open (name + ".data", "w") as fp:
+        fp.write ("HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/plain\r\n"
+                  "Content-Length: %d\r\n\r\n%s" % (len (body), body))
+    with open (name + ".meta", "w") as fp:
+        fp.write ("url %s\n" % url)
+        for keyword, value in meta:
+            fp.write ("%s %s\n" % (keyword, value))
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+}
+
+test = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+)
+
+# The cache is looked up by URL, so its entries can only be made once the
+# server's port is known.
+test.setup ()
+Server = "http://%s:%s/" % (test.addr, test.port)
+now = int (time.time ())
+store_entry (Server + "File3", File3_Cached,
+             [("time", now - 3600), ("lifetime", 60), ("age", 0),
+              ("etag", '"stale-1"')])
+store_entry (Server + "File5", File5_Cached,
+             [("time", now), ("lifetime", 3600), ("age", 0),
+              ("vary", "accept: text/html")])
+
+err = test.begin ()
+
+rmtree (CACHE)
+exit (err)
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from test.base_test import HTTP2
+from misc.wget_file import WgetFile
+import os
+
+"""
+    This test ensures that Wget negotiates HTTP/2 with servers supporting it,
+    and sends all the requests of a recursive download over one connection.
+    The requests for the links of a page are sent ahead, so that a response
+    too large to be sent whole until it is read is still under way when the
+    request for the next link comes in.
+"""
+if os.getenv('SSL_TESTS') is None or os.getenv('HTTP2_TESTS') is None:
+    exit (77)
+try:
+    import h2
+except ImportError:
+    exit (77)
+
+############# File Definitions ###############################################
+File1 = """<html><head>
+<link rel=\"stylesheet\" href=\"style.css\">
+</head><body>
+<a href=\"/a/File2.html\">text</a>
+<a href=\"/b/File3.html\">text</a>
+<a href=\"/b/missing.html\">text</a>
+</body></html>"""
+File2 = "With lemon or cream?"
+File3 = "Surely you're joking Mr. Feynman" * 40000
+Style = "body { color: black; }"
+
+File1_File = WgetFile ("a/File1.html", File1)
+File2_File = WgetFile ("a/File2.html", File2)
+File3_File = WgetFile ("b/File3.html", File3)
+Style_File = WgetFile ("a/style.css", Style)
+
+CAFILE = os.path.abspath(os.path.join(os.getenv('srcdir', '.'), 'certs', 'ca-cert.pem'))
+WGET_OPTIONS = "--recursive --no-host-directories --ca-certificate=" + CAFILE
+WGET_URLS = [["a/File1.html"]]
+
+Servers = [HTTP2]
+
+Files = [[File1_File, File2_File, File3_File, Style_File]]
+Existing_Files = []
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [File1_File, File2_File, File3_File, Style_File]
+Request_List = [["GET /a/File1.html",
+                 "GET /robots.txt",
+                 "GET /a/style.css",
+                 "GET /a/File2.html",
+                 "GET /b/File3.html",
+                 "GET /b/missing.html"]]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+    "ExpectedConnections" : [1],
+    "ExpectedStreams"   : [2]
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test,
+                protocols=Servers,
+                req_protocols=["https"]
+).begin ()
+
+exit (err)
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget retrieves the URLs of an --input-file in
+    order, skipping blank and comment lines, resolving relative URLs with
+    --base, reading a last line without a newline, and going on after an
+    invalid URL.
+"""
+############# File Definitions ###############################################
+A_File = WgetFile ("dir/a.txt", "Content of a")
+B_File = WgetFile ("dir/b.txt", "Content of b")
+C_File = WgetFile ("dir/sub/c.txt", "Content of c")
+D_File = WgetFile ("d.txt", "Content of d")
+E_File = WgetFile ("e.txt", "Content of e")
+Skipped_File = WgetFile ("skipped.txt", "Must not be retrieved")
+
+# Written once the server's port is known.
+Input_File = WgetFile ("urls.txt", "")
+
+WGET_OPTIONS = "--base=http://localhost:{{port}}/dir/sub/ -i urls.txt"
+WGET_URLS = [[]]
+
+Files = [[A_File, B_File, C_File, D_File, E_File, Skipped_File]]
+
+ExpectedReturnCode = 1
+ExpectedDownloadedFiles = [
+    Input_File,
+    WgetFile ("a.txt", A_File.content),
+    WgetFile ("b.txt", B_File.content),
+    WgetFile ("c.txt", C_File.content),
+    WgetFile ("d.txt", D_File.content),
+    WgetFile ("e.txt", E_File.content),
+]
+
+Request_List = [
+    [
+        "GET /dir/a.txt",
+        "GET /dir/b.txt",
+        "GET /dir/sub/c.txt",
+        "GET /d.txt",
+        "GET /e.txt",
+    ]
+]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : [Input_File]
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+    "FilesCrawled"      : Request_List,
+}
+
+test = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+)
+
+test.setup ()
+Server = "http://localhost:%s" % test.port
+Input_File.content = "\n".join ([
+    "",
+    "# The files of the first directory",
+    "   ",
+    Server + "/dir/a.txt",
+    "\t",
+    "../b.txt",
+    "http://[bad/",
+    "  c.txt  ",
+    "/d.txt",
+    "  #" + Server + "/skipped.txt",
+    Server + "/e.txt",
+])
+
+err = test.begin ()
+
+exit (err)
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that Wget writes files larger than its write-behind
+    block intact with --preallocate, both when it retrieves them whole and
+    when it continues a partial file whose size is not a multiple of the
+    block.  A file whose size is not known in advance is written as it
+    comes.
+"""
+############# File Definitions ###############################################
+# Numbered lines, so that data written at the wrong place shows.  All are
+# well over the 1 MiB block.
+File1 = "".join ("line %07d of File1\n" % i for i in range (150000))
+File2 = "".join ("line %07d of File2\n" % i for i in range (150000))
+File3 = "".join ("line %07d of File3\n" % i for i in range (150000))
+
+Chunked_Rules = {
+    "SendHeader" : {
+        "Transfer-Encoding" : "chunked",
+    },
+}
+
+A_File = WgetFile ("File1", File1)
+B_File = WgetFile ("File2", File2)
+C_File = WgetFile ("File3", File3, rules=Chunked_Rules)
+
+# A download of File2 interrupted a little after the first block.
+B_Partial = WgetFile ("File2", File2[:1024 * 1024 + 4097])
+
+WGET_OPTIONS = "--preallocate -c"
+WGET_URLS = [["File1", "File2", "File3"]]
+
+Files = [[A_File, B_File, C_File]]
+Existing_Files = [B_Partial]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [A_File, B_File, C_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files,
+    "LocalFiles"        : Existing_Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
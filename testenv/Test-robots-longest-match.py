@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+
+"""
+    This test ensures that the most specific robots.txt rule decides
+    whether a path may be retrieved, whatever the order of the rules,
+    and that the `*' and `$' wildcards are honored.  The rules are matched
+    against the path and the query of URLs together.
+"""
+############# File Definitions ###############################################
+mainpage = """
+<html>
+<head>
+  <title>Main Page</title>
+</head>
+<body>
+  <p>
+    <a href="http://127.0.0.1:{{port}}/private/secret.html">secret</a>
+    <a href="http://127.0.0.1:{{port}}/private/public/open.html">open</a>
+    <a href="http://127.0.0.1:{{port}}/run.cgi">script</a>
+    <a href="http://127.0.0.1:{{port}}/cgi/run.cgi">allowed script</a>
+    <a href="http://127.0.0.1:{{port}}/run.cgi.txt">not a script</a>
+    <a href="http://127.0.0.1:{{port}}/run.cgi?x=1">script with a query</a>
+    <a href="http://127.0.0.1:{{port}}/list.html">list</a>
+    <a href="http://127.0.0.1:{{port}}/list.html?sort=size">sorted list</a>
+  </p>
+</body>
+</html>
+"""
+
+robots = """
+User-agent: *
+Disallow: /private
+Allow: /private/public/
+Disallow: /*.cgi$
+Allow: /cgi/*.cgi$
+Disallow: /*?sort=
+"""
+
+content = "Some content."
+
+
+index_html = WgetFile ("index.html", mainpage)
+robots_txt = WgetFile ("robots.txt", robots)
+secret_html = WgetFile ("private/secret.html", content)
+open_html = WgetFile ("private/public/open.html", content)
+run_cgi = WgetFile ("run.cgi", content)
+cgi_run_cgi = WgetFile ("cgi/run.cgi", content)
+run_cgi_txt = WgetFile ("run.cgi.txt", content)
+run_cgi_query = WgetFile ("run.cgi?x=1", content)
+list_html = WgetFile ("list.html", content)
+list_html_sorted = WgetFile ("list.html?sort=size", content)
+
+WGET_OPTIONS = "-r -nH"
+WGET_URLS = [["index.html"]]
+
+Files = [[index_html, robots_txt, secret_html, open_html, run_cgi,
+          cgi_run_cgi, run_cgi_txt, run_cgi_query, list_html,
+          list_html_sorted]]
+
+ExpectedReturnCode = 0
+ExpectedDownloadedFiles = [index_html, robots_txt, open_html, cgi_run_cgi,
+                           run_cgi_txt, run_cgi_query, list_html]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+exit (err)
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+from sys import exit
+from test.http_test import HTTPTest
+from misc.wget_file import WgetFile
+from tempfile import mkdtemp
+from shutil import rmtree
+import json
+import os
+
+"""
+    This test ensures that Wget writes the timings of every request to the
+    file given with --timing-log, as one line of JSON for each request.
+"""
+############# File Definitions ###############################################
+File1 = "Timed."
+
+File1_File = WgetFile ("File1", File1)
+
+# Keep the log out of the directory the files are downloaded to.
+LOGDIR = mkdtemp ()
+LOG = os.path.join (LOGDIR, "timings.json")
+
+WGET_OPTIONS = "--timing-log=" + LOG
+WGET_URLS = [["File1", "File2"]]
+
+Files = [[File1_File]]
+
+ExpectedReturnCode = 8
+ExpectedDownloadedFiles = [File1_File]
+
+################ Pre and Post Test Hooks #####################################
+pre_test = {
+    "ServerFiles"       : Files
+}
+test_options = {
+    "WgetCommands"      : WGET_OPTIONS,
+    "Urls"              : WGET_URLS
+}
+post_test = {
+    "ExpectedFiles"     : ExpectedDownloadedFiles,
+    "ExpectedRetcode"   : ExpectedReturnCode,
+}
+
+err = HTTPTest (
+                pre_hook=pre_test,
+                test_params=test_options,
+                post_hook=post_test
+).begin ()
+
+if err == 0:
+    with open (LOG) as log:
+        records = [json.loads (line) for line in log]
+    if [(r["url"].rsplit ("/", 1)[1], r["status"], r["bytes"])
+            for r in records] != [("File1", 200, len (File1)),
+                                  ("File2", 404, 0)]:
+        print ("Unexpected timing records: %s" % records)
+        err = 1
+    for r in records:
+        if r["ttfb"] is None or r["tls"] is not None \
+                or r["total"] < r["ttfb"]:
+            print ("Unexpected phase times: %s" % r)
+            err = 1
+    if records and records[0]["transfer"] is None:
+        print ("Missing transfer time: %s" % records[0])
+        err = 1
+
+rmtree (LOGDIR)
+exit (err)
@@ -0,0 +1,21 @@
+from exc.test_failed import TestFailed
+from conf import hook
+
+""" Post-Test Hook: ExpectedConnections
+This is a post-test hook which checks the number of connections Wget made to
+each of the servers, in the order of the servers. It requires servers which
+count their connections, such as the HTTP/2 server.
+"""
+
+
+@hook()
+class ExpectedConnections:
+    def __init__(self, connections):
+        self.connections = connections
+
+    def __call__(self, test_obj):
+        actual = [s.server_inst.connections for s in test_obj.servers]
+        if actual != self.connections:
+            raise TestFailed("Connections do not match.\n"
+                             "Expected: %s\n"
+                             "Actual: %s" % (self.connections, actual))
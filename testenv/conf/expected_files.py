@@ -8,7 +8,8 @@ from exc.test_failed import TestFailed
 This is a Post-Test hook that checks the test directory for the files it
 contains. A dictionary object is passed to it, which contains a mapping of
 filenames and contents of all the files that the directory is expected to
-contain.
+contain.  The extended attributes given for a file must have the values
+given.
 Raises a TestFailed exception if the expected files are not found or if extra
 files are found, else returns gracefully.
 """
@@ -37,6 +38,21 @@ class ExpectedFiles:
 
         return snapshot
 
+    @staticmethod
+    def check_xattrs(file):
+        if not file.xattrs:
+            return
+        # os.getxattr is only available on Linux
+        from os import getxattr
+        for name, value in file.xattrs.items():
+            try:
+                actual = getxattr(file.name, name).decode('utf-8')
+            except OSError:
+                actual = None
+            if actual != value:
+                raise TestFailed('Attribute %s of %s is %r, not %r'
+                                 % (name, file.name, actual, value))
+
     def __call__(self, test_obj):
         local_fs = self.gen_local_fs_snapshot()
         for file in self.expected_fs:
@@ -50,6 +66,7 @@ class ExpectedFiles:
                                              tofile='Expected'):
                         print(line, file=sys.stderr)
                     raise TestFailed('Contents of %s do not match' % file.name)
+                self.check_xattrs(file)
             else:
                 raise TestFailed('Expected file %s not found.' % file.name)
         if local_fs:
@@ -0,0 +1,21 @@
+from exc.test_failed import TestFailed
+from conf import hook
+
+""" Post-Test Hook: ExpectedStreams
+This is a post-test hook which checks the largest number of streams Wget had
+open at once on one connection to each of the servers, in the order of the
+servers. It requires servers which count them, such as the HTTP/2 server.
+"""
+
+
+@hook()
+class ExpectedStreams:
+    def __init__(self, streams):
+        self.streams = streams
+
+    def __call__(self, test_obj):
+        actual = [s.server_inst.max_streams for s in test_obj.servers]
+        if actual != self.streams:
+            raise TestFailed("Streams do not match.\n"
+                             "Expected: %s\n"
+                             "Actual: %s" % (self.streams, actual))
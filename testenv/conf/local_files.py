@@ -24,3 +24,8 @@ class LocalFiles:
                 atime = tstamp
                 mtime = tstamp
                 utime(f.name, (atime, mtime))
+            if f.xattrs:
+                # os.setxattr is only available on Linux
+                from os import setxattr
+                for name, value in f.xattrs.items():
+                    setxattr(f.name, name, value.encode('utf-8'))
@@ -8,9 +8,11 @@ class WgetFile:
         name,
         content="Test Contents",
         timestamp=None,
-        rules=None
+        rules=None,
+        xattrs=None
     ):
         self.name = name
         self.content = content
         self.timestamp = timestamp
         self.rules = rules or {}
+        self.xattrs = xattrs or {}
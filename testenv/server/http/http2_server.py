@@ -0,0 +1,154 @@
+from socketserver import ThreadingMixIn, TCPServer, BaseRequestHandler
+from posixpath import splitext
+import threading
+import ssl
+import os
+
+import h2.config
+import h2.connection
+import h2.events
+
+
+class HTTP2Server(ThreadingMixIn, TCPServer):
+    """ This class serves the virtual set of files made by the WgetFile class
+    over HTTP/2, negotiated with ALPN on TLS connections. Only GET and HEAD
+    requests are supported, and no server rules. Along with the requests, it
+    counts the connections made to it, so that tests can check that Wget
+    sends several requests over one connection, and the most streams open at
+    once on one of them, so that they can check that the requests are sent
+    concurrently. """
+
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, address, handler):
+        TCPServer.__init__(self, address, handler)
+        # step one up because test suite change directory away from $srcdir
+        # (don't do that !!!)
+        certs = os.path.abspath(os.path.join('..',
+                                             os.getenv('srcdir', '.'),
+                                             'certs'))
+        self.ssl_context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        self.ssl_context.load_cert_chain(os.path.join(certs,
+                                                      'server-cert.pem'),
+                                         os.path.join(certs,
+                                                      'server-key.pem'))
+        self.ssl_context.set_alpn_protocols(['h2'])
+        self.request_headers = list()
+        self.connections = 0
+        self.max_streams = 0
+        self.lock = threading.Lock()
+
+    def server_conf(self, filelist, conf_dict):
+        self.server_configs = conf_dict
+        self.fileSys = filelist
+
+    def get_req_headers(self):
+        return self.request_headers
+
+
+class _Handler(BaseRequestHandler):
+    """ Speaks HTTP/2 on one connection until the client closes it. """
+
+    def handle(self):
+        sock = self.server.ssl_context.wrap_socket(self.request,
+                                                   server_side=True)
+        if sock.selected_alpn_protocol() != 'h2':
+            sock.close()
+            return
+        with self.server.lock:
+            self.server.connections += 1
+
+        config = h2.config.H2Configuration(client_side=False,
+                                           header_encoding='utf-8')
+        self.conn = h2.connection.H2Connection(config=config)
+        self.conn.initiate_connection()
+        sock.sendall(self.conn.data_to_send())
+        self.pending = dict()
+
+        while True:
+            data = sock.recv(65535)
+            if not data:
+                break
+            for event in self.conn.receive_data(data):
+                if isinstance(event, h2.events.RequestReceived):
+                    self.respond(event.stream_id, dict(event.headers))
+                elif isinstance(event, h2.events.DataReceived):
+                    self.conn.acknowledge_received_data(
+                        event.flow_controlled_length, event.stream_id)
+                elif isinstance(event, h2.events.WindowUpdated):
+                    self.send_pending()
+                elif isinstance(event, h2.events.ConnectionTerminated):
+                    sock.sendall(self.conn.data_to_send())
+                    sock.close()
+                    return
+            sock.sendall(self.conn.data_to_send())
+        sock.close()
+
+    def respond(self, stream_id, headers):
+        method = headers[':method']
+        path = headers[':path'][1:]
+        self.server.request_headers.append(method + " /" + path)
+        # The streams whose responses are still being sent are open.
+        with self.server.lock:
+            self.server.max_streams = max(self.server.max_streams,
+                                          len(self.pending) + 1)
+
+        if path not in self.server.fileSys:
+            self.conn.send_headers(stream_id, [(':status', '404')],
+                                   end_stream=True)
+            return
+
+        content = self.server.fileSys[path].encode('utf-8')
+        self.conn.send_headers(stream_id,
+                               [(':status', '200'),
+                                ('content-type', self.guess_type(path)),
+                                ('content-length', str(len(content)))],
+                               end_stream=method == 'HEAD' or not content)
+        if method != 'HEAD' and content:
+            self.pending[stream_id] = content
+            self.send_pending()
+
+    def send_pending(self):
+        """ Send as much of the pending bodies as flow control allows. """
+        for stream_id in list(self.pending):
+            content = self.pending.pop(stream_id)
+            while content:
+                size = min(len(content),
+                           self.conn.local_flow_control_window(stream_id),
+                           self.conn.max_outbound_frame_size)
+                if size <= 0:
+                    self.pending[stream_id] = content
+                    break
+                self.conn.send_data(stream_id, content[:size],
+                                    end_stream=size == len(content))
+                content = content[size:]
+
+    def guess_type(self, path):
+        name, ext = splitext(path)
+        extension_map = {
+            ".txt":    "text/plain",
+            ".css":    "text/css",
+            ".html":   "text/html"
+        }
+        return extension_map.get(ext, "text/plain")
+
+
+class HTTP2d(threading.Thread):
+    server_class = HTTP2Server
+    handler = _Handler
+
+    def __init__(self, addr=None):
+        threading.Thread.__init__(self)
+        if addr is None:
+            addr = ('localhost', 0)
+        self.server_inst = self.server_class(addr, self.handler)
+        self.server_address = self.server_inst.socket.getsockname()[:2]
+
+    def run(self):
+        self.server_inst.serve_forever()
+
+    def server_conf(self, file_list, server_rules):
+        self.server_inst.server_conf(file_list, server_rules)
+
+# vim: set ts=4 sts=4 sw=4 tw=79 et :
@@ -86,10 +86,21 @@ class _Handler(BaseHTTPRequestHandler):
 
         content, start = self.send_head("GET")
         if content:
-            if start is None:
-                self.wfile.write(content.encode('utf-8'))
+            data = content.encode('utf-8')
+            if start is not None:
+                data = data[start:]
+            if self.chunked:
+                self.write_chunked(data)
             else:
-                self.wfile.write(content.encode('utf-8')[start:])
+                self.wfile.write(data)
+
+    def write_chunked(self, data, size=16):
+        """ Send data with the chunked transfer coding, in chunks of at most
+        size bytes. """
+        for i in range(0, len(data), size):
+            chunk = data[i:i + size]
+            self.wfile.write(b"%x\r\n%s\r\n" % (len(chunk), chunk))
+        self.wfile.write(b"0\r\n\r\n")
 
     def do_POST(self):
         """ According to RFC 7231 sec 4.3.3, if the resource requested in a POST
@@ -189,7 +200,13 @@ class _Handler(BaseHTTPRequestHandler):
 
     def finish_headers(self):
         self.send_cust_headers()
+        self.chunked = False
         try:
+            # A "Transfer-Encoding: chunked" rule makes do_GET send the body
+            # in chunks, which replace Content-Length.
+            if self._headers_dict.get("transfer-encoding") == "chunked":
+                self._headers_dict.pop("content-length", None)
+                self.chunked = True
             for keyword, value in self._headers_dict.items():
                 if isinstance(value, list):
                     for value_el in value:
@@ -12,6 +12,7 @@ import conf
 
 HTTP = "HTTP"
 HTTPS = "HTTPS"
+HTTP2 = "HTTP2"
 
 
 class BaseTest:
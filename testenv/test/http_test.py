@@ -1,6 +1,6 @@
 from misc.colour_terminal import print_green
 from server.http.http_server import HTTPd, HTTPSd
-from test.base_test import BaseTest, HTTP, HTTPS
+from test.base_test import BaseTest, HTTP, HTTPS, HTTP2
 
 
 class HTTPTest(BaseTest):
@@ -45,8 +45,13 @@ class HTTPTest(BaseTest):
             super(HTTPTest, self).begin()
 
     def instantiate_server_by(self, protocol):
-        server = {HTTP: HTTPd,
-                  HTTPS: HTTPSd}[protocol]()
+        if protocol == HTTP2:
+            # Needs the h2 module, which the other tests can do without.
+            from server.http.http2_server import HTTP2d
+            server = HTTP2d()
+        else:
+            server = {HTTP: HTTPd,
+                      HTTPS: HTTPSd}[protocol]()
         server.start()
 
         return server
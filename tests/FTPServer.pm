@@ -51,6 +51,11 @@ my %_commands = (
 
     # From ftpexts Internet Draft.
     'SIZE' => $_connection_states{LOGGEDIN} | $_connection_states{TWOSOCKS},
+
+    # From RFC 2389 and RFC 3659, only with the 'mlsd' behavior.
+    'FEAT' => $_connection_states{LOGGEDIN} | $_connection_states{TWOSOCKS},
+    'MLSD' => $_connection_states{TWOSOCKS},
+    'MLST' => $_connection_states{LOGGEDIN} | $_connection_states{TWOSOCKS},
 );
 
 # COMMAND-HANDLING ROUTINES
@@ -74,6 +79,22 @@ sub _CWD_command
     print {$conn->{socket}} "200 directory changed to $new_path.\r\n";
 }
 
+sub _FEAT_command
+{
+    my ($conn, $cmd, $dummy) = @_;
+
+    unless ($conn->{'paths'}->GetBehavior('mlsd'))
+    {
+        print {$conn->{socket}} "500 Unrecognized command.\r\n";
+        return;
+    }
+
+    print {$conn->{socket}} "211-Features:\r\n";
+    print {$conn->{socket}} " MLST type*;size*;modify*;\r\n";
+    print {$conn->{socket}} " SIZE\r\n";
+    print {$conn->{socket}} "211 End\r\n";
+}
+
 sub _LIST_command
 {
     my ($conn, $cmd, $path) = @_;
@@ -148,6 +169,84 @@ sub _LIST_command
       "226 Listing complete. Data connection has been closed.\r\n";
 }
 
+sub _MLSD_command
+{
+    my ($conn, $cmd, $path) = @_;
+    my $paths = $conn->{'paths'};
+
+    unless ($paths->GetBehavior('mlsd'))
+    {
+        print {$conn->{socket}} "500 Unrecognized command.\r\n";
+        return;
+    }
+
+    my $dir = FTPPaths::path_merge($conn->{'dir'}, $path);
+
+    # The directories of 'mlsd_once' are listed only the first time,
+    # so that the later listings must be taken from elsewhere.
+    my $once = $paths->GetBehavior('mlsd_once');
+    if ($once && $once->{$dir} && $once->{$dir}++ > 1)
+    {
+        print {$conn->{socket}} "550 Listing refused.\r\n";
+        return;
+    }
+
+    my $listing = $paths->get_list($dir, 0, 1);
+    unless ($listing)
+    {
+        print {$conn->{socket}} "550 File or directory not found.\r\n";
+        return;
+    }
+
+    print {$conn->{socket}} "150 Opening data connection for file listing.\r\n";
+
+    # Open a path back to the client.
+    my $sock = __open_data_connection($conn);
+    unless ($sock)
+    {
+        print {$conn->{socket}} "425 Can't open data connection.\r\n";
+        return;
+    }
+
+    for my $item (@$listing)
+    {
+        print $sock "$item\r\n";
+    }
+
+    unless ($sock->close)
+    {
+        print {$conn->{socket}} "550 Error closing data connection: $!\r\n";
+        return;
+    }
+
+    print {$conn->{socket}}
+      "226 Listing complete. Data connection has been closed.\r\n";
+}
+
+sub _MLST_command
+{
+    my ($conn, $cmd, $path) = @_;
+    my $paths = $conn->{'paths'};
+
+    unless ($paths->GetBehavior('mlsd'))
+    {
+        print {$conn->{socket}} "500 Unrecognized command.\r\n";
+        return;
+    }
+
+    $path = FTPPaths::path_merge($conn->{'dir'}, $path);
+    my $info = $paths->get_info($path);
+    unless ($info)
+    {
+        print {$conn->{socket}} "550 File or directory not found.\r\n";
+        return;
+    }
+
+    print {$conn->{socket}} "250-Listing $path\r\n";
+    print {$conn->{socket}} " " . $paths->_format_for_mlsd($path, $info) . "\r\n";
+    print {$conn->{socket}} "250 End.\r\n";
+}
+
 sub _PASS_command
 {
     my ($conn, $cmd, $pass) = @_;
@@ -297,6 +396,13 @@ sub _RETR_command
         return;
     }
 
+    if ($info->{'unreadable'}
+        || ($info->{'syst_required'} && !$conn->{'syst'}))
+    {
+        print {$conn->{socket}} "550 Permission denied.\r\n";
+        return;
+    }
+
     print {$conn->{socket}} "150 Opening "
       . ($conn->{type} eq 'A' ? "ASCII mode" : "BINARY mode")
       . " data connection.\r\n";
@@ -436,6 +542,7 @@ sub _SYST_command
 {
     my ($conn, $cmd, $dummy) = @_;
 
+    $conn->{'syst'} = 1;
     if ($conn->{'paths'}->GetBehavior('syst_response'))
     {
         print {$conn->{socket}} $conn->{'paths'}->GetBehavior('syst_response')
@@ -624,8 +731,16 @@ sub run
     my $server_sock = $self->{_server_sock};
 
     # the accept loop
-    while (my $client_addr = accept(my $socket, $server_sock))
+    for (; ;)
     {
+        my $client_addr = accept(my $socket, $server_sock);
+        unless ($client_addr)
+        {
+            # Interrupted by SIGCHLD from a connection process.
+            next if $!{EINTR};
+            last;
+        }
+
         # turn buffering off on $socket
         select((select($socket), $| = 1)[0]);
 
@@ -636,15 +751,20 @@ sub run
         # print who connected
         print STDERR "got a connection from: $client_ipnum\n" if $log;
 
-        # fork off a process to handle this connection.
-        # my $pid = fork();
-        # unless (defined $pid) {
-        #     warn "fork: $!";
-        #     sleep 5; # Back off in case system is overloaded.
-        #     next;
-        # }
+        # Connections are served one at a time, unless the 'concurrent'
+        # behavior asks for a process to handle each of them.
+        my $pid = 0;
+        if ($self->{_server_behavior}{concurrent})
+        {
+            $pid = fork();
+            unless (defined $pid) {
+                warn "fork: $!";
+                sleep 5; # Back off in case system is overloaded.
+                next;
+            }
+        }
 
-        if (1)
+        if ($pid == 0)
         {    # Child process.
 
             # install signals
@@ -751,6 +871,7 @@ sub run
                 # Run the command.
                 &{$command_table->{$cmd}}($conn, $cmd, $rest);
             }
+            exit 0 if $pid == 0 && $self->{_server_behavior}{concurrent};
         }
         else
         {    # Father
@@ -930,9 +1051,43 @@ sub _format_for_list
     return "$mode_str 1  0  0  $size $date $name";
 }
 
+# Returns the modification time of a file or directory: the
+# 'timestamp' of a file, if given, and the newest of those of its
+# files for a directory.
+sub _mtime
+{
+    my ($self, $info) = @_;
+
+    return defined($info->{'timestamp'}) ? $info->{'timestamp'} : time
+        unless $info->{'_type'} eq 'd';
+
+    my $time;
+    for my $item (keys %$info)
+    {
+        next if $item =~ /^_/;
+        my $t = $self->_mtime($info->{$item});
+        $time = $t if !defined($time) || $t > $time;
+    }
+    return defined($time) ? $time : time;
+}
+
+# Formats an entry of an MLSD listing (RFC 3659), also used for the
+# MLST reply.  The modification time is taken from the 'timestamp' of
+# the url files, if given.
+sub _format_for_mlsd
+{
+    my ($self, $name, $info) = @_;
+
+    my $type = $info->{'_type'} eq 'd' ? 'dir' : 'file';
+    my $size = $info->{'_type'} eq 'f' ? length $info->{'content'} : 0;
+    my $time = $self->_mtime($info);
+    my $modify = strftime("%Y%m%d%H%M%S", gmtime($time));
+    return "type=$type;size=$size;modify=$modify; $name";
+}
+
 sub get_list
 {
-    my ($self, $path, $no_hidden) = @_;
+    my ($self, $path, $no_hidden, $mlsd) = @_;
     my $info = $self->get_info($path);
     if (!defined $info)
     {
@@ -955,12 +1110,20 @@ sub get_list
                 # This is an hidden file and I don't want to see it!
                 print STDERR "get_list: Skipped hidden file [$item]\n";
             }
+            elsif ($mlsd)
+            {
+                push @$list, $self->_format_for_mlsd($item, $info->{$item});
+            }
             else
             {
                 push @$list, $self->_format_for_list($item, $info->{$item});
             }
         }
     }
+    elsif ($mlsd)
+    {
+        return;
+    }
     else
     {
         push @$list, $self->_format_for_list(final_component($path), $info);
@@ -987,6 +1150,19 @@ sub get_list
 #                          to the url files
 #  syst_response         : if defined, its content is printed
 #                          out as SYST response
+#  mlsd                  : if defined, FEAT announces MLST, and
+#                          MLST and MLSD are supported; otherwise
+#                          both commands are unrecognized
+#  mlsd_once             : a hash whose keys are directories
+#                          that MLSD lists only the first time,
+#                          each with the value 1
+#  concurrent            : if defined, each connection is
+#                          handled by a process of its own, so
+#                          that several can be open at once
+# A file of the url files is refused by RETR if it has
+#   unreadable => 1
+# or, on connections which have not sent SYST, if it has
+#   syst_required => 1
 sub GetBehavior
 {
     my ($self, $name) = @_;